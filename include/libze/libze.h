@@ -17,6 +17,20 @@
 
 #define ZE_PROP_NAMESPACE "org.zectl"
 
+/* Set on snapshots libze takes implicitly, e.g. during create, so they can be garbage collected */
+#define ZE_PROP_SNAPSHOT ZE_PROP_NAMESPACE ":snapshot"
+#define ZE_SNAPSHOT_CREATE "create"
+/* Plugin fingerprint of bootloader state a snapshot was taken with */
+#define ZE_PROP_FINGERPRINT ZE_PROP_NAMESPACE ":fingerprint"
+
+// strftime(3) format of generated snapshot names, with %N for microseconds and %Q for a sequence
+// unique to the process
+#define ZE_SNAPSHOT_FORMAT_DEFAULT "%F-%T.%N-%Q"
+
+/* Set on a boot environment activated without promoting it */
+#define ZE_PROP_PROMOTE ZE_PROP_NAMESPACE ":promote"
+#define ZE_PROMOTE_PENDING "pending"
+
 /** @enum libze_error
  * Error type
  */
@@ -36,6 +50,58 @@ typedef enum libze_error {
 
 typedef struct libze_handle libze_handle;
 typedef struct libze_plugin_fn_export libze_plugin_fn_export;
+typedef struct libze_prop_index libze_prop_index;
+
+/** @enum libze_prop_type
+ * Type of a property value, an empty value is valid for every type and means unset
+ */
+typedef enum libze_prop_type {
+    LIBZE_PROP_TYPE_STRING = 0,
+    LIBZE_PROP_TYPE_PATH,    /**< Absolute path */
+    LIBZE_PROP_TYPE_DATASET, /**< ZFS filesystem name */
+} libze_prop_type;
+
+/**< Check of a non-empty property value beyond its type, returns B_TRUE if valid */
+typedef boolean_t (*libze_prop_validate_fn)(char const value[static 1]);
+
+/**
+ * @struct libze_prop_schema
+ * @brief A property known to libze or a plugin, as entry of a static schema table
+ */
+typedef struct libze_prop_schema {
+    /**< Property name without namespace */
+    char const *name;
+    libze_prop_type type;
+    /**< Value of the property while it is unset */
+    char const *default_value;
+    /**< Optional, NULL if any value of @p type is valid */
+    libze_prop_validate_fn validate;
+} libze_prop_schema;
+
+/** @enum libze_prop
+ * Index of a property in the org.zectl namespace in @p libze_properties
+ */
+typedef enum libze_prop {
+    LIBZE_PROP_BOOTLOADER = 0,
+    LIBZE_PROP_BOOTPOOLROOT,
+    LIBZE_PROP_BOOTPOOLPREFIX,
+    LIBZE_PROP_SNAPFORMAT,
+    LIBZE_PROP_NUM
+} libze_prop;
+
+extern libze_prop_schema const libze_properties[LIBZE_PROP_NUM];
+
+/** @enum libze_facet
+ * Optional part of a @p libze_handle, only resolved once a command requires it with
+ * libze_facets_require
+ */
+typedef enum libze_facet {
+    LIBZE_FACET_NONE = 0,
+    LIBZE_FACET_PLUGIN = 1 << 0,    /**< Bootloader plugin loaded and initialized */
+    LIBZE_FACET_BOOTPOOL = 1 << 1,  /**< Separate boot pool resolved into bootpool */
+    LIBZE_FACET_VALIDATED = 1 << 2, /**< Activated and running boot environment validated */
+    LIBZE_FACET_ALL = LIBZE_FACET_PLUGIN | LIBZE_FACET_BOOTPOOL | LIBZE_FACET_VALIDATED
+} libze_facet;
 
 /**
  * @struct libze_bootpool
@@ -67,6 +133,7 @@ typedef struct libze_bootpool {
  * @invariant Initialized with libze_init:
  * @invariant (lzh != NULL) && (lzph != NULL)
  * @invariant ze_props != NULL
+ * @invariant facets == LIBZE_FACET_NONE
  * @invariant strlen(env_pool) >= 1
  * @invariant strlen(env_root) >= 1
  * @invariant strlen(env_activated_path) >= 3
@@ -76,7 +143,9 @@ typedef struct libze_bootpool {
  *
  * @invariant Closed with libze_fini:
  * @invariant lzh, pool_zhdl are closed and NULL
- * @invariant ze_props has been freed and is NULL
+ * @invariant ze_props, ze_default_props and prop_index have been freed and are NULL
+ * @invariant mount_sessions have been unmounted, freed and is NULL
+ * @invariant mnttab and mnttab_datasets have been freed and are NULL
  */
 struct libze_handle {
     /**< Handle to libzfs */
@@ -101,6 +170,19 @@ struct libze_handle {
     libze_plugin_fn_export *lz_funcs;
     /**< User org.zectl properties */
     nvlist_t *ze_props;
+    /**< Defaults of org.zectl properties, lookups fall back to them if unset in ze_props */
+    nvlist_t *ze_default_props;
+    /**< Hashed index of ze_props and ze_default_props, rebuilt on lookup after either changed */
+    libze_prop_index *prop_index;
+    /**< Boot environment -> mountpoint of mounts shared by hooks, released by libze_fini */
+    nvlist_t *mount_sessions;
+    /**< Mountpoint -> dataset of ZFS mounts, read on first lookup, NULL after libze mounted or
+     *   unmounted anything */
+    nvlist_t *mnttab;
+    /**< Dataset -> mountpoint of ZFS mounts, read together with mnttab */
+    nvlist_t *mnttab_datasets;
+    /**< libze_facet flags of the facets which have been resolved */
+    unsigned int facets;
     /**< Last error buffer */
     char libze_error_message[LIBZE_MAX_ERROR_LEN];
     /**< Last error buffer */
@@ -119,12 +201,18 @@ libze_init(void);
 void
 libze_fini(libze_handle *lzeh);
 
+libze_error
+libze_refresh(libze_handle *lzeh, boolean_t *facets_stale);
+
 libze_error
 libze_boot_pool_set(libze_handle *lzeh);
 
 libze_error
 libze_validate_system(libze_handle *lzeh);
 
+libze_error
+libze_facets_require(libze_handle *lzeh, unsigned int facets);
+
 libze_error
 libze_clone(libze_handle *lzeh, char source_root[static 1], char source_snap_suffix[static 1],
             char be[static 1], boolean_t recursive);
@@ -149,8 +237,16 @@ typedef struct libze_bootloader {
 typedef struct libze_activate_options {
     char *be_name;
     boolean_t noconfirm;
+    /**< Defer promotion to libze_promote */
+    boolean_t deferred;
 } libze_activate_options;
 
+typedef struct libze_promote_options {
+    char *be_name;
+    /**< Promote all boot environments with a pending promotion */
+    boolean_t pending;
+} libze_promote_options;
+
 typedef struct libze_destroy_options {
     char *be_name;
     boolean_t noconfirm;
@@ -165,6 +261,58 @@ typedef struct libze_create_options {
     char be_source[ZFS_MAX_DATASET_NAME_LEN];
 } libze_create_options;
 
+typedef struct libze_gc_options {
+    boolean_t noop;
+} libze_gc_options;
+
+typedef struct libze_snapshot_options {
+    /**< Boot environment, optionally with the snapshot name as <boot environment>@<snapshot> */
+    char *be_name;
+    /**< Don't take a snapshot if nothing changed since the latest snapshot */
+    boolean_t if_changed;
+    /**< Seconds to wait for further snapshot requests of the boot environment, which are folded
+     *   into the snapshot taken once the window ends. 0 to snapshot immediately. */
+    unsigned int coalesce;
+} libze_snapshot_options;
+
+typedef struct libze_diff_options {
+    /**< Boot environment compared from, as <boot environment>[@<snapshot>] */
+    char *from;
+    /**< Boot environment compared to, as <boot environment>[@<snapshot>], NULL for the current
+     *   state of @p from */
+    char *to;
+    /**< diff_flags_t passed to zfs_show_diffs */
+    int flags;
+    /**< Descriptor the differences are written to */
+    int outfd;
+} libze_diff_options;
+
+typedef struct libze_set_options {
+    /**< Glob pattern matching the names of boot environments to set properties on, NULL for all */
+    char const *pattern;
+    /**< Also set the properties on the children of matching boot environments */
+    boolean_t recursive;
+} libze_set_options;
+
+typedef struct libze_exec_options {
+    char be_name[ZFS_MAX_DATASET_NAME_LEN];
+    /**< Bind mount /proc, /sys and /dev into the boot environment */
+    boolean_t bind_system;
+    /**< NULL terminated command and arguments */
+    char *const *argv;
+} libze_exec_options;
+
+typedef struct libze_upgrade_options {
+    /**< Boot environment to create */
+    libze_create_options create;
+    /**< Bind mount /proc, /sys and /dev into the boot environment */
+    boolean_t bind_system;
+    /**< Defer promotion of the activated boot environment to libze_promote */
+    boolean_t deferred;
+    /**< NULL terminated command and arguments */
+    char *const *argv;
+} libze_upgrade_options;
+
 libze_error
 libze_activate(libze_handle *lzeh, libze_activate_options *options);
 
@@ -174,6 +322,18 @@ libze_create(libze_handle *lzeh, libze_create_options *options);
 libze_error
 libze_destroy(libze_handle *lzeh, libze_destroy_options *options);
 
+libze_error
+libze_diff(libze_handle *lzeh, libze_diff_options *options);
+
+libze_error
+libze_exec(libze_handle *lzeh, libze_exec_options *options, int *exit_status);
+
+libze_error
+libze_upgrade(libze_handle *lzeh, libze_upgrade_options *options, int *exit_status);
+
+libze_error
+libze_gc(libze_handle *lzeh, libze_gc_options *options, nvlist_t **outnvl);
+
 libze_error
 libze_list(libze_handle *lzeh, nvlist_t **outnvl);
 
@@ -181,6 +341,17 @@ libze_error
 libze_mount(libze_handle *lzeh, char const boot_environment[static 1], char const *mountpoint,
             char mountpoint_buffer[LIBZE_MAX_PATH_LEN]);
 
+libze_error
+libze_promote(libze_handle *lzeh, libze_promote_options *options);
+
+libze_error
+libze_mount_detached(libze_handle *lzeh, char const boot_environment[static 1],
+                     char const *mountpoint, char mountpoint_buffer[LIBZE_MAX_PATH_LEN]);
+
+libze_error
+libze_mount_session_get(libze_handle *lzeh, char const boot_environment[static 1],
+                        char mountpoint_buffer[LIBZE_MAX_PATH_LEN]);
+
 libze_error
 libze_rename(libze_handle *lzeh, char const boot_environment[static 1],
              char const new_boot_environment[static 1]);
@@ -189,10 +360,17 @@ libze_error
 libze_set(libze_handle *lzeh, nvlist_t *properties);
 
 libze_error
-libze_snapshot(libze_handle *lzeh, char const boot_environment[static 1]);
+libze_be_set(libze_handle *lzeh, char const boot_environment[static 1], nvlist_t *properties);
+
+libze_error
+libze_be_set_bulk(libze_handle *lzeh, libze_set_options *options, nvlist_t *properties);
+
+libze_error
+libze_snapshot(libze_handle *lzeh, libze_snapshot_options *options,
+               char snapshot[ZFS_MAX_DATASET_NAME_LEN]);
 
 libze_error
-libze_unmount(libze_handle *lzeh, char const boot_environment[static 1]);
+libze_unmount(libze_handle *lzeh, char const boot_environment[static 1], boolean_t lazy);
 
 libze_error
 libze_bootloader_init(libze_handle *lzeh, libze_bootloader *bootloader,
@@ -218,11 +396,22 @@ libze_default_prop_add(nvlist_t **prop_out, char const *name, char const *value,
                        char const *namespace);
 
 libze_error
-libze_add_set_property(nvlist_t *properties, char const *property);
+libze_schema_defaults_set(libze_handle *lzeh, libze_prop_schema const *schema,
+                          size_t num_properties, char const namespace[static 1]);
+
+libze_error
+libze_add_set_property(libze_handle *lzeh, nvlist_t *properties, char const *property);
 
 libze_error
 libze_add_get_property(libze_handle *lzeh, nvlist_t **properties, char const *property);
 
+libze_error
+libze_add_get_properties(libze_handle *lzeh, nvlist_t **properties);
+
+libze_error
+libze_add_be_get_properties(libze_handle *lzeh, nvlist_t **properties,
+                            char const *boot_environment, char const *property);
+
 libze_error
 libze_bootloader_set(libze_handle *lzeh);
 
@@ -233,4 +422,24 @@ libze_error
 libze_be_prop_get(libze_handle *lzeh, char *result_prop, char const *property,
                   char const *namespace);
 
+char const *
+libze_be_prop_value(libze_handle *lzeh, char const property[static 1],
+                    char const namespace[static 1]);
+
+char const *
+libze_prop_value(libze_handle *lzeh, libze_prop property);
+
+char const *
+libze_mnttab_dataset(libze_handle *lzeh, char const mountpoint[static 1]);
+
+char const *
+libze_mnttab_mountpoint(libze_handle *lzeh, char const dataset[static 1]);
+
+void
+libze_mnttab_invalidate(libze_handle *lzeh);
+
+char const *
+libze_be_prop_source(libze_handle *lzeh, char const property[static 1],
+                     char const namespace[static 1]);
+
 #endif // ZECTL_LIBZE_H
@@ -26,6 +26,8 @@ typedef struct libze_create_data {
 typedef struct libze_snap_data {
     char const *const be_name;
     boolean_t is_root;
+    /**< Result of plugin_snapshot_fingerprint once computed for the snapshot, otherwise NULL */
+    char const *fingerprint;
 } libze_snap_data;
 
 typedef libze_error (*plugin_fn_init)(libze_handle *lzeh);
@@ -49,6 +51,12 @@ typedef libze_error (*plugin_fn_post_rename)(libze_handle *lzeh,
 
 typedef libze_error (*plugin_fn_pre_snapshot)(libze_handle *lzeh, libze_snap_data *snap_data);
 
+/**< Optional, fingerprint bootloader state outside of the boot environment which is saved with
+ * a snapshot, so that unchanged state can be detected */
+typedef libze_error (*plugin_fn_snapshot_fingerprint)(libze_handle *lzeh,
+                                                      libze_snap_data *snap_data,
+                                                      char fingerprint[ZFS_MAXPROPLEN]);
+
 typedef struct libze_plugin_fn_export {
     plugin_fn_init plugin_init;
     plugin_fn_pre_activate plugin_pre_activate;
@@ -58,6 +66,10 @@ typedef struct libze_plugin_fn_export {
     plugin_fn_post_create plugin_post_create;
     plugin_fn_post_rename plugin_post_rename;
     plugin_fn_pre_snapshot plugin_pre_snapshot;
+    plugin_fn_snapshot_fingerprint plugin_snapshot_fingerprint;
+    /**< Schema of the properties in the plugin namespace, validated when set */
+    libze_prop_schema const *plugin_properties;
+    size_t plugin_num_properties;
 } libze_plugin_fn_export;
 
 libze_plugin_manager_error
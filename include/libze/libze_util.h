@@ -6,6 +6,7 @@
 #include <stddef.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 
 #define COPY_BUFLEN 4096
 #define LIBZE_UTIL_MAX_REGEX_GROUPS 10
@@ -52,6 +53,10 @@ libze_error
 libze_util_temporary_mount(char const dataset[ZFS_MAX_DATASET_NAME_LEN],
                            char const mountpoint[static 2]);
 
+libze_error
+libze_util_readonly_mount(char const dataset[ZFS_MAX_DATASET_NAME_LEN],
+                          char const mountpoint[static 2]);
+
 void
 libze_list_free(nvlist_t *nvl);
 
@@ -68,6 +73,14 @@ libze_util_rmdir(char const directory_path[LIBZE_MAX_PATH_LEN]);
 int
 libze_util_mkdir(char const directory_path[LIBZE_MAX_PATH_LEN], mode_t mode);
 
+int
+libze_util_fingerprint_dir(char const directory_path[LIBZE_MAX_PATH_LEN], size_t buflen,
+                           char buf[buflen]);
+
+int
+libze_util_fingerprint_file(char const file_path[LIBZE_MAX_PATH_LEN], size_t buflen,
+                            char buf[buflen]);
+
 libze_error
 libze_util_replace_string(char const *to_replace, char const *replacement, size_t line_length,
                           char const line[line_length], size_t line_replaced_length,
@@ -79,4 +92,11 @@ libze_util_regex_subexpr_replace(regex_t *re, size_t replace_buflen,
                                  char const input[input_buflen], size_t output_buflen,
                                  char output[output_buflen]);
 
+libze_error
+libze_util_snap_format_expand(char const format[static 1], struct timespec const *now,
+                              unsigned long sequence, size_t buflen, char buf[buflen]);
+
+boolean_t
+libze_util_snap_suffix_valid(char const snap_suffix[static 1]);
+
 #endif // ZECTL_LIBZE_UTIL_H
@@ -5,6 +5,18 @@
 
 char const *PLUGIN_SYSTEMDBOOT = "systemdboot";
 
+/** @enum systemdboot_prop
+ * Index of a property in @p systemdboot_properties
+ */
+typedef enum systemdboot_prop {
+    SYSTEMDBOOT_PROP_EFI = 0,
+    SYSTEMDBOOT_PROP_BOOT,
+    SYSTEMDBOOT_PROP_KERNEL_SNAPSHOT_DIRECTORY,
+    SYSTEMDBOOT_PROP_NUM
+} systemdboot_prop;
+
+extern libze_prop_schema const systemdboot_properties[SYSTEMDBOOT_PROP_NUM];
+
 libze_error
 libze_plugin_systemdboot_init(libze_handle *lzeh);
 
@@ -30,6 +42,10 @@ libze_plugin_systemdboot_post_rename(libze_handle *lzeh, char const be_name_old[
 libze_error
 libze_plugin_systemdboot_pre_snapshot(libze_handle *lzeh, libze_snap_data *snap_data);
 
+libze_error
+libze_plugin_systemdboot_snapshot_fingerprint(libze_handle *lzeh, libze_snap_data *snap_data,
+                                              char fingerprint[ZFS_MAXPROPLEN]);
+
 libze_plugin_fn_export const exported_plugin = {
     .plugin_init = libze_plugin_systemdboot_init,
     .plugin_pre_activate = libze_plugin_systemdboot_pre_activate,
@@ -38,7 +54,10 @@ libze_plugin_fn_export const exported_plugin = {
     .plugin_post_destroy = libze_plugin_systemdboot_post_destroy,
     .plugin_post_create = libze_plugin_systemdboot_post_create,
     .plugin_post_rename = libze_plugin_systemdboot_post_rename,
-    .plugin_pre_snapshot = libze_plugin_systemdboot_pre_snapshot
+    .plugin_pre_snapshot = libze_plugin_systemdboot_pre_snapshot,
+    .plugin_snapshot_fingerprint = libze_plugin_systemdboot_snapshot_fingerprint,
+    .plugin_properties = systemdboot_properties,
+    .plugin_num_properties = SYSTEMDBOOT_PROP_NUM
 };
 
 #endif // ZECTL_LIBZE_PLUGIN_SYSTEMDBOOT_H
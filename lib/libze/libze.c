@@ -7,23 +7,310 @@
 
 #include "libze/libze_plugin_manager.h"
 #include "libze/libze_util.h"
+#include "libze_taskq.h"
+#include "system_linux.h"
 
 #include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
 #include <libzfs_core.h>
+#include <poll.h>
+#include <pthread.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/file.h>
+#include <sys/mount.h>
 #include <sys/nvpair.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <time.h>
+#include <unistd.h>
 
 // Unsigned long long is 64 bits or more
 #define ULL_SIZE 128
 
+// Runtime state shared between zectl processes
+#define ZE_RUN_DIR "/run/zectl"
+
+// Raised by channel programs if ZFS lacks a function they need
+#define ZCP_UNSUPPORTED "zectl: channel program unsupported"
+// Key of the Lua error message in the output of a failed channel program
+#define ZCP_OUTPUT_ERROR "error"
+
 static int
 libze_clone_cb(zfs_handle_t *zhdl, void *data);
 
+static int
+channel_program_run(libze_handle *lzeh, char const pool[static 1], char const program[static 1],
+                    nvlist_t *args);
+
+/**
+ * @brief Property of @p lzeh->ze_props or @p lzeh->ze_default_props in @p libze_prop_index.
+ *        The strings point into the nvlists, so the index must be rebuilt whenever they change.
+ */
+typedef struct libze_prop_entry {
+    /**< Full property name, NULL if the slot is empty */
+    char const *name;
+    /**< Length of the namespace at the start of @p name, before the colon */
+    size_t namespace_len;
+    uint64_t hash;
+    /**< NULL if the property has no string value */
+    char const *value;
+    /**< NULL if the property has no source, as defaults don't */
+    char const *source;
+} libze_prop_entry;
+
+struct libze_prop_index {
+    /**< Number of slots minus one, the number of slots is a power of two */
+    size_t mask;
+    /**< Open addressing table with linear probing */
+    libze_prop_entry slots[];
+};
+
+/**
+ * @brief FNV-1a hash of <namespace>:<property>, without forming the string
+ */
+static uint64_t
+prop_index_hash(char const *namespace, size_t namespace_len, char const *property) {
+    uint64_t hash = 14695981039346656037ULL;
+
+    for (size_t i = 0; i < namespace_len; i++) {
+        hash = (hash ^ (unsigned char) namespace[i]) * 1099511628211ULL;
+    }
+    hash = (hash ^ (unsigned char) ':') * 1099511628211ULL;
+    for (; *property != '\0'; property++) {
+        hash = (hash ^ (unsigned char) *property) * 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+/**
+ * @brief Free the property index of @p lzeh, it is rebuilt on the next lookup
+ * @param[in,out] lzeh libze handle
+ */
+static void
+prop_index_invalidate(libze_handle *lzeh) {
+    free(lzeh->prop_index);
+    lzeh->prop_index = NULL;
+}
+
+/**
+ * @brief Insert all properties of @p props into @p index, unless already present
+ */
+static void
+prop_index_insert(libze_prop_index *index, nvlist_t *props) {
+    nvpair_t *pair = NULL;
+
+    while ((pair = nvlist_next_nvpair(props, pair)) != NULL) {
+        char const *name = nvpair_name(pair);
+        char const *colon = strchr(name, ':');
+        nvlist_t *prop = NULL;
+
+        if ((colon == NULL) || (nvpair_value_nvlist(pair, &prop) != 0)) {
+            continue;
+        }
+
+        libze_prop_entry entry = {.name = name,
+                                  .namespace_len = colon - name,
+                                  .hash = 0,
+                                  .value = NULL,
+                                  .source = NULL};
+        entry.hash = prop_index_hash(name, entry.namespace_len, colon + 1);
+        (void) nvlist_lookup_string(prop, "value", &entry.value);
+        (void) nvlist_lookup_string(prop, "source", &entry.source);
+
+        size_t slot = entry.hash & index->mask;
+        boolean_t present = B_FALSE;
+        while (!present && (index->slots[slot].name != NULL)) {
+            present = (index->slots[slot].hash == entry.hash) &&
+                      (strcmp(index->slots[slot].name, name) == 0);
+            slot = (slot + 1) & index->mask;
+        }
+        if (!present) {
+            index->slots[slot] = entry;
+        }
+    }
+}
+
+/**
+ * @brief Build the property index of @p lzeh from @p lzeh->ze_props, falling back to
+ *        @p lzeh->ze_default_props for unset properties
+ * @param[in,out] lzeh libze handle
+ * @return @p LIBZE_ERROR_SUCCESS on success, @p LIBZE_ERROR_NOMEM on failure
+ */
+static libze_error
+prop_index_build(libze_handle *lzeh) {
+    size_t count = 0;
+    size_t nslots = 8;
+    nvpair_t *pair = NULL;
+
+    prop_index_invalidate(lzeh);
+
+    while ((pair = nvlist_next_nvpair(lzeh->ze_props, pair)) != NULL) {
+        count++;
+    }
+    if (lzeh->ze_default_props != NULL) {
+        while ((pair = nvlist_next_nvpair(lzeh->ze_default_props, pair)) != NULL) {
+            count++;
+        }
+    }
+    // Keep the load factor at or below one half
+    while (nslots < (count * 2)) {
+        nslots *= 2;
+    }
+
+    libze_prop_index *index =
+        calloc(1, sizeof(libze_prop_index) + (nslots * sizeof(libze_prop_entry)));
+    if (index == NULL) {
+        return libze_error_nomem(lzeh);
+    }
+    index->mask = nslots - 1;
+
+    prop_index_insert(index, lzeh->ze_props);
+    // Defaults only fill in properties which aren't set
+    if (lzeh->ze_default_props != NULL) {
+        prop_index_insert(index, lzeh->ze_default_props);
+    }
+
+    lzeh->prop_index = index;
+    return LIBZE_ERROR_SUCCESS;
+}
+
+/**
+ * @brief Find a property in the property index of @p lzeh, building it if needed
+ * @param[in] lzeh Initialized lzeh libze handle
+ * @param[in] property Property name without namespace
+ * @param[in] namespace Property namespace without colon
+ * @param[out] entry Property, NULL if unset
+ * @return @p LIBZE_ERROR_SUCCESS on success
+ */
+static libze_error
+prop_index_lookup(libze_handle *lzeh, char const property[static 1],
+                  char const namespace[static 1], libze_prop_entry const **entry) {
+    libze_error ret = LIBZE_ERROR_SUCCESS;
+    size_t namespace_len = strlen(namespace);
+    *entry = NULL;
+
+    if ((lzeh->prop_index == NULL) && ((ret = prop_index_build(lzeh)) != LIBZE_ERROR_SUCCESS)) {
+        return ret;
+    }
+
+    uint64_t hash = prop_index_hash(namespace, namespace_len, property);
+    libze_prop_index const *index = lzeh->prop_index;
+    for (size_t slot = hash & index->mask; index->slots[slot].name != NULL;
+         slot = (slot + 1) & index->mask) {
+        libze_prop_entry const *candidate = &index->slots[slot];
+        if ((candidate->hash == hash) && (candidate->namespace_len == namespace_len) &&
+            (strncmp(candidate->name, namespace, namespace_len) == 0) &&
+            (strcmp(candidate->name + namespace_len + 1, property) == 0)) {
+            *entry = candidate;
+            break;
+        }
+    }
+
+    return ret;
+}
+
+/**
+ * @brief Drop the mount table snapshot of @p lzeh, it is read again on the next lookup. Must be
+ *        called whenever libze mounts or unmounts anything.
+ * @param[in,out] lzeh Initialized lzeh libze handle
+ */
+void
+libze_mnttab_invalidate(libze_handle *lzeh) {
+    nvlist_free(lzeh->mnttab);
+    nvlist_free(lzeh->mnttab_datasets);
+    lzeh->mnttab = NULL;
+    lzeh->mnttab_datasets = NULL;
+}
+
+/**
+ * @brief Read the mount table snapshot of @p lzeh, unless it is current
+ * @param[in,out] lzeh Initialized lzeh libze handle
+ * @return @p LIBZE_ERROR_SUCCESS on success,
+ *         @p LIBZE_ERROR_NOMEM or @p LIBZE_ERROR_UNKNOWN if the mount table can't be read
+ */
+static libze_error
+mnttab_load(libze_handle *lzeh) {
+    if (lzeh->mnttab != NULL) {
+        return LIBZE_ERROR_SUCCESS;
+    }
+
+    if (((lzeh->mnttab = fnvlist_alloc()) == NULL) ||
+        ((lzeh->mnttab_datasets = fnvlist_alloc()) == NULL)) {
+        libze_mnttab_invalidate(lzeh);
+        return libze_error_nomem(lzeh);
+    }
+
+    if (libze_zfs_mounts_get(lzeh->mnttab, lzeh->mnttab_datasets) != SYSTEM_ERR_SUCCESS) {
+        libze_mnttab_invalidate(lzeh);
+        return libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN, "Failed to read the mount table.\n");
+    }
+
+    return LIBZE_ERROR_SUCCESS;
+}
+
+/**
+ * @brief Get the ZFS dataset mounted at @p mountpoint from the mount table snapshot of @p lzeh
+ * @param[in,out] lzeh Initialized lzeh libze handle
+ * @param[in] mountpoint Mountpoint to get dataset from
+ * @return The dataset, valid until the snapshot is invalidated, or @p NULL if no ZFS dataset is
+ *         mounted there, or with the error set if the mount table can't be read
+ */
+char const *
+libze_mnttab_dataset(libze_handle *lzeh, char const mountpoint[static 1]) {
+    char const *dataset = NULL;
+
+    if ((mnttab_load(lzeh) != LIBZE_ERROR_SUCCESS) ||
+        (nvlist_lookup_string(lzeh->mnttab, mountpoint, &dataset) != 0)) {
+        return NULL;
+    }
+
+    return dataset;
+}
+
+/**
+ * @brief Get where @p dataset is mounted from the mount table snapshot of @p lzeh
+ * @param[in,out] lzeh Initialized lzeh libze handle
+ * @param[in] dataset Dataset to get the mountpoint of
+ * @return The first mountpoint, valid until the snapshot is invalidated, or @p NULL if
+ *         @p dataset isn't mounted, or with the error set if the mount table can't be read
+ */
+char const *
+libze_mnttab_mountpoint(libze_handle *lzeh, char const dataset[static 1]) {
+    char const *mountpoint = NULL;
+
+    if ((mnttab_load(lzeh) != LIBZE_ERROR_SUCCESS) ||
+        (nvlist_lookup_string(lzeh->mnttab_datasets, dataset, &mountpoint) != 0)) {
+        return NULL;
+    }
+
+    return mountpoint;
+}
+
+/**
+ * @brief Check if a dataset is mounted using the mount table snapshot of @p lzeh, falling back
+ *        to libzfs if the mount table can't be read
+ * @param[in,out] lzeh Initialized lzeh libze handle
+ * @param[in] zh Dataset handle
+ * @return @p B_TRUE if mounted
+ */
+static boolean_t
+dataset_is_mounted(libze_handle *lzeh, zfs_handle_t *zh) {
+    if (mnttab_load(lzeh) != LIBZE_ERROR_SUCCESS) {
+        (void) libze_error_clear(lzeh);
+        return zfs_is_mounted(zh, NULL);
+    }
+
+    return nvlist_exists(lzeh->mnttab_datasets, zfs_get_name(zh));
+}
+
 static libze_error
 parse_property(char const property[static 1], char property_prefix[ZFS_MAXPROPLEN],
                char property_suffix[ZFS_MAXPROPLEN]) {
@@ -70,6 +357,118 @@ parse_property(char const property[static 1], char property_prefix[ZFS_MAXPROPLE
     return ret;
 }
 
+/**
+ * @brief Check that a plugin name is usable as part of the plugin library path
+ * @param[in] value Plugin name
+ * @return @p B_TRUE if @p value only has alphanumerics, '-' or '_'
+ */
+static boolean_t
+validate_plugin_name(char const value[static 1]) {
+    return strspn(value, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789-_") ==
+           strlen(value);
+}
+
+/**
+ * @brief Check that a snapshot name format expands to a valid snapshot name, conversions such as
+ *        %D or %c expand to '/' or spaces
+ * @param[in] value Snapshot name format, see @p libze_util_snap_format_expand
+ * @return @p B_TRUE if @p value is empty, or expands to a valid snapshot name now
+ */
+static boolean_t
+validate_snapformat(char const value[static 1]) {
+    char snap_suffix[ZFS_MAX_DATASET_NAME_LEN];
+    struct timespec now = {0};
+
+    // Empty and '-' fall back to the default format
+    if ((strlen(value) == 0) || (strcmp(value, "-") == 0)) {
+        return B_TRUE;
+    }
+
+    (void) clock_gettime(CLOCK_REALTIME, &now);
+    if (libze_util_snap_format_expand(value, &now, 0, ZFS_MAX_DATASET_NAME_LEN, snap_suffix) !=
+        LIBZE_ERROR_SUCCESS) {
+        return B_FALSE;
+    }
+
+    return libze_util_snap_suffix_valid(snap_suffix);
+}
+
+libze_prop_schema const libze_properties[LIBZE_PROP_NUM] = {
+    [LIBZE_PROP_BOOTLOADER] = {"bootloader", LIBZE_PROP_TYPE_STRING, "", validate_plugin_name},
+    [LIBZE_PROP_BOOTPOOLROOT] = {"bootpoolroot", LIBZE_PROP_TYPE_DATASET, "", NULL},
+    [LIBZE_PROP_BOOTPOOLPREFIX] = {"bootpoolprefix", LIBZE_PROP_TYPE_STRING, "", NULL},
+    [LIBZE_PROP_SNAPFORMAT] = {"snapformat", LIBZE_PROP_TYPE_STRING, ZE_SNAPSHOT_FORMAT_DEFAULT,
+                               validate_snapformat}};
+
+/**
+ * @brief Find the schema of a property in the core schema, or the schema of the loaded plugin
+ * @param[in] lzeh Initialized lzeh libze handle
+ * @param[in] namespace Property namespace without colon
+ * @param[in] property Property name without namespace
+ * @return Schema entry, or NULL if the property isn't known
+ */
+static libze_prop_schema const *
+prop_schema_find(libze_handle *lzeh, char const namespace[static 1],
+                 char const property[static 1]) {
+    libze_prop_schema const *schema = NULL;
+    size_t num_properties = 0;
+
+    if (strcmp(namespace, ZE_PROP_NAMESPACE) == 0) {
+        schema = libze_properties;
+        num_properties = LIBZE_PROP_NUM;
+    } else if ((lzeh->lz_funcs != NULL) && (lzeh->lz_funcs->plugin_properties != NULL)) {
+        // Plugin namespace is formed from the name of the loaded bootloader
+        char const *plugin = libze_prop_value(lzeh, LIBZE_PROP_BOOTLOADER);
+        char plugin_namespace[ZFS_MAXPROPLEN] = "";
+        if ((plugin == NULL) ||
+            (libze_plugin_form_namespace(plugin, plugin_namespace) !=
+             LIBZE_PLUGIN_MANAGER_ERROR_SUCCESS) ||
+            (strcmp(namespace, plugin_namespace) != 0)) {
+            return NULL;
+        }
+        schema = lzeh->lz_funcs->plugin_properties;
+        num_properties = lzeh->lz_funcs->plugin_num_properties;
+    }
+
+    for (size_t i = 0; i < num_properties; i++) {
+        if (strcmp(schema[i].name, property) == 0) {
+            return &schema[i];
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Check a property value against its schema
+ * @param[in] schema Schema entry of the property
+ * @param[in] value Value to check
+ * @return @p B_TRUE if @p value is empty, or of the right type and accepted by the validator
+ */
+static boolean_t
+prop_schema_valid(libze_prop_schema const *schema, char const value[static 1]) {
+    if (strlen(value) == 0) {
+        return B_TRUE;
+    }
+
+    switch (schema->type) {
+        case LIBZE_PROP_TYPE_PATH:
+            if (value[0] != '/') {
+                return B_FALSE;
+            }
+            break;
+        case LIBZE_PROP_TYPE_DATASET:
+            if (!zfs_name_valid(value, ZFS_TYPE_FILESYSTEM)) {
+                return B_FALSE;
+            }
+            break;
+        case LIBZE_PROP_TYPE_STRING:
+            break;
+    }
+
+    return (schema->validate == NULL) || schema->validate(value);
+}
+
 /**
  * @brief Checks if the specified boot environment name is valid and exists
  *
@@ -297,18 +696,38 @@ open_boot_environment(libze_handle *lzeh, char const be[static 1], zfs_handle_t
     return ret;
 }
 
+/**
+ * @brief Check if the user property @p property is set locally on @p zh, rather than
+ *        inherited or unset.
+ * @param[in] zh Initialized dataset handle
+ * @param[in] property Full name of user property
+ * @return @p B_TRUE if set locally
+ */
+static boolean_t
+user_prop_is_local(zfs_handle_t *zh, char const property[static 1]) {
+    nvlist_t *user_props = zfs_get_user_props(zh);
+    nvlist_t *prop = NULL;
+    const char *source = NULL;
+
+    return (user_props != NULL) && (nvlist_lookup_nvlist(user_props, property, &prop) == 0) &&
+           (nvlist_lookup_string(prop, "source", &source) == 0) &&
+           (strcmp(source, zfs_get_name(zh)) == 0);
+}
+
 /**
  * @brief Given a property with an optional prefix for a bootloader,
- *        form a ZFS property nvlist
+ *        form a ZFS property nvlist. Properties known to the core or the loaded plugin schema
+ *        are validated, other properties are added as they are.
+ * @param[in] lzeh Initialized lzeh libze handle
  * @param[in,out] properties Pre-allocated nvlist to add a property to
  * @param property Individual property to add to the list
  * @return @p LIBZE_ERROR_SUCCESS on success,
  *         @p LIBZE_ERROR_MAXPATHLEN if property is too long,
- *         @p LIBZE_ERROR_UNKNOWN if no '=' in property
+ *         @p LIBZE_ERROR_UNKNOWN if no '=' in property, or if the value is invalid
  * @pre @p properties is allocated and non NULL
  */
 libze_error
-libze_add_set_property(nvlist_t *properties, char const *property) {
+libze_add_set_property(libze_handle *lzeh, nvlist_t *properties, char const *property) {
     libze_error ret = LIBZE_ERROR_SUCCESS;
 
     // Property value, part after '='
@@ -320,27 +739,39 @@ libze_add_set_property(nvlist_t *properties, char const *property) {
     // Full resulting ZFS property
     char prop_full_name[ZFS_MAXPROPLEN];
     char prop_after_colon[ZFS_MAXPROPLEN];
+    char prop_name[ZFS_MAXPROPLEN];
 
-    if (parse_property(property, prop_prefix, prop_after_colon) != LIBZE_ERROR_SUCCESS) {
+    if (strlcpy(prop_name, property, ZFS_MAXPROPLEN) >= ZFS_MAXPROPLEN) {
         fprintf(stderr, "property '%s' is too long\n", property);
         return LIBZE_ERROR_MAXPATHLEN;
     }
 
-    if ((value = strchr(prop_after_colon, '=')) == NULL) {
+    if ((value = strchr(prop_name, '=')) == NULL) {
         fprintf(stderr, "missing '=' for property=value argument\n");
         return LIBZE_ERROR_UNKNOWN;
     }
 
-    // Cut at '='
+    // Cut at '=', so that a colon in the value isn't taken as prefix
     *value = '\0';
     value++;
 
+    if (parse_property(prop_name, prop_prefix, prop_after_colon) != LIBZE_ERROR_SUCCESS) {
+        fprintf(stderr, "property '%s' is too long\n", property);
+        return LIBZE_ERROR_MAXPATHLEN;
+    }
+
     ret = libze_util_concat(prop_prefix, ":", prop_after_colon, ZFS_MAXPROPLEN, prop_full_name);
     if (ret != LIBZE_ERROR_SUCCESS) {
         fprintf(stderr, "property '%s' is too long\n", property);
         return ret;
     }
 
+    libze_prop_schema const *schema = prop_schema_find(lzeh, prop_prefix, prop_after_colon);
+    if ((schema != NULL) && !prop_schema_valid(schema, value)) {
+        fprintf(stderr, "invalid value '%s' for property '%s'\n", value, prop_name);
+        return LIBZE_ERROR_UNKNOWN;
+    }
+
     if (nvlist_exists(properties, prop_full_name)) {
         fprintf(stderr, "property '%s' specified multiple times\n", property);
         return LIBZE_ERROR_UNKNOWN;
@@ -355,8 +786,8 @@ libze_add_set_property(nvlist_t *properties, char const *property) {
 
 libze_error
 libze_add_get_property(libze_handle *lzeh, nvlist_t **properties, char const *property) {
-    nvpair_t *pair = NULL;
     libze_error ret = LIBZE_ERROR_SUCCESS;
+    libze_prop_entry const *entry = NULL;
 
     /* Prefix, just ZE_NAMESPACE if no colon in property
      * Otherwise ZE_NAMESPACE + part before colon */
@@ -376,27 +807,52 @@ libze_add_get_property(libze_handle *lzeh, nvlist_t **properties, char const *pr
         return libze_error_set(lzeh, ret, "property '%s' is too long\n", property);
     }
 
-    for (pair = nvlist_next_nvpair(lzeh->ze_props, NULL); pair != NULL;
-         pair = nvlist_next_nvpair(lzeh->ze_props, pair)) {
-        if (strcmp(nvpair_name(pair), prop_full_name) == 0) {
-            if (nvlist_add_nvpair(*properties, pair) != 0) {
-                return libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN,
-                                       "Failed to add property '%s' to list\n", property);
-            }
-        }
+    if ((ret = prop_index_lookup(lzeh, prop_after_colon, prop_prefix, &entry)) !=
+        LIBZE_ERROR_SUCCESS) {
+        return ret;
     }
 
-    // Add empty property
-    if (nvlist_empty(*properties)) {
-        nvlist_t *prop_nvl = fnvlist_alloc();
-        if (prop_nvl == NULL) {
-            return libze_error_set(lzeh, LIBZE_ERROR_NOMEM, "Failed to allocate nvlist\n");
-        }
-        if ((nvlist_add_string(prop_nvl, "value", "-") != 0) ||
-            (nvlist_add_string(prop_nvl, "source", "-") != 0) ||
-            (nvlist_add_nvlist(*properties, prop_full_name, prop_nvl) != 0)) {
-            return libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN,
-                                   "Failed to add property '%s' to list\n", property);
+    nvlist_t *prop_nvl = fnvlist_alloc();
+    if (prop_nvl == NULL) {
+        return libze_error_set(lzeh, LIBZE_ERROR_NOMEM, "Failed to allocate nvlist\n");
+    }
+
+    // Unset properties are added empty, defaults without a source
+    char const *value = ((entry != NULL) && (entry->value != NULL)) ? entry->value : "-";
+    char const *source = (entry != NULL) ? entry->source : "-";
+    if ((nvlist_add_string(prop_nvl, "value", value) != 0) ||
+        ((source != NULL) && (nvlist_add_string(prop_nvl, "source", source) != 0)) ||
+        (nvlist_add_nvlist(*properties, prop_full_name, prop_nvl) != 0)) {
+        fnvlist_free(prop_nvl);
+        return libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN, "Failed to add property '%s' to list\n",
+                               property);
+    }
+
+    fnvlist_free(prop_nvl);
+    return LIBZE_ERROR_SUCCESS;
+}
+
+/**
+ * @brief Add all properties to @p properties, including the defaults of unset properties
+ * @param[in] lzeh Initialized lzeh libze handle
+ * @param[out] properties nvlist to add the properties to
+ * @return @p LIBZE_ERROR_SUCCESS on success
+ */
+libze_error
+libze_add_get_properties(libze_handle *lzeh, nvlist_t **properties) {
+    if (nvlist_merge(*properties, lzeh->ze_props, 0) != 0) {
+        return libze_error_nomem(lzeh);
+    }
+
+    if (lzeh->ze_default_props == NULL) {
+        return LIBZE_ERROR_SUCCESS;
+    }
+
+    nvpair_t *pair = NULL;
+    while ((pair = nvlist_next_nvpair(lzeh->ze_default_props, pair)) != NULL) {
+        if (!nvlist_exists(lzeh->ze_props, nvpair_name(pair)) &&
+            (nvlist_add_nvpair(*properties, pair) != 0)) {
+            return libze_error_nomem(lzeh);
         }
     }
 
@@ -449,67 +905,78 @@ err:
 }
 
 /**
- * @brief Set default properties
+ * @brief Add a layer of default properties, which lookups fall back to for unset properties.
+ *        The defaults are not copied into @p lzeh->ze_props.
  * @param[in] lzeh Initialized lzeh libze handle
- * @param[in] default_prop Properties of boot environment
+ * @param[in] default_prop Default properties, ownership is taken over in any case. Properties
+ *            outside of @p namespace are dropped.
+ * @param[in] namespace Namespace of the default properties without colon
  * @return @p LIBZE_ERROR_SUCCESS on success,
- *         @p LIBZE_ERROR_NOMEM if nvlist can't be duplicated,
- *         @p LIBZE_ERROR_UNKNOWN otherwise
+ *         @p LIBZE_ERROR_NOMEM if the defaults can't be merged with existing defaults
  *
  * @pre @p default_prop != NULL
  * @pre @p namespace != NULL
  */
 libze_error
 libze_default_props_set(libze_handle *lzeh, nvlist_t *default_prop, char const *namespace) {
-    nvpair_t *pair = NULL;
-    libze_error ret = LIBZE_ERROR_SUCCESS;
-
-    for (pair = nvlist_next_nvpair(default_prop, NULL); pair != NULL;
-         pair = nvlist_next_nvpair(default_prop, pair)) {
-
-        const char *nvp_name = nvpair_name(pair);
-        char buf[ZFS_MAXPROPLEN];
-
-        if (libze_util_cut(nvp_name, ZFS_MAXPROPLEN, buf, ':') != 0) {
-            return LIBZE_ERROR_UNKNOWN;
+    size_t namespace_len = strlen(namespace);
+    nvpair_t *pair = nvlist_next_nvpair(default_prop, NULL);
+
+    while (pair != NULL) {
+        nvpair_t *next = nvlist_next_nvpair(default_prop, pair);
+        char const *name = nvpair_name(pair);
+        if ((strncmp(name, namespace, namespace_len) != 0) || (name[namespace_len] != ':')) {
+            fnvlist_remove_nvpair(default_prop, pair);
         }
+        pair = next;
+    }
 
-        if (strcmp(buf, namespace) != 0) {
-            continue;
-        }
+    prop_index_invalidate(lzeh);
 
-        // Check if property set
-        boolean_t ze_prop_unset = B_TRUE;
-        nvpair_t *ze_pair = NULL;
-        for (ze_pair = nvlist_next_nvpair(lzeh->ze_props, NULL); ze_pair != NULL;
-             ze_pair = nvlist_next_nvpair(lzeh->ze_props, ze_pair)) {
-            const char *ze_nvp_name = nvpair_name(ze_pair);
-            if (strcmp(ze_nvp_name, nvp_name) == 0) {
-                ze_prop_unset = B_FALSE;
-                break;
-            }
-        }
+    if (lzeh->ze_default_props == NULL) {
+        lzeh->ze_default_props = default_prop;
+        return LIBZE_ERROR_SUCCESS;
+    }
 
-        // Property unset, set default
-        if (ze_prop_unset) {
-            nvlist_t *ze_default_prop_nvl = NULL;
-            nvlist_t *ze_prop_nvl = NULL;
-            if (nvpair_value_nvlist(pair, &ze_prop_nvl) != 0) {
-                return libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN, "Failed to get nvpair_value\n");
-            }
+    int err = nvlist_merge(lzeh->ze_default_props, default_prop, 0);
+    fnvlist_free(default_prop);
+    if (err != 0) {
+        return libze_error_nomem(lzeh);
+    }
 
-            if (nvlist_dup(ze_prop_nvl, &ze_default_prop_nvl, 0) != 0) {
-                return libze_error_set(lzeh, LIBZE_ERROR_NOMEM, "Failed to duplicate nvlist\n");
-            }
+    return LIBZE_ERROR_SUCCESS;
+}
 
-            if (nvlist_add_nvlist(lzeh->ze_props, nvp_name, ze_default_prop_nvl) != 0) {
-                return libze_error_set(lzeh, LIBZE_ERROR_NOMEM,
-                                       "Failed to add default property %s\n", nvp_name);
-            }
+/**
+ * @brief Add the defaults of every property in @p schema as a layer of default properties
+ * @param[in] lzeh Initialized lzeh libze handle
+ * @param[in] schema Static schema table
+ * @param[in] num_properties Number of entries in @p schema
+ * @param[in] namespace Namespace of the properties in @p schema without colon
+ * @return @p LIBZE_ERROR_SUCCESS on success,
+ *         @p LIBZE_ERROR_MAXPATHLEN if a property name is too long,
+ *         @p LIBZE_ERROR_NOMEM if the defaults can't be allocated or merged
+ */
+libze_error
+libze_schema_defaults_set(libze_handle *lzeh, libze_prop_schema const *schema,
+                          size_t num_properties, char const namespace[static 1]) {
+    nvlist_t *default_props = fnvlist_alloc();
+    if (default_props == NULL) {
+        return libze_error_nomem(lzeh);
+    }
+
+    for (size_t i = 0; i < num_properties; i++) {
+        if (libze_default_prop_add(&default_props, schema[i].name, schema[i].default_value,
+                                   namespace) != LIBZE_ERROR_SUCCESS) {
+            nvlist_free(default_props);
+            return libze_error_set(lzeh, LIBZE_ERROR_MAXPATHLEN,
+                                   "Failed to add default of property %s:%s.\n", namespace,
+                                   schema[i].name);
         }
     }
 
-    return ret;
+    // Takes ownership of default_props
+    return libze_default_props_set(lzeh, default_props, namespace);
 }
 
 /**
@@ -605,40 +1072,113 @@ libze_nvlist_prop_get(libze_handle *lzeh, nvlist_t *props, char *result_prop, ch
     return LIBZE_ERROR_SUCCESS;
 }
 
-libze_error
-libze_be_prop_get(libze_handle *lzeh, char *result_prop, char const *property,
-                  char const *namespace) {
-    return libze_nvlist_prop_get(lzeh, lzeh->ze_props, result_prop, property, namespace);
-}
-
 /**
- * @brief Get all the ZFS properties which have been set with the @p namespace prefix
- *        and return them in @a result for provided dataset.
- *
- *        Properties in form:
- * @verbatim
-   org.zectl:bootloader:
-       value: 'systemdboot'
-       source: 'zroot/ROOT'
-   @endverbatim
- *
+ * @brief Get the value of a property of the boot environment root without copying it
  * @param[in] lzeh Initialized lzeh libze handle
- * @param[out] result Properties of boot environment
- * @param[in] namespace ZFS property prefix
- * @return LIBZE_ERROR_SUCCESS on success, or
- *         LIBZE_ERROR_ZFS_OPEN, LIBZE_ERROR_UNKNOWN, LIBZE_ERROR_NOMEM
- *
- * @pre @p lzeh != NULL
- * @pre @p namespace != NULL
+ * @param[in] property Property name without namespace
+ * @param[in] namespace Property namespace without colon
+ * @return The value, valid until the properties of @p lzeh change, an empty string if unset,
+ *         or @p NULL with the error set on failure
  */
-libze_error
-libze_dataset_props_get(libze_handle *lzeh, nvlist_t **result, char const *dataset, char const *namespace){
-    nvlist_t *user_props = NULL;
-    nvlist_t *filtered_user_props = NULL;
-    libze_error ret = LIBZE_ERROR_SUCCESS;
+char const *
+libze_be_prop_value(libze_handle *lzeh, char const property[static 1],
+                    char const namespace[static 1]) {
+    libze_prop_entry const *entry = NULL;
 
-    zfs_handle_t *zhp = zfs_open(lzeh->lzh, dataset, ZFS_TYPE_FILESYSTEM);
-    if (zhp == NULL) {
+    if (prop_index_lookup(lzeh, property, namespace, &entry) != LIBZE_ERROR_SUCCESS) {
+        return NULL;
+    }
+    if (entry == NULL) {
+        return "";
+    }
+    // Should always have a value if set correctly
+    if (entry->value == NULL) {
+        (void) libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN, "Property %s set incorrectly.\n",
+                               entry->name);
+        return NULL;
+    }
+
+    return entry->value;
+}
+
+/**
+ * @brief Get the source of a property of the boot environment root without copying it
+ * @param[in] lzeh Initialized lzeh libze handle
+ * @param[in] property Property name without namespace
+ * @param[in] namespace Property namespace without colon
+ * @return The dataset the property is set on, valid until the properties of @p lzeh change,
+ *         an empty string if unset or a default, or @p NULL with the error set on failure
+ */
+char const *
+libze_be_prop_source(libze_handle *lzeh, char const property[static 1],
+                     char const namespace[static 1]) {
+    libze_prop_entry const *entry = NULL;
+
+    if (prop_index_lookup(lzeh, property, namespace, &entry) != LIBZE_ERROR_SUCCESS) {
+        return NULL;
+    }
+    if ((entry == NULL) || (entry->source == NULL)) {
+        return "";
+    }
+
+    return entry->source;
+}
+
+/**
+ * @brief Get the value of a core property of the boot environment root without copying it
+ * @param[in] lzeh Initialized lzeh libze handle
+ * @param[in] property Index of the property in @p libze_properties
+ * @return The value, valid until the properties of @p lzeh change, its default if unset,
+ *         or @p NULL with the error set on failure
+ */
+char const *
+libze_prop_value(libze_handle *lzeh, libze_prop property) {
+    return libze_be_prop_value(lzeh, libze_properties[property].name, ZE_PROP_NAMESPACE);
+}
+
+libze_error
+libze_be_prop_get(libze_handle *lzeh, char *result_prop, char const *property,
+                  char const *namespace) {
+    char const *value = libze_be_prop_value(lzeh, property, namespace);
+    if (value == NULL) {
+        return lzeh->libze_error;
+    }
+
+    if (strlcpy(result_prop, value, ZFS_MAXPROPLEN) >= ZFS_MAXPROPLEN) {
+        return libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN, "Property is too large.\n");
+    }
+
+    return LIBZE_ERROR_SUCCESS;
+}
+
+/**
+ * @brief Get all the ZFS properties which have been set with the @p namespace prefix
+ *        and return them in @a result for provided dataset.
+ *
+ *        Properties in form:
+ * @verbatim
+   org.zectl:bootloader:
+       value: 'systemdboot'
+       source: 'zroot/ROOT'
+   @endverbatim
+ *
+ * @param[in] lzeh Initialized lzeh libze handle
+ * @param[out] result Properties of boot environment
+ * @param[in] namespace ZFS property prefix
+ * @return LIBZE_ERROR_SUCCESS on success, or
+ *         LIBZE_ERROR_ZFS_OPEN, LIBZE_ERROR_UNKNOWN, LIBZE_ERROR_NOMEM
+ *
+ * @pre @p lzeh != NULL
+ * @pre @p namespace != NULL
+ */
+libze_error
+libze_dataset_props_get(libze_handle *lzeh, nvlist_t **result, char const *dataset, char const *namespace){
+    nvlist_t *user_props = NULL;
+    nvlist_t *filtered_user_props = NULL;
+    libze_error ret = LIBZE_ERROR_SUCCESS;
+
+    zfs_handle_t *zhp = zfs_open(lzeh->lzh, dataset, ZFS_TYPE_FILESYSTEM);
+    if (zhp == NULL) {
         return libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN, "Failed opening handle to %s.\n",
                                lzeh->env_root);
     }
@@ -674,6 +1214,190 @@ libze_be_props_get(libze_handle *lzeh, nvlist_t **result, char const *namespace)
     return libze_dataset_props_get(lzeh, result, lzeh->env_root, namespace);
 }
 
+typedef struct be_get_cbdata {
+    libze_handle *lzeh;
+    /**< Boot environment properties, keyed by boot environment name */
+    nvlist_t *properties;
+    /**< Full name of the single property to get, or NULL for all properties */
+    char const *property;
+} be_get_cbdata;
+
+/**
+ * @brief Resolve the effective properties of a boot environment from its user properties,
+ *        and add them to @p cbd->properties under the name of the boot environment.
+ *        Unset properties fall back to their defaults.
+ * @param[in,out] cbd Callback data, @p cbd->properties is allocated
+ * @param[in] be_zh Handle to boot environment dataset. Its user properties were already
+ *            fetched when it was opened or iterated, local properties have the dataset itself
+ *            as their source, inherited properties the dataset they are set on.
+ * @return @p LIBZE_ERROR_SUCCESS on success,
+ *         @p LIBZE_ERROR_NOMEM or @p LIBZE_ERROR_UNKNOWN on failure
+ */
+static libze_error
+be_get_resolve(be_get_cbdata *cbd, zfs_handle_t *be_zh) {
+    libze_error ret = LIBZE_ERROR_SUCCESS;
+    libze_handle *lzeh = cbd->lzeh;
+    nvlist_t *user_props = NULL;
+    nvlist_t *be_props = NULL;
+    nvlist_t *prop = NULL;
+
+    char be_name[ZFS_MAX_DATASET_NAME_LEN] = "";
+    if (libze_boot_env_name(zfs_get_name(be_zh), ZFS_MAX_DATASET_NAME_LEN, be_name) != 0) {
+        return libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN,
+                               "Failed to get boot environment name of %s.\n",
+                               zfs_get_name(be_zh));
+    }
+
+    if ((user_props = zfs_get_user_props(be_zh)) == NULL) {
+        return libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN,
+                               "Failed to retrieve user properties for %s.\n",
+                               zfs_get_name(be_zh));
+    }
+
+    if ((be_props = fnvlist_alloc()) == NULL) {
+        return libze_error_nomem(lzeh);
+    }
+
+    if (cbd->property != NULL) {
+        if ((nvlist_lookup_nvlist(user_props, cbd->property, &prop) == 0) ||
+            ((lzeh->ze_default_props != NULL) &&
+             (nvlist_lookup_nvlist(lzeh->ze_default_props, cbd->property, &prop) == 0))) {
+            if (nvlist_add_nvlist(be_props, cbd->property, prop) != 0) {
+                ret = libze_error_nomem(lzeh);
+                goto err;
+            }
+        } else {
+            // Unset properties are added empty
+            if (((prop = fnvlist_alloc()) == NULL) ||
+                (nvlist_add_string(prop, "value", "-") != 0) ||
+                (nvlist_add_string(prop, "source", "-") != 0) ||
+                (nvlist_add_nvlist(be_props, cbd->property, prop) != 0)) {
+                ret = libze_error_nomem(lzeh);
+            }
+            fnvlist_free(prop);
+            if (ret != LIBZE_ERROR_SUCCESS) {
+                goto err;
+            }
+        }
+    } else {
+        if (libze_filter_be_props(user_props, &be_props, ZE_PROP_NAMESPACE) !=
+            LIBZE_ERROR_SUCCESS) {
+            ret = libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN,
+                                  "Failed to filter user properties of %s.\n",
+                                  zfs_get_name(be_zh));
+            goto err;
+        }
+
+        nvpair_t *pair = NULL;
+        while ((lzeh->ze_default_props != NULL) &&
+               ((pair = nvlist_next_nvpair(lzeh->ze_default_props, pair)) != NULL)) {
+            if (!nvlist_exists(be_props, nvpair_name(pair)) &&
+                (nvlist_add_nvpair(be_props, pair) != 0)) {
+                ret = libze_error_nomem(lzeh);
+                goto err;
+            }
+        }
+    }
+
+    if (nvlist_add_nvlist(cbd->properties, be_name, be_props) != 0) {
+        ret = libze_error_nomem(lzeh);
+    }
+
+err:
+    fnvlist_free(be_props);
+    return ret;
+}
+
+/**
+ * @brief Callback run on every boot environment, resolving its properties
+ * @param[in] zhdl Initialized zfs handle for boot environment being iterated
+ * @param[in,out] data Callback data, @p be_get_cbdata
+ * @return Non-zero on failure
+ */
+static int
+be_get_cb(zfs_handle_t *zhdl, void *data) {
+    be_get_cbdata *cbd = data;
+
+    libze_error ret = be_get_resolve(cbd, zhdl);
+    zfs_close(zhdl);
+
+    return (ret != LIBZE_ERROR_SUCCESS) ? -1 : 0;
+}
+
+/**
+ * @brief Add the effective properties of one, or all boot environments to @p properties, keyed
+ *        by boot environment name. Properties in form:
+ * @verbatim
+   default:
+       org.zectl:bootloader:
+           value: 'systemdboot'
+           source: 'zroot/ROOT'
+   @endverbatim
+ *
+ *        A property set on the boot environment itself has the boot environment dataset as its
+ *        source, an inherited property the dataset it is inherited from. Defaults of unset
+ *        properties have no source. All boot environments are resolved from a single iteration
+ *        of @p lzeh->env_root, without opening any boot environment separately.
+ *
+ * @param[in] lzeh Initialized lzeh libze handle
+ * @param[out] properties nvlist to add the properties to
+ * @param[in] boot_environment Boot environment to get the properties of, or NULL for all
+ * @param[in] property Property to get, without namespace prefix, or NULL for all properties
+ * @return @p LIBZE_ERROR_SUCCESS on success,
+ *         @p LIBZE_ERROR_EEXIST if @p boot_environment doesn't exist,
+ *         @p LIBZE_ERROR_MAXPATHLEN if @p property is too long,
+ *         @p LIBZE_ERROR_ZFS_OPEN, @p LIBZE_ERROR_NOMEM, or @p LIBZE_ERROR_UNKNOWN on failure
+ */
+libze_error
+libze_add_be_get_properties(libze_handle *lzeh, nvlist_t **properties,
+                            char const *boot_environment, char const *property) {
+    libze_error ret = LIBZE_ERROR_SUCCESS;
+    be_get_cbdata cbd = {.lzeh = lzeh, .properties = *properties, .property = NULL};
+
+    char prop_prefix[ZFS_MAXPROPLEN];
+    char prop_full_name[ZFS_MAXPROPLEN];
+    char prop_after_colon[ZFS_MAXPROPLEN];
+
+    if (property != NULL) {
+        if ((parse_property(property, prop_prefix, prop_after_colon) != LIBZE_ERROR_SUCCESS) ||
+            (libze_util_concat(prop_prefix, ":", prop_after_colon, ZFS_MAXPROPLEN,
+                               prop_full_name) != LIBZE_ERROR_SUCCESS)) {
+            return libze_error_set(lzeh, LIBZE_ERROR_MAXPATHLEN, "property '%s' is too long\n",
+                                   property);
+        }
+        cbd.property = prop_full_name;
+    }
+
+    char be_ds[ZFS_MAX_DATASET_NAME_LEN] = "";
+    if (boot_environment != NULL) {
+        if ((ret = validate_existing_be(lzeh, boot_environment, be_ds, NULL)) !=
+            LIBZE_ERROR_SUCCESS) {
+            return ret;
+        }
+    }
+
+    zfs_handle_t *zh = zfs_open(lzeh->lzh, (boot_environment != NULL) ? be_ds : lzeh->env_root,
+                                ZFS_TYPE_FILESYSTEM);
+    if (zh == NULL) {
+        return libze_error_set(lzeh, LIBZE_ERROR_ZFS_OPEN, "Failed to open %s.\n",
+                               (boot_environment != NULL) ? be_ds : lzeh->env_root);
+    }
+
+    if (boot_environment != NULL) {
+        ret = be_get_resolve(&cbd, zh);
+    } else if (zfs_iter_filesystems(zh, be_get_cb, &cbd) != 0) {
+        // Error set in callback, unless iteration itself failed
+        ret = (lzeh->libze_error != LIBZE_ERROR_SUCCESS)
+                  ? lzeh->libze_error
+                  : libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN,
+                                    "Failed to iterate boot environments of %s.\n",
+                                    lzeh->env_root);
+    }
+
+    zfs_close(zh);
+    return ret;
+}
+
 /**
  * @brief Prepend an error message to the already specified error message to
  *        @p lzeh->libze_error_message and return the error type given in @p lze_err.
@@ -797,12 +1521,11 @@ libze_error_clear(libze_handle *lzeh) {
  */
 libze_error
 libze_bootloader_set(libze_handle *lzeh) {
-    char plugin[ZFS_MAXPROPLEN] = "";
     libze_error ret = LIBZE_ERROR_SUCCESS;
 
-    ret = libze_be_prop_get(lzeh, plugin, "bootloader", ZE_PROP_NAMESPACE);
-    if (ret != LIBZE_ERROR_SUCCESS) {
-        return ret;
+    char const *plugin = libze_prop_value(lzeh, LIBZE_PROP_BOOTLOADER);
+    if (plugin == NULL) {
+        return lzeh->libze_error;
     }
 
     // No plugin set
@@ -825,9 +1548,14 @@ libze_bootloader_set(libze_handle *lzeh) {
             ret = libze_error_set(lzeh, LIBZE_ERROR_PLUGIN,
                                   "Failed to open %s export table for plugin %s\n", plugin);
         } else {
-            if (lzeh->lz_funcs->plugin_init(lzeh) != 0) {
+            // The plugin may add its defaults to the properties, leaving plugin dangling
+            char plugin_name[ZFS_MAXPROPLEN] = "";
+            (void) strlcpy(plugin_name, plugin, ZFS_MAXPROPLEN);
+            int init_ret = lzeh->lz_funcs->plugin_init(lzeh);
+            prop_index_invalidate(lzeh);
+            if (init_ret != 0) {
                 ret = libze_error_set(lzeh, LIBZE_ERROR_PLUGIN, "Failed to initialize plugin %s\n",
-                                      plugin);
+                                      plugin_name);
             }
         }
     }
@@ -835,8 +1563,26 @@ libze_bootloader_set(libze_handle *lzeh) {
     return ret;
 }
 
+typedef struct mount_tree mount_tree;
+
+typedef struct libze_mount_cb_data {
+    libze_handle *lzeh;
+    char const *mountpoint;
+    mount_tree *tree;
+    /**< If set, mount this snapshot of each dataset read-only instead of the dataset */
+    char const *snapshot;
+} libze_mount_cb_data;
+
+static libze_error
+mount_children(libze_handle *lzeh, zfs_handle_t *zh, char const mountpoint[static 1],
+               char const *snapshot);
+
+static libze_error
+unmount_dataset(libze_handle *lzeh, char const dataset[static 1], boolean_t lazy);
+
 /**
- * @brief Execute an unmount of a already temp_mount_be mounted dataset
+ * @brief Execute an unmount of a already temp_mount_be mounted dataset and its children,
+ *        and remove the temporary directory. Datasets which are not mounted are skipped.
  *
  * @param[in,out] lzeh       libze handle
  * @param[in] tmp_dirname    Directory to unmount be from
@@ -846,152 +1592,255 @@ libze_bootloader_set(libze_handle *lzeh) {
  */
 static libze_error
 temp_unmount_be(libze_handle *lzeh, char const *tmp_dirname, zfs_handle_t *be_zh) {
-
-    libze_error ret = LIBZE_ERROR_SUCCESS;
-
-    nvlist_t *props = fnvlist_alloc();
-    if (props == NULL) {
-        return libze_error_nomem(lzeh);
-    }
-    nvlist_add_string(props, "canmount", "noauto");
-    nvlist_add_string(props, "mountpoint", "/");
-
-    if (!zfs_is_mounted(be_zh, NULL)) {
-        return LIBZE_ERROR_SUCCESS;
-    }
-
     // Retain existing error if occurred
-    if (zfs_unmount(be_zh, NULL, 0) != 0) {
-        ret = libze_error_prepend(lzeh, LIBZE_ERROR_UNKNOWN, "Failed to unmount %s", tmp_dirname);
-    } else {
-        rmdir(tmp_dirname);
-        if ((zfs_prop_set_list(be_zh, props) != 0)) {
-            ret = libze_error_prepend(lzeh, LIBZE_ERROR_UNKNOWN, "Failed to unset mountpoint %s:\n",
-                                      tmp_dirname);
-        }
+    if (unmount_dataset(lzeh, zfs_get_name(be_zh), B_FALSE) != LIBZE_ERROR_SUCCESS) {
+        return libze_error_prepend(lzeh, LIBZE_ERROR_UNKNOWN, "Failed to unmount %s\n",
+                                   tmp_dirname);
     }
 
-    return ret;
+    (void) rmdir(tmp_dirname);
+    return LIBZE_ERROR_SUCCESS;
 }
 
 /**
- * @brief Execute a temporary mount of a dataset
+ * @brief Execute a temporary mount of a dataset and its children. The datasets are mounted
+ *        directly with the 'zfsutil' option, no properties are modified.
  *
  * @param[in,out] lzeh        libze handle
  * @param[in] be_name         Boot environment name
- * @param[out] tmp_dirname    Directory to unmount be from
  * @param[in] be_zh           Handle to be
+ * @param[out] tmp_dirname    Directory the be was mounted to, unchanged on failure
  *
  * @return @p LIBZE_ERROR_SUCCESS on success, or @p LIBZE_ERROR_UNKNOWN on failure
  */
 static libze_error
-temp_mount_be(libze_handle *lzeh, char const *be_name, zfs_handle_t *be_zh, char **tmp_dirname) {
-    libze_error ret = LIBZE_ERROR_SUCCESS;
-
+temp_mount_be(libze_handle *lzeh, char const *be_name, zfs_handle_t *be_zh,
+              char tmp_dirname[LIBZE_MAX_PATH_LEN]) {
     char const *ds_name = zfs_get_name(be_zh);
 
-    // Not currently mounted
-    char tmpdir_template[ZFS_MAX_DATASET_NAME_LEN] = "";
-    if (libze_util_concat("/tmp/ze.", be_name, ".XXXXXX", ZFS_MAX_DATASET_NAME_LEN,
-                          tmpdir_template) != LIBZE_ERROR_SUCCESS) {
+    if (dataset_is_mounted(lzeh, be_zh)) {
+        return libze_error_set(lzeh, LIBZE_ERROR_MOUNTPOINT, "Dataset %s is already mounted\n",
+                               ds_name);
+    }
+
+    char tmpdir_template[LIBZE_MAX_PATH_LEN] = "";
+    if (libze_util_concat("/tmp/ze.", be_name, ".XXXXXX", LIBZE_MAX_PATH_LEN, tmpdir_template) !=
+        LIBZE_ERROR_SUCCESS) {
         return libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN, "Could not create directory template\n");
     }
 
     // Create tmp mountpoint
-    *tmp_dirname = mkdtemp(tmpdir_template);
-    if (tmp_dirname == NULL) {
+    if (mkdtemp(tmpdir_template) == NULL) {
         return libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN, "Could not create tmp directory %s\n",
                                tmpdir_template);
     }
 
-    // AFTER here always goto err to cleanup
-
-    if (zfs_prop_set(be_zh, "mountpoint", *tmp_dirname) != 0) {
-        ret = libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN, "Failed to set mountpoint=%s for %s\n",
-                              tmpdir_template, ds_name);
-        goto err;
+    if (libze_util_temporary_mount(ds_name, tmpdir_template) != LIBZE_ERROR_SUCCESS) {
+        (void) rmdir(tmpdir_template);
+        return libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN, "Failed to mount %s to %s\n", ds_name,
+                               tmpdir_template);
     }
+    libze_mnttab_invalidate(lzeh);
 
-    if (zfs_mount(be_zh, NULL, 0) != 0) {
-        ret = libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN, "Failed to mount %s to %s\n", ds_name,
-                              tmpdir_template);
-        goto err;
+    libze_error ret = mount_children(lzeh, be_zh, tmpdir_template, NULL);
+    if (ret != LIBZE_ERROR_SUCCESS) {
+        // Retain existing error
+        (void) temp_unmount_be(lzeh, tmpdir_template, be_zh);
+        return ret;
     }
 
-    return ret;
-
-err:
-    // Retain existing error (ret)
-    (void) temp_unmount_be(lzeh, *tmp_dirname, be_zh);
-    return ret;
+    (void) strlcpy(tmp_dirname, tmpdir_template, LIBZE_MAX_PATH_LEN);
+    return LIBZE_ERROR_SUCCESS;
 }
 
-/********************************************************
- ************** libze initialize / destroy **************
- ********************************************************/
-
 /**
- * @brief Rep invariant check for initialized @p libze_handle
- * @param lzeh @p libze_handle to check
- * @return Non-zero if rep check fails, else zero
+ * @brief Get the mountpoint of a boot environment in the mount session of @p lzeh. If it isn't
+ *        part of the session yet, it is mounted with @p temp_mount_be and stays mounted until
+ *        @p libze_fini, so all hooks run on it by this handle share a single mount.
+ *
+ * @param[in,out] lzeh        libze handle
+ * @param[in] be_name         Boot environment name
+ * @param[in] be_zh           Handle to be
+ * @param[out] mountpoint     Directory the be is mounted to
+ *
+ * @return @p LIBZE_ERROR_SUCCESS on success
  */
-static int
-libze_handle_rep_check_init(libze_handle *lzeh) {
-    int ret = 0;
-    char check_failure[LIBZE_MAX_ERROR_LEN] = "ERROR - libze_handle RI:\n";
+static libze_error
+mount_session_get(libze_handle *lzeh, char const be_name[static 1], zfs_handle_t *be_zh,
+                  char mountpoint[LIBZE_MAX_PATH_LEN]) {
+    const char *session_mountpoint = NULL;
 
-    if (lzeh == NULL) {
-        fprintf(stderr, "ERROR - libze_handle RI: libze_handle isn't initialized\n");
-        return -1;
+    if ((lzeh->mount_sessions != NULL) &&
+        (nvlist_lookup_string(lzeh->mount_sessions, be_name, &session_mountpoint) == 0)) {
+        (void) strlcpy(mountpoint, session_mountpoint, LIBZE_MAX_PATH_LEN);
+        return LIBZE_ERROR_SUCCESS;
     }
 
-    if ((lzeh->lzh == NULL) || (lzeh->pool_zhdl == NULL) || ((lzeh->ze_props == NULL))) {
-        (void) strlcat(check_failure, "A handle isn't initialized\n", LIBZE_MAX_ERROR_LEN);
-        ret++;
-    }
-    if (!((strlen(lzeh->env_root) >= 1) && (strlen(lzeh->env_running_path) >= 3) &&
-          (strlen(lzeh->env_running) >= 1) && (strlen(lzeh->env_activated_path) >= 3) &&
-          (strlen(lzeh->env_activated) >= 1) && (strlen(lzeh->env_pool) >= 1))) {
-        (void) strlcat(check_failure, "Lengths of strings incorrect\n", LIBZE_MAX_ERROR_LEN);
-        ret++;
+    if ((lzeh->mount_sessions == NULL) && ((lzeh->mount_sessions = fnvlist_alloc()) == NULL)) {
+        return libze_error_nomem(lzeh);
     }
-    if ((lzeh->libze_error != LIBZE_ERROR_SUCCESS) || (strlen(lzeh->libze_error_message) != 0)) {
-        (void) strlcat(check_failure, "Errors not cleared\n", LIBZE_MAX_ERROR_LEN);
-        ret++;
+
+    libze_error ret = temp_mount_be(lzeh, be_name, be_zh, mountpoint);
+    if (ret != LIBZE_ERROR_SUCCESS) {
+        return ret;
     }
 
-    if (ret != 0) {
-        (void) libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN, check_failure);
+    if (nvlist_add_string(lzeh->mount_sessions, be_name, mountpoint) != 0) {
+        (void) temp_unmount_be(lzeh, mountpoint, be_zh);
+        return libze_error_nomem(lzeh);
     }
 
-    return ret;
+    return LIBZE_ERROR_SUCCESS;
 }
 
 /**
- * @brief Check if a bootpool is set, if it is, set @p lzeh->bootpool
- * @param lzeh Initialized @p libze_handle
- * @return @p LIBZE_ERROR_SUCCESS if no boot pool set, or if boot pool dataset set successfully.
- *         @p LIBZE_ERROR_MAXPATHLEN if requested boot pool is too long.
- *         @p LIBZE_ERROR_ZFS_OPEN if @p lzeh->bootpool.pool_zhdl can't be opened,
- *         @p LIBZE_ERROR_MAXPATHLEN if @p bootpool too long
+ * @brief Unmount a boot environment mounted by @p mount_session_get and remove it from the
+ *        mount session of @p lzeh. Nothing is done if it isn't part of the session.
+ *
+ * @param[in,out] lzeh        libze handle
+ * @param[in] be_name         Boot environment name
+ *
+ * @return @p LIBZE_ERROR_SUCCESS on success
  */
-libze_error
-libze_boot_pool_set(libze_handle *lzeh) {
-    libze_error ret = LIBZE_ERROR_SUCCESS;
+static libze_error
+mount_session_drop(libze_handle *lzeh, char const be_name[static 1]) {
+    const char *mountpoint = NULL;
+    char be_ds[ZFS_MAX_DATASET_NAME_LEN] = "";
 
-    zfs_handle_t *zph_activated = NULL;
-    zfs_handle_t *zph_running = NULL;
+    if ((lzeh->mount_sessions == NULL) ||
+        (nvlist_lookup_string(lzeh->mount_sessions, be_name, &mountpoint) != 0)) {
+        return LIBZE_ERROR_SUCCESS;
+    }
 
-    // NOTE constant string
-    char bpool_root_path[ZFS_MAX_DATASET_NAME_LEN] = "";
-    if ((ret = libze_be_prop_get(lzeh, bpool_root_path, "bootpoolroot", ZE_PROP_NAMESPACE)) !=
+    if (libze_util_concat(lzeh->env_root, "/", be_name, ZFS_MAX_DATASET_NAME_LEN, be_ds) !=
         LIBZE_ERROR_SUCCESS) {
-        return ret;
+        return libze_error_set(lzeh, LIBZE_ERROR_MAXPATHLEN,
+                               "Boot environment dataset (%s/%s) exceeds max length (%d).\n",
+                               lzeh->env_root, be_name, ZFS_MAX_DATASET_NAME_LEN);
     }
-    char boot_prefix[ZFS_MAX_DATASET_NAME_LEN] = "";
-    if ((ret = libze_be_prop_get(lzeh, boot_prefix, "bootpoolprefix", ZE_PROP_NAMESPACE)) !=
-        LIBZE_ERROR_SUCCESS) {
-        return ret;
+
+    if (unmount_dataset(lzeh, be_ds, B_FALSE) != LIBZE_ERROR_SUCCESS) {
+        return libze_error_prepend(lzeh, LIBZE_ERROR_UNKNOWN, "Failed to unmount %s\n",
+                                   mountpoint);
+    }
+
+    (void) rmdir(mountpoint);
+    fnvlist_remove(lzeh->mount_sessions, be_name);
+    return LIBZE_ERROR_SUCCESS;
+}
+
+/**
+ * @brief Unmount all boot environments in the mount session of @p lzeh. Mounts which fail to
+ *        unmount are left in place, since there is nobody left to report the error to.
+ * @param[in,out] lzeh libze handle
+ */
+static void
+mount_sessions_release(libze_handle *lzeh) {
+    if (lzeh->mount_sessions == NULL) {
+        return;
+    }
+
+    nvpair_t *pair = NULL;
+    while ((pair = nvlist_next_nvpair(lzeh->mount_sessions, NULL)) != NULL) {
+        if (mount_session_drop(lzeh, nvpair_name(pair)) != LIBZE_ERROR_SUCCESS) {
+            fnvlist_remove_nvpair(lzeh->mount_sessions, pair);
+        }
+    }
+
+    fnvlist_free(lzeh->mount_sessions);
+    lzeh->mount_sessions = NULL;
+}
+
+/**
+ * @brief Get the mountpoint of a boot environment, mounting it if needed. The boot environment
+ *        stays mounted until @p lzeh is closed with @p libze_fini, repeated calls for the same
+ *        boot environment reuse the mount. Intended for plugin hooks.
+ * @param[in] lzeh Initialized lzeh libze handle
+ * @param[in] boot_environment Boot environment to mount
+ * @param[out] mountpoint_buffer Mountpoint of the boot environment
+ * @return @p LIBZE_ERROR_SUCCESS on success
+ */
+libze_error
+libze_mount_session_get(libze_handle *lzeh, char const boot_environment[static 1],
+                        char mountpoint_buffer[LIBZE_MAX_PATH_LEN]) {
+    zfs_handle_t *be_zh = NULL;
+
+    if (open_boot_environment(lzeh, boot_environment, &be_zh, NULL, NULL, NULL) !=
+        LIBZE_ERROR_SUCCESS) {
+        return libze_error_prepend(lzeh, lzeh->libze_error,
+                                   "Failed to open boot environment (%s) for mount!\n",
+                                   boot_environment);
+    }
+
+    libze_error ret = mount_session_get(lzeh, boot_environment, be_zh, mountpoint_buffer);
+    zfs_close(be_zh);
+    return ret;
+}
+
+/********************************************************
+ ************** libze initialize / destroy **************
+ ********************************************************/
+
+/**
+ * @brief Rep invariant check for initialized @p libze_handle
+ * @param lzeh @p libze_handle to check
+ * @return Non-zero if rep check fails, else zero
+ */
+static int
+libze_handle_rep_check_init(libze_handle *lzeh) {
+    int ret = 0;
+    char check_failure[LIBZE_MAX_ERROR_LEN] = "ERROR - libze_handle RI:\n";
+
+    if (lzeh == NULL) {
+        fprintf(stderr, "ERROR - libze_handle RI: libze_handle isn't initialized\n");
+        return -1;
+    }
+
+    if ((lzeh->lzh == NULL) || (lzeh->pool_zhdl == NULL) || ((lzeh->ze_props == NULL))) {
+        (void) strlcat(check_failure, "A handle isn't initialized\n", LIBZE_MAX_ERROR_LEN);
+        ret++;
+    }
+    if (!((strlen(lzeh->env_root) >= 1) && (strlen(lzeh->env_running_path) >= 3) &&
+          (strlen(lzeh->env_running) >= 1) && (strlen(lzeh->env_activated_path) >= 3) &&
+          (strlen(lzeh->env_activated) >= 1) && (strlen(lzeh->env_pool) >= 1))) {
+        (void) strlcat(check_failure, "Lengths of strings incorrect\n", LIBZE_MAX_ERROR_LEN);
+        ret++;
+    }
+    if ((lzeh->libze_error != LIBZE_ERROR_SUCCESS) || (strlen(lzeh->libze_error_message) != 0)) {
+        (void) strlcat(check_failure, "Errors not cleared\n", LIBZE_MAX_ERROR_LEN);
+        ret++;
+    }
+
+    if (ret != 0) {
+        (void) libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN, check_failure);
+    }
+
+    return ret;
+}
+
+/**
+ * @brief Check if a bootpool is set, if it is, set @p lzeh->bootpool
+ * @param lzeh Initialized @p libze_handle
+ * @return @p LIBZE_ERROR_SUCCESS if no boot pool set, or if boot pool dataset set successfully.
+ *         @p LIBZE_ERROR_MAXPATHLEN if requested boot pool is too long.
+ *         @p LIBZE_ERROR_ZFS_OPEN if @p lzeh->bootpool.pool_zhdl can't be opened,
+ *         @p LIBZE_ERROR_MAXPATHLEN if @p bootpool too long
+ */
+libze_error
+libze_boot_pool_set(libze_handle *lzeh) {
+    libze_error ret = LIBZE_ERROR_SUCCESS;
+
+    zfs_handle_t *zph_activated = NULL;
+    zfs_handle_t *zph_running = NULL;
+
+    // NOTE constant string
+    char const *bpool_root_path = libze_prop_value(lzeh, LIBZE_PROP_BOOTPOOLROOT);
+    if (bpool_root_path == NULL) {
+        return lzeh->libze_error;
+    }
+    char const *boot_prefix = libze_prop_value(lzeh, LIBZE_PROP_BOOTPOOLPREFIX);
+    if (boot_prefix == NULL) {
+        return lzeh->libze_error;
     }
 
     if (strlen(bpool_root_path) == 0) {
@@ -1109,6 +1958,50 @@ libze_validate_system(libze_handle *lzeh) {
     return LIBZE_ERROR_SUCCESS;
 }
 
+/**
+ * @brief Resolve the facets of @p lzeh in @p facets which haven't been resolved yet, in the order
+ *        plugin, boot pool, validation. Each facet is only resolved once, including a plugin
+ *        which doesn't exist, so this can be called again after handling that error.
+ * @param lzeh Initialized @p libze_handle
+ * @param facets @p libze_facet flags of the required facets
+ * @return @p LIBZE_ERROR_SUCCESS on success,
+ *         @p LIBZE_ERROR_PLUGIN_EEXIST if the bootloader plugin doesn't exist, without
+ *         resolving the remaining facets,
+ *         or the error of @p libze_bootloader_set, @p libze_boot_pool_set or
+ *         @p libze_validate_system
+ */
+libze_error
+libze_facets_require(libze_handle *lzeh, unsigned int facets) {
+    libze_error ret = LIBZE_ERROR_SUCCESS;
+    unsigned int missing = facets & ~lzeh->facets;
+
+    if (missing & LIBZE_FACET_PLUGIN) {
+        ret = libze_bootloader_set(lzeh);
+        if ((ret == LIBZE_ERROR_SUCCESS) || (ret == LIBZE_ERROR_PLUGIN_EEXIST)) {
+            lzeh->facets |= LIBZE_FACET_PLUGIN;
+        }
+        if (ret != LIBZE_ERROR_SUCCESS) {
+            return ret;
+        }
+    }
+
+    if (missing & LIBZE_FACET_BOOTPOOL) {
+        if ((ret = libze_boot_pool_set(lzeh)) != LIBZE_ERROR_SUCCESS) {
+            return ret;
+        }
+        lzeh->facets |= LIBZE_FACET_BOOTPOOL;
+    }
+
+    if (missing & LIBZE_FACET_VALIDATED) {
+        if ((ret = libze_validate_system(lzeh)) != LIBZE_ERROR_SUCCESS) {
+            return ret;
+        }
+        lzeh->facets |= LIBZE_FACET_VALIDATED;
+    }
+
+    return ret;
+}
+
 /**
  * @brief Initialize libze handle.
  * @return Initialized handle, or NULL if unsuccessful.
@@ -1172,10 +2065,15 @@ libze_init(void) {
         goto err;
     }
 
-    // Clear bootloader
+    if (prop_index_build(lzeh) != LIBZE_ERROR_SUCCESS) {
+        goto err;
+    }
+
+    // Clear bootloader and bootpool facets, they are resolved on demand
+    lzeh->facets = LIBZE_FACET_NONE;
     lzeh->lz_funcs = NULL;
 
-    // Clear bootpool, initialization is done later
+    // Clear bootpool, initialization is done by libze_facets_require
     lzeh->bootpool.pool_zhdl = NULL;
     (void) strlcpy(lzeh->bootpool.zpool_name, "", ZFS_MAX_DATASET_NAME_LEN);
     (void) strlcpy(lzeh->bootpool.root_path, "", ZFS_MAX_DATASET_NAME_LEN);
@@ -1197,6 +2095,82 @@ err:
     return NULL;
 }
 
+/**
+ * @brief Read the activated boot environment and the properties of @p lzeh again, as they may
+ *        have changed outside of the handle since it was initialized. The activated boot
+ *        environment is validated again when required.
+ * @param[in,out] lzeh Initialized lzeh libze handle
+ * @param[out] facets_stale Set if a property the plugin or bootpool were resolved from changed,
+ *             @p lzeh must be initialized again before requiring them
+ * @return @p LIBZE_ERROR_SUCCESS on success, or the error of reading the pool or properties
+ */
+libze_error
+libze_refresh(libze_handle *lzeh, boolean_t *facets_stale) {
+    libze_prop const facet_props[] = {LIBZE_PROP_BOOTLOADER, LIBZE_PROP_BOOTPOOLROOT,
+                                      LIBZE_PROP_BOOTPOOLPREFIX};
+    size_t const num_facet_props = sizeof(facet_props) / sizeof(facet_props[0]);
+    char facet_values[sizeof(facet_props) / sizeof(facet_props[0])][ZFS_MAXPROPLEN];
+    char activated_path[ZFS_MAX_DATASET_NAME_LEN] = "";
+    char activated[ZFS_MAX_DATASET_NAME_LEN] = "";
+    nvlist_t *props = NULL;
+
+    *facets_stale = B_FALSE;
+
+    for (size_t i = 0; i < num_facet_props; i++) {
+        char const *value = libze_prop_value(lzeh, facet_props[i]);
+        if (value == NULL) {
+            return lzeh->libze_error;
+        }
+        (void) strlcpy(facet_values[i], value, ZFS_MAXPROPLEN);
+    }
+
+    // Pool properties are cached in the pool handle
+    zpool_handle_t *pool_zhdl = zpool_open(lzeh->lzh, lzeh->env_pool);
+    if (pool_zhdl == NULL) {
+        return libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN, "Failed to open pool (%s).\n",
+                               lzeh->env_pool);
+    }
+
+    if ((zpool_get_prop(pool_zhdl, ZPOOL_PROP_BOOTFS, activated_path, sizeof(activated_path),
+                        NULL, B_TRUE) != 0) ||
+        (libze_boot_env_name(activated_path, ZFS_MAX_DATASET_NAME_LEN, activated) != 0)) {
+        zpool_close(pool_zhdl);
+        return libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN,
+                               "Failed to get the activated boot environment of (%s).\n",
+                               lzeh->env_pool);
+    }
+
+    if (libze_be_props_get(lzeh, &props, ZE_PROP_NAMESPACE) != LIBZE_ERROR_SUCCESS) {
+        zpool_close(pool_zhdl);
+        return lzeh->libze_error;
+    }
+
+    zpool_close(lzeh->pool_zhdl);
+    lzeh->pool_zhdl = pool_zhdl;
+
+    if (strcmp(lzeh->env_activated_path, activated_path) != 0) {
+        (void) strlcpy(lzeh->env_activated_path, activated_path, ZFS_MAX_DATASET_NAME_LEN);
+        (void) strlcpy(lzeh->env_activated, activated, ZFS_MAX_DATASET_NAME_LEN);
+        lzeh->facets &= ~LIBZE_FACET_VALIDATED;
+    }
+
+    prop_index_invalidate(lzeh);
+    fnvlist_free(lzeh->ze_props);
+    lzeh->ze_props = props;
+
+    for (size_t i = 0; i < num_facet_props; i++) {
+        char const *value = libze_prop_value(lzeh, facet_props[i]);
+        if (value == NULL) {
+            return lzeh->libze_error;
+        }
+        if (strcmp(facet_values[i], value) != 0) {
+            *facets_stale = (lzeh->facets & (LIBZE_FACET_PLUGIN | LIBZE_FACET_BOOTPOOL)) != 0;
+        }
+    }
+
+    return LIBZE_ERROR_SUCCESS;
+}
+
 /**
  * @brief @p libze_handle cleanup.
  * @param lzeh @p libze_handle to de-allocate and close resources on.
@@ -1204,7 +2178,8 @@ err:
  * @post @p lzeh->lzh is closed
  * @post @p lzeh->pool_zhdl is closed
  * @post @p lzeh->bootpool.pool_zhdl is closed
- * @post @p lzeh->ze_props is free'd
+ * @post @p lzeh->ze_props, @p lzeh->ze_default_props and @p lzeh->prop_index are free'd
+ * @post @p lzeh->mnttab and @p lzeh->mnttab_datasets are free'd
  * @post @p lzeh is free'd
  */
 void
@@ -1213,6 +2188,9 @@ libze_fini(libze_handle *lzeh) {
         return;
     }
 
+    // Mounts of the session are released with the handle
+    mount_sessions_release(lzeh);
+
     if (lzeh->lzh != NULL) {
         libzfs_fini(lzeh->lzh);
         lzeh->lzh = NULL;
@@ -1223,11 +2201,19 @@ libze_fini(libze_handle *lzeh) {
         lzeh->pool_zhdl = NULL;
     }
 
+    prop_index_invalidate(lzeh);
+    libze_mnttab_invalidate(lzeh);
+
     if (lzeh->ze_props != NULL) {
         fnvlist_free(lzeh->ze_props);
         lzeh->ze_props = NULL;
     }
 
+    if (lzeh->ze_default_props != NULL) {
+        fnvlist_free(lzeh->ze_default_props);
+        lzeh->ze_default_props = NULL;
+    }
+
     // Cleanup bootloader
     if (lzeh->bootpool.pool_zhdl != NULL) {
         zpool_close(lzeh->bootpool.pool_zhdl);
@@ -1273,955 +2259,2308 @@ libze_set(libze_handle *lzeh, nvlist_t *properties) {
     return libze_dataset_set(lzeh, lzeh->env_root, properties);
 }
 
-/**************************************
- ************** activate **************
- **************************************/
-
-typedef struct libze_activate_cbdata {
-    libze_handle *lzeh;
-} libze_activate_cbdata;
-
 /**
- * @brief Callback run for ever sub dataset of @p zhdl
- * @param[in] zhdl Initialed @p zfs_handle_t to recurse based on.
- * @param[in,out] data @p libze_activate_cbdata to activate based on.
- * @return Non zero on failure.
- *
- * @pre zhdl != NULL
- * @pre data != NULL
+ * @brief Set a list of properties locally on a boot environment, overriding the properties
+ *        inherited from @p lzeh->env_root
+ * @param[in] lzeh Initialized lzeh libze handle
+ * @param[in] boot_environment Boot environment whose properties are to be updated
+ * @param[in] properties List of ZFS properties to set
+ * @return @p LIBZE_ERROR_SUCCESS on success,
+ *         @p LIBZE_ERROR_EEXIST if @p boot_environment doesn't exist,
+ *         @p LIBZE_ERROR_ZFS_OPEN if failure to open @p boot_environment,
+ *         @p LIBZE_ERROR_UNKNOWN if failure to set properties
  */
-static int
-libze_activate_cb(zfs_handle_t *zhdl, void *data) {
-    char buf[ZFS_MAXPROPLEN];
-    libze_activate_cbdata *cbd = data;
+libze_error
+libze_be_set(libze_handle *lzeh, char const boot_environment[static 1], nvlist_t *properties) {
+    libze_error ret = LIBZE_ERROR_SUCCESS;
+    char be_ds[ZFS_MAX_DATASET_NAME_LEN] = "";
 
-    if (zfs_prop_set(zhdl, "canmount", "noauto") != 0) {
-        return libze_error_set(cbd->lzeh, LIBZE_ERROR_UNKNOWN,
-                               "Failed setting canmount=noauto for %s\n", zfs_get_name(zhdl));
+    if ((ret = validate_existing_be(lzeh, boot_environment, be_ds, NULL)) !=
+        LIBZE_ERROR_SUCCESS) {
+        return ret;
     }
 
-    // Check if clone
-    if (zfs_prop_get(zhdl, ZFS_PROP_ORIGIN, buf, ZFS_MAXPROPLEN, NULL, NULL, 0, 1) != 0) {
-        // Not a clone, continue
-        return 0;
-    }
+    return libze_dataset_set(lzeh, be_ds, properties);
+}
 
-    if (zfs_promote(zhdl) != 0) {
-        return libze_error_set(cbd->lzeh, LIBZE_ERROR_UNKNOWN, "Failed promoting %s\n",
-                               zfs_get_name(zhdl));
-    }
+/* Set every property in args.properties on every dataset in args.datasets within a single
+ * transaction. All changes are checked before any are made, so no dataset is left behind. */
+static char const *const set_bulk_program =
+    "if zfs.check.set_prop == nil or zfs.sync.set_prop == nil then\n"
+    "    error(\"" ZCP_UNSUPPORTED "\")\n"
+    "end\n"
+    "args = ...\n"
+    "datasets = args[\"datasets\"]\n"
+    "properties = args[\"properties\"]\n"
+    "for _, ds in ipairs(datasets) do\n"
+    "    for prop, value in pairs(properties) do\n"
+    "        err = zfs.check.set_prop(ds, prop, value)\n"
+    "        if err ~= 0 then\n"
+    "            error(\"cannot set \" .. prop .. \" on \" .. ds .. \": \" .. err)\n"
+    "        end\n"
+    "    end\n"
+    "end\n"
+    "for _, ds in ipairs(datasets) do\n"
+    "    for prop, value in pairs(properties) do\n"
+    "        err = zfs.sync.set_prop(ds, prop, value)\n"
+    "        if err ~= 0 then\n"
+    "            error(\"failed setting \" .. prop .. \" on \" .. ds .. \": \" .. err)\n"
+    "        end\n"
+    "    end\n"
+    "end\n";
+
+typedef struct set_bulk_cbdata {
+    libze_handle *lzeh;
+    libze_set_options *options;
+    /**< Names of datasets to set the properties on */
+    nvlist_t *datasets;
+} set_bulk_cbdata;
 
-    if (zfs_iter_filesystems(zhdl, libze_activate_cb, cbd) != 0) {
-        return -1;
+/**
+ * @brief Callback run on every child of a matching boot environment, recording its name
+ * @param[in] zhdl Initialized zfs handle for dataset being iterated
+ * @param[in,out] data Callback data, @p set_bulk_cbdata
+ * @return Non-zero on failure
+ */
+static int
+set_bulk_children_cb(zfs_handle_t *zhdl, void *data) {
+    set_bulk_cbdata *cbd = data;
+    int ret = 0;
+
+    if (nvlist_add_boolean(cbd->datasets, zfs_get_name(zhdl)) != 0) {
+        ret = libze_error_nomem(cbd->lzeh);
+    } else {
+        ret = zfs_iter_filesystems(zhdl, set_bulk_children_cb, cbd);
     }
 
-    return 0;
+    zfs_close(zhdl);
+    return ret;
 }
 
 /**
- * @brief Function run mid-activate, execute plugin if it exists.
- * @param[in] lzeh Initialized @p libze_handle
- * @param[in] options Options to set properties based on
- * @param[in] be_zh Initialized @p zfs_handle_t to run mid activate upon
- * @return @p LIBZE_ERROR_SUCCESS on success,
- *         @p LIBZE_ERROR_UNKNOWN, or @p LIBZE_ERROR_PLUGIN on failure.
- *
- * @pre lzeh != NULL
- * @pre be_zh != NULL
- * @pre options != NULL
- * @post if be_zh != root dataset, be_zh unmounted on exit
+ * @brief Callback run on every boot environment, recording its name if it matches
+ *        @p cbd->options->pattern, and the names of its children if requested
+ * @param[in] zhdl Initialized zfs handle for boot environment being iterated
+ * @param[in,out] data Callback data, @p set_bulk_cbdata
+ * @return Non-zero on failure
  */
-static libze_error
-mid_activate(libze_handle *lzeh, libze_activate_options *options, zfs_handle_t *be_zh) {
-    libze_error ret = LIBZE_ERROR_SUCCESS;
-    char *tmp_dirname = "/";
-    char const *ds_name = zfs_get_name(be_zh);
-    boolean_t is_root = libze_is_root_be(lzeh, ds_name);
+static int
+set_bulk_cb(zfs_handle_t *zhdl, void *data) {
+    set_bulk_cbdata *cbd = data;
+    int ret = 0;
 
-    // mid_activate
-    if ((lzeh->lz_funcs != NULL)) {
-        /* Only temp mount if we are running hook */
-        if (!is_root) {
-            ret = temp_mount_be(lzeh, options->be_name, be_zh, &tmp_dirname);
-            if (ret != LIBZE_ERROR_SUCCESS) {
-                goto err;
-            }
-        }
+    char be_name[ZFS_MAX_DATASET_NAME_LEN] = "";
+    if (libze_boot_env_name(zfs_get_name(zhdl), ZFS_MAX_DATASET_NAME_LEN, be_name) != 0) {
+        ret = libze_error_set(cbd->lzeh, LIBZE_ERROR_UNKNOWN,
+                              "Failed to get boot environment name of %s.\n",
+                              zfs_get_name(zhdl));
+        goto done;
+    }
 
-        libze_activate_data activate_data = {.be_name = options->be_name,
-                                             .be_mountpoint = tmp_dirname};
+    if ((cbd->options->pattern != NULL) && (fnmatch(cbd->options->pattern, be_name, 0) != 0)) {
+        goto done;
+    }
 
-        if (lzeh->lz_funcs->plugin_mid_activate(lzeh, &activate_data) != 0) {
-            ret = libze_error_set(lzeh, LIBZE_ERROR_PLUGIN, "Failed to run mid-activate hook\n");
-            goto err;
-        }
+    if (nvlist_add_boolean(cbd->datasets, zfs_get_name(zhdl)) != 0) {
+        ret = libze_error_nomem(cbd->lzeh);
+        goto done;
     }
 
-err:
-    if (!is_root) {
-        ret = (ret == LIBZE_ERROR_SUCCESS) ? temp_unmount_be(lzeh, tmp_dirname, be_zh) : ret;
+    if (cbd->options->recursive) {
+        ret = zfs_iter_filesystems(zhdl, set_bulk_children_cb, cbd);
     }
 
+done:
+    zfs_close(zhdl);
     return ret;
 }
 
 /**
- * @brief Based on @p options, activate a boot environment
+ * @brief Set a list of properties locally on every boot environment matching
+ *        @p options->pattern. The properties are set in a single transaction with a channel
+ *        program, only if channel programs are unavailable fall back to setting them on each
+ *        dataset separately.
  * @param[in] lzeh Initialized lzeh libze handle
- * @param options The options based on which the boot environment is activated
- * @return LIBZE_ERROR_SUCCESS on success,
- *         or LIBZE_ERROR_EEXIST, LIBZE_ERROR_PLUGIN, LIBZE_ERROR_ZFS_OPEN,
- *         LIBZE_ERROR_UNKNOWN
+ * @param[in] options Boot environments to set the properties on
+ * @param[in] properties List of ZFS user properties to set
+ * @return @p LIBZE_ERROR_SUCCESS on success,
+ *         @p LIBZE_ERROR_EEXIST if no boot environment matches,
+ *         @p LIBZE_ERROR_ZFS_OPEN, @p LIBZE_ERROR_NOMEM or @p LIBZE_ERROR_UNKNOWN on failure
  */
 libze_error
-libze_activate(libze_handle *lzeh, libze_activate_options *options) {
+libze_be_set_bulk(libze_handle *lzeh, libze_set_options *options, nvlist_t *properties) {
     libze_error ret = LIBZE_ERROR_SUCCESS;
-    zfs_handle_t *be_zh = NULL, *be_bpool_zh = NULL;
-    char be_ds[ZFS_MAX_DATASET_NAME_LEN] = "";
+    char const **datasets = NULL;
+    nvlist_t *args = NULL;
+    nvpair_t *pair = NULL;
+    uint_t num_datasets = 0;
+    set_bulk_cbdata cbd = {.lzeh = lzeh, .options = options, .datasets = NULL};
 
-    if (open_boot_environment(lzeh, options->be_name, &be_zh, be_ds, &be_bpool_zh, NULL) !=
-        LIBZE_ERROR_SUCCESS) {
-        return libze_error_prepend(lzeh, lzeh->libze_error,
-                                   "Failed to open boot environment (%s) for activation!\n",
-                                   options->be_name);
+    zfs_handle_t *root_zh = zfs_open(lzeh->lzh, lzeh->env_root, ZFS_TYPE_FILESYSTEM);
+    if (root_zh == NULL) {
+        return libze_error_set(lzeh, LIBZE_ERROR_ZFS_OPEN, "Failed to open %s\n",
+                               lzeh->env_root);
     }
 
-    /* ZFS handle is open, on failure goto err */
-
-    /* Plugin - Pre Activate */
-    if ((lzeh->lz_funcs != NULL) && (lzeh->lz_funcs->plugin_pre_activate(lzeh) != 0)) {
-        ret = LIBZE_ERROR_PLUGIN;
+    if ((cbd.datasets = fnvlist_alloc()) == NULL) {
+        ret = libze_error_nomem(lzeh);
         goto err;
     }
 
-    if (mid_activate(lzeh, options, be_zh) != LIBZE_ERROR_SUCCESS) {
+    if (zfs_iter_filesystems(root_zh, set_bulk_cb, &cbd) != 0) {
+        // Error set in callback, unless iteration itself failed
+        ret = (lzeh->libze_error != LIBZE_ERROR_SUCCESS)
+                  ? lzeh->libze_error
+                  : libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN,
+                                    "Failed to iterate boot environments of %s.\n",
+                                    lzeh->env_root);
         goto err;
     }
 
-    if (zpool_set_prop(lzeh->pool_zhdl, "bootfs", be_ds) != 0) {
-        ret = libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN,
-                              "Failed to set the pool property 'bootfs=%s'.\n", be_ds);
-        goto err;
+    for (pair = nvlist_next_nvpair(cbd.datasets, NULL); pair != NULL;
+         pair = nvlist_next_nvpair(cbd.datasets, pair)) {
+        num_datasets++;
     }
 
-    libze_activate_cbdata cbd = {lzeh};
+    if (num_datasets == 0) {
+        ret = libze_error_set(lzeh, LIBZE_ERROR_EEXIST, "No boot environment matches %s.\n",
+                              (options->pattern != NULL) ? options->pattern : "*");
+        goto err;
+    }
 
-    // Set for top level dataset
-    if (libze_activate_cb(be_zh, &cbd) != 0) {
-        ret = LIBZE_ERROR_UNKNOWN;
+    datasets = calloc(num_datasets, sizeof(char const *));
+    args = fnvlist_alloc();
+    if ((datasets == NULL) || (args == NULL)) {
+        ret = libze_error_nomem(lzeh);
         goto err;
     }
 
-    if (be_bpool_zh != NULL) {
-        if (libze_activate_cb(be_bpool_zh, &cbd) != 0) {
-            ret = libze_error_set(
-                lzeh, LIBZE_ERROR_UNKNOWN,
-                "Failed to activate the requested boot environment on bootpool (%s).\n",
-                options->be_name);
-        }
+    uint_t i = 0;
+    for (pair = nvlist_next_nvpair(cbd.datasets, NULL); pair != NULL;
+         pair = nvlist_next_nvpair(cbd.datasets, pair)) {
+        datasets[i++] = nvpair_name(pair);
     }
 
-    /* Plugin - Post Activate */
-    if ((lzeh->lz_funcs != NULL) &&
-        (lzeh->lz_funcs->plugin_post_activate(lzeh, options->be_name) != 0)) {
+    if ((nvlist_add_string_array(args, "datasets", datasets, num_datasets) != 0) ||
+        (nvlist_add_nvlist(args, "properties", properties) != 0)) {
+        ret = libze_error_nomem(lzeh);
         goto err;
     }
 
-err:
-    zfs_close(be_zh);
-    if (be_bpool_zh != NULL) {
-        zfs_close(be_bpool_zh);
+    int cp_ret = channel_program_run(lzeh, lzeh->env_pool, set_bulk_program, args);
+    if (cp_ret == 0) {
+        goto err;
+    }
+    // The checks failed, setting individually would apply the change to some datasets only
+    if (cp_ret != ENOTSUP) {
+        ret = libze_error_prepend(lzeh, LIBZE_ERROR_UNKNOWN, "Failed to set properties.\n");
+        goto err;
+    }
+
+    DEBUG_PRINT("Channel programs unavailable on %s, setting individually", lzeh->env_pool);
+
+    for (i = 0; i < num_datasets; i++) {
+        if ((ret = libze_dataset_set(lzeh, datasets[i], properties)) != LIBZE_ERROR_SUCCESS) {
+            goto err;
+        }
     }
+
+err:
+    nvlist_free(args);
+    free(datasets);
+    nvlist_free(cbd.datasets);
+    zfs_close(root_zh);
     return ret;
 }
 
-/**********************************************
- ************** clone and create **************
- **********************************************/
+/**************************************
+ ************** activate **************
+ **************************************/
 
-typedef struct libze_clone_prop_cbdata {
+typedef struct libze_activate_cbdata {
     libze_handle *lzeh;
-    zfs_handle_t *zhp;
-    nvlist_t *props;
-} libze_clone_prop_cbdata_t;
+    /**< Names of datasets which require canmount=noauto to be set */
+    nvlist_t *canmount;
+    /**< Names of clones to promote, in the order they were visited */
+    nvlist_t *promote;
+} libze_activate_cbdata;
+
+/* Promote every dataset in args.datasets within a single transaction. All promotions are checked
+ * before any are performed, so the tree is never left partially promoted. */
+static char const *const activate_promote_program =
+    "if zfs.check.promote == nil or zfs.sync.promote == nil then\n"
+    "    error(\"" ZCP_UNSUPPORTED "\")\n"
+    "end\n"
+    "args = ...\n"
+    "datasets = args[\"datasets\"]\n"
+    "for _, ds in ipairs(datasets) do\n"
+    "    err = zfs.check.promote(ds)\n"
+    "    if err ~= 0 then\n"
+    "        error(\"cannot promote \" .. ds .. \": \" .. err)\n"
+    "    end\n"
+    "end\n"
+    "for _, ds in ipairs(datasets) do\n"
+    "    err = zfs.sync.promote(ds)\n"
+    "    if err ~= 0 then\n"
+    "        error(\"failed promoting \" .. ds .. \": \" .. err)\n"
+    "    end\n"
+    "end\n";
+
+// Trivial channel program, only fails if channel programs cannot run at all
+static char const probe_program[] = "return 0\n";
 
 /**
- * @brief Callback to run on each property
- * @param prop Current property
- * @param[in,out] data Initialized @p libze_clone_prop_cbdata_t to save props into.
- * @return @p ZPROP_CONT to continue iterating.
+ * @brief Check whether channel programs can run on @p pool by running @p probe_program
+ * @param[in] pool Pool to run the probe on
+ * @return @p B_TRUE if the probe succeeded
+ */
+static boolean_t
+channel_program_supported(char const pool[static 1]) {
+    nvlist_t *outnvl = NULL;
+    nvlist_t *args = fnvlist_alloc();
+    int ret = lzc_channel_program(pool, probe_program, ZCP_DEFAULT_INSTRLIMIT,
+                                  ZCP_DEFAULT_MEMLIMIT, args, &outnvl);
+    nvlist_free(outnvl);
+    fnvlist_free(args);
+    return ret == 0;
+}
+
+/**
+ * @brief Run a channel program synchronously on @p pool
+ * @param[in,out] lzeh Initialized lzeh libze handle
+ * @param[in] pool Pool to run @p program on
+ * @param[in] program Lua source of channel program
+ * @param[in] args Arguments passed to @p program
+ * @return 0 on success,
+ *         @p ENOTSUP if channel programs, or the functions @p program uses, are unavailable,
+ *         otherwise the error of @p program, with the error and Lua error message set in
+ *         @p lzeh. Only @p ENOTSUP may be retried without a channel program, after any other
+ *         error the checks of @p program failed and nothing should be modified.
+ *
+ * Unsupported is only reported for @p ENOTSUP, @p ENOSYS, the @p ZCP_UNSUPPORTED error raised
+ * by @p program, or an @p EINVAL without a Lua message when @p probe_program fails as well.
  */
 static int
-clone_prop_cb(int prop, void *data) {
-    libze_clone_prop_cbdata_t *pcbd = data;
+channel_program_run(libze_handle *lzeh, char const pool[static 1], char const program[static 1],
+                    nvlist_t *args) {
+    nvlist_t *outnvl = NULL;
+    char const *message = NULL;
+    int ret = lzc_channel_program(pool, program, ZCP_DEFAULT_INSTRLIMIT, ZCP_DEFAULT_MEMLIMIT,
+                                  args, &outnvl);
+    if (ret == 0) {
+        goto done;
+    }
+
+    if (outnvl != NULL) {
+        (void) nvlist_lookup_string(outnvl, ZCP_OUTPUT_ERROR, &message);
+    }
+
+    /*
+     * Kernels without channel programs reject the ioctl before any program runs, older ones
+     * with EINVAL. An EINVAL can also come from the program itself, so only treat it as
+     * unsupported if a trivial program cannot run either.
+     */
+    if ((ret == ENOTSUP) || (ret == ENOSYS) ||
+        ((ret == ECHRNG) && (message != NULL) && (strstr(message, ZCP_UNSUPPORTED) != NULL)) ||
+        ((ret == EINVAL) && (message == NULL) && !channel_program_supported(pool))) {
+        ret = ENOTSUP;
+        goto done;
+    }
+
+    (void) libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN, "Channel program failed on %s: %s\n%s%s",
+                           pool, strerror(ret), (message != NULL) ? message : "",
+                           (message != NULL) ? "\n" : "");
+
+done:
+    nvlist_free(outnvl);
+    return ret;
+}
 
-    zprop_source_t src;
-    char propbuf[ZFS_MAXPROPLEN];
-    char statbuf[ZFS_MAXPROPLEN];
-    char const *prop_name;
+static int
+libze_activate_children_cb(zfs_handle_t *zhdl, void *data);
 
-    // Skip if readonly or canmount
-    if (zfs_prop_readonly(prop)) {
-        return ZPROP_CONT;
-    }
+/**
+ * @brief Callback run for ever sub dataset of @p zhdl, reads the current state of the dataset and
+ *        records the changes activation requires in @p data. Nothing is modified.
+ * @param[in] zhdl Initialed @p zfs_handle_t to recurse based on, left open.
+ * @param[in,out] data @p libze_activate_cbdata to activate based on.
+ * @return Non zero on failure.
+ *
+ * @pre zhdl != NULL
+ * @pre data != NULL
+ */
+static int
+libze_activate_cb(zfs_handle_t *zhdl, void *data) {
+    char buf[ZFS_MAXPROPLEN];
+    libze_activate_cbdata *cbd = data;
 
-    prop_name = zfs_prop_to_name(prop);
+    if (zfs_prop_get(zhdl, ZFS_PROP_CANMOUNT, buf, ZFS_MAXPROPLEN, NULL, NULL, 0, B_FALSE) != 0) {
+        return libze_error_set(cbd->lzeh, LIBZE_ERROR_UNKNOWN, "Failed getting canmount for %s\n",
+                               zfs_get_name(zhdl));
+    }
 
-    // Always set canmount=noauto
-    if (prop == ZFS_PROP_CANMOUNT) {
-        fnvlist_add_string(pcbd->props, prop_name, "noauto");
-        return ZPROP_CONT;
+    if ((strcmp(buf, "noauto") != 0) &&
+        (nvlist_add_boolean(cbd->canmount, zfs_get_name(zhdl)) != 0)) {
+        return libze_error_nomem(cbd->lzeh);
     }
 
-    if (zfs_prop_get(pcbd->zhp, prop, propbuf, ZFS_MAXPROPLEN, &src, statbuf, ZFS_MAXPROPLEN,
-                     B_FALSE) != 0) {
-        return ZPROP_CONT;
+    // Check if clone
+    if (zfs_prop_get(zhdl, ZFS_PROP_ORIGIN, buf, ZFS_MAXPROPLEN, NULL, NULL, 0, 1) != 0) {
+        // Not a clone, continue
+        return 0;
     }
 
-    // Skip if not LOCAL and not RECEIVED
-    if ((src != ZPROP_SRC_LOCAL) && (src != ZPROP_SRC_RECEIVED)) {
-        return ZPROP_CONT;
+    if (nvlist_add_boolean(cbd->promote, zfs_get_name(zhdl)) != 0) {
+        return libze_error_nomem(cbd->lzeh);
     }
 
-    if (nvlist_add_string(pcbd->props, prop_name, propbuf) != 0) {
-        return ZPROP_CONT;
+    if (zfs_iter_filesystems(zhdl, libze_activate_children_cb, cbd) != 0) {
+        return -1;
     }
 
-    return ZPROP_CONT;
+    return 0;
 }
 
 /**
- * @brief Callback run recursively on a dataset
- * @param[in] zhdl Initialized @p zfs_handle_t representing current dataset
- * @param data Initialized @p libze_clone_cbdata to save properties into.
- * @return Non-zero on success.
+ * @brief Callback run by @p zfs_iter_filesystems on the children of a boot environment,
+ *        runs @p libze_activate_cb and closes the handle afterwards
+ * @param[in] zhdl Child dataset, closed on exit
+ * @param[in,out] data @p libze_activate_cbdata to activate based on.
+ * @return Non zero on failure.
  */
 static int
-libze_clone_cb(zfs_handle_t *zhdl, void *data) {
-    libze_clone_cbdata *cbd = data;
-    int ret = LIBZE_ERROR_SUCCESS;
-    nvlist_t *props = NULL;
-
-    if (((props = fnvlist_alloc()) == NULL)) {
-        return libze_error_nomem(cbd->lzeh);
-    }
-
-    libze_clone_prop_cbdata_t cb_data = {.lzeh = cbd->lzeh, .props = props, .zhp = zhdl};
-
-    // Iterate over all props
-    if (zprop_iter(clone_prop_cb, &cb_data, B_FALSE, B_FALSE, ZFS_TYPE_FILESYSTEM) == ZPROP_INVAL) {
-        ret = libze_error_set(cbd->lzeh, LIBZE_ERROR_UNKNOWN,
-                              "Failed to iterate over properties for top level dataset.\n");
-        goto err;
-    }
-
-    fnvlist_add_nvlist(*cbd->outnvl, zfs_get_name(zhdl), props);
+libze_activate_children_cb(zfs_handle_t *zhdl, void *data) {
+    int ret = libze_activate_cb(zhdl, data);
+    zfs_close(zhdl);
+    return ret;
+}
 
-    if (cbd->recursive) {
-        if (zfs_iter_filesystems(zhdl, libze_clone_cb, cbd) != 0) {
-            ret = libze_error_set(cbd->lzeh, LIBZE_ERROR_UNKNOWN,
-                                  "Failed to iterate over child datasets.\n");
-            goto err;
+/**
+ * @brief Set canmount=noauto on every dataset in @p canmount
+ * @param[in] lzeh Initialized @p libze_handle
+ * @param[in] canmount nvlist with the names of the datasets to modify
+ * @return @p LIBZE_ERROR_SUCCESS on success,
+ *         @p LIBZE_ERROR_ZFS_OPEN or @p LIBZE_ERROR_UNKNOWN on failure.
+ */
+static libze_error
+activate_canmount(libze_handle *lzeh, nvlist_t *canmount) {
+    for (nvpair_t *pair = nvlist_next_nvpair(canmount, NULL); pair != NULL;
+         pair = nvlist_next_nvpair(canmount, pair)) {
+        char const *ds = nvpair_name(pair);
+        zfs_handle_t *zh = zfs_open(lzeh->lzh, ds, ZFS_TYPE_FILESYSTEM);
+        if (zh == NULL) {
+            return libze_error_set(lzeh, LIBZE_ERROR_ZFS_OPEN, "Failed opening %s\n", ds);
         }
+        if (zfs_prop_set(zh, "canmount", "noauto") != 0) {
+            zfs_close(zh);
+            return libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN,
+                                   "Failed setting canmount=noauto for %s\n", ds);
+        }
+        zfs_close(zh);
     }
 
-    return ret;
-err:
-    fnvlist_free(props);
-    return ret;
+    return LIBZE_ERROR_SUCCESS;
 }
 
 /**
- * @brief Create a recursive clone from a snapshot given the dataset and snapshot separately.
- *        The snapshot suffix should be the same for all nested datasets.
- * @param lzeh Initialized libze handle
- * @param source_root Top level dataset for clone.
- * @param source_snap_suffix Snapshot name.
- * @param be Name for new boot environment
- * @param recursive Do recursive clone
+ * @brief Promote all clones in @p promote. The promotions are done in a single transaction
+ *        with a channel program, only if channel programs are unavailable fall back to
+ *        promoting each dataset separately.
+ * @param[in] lzeh Initialized @p libze_handle
+ * @param[in] pool Pool containing all datasets in @p promote
+ * @param[in] promote nvlist with the names of the datasets to promote
  * @return @p LIBZE_ERROR_SUCCESS on success,
- *         @p LIBZE_ERROR_ZFS_OPEN, @p LIBZE_ERROR_UNKNOWN,
- *         or @p LIBZE_ERROR_MAXPATHLEN on failure.
- *
- * @pre lzeh != NULL
- * @pre source_root != NULL
- * @pre source_snap_suffix != NULL
- * @pre be != NULL
+ *         @p LIBZE_ERROR_NOMEM, @p LIBZE_ERROR_ZFS_OPEN or @p LIBZE_ERROR_UNKNOWN on failure.
  */
-libze_error
-libze_clone(libze_handle *lzeh, char source_root[static 1], char source_snap_suffix[static 1],
-            char be[static 1], boolean_t recursive) {
+static libze_error
+activate_promote(libze_handle *lzeh, char const pool[static 1], nvlist_t *promote) {
     libze_error ret = LIBZE_ERROR_SUCCESS;
+    nvpair_t *pair = NULL;
+    uint_t num_datasets = 0;
 
-    nvlist_t *cdata = NULL;
-    if ((cdata = fnvlist_alloc()) == NULL) {
-        return libze_error_nomem(lzeh);
+    for (pair = nvlist_next_nvpair(promote, NULL); pair != NULL;
+         pair = nvlist_next_nvpair(promote, pair)) {
+        num_datasets++;
     }
 
-    // Get be root handle
-    zfs_handle_t *zroot_hdl = NULL;
-    if ((zroot_hdl = zfs_open(lzeh->lzh, source_root, ZFS_TYPE_FILESYSTEM)) == NULL) {
-        ret = libze_error_set(lzeh, LIBZE_ERROR_ZFS_OPEN, "Error opening %s", source_root);
+    if (num_datasets == 0) {
+        return LIBZE_ERROR_SUCCESS;
+    }
+
+    char const **datasets = calloc(num_datasets, sizeof(char const *));
+    nvlist_t *args = fnvlist_alloc();
+    if ((datasets == NULL) || (args == NULL)) {
+        ret = libze_error_nomem(lzeh);
         goto err;
     }
 
-    libze_clone_cbdata cbd = {.outnvl = &cdata, .lzeh = lzeh, .recursive = recursive};
+    uint_t i = 0;
+    for (pair = nvlist_next_nvpair(promote, NULL); pair != NULL;
+         pair = nvlist_next_nvpair(promote, pair)) {
+        datasets[i++] = nvpair_name(pair);
+    }
 
-    // Get properties for bootfs and under bootfs
-    if (libze_clone_cb(zroot_hdl, &cbd) != 0) {
-        // libze_clone_cb sets error message.
-        ret = LIBZE_ERROR_UNKNOWN;
+    if (nvlist_add_string_array(args, "datasets", datasets, num_datasets) != 0) {
+        ret = libze_error_nomem(lzeh);
         goto err;
     }
 
-    nvpair_t *pair = NULL;
-    for (pair = nvlist_next_nvpair(cdata, NULL); pair != NULL;
-         pair = nvlist_next_nvpair(cdata, pair)) {
-        nvlist_t *ds_props = NULL;
-        nvpair_value_nvlist(pair, &ds_props);
-
-        // Recursive clone
-        const char *ds_name = nvpair_name(pair);
-        char ds_snap_buf[ZFS_MAX_DATASET_NAME_LEN] = "";
-        char be_child_buf[ZFS_MAX_DATASET_NAME_LEN] = "";
-        char ds_child_buf[ZFS_MAX_DATASET_NAME_LEN] = "";
-        if (libze_util_suffix_after_string(source_root, ds_name, ZFS_MAX_DATASET_NAME_LEN,
-                                           be_child_buf) == 0) {
-            if (strlen(be_child_buf) > 0) {
-                if (libze_util_concat(be, be_child_buf, "/", ZFS_MAX_DATASET_NAME_LEN,
-                                      ds_child_buf) != LIBZE_ERROR_SUCCESS) {
-                    ret = libze_error_set(lzeh, LIBZE_ERROR_MAXPATHLEN,
-                                          "Requested child clone exceeds max length %d\n",
-                                          ZFS_MAX_DATASET_NAME_LEN);
-                    goto err;
-                }
-            } else {
-                // Child empty
-                if (strlcpy(ds_child_buf, be, ZFS_MAX_DATASET_NAME_LEN) >=
-                    ZFS_MAX_DATASET_NAME_LEN) {
-                    ret = libze_error_set(lzeh, LIBZE_ERROR_MAXPATHLEN, "No child clone found\n");
-                    goto err;
-                }
-            }
-        }
+    int cp_ret = channel_program_run(lzeh, pool, activate_promote_program, args);
+    if (cp_ret == 0) {
+        goto err;
+    }
+    // The checks failed, promoting individually would leave the tree partially promoted
+    if (cp_ret != ENOTSUP) {
+        ret = libze_error_prepend(lzeh, LIBZE_ERROR_UNKNOWN, "Failed to promote clones.\n");
+        goto err;
+    }
 
-        if (libze_util_concat(ds_name, "@", source_snap_suffix, ZFS_MAX_DATASET_NAME_LEN,
-                              ds_snap_buf) != LIBZE_ERROR_SUCCESS) {
-            ret = libze_error_set(lzeh, LIBZE_ERROR_MAXPATHLEN,
-                                  "Requested snapshot exceeds max length %d\n",
-                                  ZFS_MAX_DATASET_NAME_LEN);
-            goto err;
-        }
+    DEBUG_PRINT("Channel programs unavailable on %s, promoting individually", pool);
 
-        zfs_handle_t *snap_handle = NULL;
-        if ((snap_handle = zfs_open(lzeh->lzh, ds_snap_buf, ZFS_TYPE_SNAPSHOT)) == NULL) {
-            ret = libze_error_set(lzeh, LIBZE_ERROR_ZFS_OPEN, "Error opening %s", ds_snap_buf);
+    for (i = 0; i < num_datasets; i++) {
+        zfs_handle_t *zh = zfs_open(lzeh->lzh, datasets[i], ZFS_TYPE_FILESYSTEM);
+        if (zh == NULL) {
+            ret = libze_error_set(lzeh, LIBZE_ERROR_ZFS_OPEN, "Failed opening %s\n", datasets[i]);
             goto err;
         }
-        if (zfs_clone(snap_handle, ds_child_buf, ds_props) != 0) {
-            zfs_close(snap_handle);
-            ret = libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN, "Clone error %s", ds_child_buf);
+        if (zfs_promote(zh) != 0) {
+            ret = libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN, "Failed promoting %s\n", datasets[i]);
+            zfs_close(zh);
             goto err;
         }
-
-        zfs_close(snap_handle);
+        zfs_close(zh);
     }
 
 err:
-    libze_list_free(cdata);
-    zfs_close(zroot_hdl);
+    nvlist_free(args);
+    free(datasets);
     return ret;
 }
 
 /**
- * @brief Create a snapshot timestamp
- * @param buflen Length of buffer @p buf
- * @param buf Buffer for snapshot timestamp
- * @return non-zero if buffer length exceeded
+ * @brief Set canmount=noauto on the tree of @p zhdl and promote it. The state of the tree is read
+ *        once up front, and only the datasets which differ are modified, so activating an already
+ *        promoted boot environment does not write anything.
+ * @param[in] lzeh Initialized @p libze_handle
+ * @param[in] zhdl Top level dataset of boot environment
+ * @param[in] pool Pool containing @p zhdl
+ * @return @p LIBZE_ERROR_SUCCESS on success
  */
-static int
-gen_snap_suffix(size_t buflen, char buf[buflen]) {
-    time_t now_time;
-    time(&now_time);
-    return strftime(buf, buflen, "%F-%T", localtime(&now_time)) != 0;
-}
+static libze_error
+activate_dataset(libze_handle *lzeh, zfs_handle_t *zhdl, char const pool[static 1]) {
+    libze_error ret = LIBZE_ERROR_SUCCESS;
+    libze_activate_cbdata cbd = {.lzeh = lzeh, .canmount = NULL, .promote = NULL};
 
-typedef struct create_data {
-    char snap_suffix[ZFS_MAX_DATASET_NAME_LEN];
-    char source_dataset[ZFS_MAX_DATASET_NAME_LEN];
-    boolean_t is_snap;
-    boolean_t recursive;
-} create_data;
+    if (((cbd.canmount = fnvlist_alloc()) == NULL) || ((cbd.promote = fnvlist_alloc()) == NULL)) {
+        ret = libze_error_nomem(lzeh);
+        goto err;
+    }
 
-/**
- * @brief Cut snapshot and dataset from full snapshot
- * @param[in] source_snap Source full snapshot
- * @param[out] dest_dataset Destination dataset
- * @param[out] dest_snapshot Destination snapshot suffix
- * @return @p LIBZE_ERROR_SUCCESS on success,
- *         @p LIBZE_ERROR_MAXPATHLEN if ZFS_MAX_DATASET_NAME_LEN exceeded,
- *         @p LIBZE_ERROR_UNKNOWN if no suffix found
- */
-static libze_error
-get_snap_and_dataset(char const source_snap[ZFS_MAX_DATASET_NAME_LEN],
-                     char dest_dataset[ZFS_MAX_DATASET_NAME_LEN],
-                     char dest_snapshot[ZFS_MAX_DATASET_NAME_LEN]) {
-    // Get snapshot dataset
-    if (libze_util_cut(source_snap, ZFS_MAX_DATASET_NAME_LEN, dest_dataset, '@') != 0) {
-        return LIBZE_ERROR_MAXPATHLEN;
+    if (libze_activate_cb(zhdl, &cbd) != 0) {
+        ret = LIBZE_ERROR_UNKNOWN;
+        goto err;
     }
-    // Get snap suffix
-    if (libze_util_suffix_after_string(dest_dataset, source_snap, ZFS_MAX_DATASET_NAME_LEN,
-                                       dest_snapshot) != 0) {
-        return LIBZE_ERROR_UNKNOWN;
+
+    if ((ret = activate_canmount(lzeh, cbd.canmount)) != LIBZE_ERROR_SUCCESS) {
+        goto err;
     }
 
-    return LIBZE_ERROR_SUCCESS;
+    ret = activate_promote(lzeh, pool, cbd.promote);
+
+err:
+    nvlist_free(cbd.canmount);
+    nvlist_free(cbd.promote);
+    return ret;
 }
 
 /**
- * @brief Prepare boot pool data
- * @param lzeh Initialized libze handle
- * @param source_snap Source snapshot
- * @param source_be_name Source boot environment name
- * @param dest_dataset Destination full dataset
- * @param dest_snapshot_suffix Destination snapshot suffix
+ * @brief Promote the boot environment tree of @p be_zh and @p be_bpool_zh, and clear any
+ *        pending promotion recorded by a deferred activation.
+ * @param[in] lzeh Initialized @p libze_handle
+ * @param[in] be_zh Top level dataset of boot environment
+ * @param[in] be_bpool_zh Boot environment dataset on bootpool, or NULL if no bootpool is used
  * @return @p LIBZE_ERROR_SUCCESS on success
  */
 static libze_error
-prepare_existing_boot_pool_data(libze_handle *lzeh,
-                                char const source_snap[ZFS_MAX_DATASET_NAME_LEN],
-                                char const source_be_name[ZFS_MAX_DATASET_NAME_LEN],
-                                char dest_dataset[ZFS_MAX_DATASET_NAME_LEN],
-                                char dest_snapshot_suffix[ZFS_MAX_DATASET_NAME_LEN]) {
-    char t_buff[ZFS_MAX_DATASET_NAME_LEN];
-    switch (get_snap_and_dataset(source_snap, t_buff, dest_snapshot_suffix)) {
-        case LIBZE_ERROR_MAXPATHLEN:
-            return libze_error_set(lzeh, LIBZE_ERROR_MAXPATHLEN,
-                                   "Source snapshot %s is too long.\n", source_snap);
-        case LIBZE_ERROR_UNKNOWN:
-            return libze_error_set(
-                lzeh, LIBZE_ERROR_UNKNOWN,
-                "Source snapshot %s doesn't contain snapshot suffix or is too long.\n",
-                source_snap);
-        default:
-            break;
-    }
+promote_boot_environment(libze_handle *lzeh, zfs_handle_t *be_zh, zfs_handle_t *be_bpool_zh) {
+    libze_error ret = LIBZE_ERROR_SUCCESS;
 
-    /* Validate source boot environment */
-    char source_bpool_ds[ZFS_MAX_DATASET_NAME_LEN] = "";
-    if (validate_existing_be(lzeh, source_be_name, NULL, source_bpool_ds) != LIBZE_ERROR_SUCCESS) {
-        return libze_error_prepend(lzeh, lzeh->libze_error,
-                                   "Failed to validate existing boot environment (%s)!\n",
-                                   source_be_name);
+    if ((ret = activate_dataset(lzeh, be_zh, lzeh->env_pool)) != LIBZE_ERROR_SUCCESS) {
+        return ret;
     }
 
-    char ds_snap_buf[ZFS_MAX_DATASET_NAME_LEN] = "";
-    if (libze_util_concat(source_bpool_ds, "@", source_snap, ZFS_MAX_DATASET_NAME_LEN,
-                          ds_snap_buf) != LIBZE_ERROR_SUCCESS) {
-        return libze_error_set(lzeh, LIBZE_ERROR_MAXPATHLEN,
-                               "Boot pool snapshot (%s@%s) is too long (%d).\n", source_bpool_ds,
-                               source_snap, ZFS_MAX_DATASET_NAME_LEN);
+    if (be_bpool_zh != NULL) {
+        if (activate_dataset(lzeh, be_bpool_zh, lzeh->bootpool.zpool_name) !=
+            LIBZE_ERROR_SUCCESS) {
+            return libze_error_prepend(lzeh, LIBZE_ERROR_UNKNOWN,
+                                       "Failed to promote boot environment on bootpool (%s).\n",
+                                       zfs_get_name(be_bpool_zh));
+        }
     }
 
-    if (!zfs_dataset_exists(lzeh->lzh, ds_snap_buf, ZFS_TYPE_SNAPSHOT)) {
-        return libze_error_set(lzeh, LIBZE_ERROR_MAXPATHLEN,
-                               "Source boot pool snapshot (%s) doesn't exist.\n", ds_snap_buf);
+    if (user_prop_is_local(be_zh, ZE_PROP_PROMOTE) &&
+        (zfs_prop_inherit(be_zh, ZE_PROP_PROMOTE, B_FALSE) != 0)) {
+        return libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN,
+                               "Failed to clear pending promotion of %s.\n", zfs_get_name(be_zh));
     }
 
-    return LIBZE_ERROR_SUCCESS;
+    return ret;
 }
 
 /**
- * @brief Populate @p cdata with what is necessary for create
- * @param[in] lzeh Initialized libze handle
- * @param[in] options Create options
- * @param[out] cdata Data to populate
+ * @brief Function run mid-activate, execute plugin if it exists.
+ * @param[in] lzeh Initialized @p libze_handle
+ * @param[in] options Options to set properties based on
+ * @param[in] be_zh Initialized @p zfs_handle_t to run mid activate upon
  * @return @p LIBZE_ERROR_SUCCESS on success,
- *         @p LIBZE_ERROR_EEXIST if source doesn't exist,
- *         @p LIBZE_ERROR_MAXPATHLEN if source is too long,
- *         @p LIBZE_ERROR_UNKNOWN if no snap suffix found
+ *         @p LIBZE_ERROR_UNKNOWN, or @p LIBZE_ERROR_PLUGIN on failure.
  *
- * @pre (options->existing == B_TRUE) && (strlen(cdata->source_dataset) > 0)
+ * @pre lzeh != NULL
+ * @pre be_zh != NULL
+ * @pre options != NULL
+ * @post if be_zh != root dataset, be_zh stays mounted in the mount session of lzeh until
+ *       libze_fini, libze_destroy or libze_rename releases it
  */
 static libze_error
-prepare_create_from_existing(libze_handle *lzeh, char const be_source[ZFS_MAX_DATASET_NAME_LEN],
-                             create_data *cdata) {
-    // Is a snapshot
-    if (strchr(be_source, '@') != NULL) {
-        cdata->is_snap = B_TRUE;
-        if (!zfs_dataset_exists(lzeh->lzh, be_source, ZFS_TYPE_SNAPSHOT)) {
-            return libze_error_set(lzeh, LIBZE_ERROR_EEXIST, "Source snapshot %s doesn't exist.\n",
-                                   be_source);
+mid_activate(libze_handle *lzeh, libze_activate_options *options, zfs_handle_t *be_zh) {
+    libze_error ret = LIBZE_ERROR_SUCCESS;
+    char tmp_dirname[LIBZE_MAX_PATH_LEN] = "/";
+    char const *ds_name = zfs_get_name(be_zh);
+    boolean_t is_root = libze_is_root_be(lzeh, ds_name);
+
+    // mid_activate
+    if ((lzeh->lz_funcs != NULL)) {
+        /* Only mount if we are running hook */
+        if (!is_root) {
+            ret = mount_session_get(lzeh, options->be_name, be_zh, tmp_dirname);
+            if (ret != LIBZE_ERROR_SUCCESS) {
+                return ret;
+            }
         }
 
-        switch (get_snap_and_dataset(be_source, cdata->source_dataset, cdata->snap_suffix)) {
-            case LIBZE_ERROR_MAXPATHLEN:
-                return libze_error_set(lzeh, LIBZE_ERROR_MAXPATHLEN,
-                                       "Source snapshot %s is too long.\n", be_source);
-            case LIBZE_ERROR_UNKNOWN:
-                return libze_error_set(
-                    lzeh, LIBZE_ERROR_UNKNOWN,
-                    "Source snapshot %s doesn't contain snapshot suffix or is too long.\n",
-                    be_source);
-            default:
-                return LIBZE_ERROR_SUCCESS;
+        libze_activate_data activate_data = {.be_name = options->be_name,
+                                             .be_mountpoint = tmp_dirname};
+
+        if (lzeh->lz_funcs->plugin_mid_activate(lzeh, &activate_data) != 0) {
+            ret = libze_error_set(lzeh, LIBZE_ERROR_PLUGIN, "Failed to run mid-activate hook\n");
         }
     }
 
-    cdata->is_snap = B_FALSE;
+    return ret;
+}
 
-    char snap_buf[ZFS_MAX_DATASET_NAME_LEN];
-    (void) gen_snap_suffix(ZFS_MAX_DATASET_NAME_LEN, cdata->snap_suffix);
-    int len =
-        libze_util_concat(be_source, "@", cdata->snap_suffix, ZFS_MAX_DATASET_NAME_LEN, snap_buf);
-    if (len != LIBZE_ERROR_SUCCESS) {
-        return libze_error_set(lzeh, LIBZE_ERROR_MAXPATHLEN,
-                               "Source dataset snapshot will exceed max dataset length.\n");
-    }
+typedef struct libze_promote_cbdata {
+    libze_handle *lzeh;
+    nvlist_t *pending;
+} libze_promote_cbdata;
 
-    if (zfs_snapshot(lzeh->lzh, snap_buf, cdata->recursive, NULL) != 0) {
-        return libze_error_set(lzeh, LIBZE_ERROR_MAXPATHLEN, "Failed to create snapshot %s.\n",
-                               snap_buf);
-    }
-    // Regular dataset
-    if (!zfs_dataset_exists(lzeh->lzh, be_source, ZFS_TYPE_FILESYSTEM)) {
-        return libze_error_set(lzeh, LIBZE_ERROR_EEXIST, "Source dataset %s doesn't exist.\n",
-                               be_source);
+/**
+ * @brief Callback run for every boot environment, add those with a pending promotion
+ *        to @p data->pending
+ * @param[in] zhdl Boot environment dataset, closed on exit
+ * @param[in,out] data @p libze_promote_cbdata
+ * @return Non zero on failure.
+ */
+static int
+promote_pending_cb(zfs_handle_t *zhdl, void *data) {
+    int ret = 0;
+    libze_promote_cbdata *cbd = data;
+    char be_name[ZFS_MAX_DATASET_NAME_LEN] = "";
+
+    if (user_prop_is_local(zhdl, ZE_PROP_PROMOTE)) {
+        if (libze_boot_env_name(zfs_get_name(zhdl), ZFS_MAX_DATASET_NAME_LEN, be_name) != 0) {
+            ret = libze_error_set(cbd->lzeh, LIBZE_ERROR_UNKNOWN,
+                                  "Failed to get boot environment name of %s.\n",
+                                  zfs_get_name(zhdl));
+        } else if (nvlist_add_boolean(cbd->pending, be_name) != 0) {
+            ret = libze_error_nomem(cbd->lzeh);
+        }
     }
-    if (strlcpy(cdata->source_dataset, be_source, ZFS_MAX_DATASET_NAME_LEN) >=
-        ZFS_MAX_DATASET_NAME_LEN) {
-        return libze_error_set(lzeh, LIBZE_ERROR_MAXPATHLEN,
-                               "Source dataset %s exceeds max dataset length.\n", be_source);
+
+    zfs_close(zhdl);
+    return ret;
+}
+
+/**
+ * @brief Collect the names of all boot environments with a pending promotion
+ * @param[in] lzeh Initialized lzeh libze handle
+ * @param[out] pending Allocated nvlist the names are added to
+ * @return @p LIBZE_ERROR_SUCCESS on success
+ */
+static libze_error
+promote_pending_get(libze_handle *lzeh, nvlist_t *pending) {
+    libze_promote_cbdata cbd = {.lzeh = lzeh, .pending = pending};
+
+    zfs_handle_t *root_zh = zfs_open(lzeh->lzh, lzeh->env_root, ZFS_TYPE_FILESYSTEM);
+    if (root_zh == NULL) {
+        return libze_error_set(lzeh, LIBZE_ERROR_ZFS_OPEN, "Failed opening %s.\n",
+                               lzeh->env_root);
     }
 
-    return LIBZE_ERROR_SUCCESS;
+    int iter_ret = zfs_iter_filesystems(root_zh, promote_pending_cb, &cbd);
+    zfs_close(root_zh);
+
+    return (iter_ret != 0) ? LIBZE_ERROR_UNKNOWN : LIBZE_ERROR_SUCCESS;
 }
 
 /**
- * @brief Function ran post-create, execute plugin if it exists.
- * @param[in] lzeh Initialized @p libze_handle
- * @param[in] options Options to set properties based on
- * @param[in] be_zh Initialized @p zfs_handle_t to run mid activate upon
- * @return @p LIBZE_ERROR_SUCCESS on success,
- *         @p LIBZE_ERROR_UNKNOWN, or @p LIBZE_ERROR_PLUGIN on failure.
- *
- * @pre lzeh != NULL
- * @pre be_zh != NULL
- * @pre options != NULL
- * @post if be_zh != root dataset, be_zh unmounted on exit
+ * @brief Clear the pending promotions of all boot environments except @p be_name, they are
+ *        stale once another boot environment is activated
+ * @param[in] lzeh Initialized lzeh libze handle
+ * @param[in] be_name Boot environment being activated
+ * @return @p LIBZE_ERROR_SUCCESS on success
  */
 static libze_error
-post_create(libze_handle *lzeh, libze_create_options *options, boolean_t is_snap) {
+promote_pending_clear_others(libze_handle *lzeh, char const be_name[static 1]) {
     libze_error ret = LIBZE_ERROR_SUCCESS;
+    nvlist_t *pending = NULL;
 
-    if (lzeh->lz_funcs == NULL) {
-        return ret;
+    if ((pending = fnvlist_alloc()) == NULL) {
+        return libze_error_nomem(lzeh);
+    }
+
+    if ((ret = promote_pending_get(lzeh, pending)) != LIBZE_ERROR_SUCCESS) {
+        goto err;
+    }
+
+    for (nvpair_t *pair = nvlist_next_nvpair(pending, NULL); pair != NULL;
+         pair = nvlist_next_nvpair(pending, pair)) {
+        if (strcmp(nvpair_name(pair), be_name) == 0) {
+            continue;
+        }
+
+        char be_ds[ZFS_MAX_DATASET_NAME_LEN];
+        if (libze_util_concat(lzeh->env_root, "/", nvpair_name(pair), ZFS_MAX_DATASET_NAME_LEN,
+                              be_ds) != LIBZE_ERROR_SUCCESS) {
+            ret = libze_error_set(lzeh, LIBZE_ERROR_MAXPATHLEN,
+                                  "Requested boot environment %s exceeds max length %d\n",
+                                  nvpair_name(pair), ZFS_MAX_DATASET_NAME_LEN);
+            goto err;
+        }
+
+        zfs_handle_t *zh = zfs_open(lzeh->lzh, be_ds, ZFS_TYPE_FILESYSTEM);
+        if (zh == NULL) {
+            ret = libze_error_set(lzeh, LIBZE_ERROR_ZFS_OPEN, "Failed opening %s.\n", be_ds);
+            goto err;
+        }
+        int inherit_ret = zfs_prop_inherit(zh, ZE_PROP_PROMOTE, B_FALSE);
+        zfs_close(zh);
+        if (inherit_ret != 0) {
+            ret = libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN,
+                                  "Failed to clear pending promotion of %s.\n", be_ds);
+            goto err;
+        }
     }
 
-    char *tmp_dirname = "/";
+err:
+    fnvlist_free(pending);
+    return ret;
+}
 
+/**
+ * @brief Based on @p options, activate a boot environment
+ * @param[in] lzeh Initialized lzeh libze handle
+ * @param options The options based on which the boot environment is activated
+ * @return LIBZE_ERROR_SUCCESS on success,
+ *         or LIBZE_ERROR_EEXIST, LIBZE_ERROR_PLUGIN, LIBZE_ERROR_ZFS_OPEN,
+ *         LIBZE_ERROR_UNKNOWN
+ */
+libze_error
+libze_activate(libze_handle *lzeh, libze_activate_options *options) {
+    libze_error ret = LIBZE_ERROR_SUCCESS;
     zfs_handle_t *be_zh = NULL, *be_bpool_zh = NULL;
     char be_ds[ZFS_MAX_DATASET_NAME_LEN] = "";
 
     if (open_boot_environment(lzeh, options->be_name, &be_zh, be_ds, &be_bpool_zh, NULL) !=
         LIBZE_ERROR_SUCCESS) {
         return libze_error_prepend(lzeh, lzeh->libze_error,
-                                   "Failed to open boot environment (%s) for post-create!\n",
+                                   "Failed to open boot environment (%s) for activation!\n",
                                    options->be_name);
     }
 
-    char const *ds_name = zfs_get_name(be_zh);
-    boolean_t is_root = libze_is_root_be(lzeh, ds_name);
+    /* ZFS handle is open, on failure goto err */
 
-    if (!is_root) {
-        ret = temp_mount_be(lzeh, options->be_name, be_zh, &tmp_dirname);
-        if (ret != LIBZE_ERROR_SUCCESS) {
+    /* Plugin - Pre Activate */
+    if ((lzeh->lz_funcs != NULL) && (lzeh->lz_funcs->plugin_pre_activate(lzeh) != 0)) {
+        ret = LIBZE_ERROR_PLUGIN;
+        goto err;
+    }
+
+    if ((ret = mid_activate(lzeh, options, be_zh)) != LIBZE_ERROR_SUCCESS) {
+        goto err;
+    }
+
+    if (options->deferred) {
+        /* Only record the promotion, it is completed later by libze_promote */
+        if (zfs_prop_set(be_zh, ZE_PROP_PROMOTE, ZE_PROMOTE_PENDING) != 0) {
+            ret = libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN,
+                                  "Failed to record pending promotion of %s.\n", be_ds);
+            goto err;
+        }
+    } else {
+        /* Promote before switching bootfs, so bootfs never refers to a partially promoted tree */
+        if ((ret = promote_boot_environment(lzeh, be_zh, be_bpool_zh)) != LIBZE_ERROR_SUCCESS) {
             goto err;
         }
     }
 
-    libze_create_data create_data = {
-            .be_name = options->be_name,
-            .be_mountpoint = tmp_dirname,
-            .from_snapshot = is_snap
-    };
+    // Always set, bootfs may have been changed outside of this handle since it was read
+    if (zpool_set_prop(lzeh->pool_zhdl, "bootfs", be_ds) != 0) {
+        ret = libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN,
+                              "Failed to set the pool property 'bootfs=%s'.\n", be_ds);
+        goto err;
+    }
+    (void) strlcpy(lzeh->env_activated_path, be_ds, ZFS_MAX_DATASET_NAME_LEN);
+    (void) strlcpy(lzeh->env_activated, options->be_name, ZFS_MAX_DATASET_NAME_LEN);
 
-    if (lzeh->lz_funcs->plugin_post_create(lzeh, &create_data) != 0) {
-        ret = libze_error_set(lzeh, LIBZE_ERROR_PLUGIN, "Failed to run post-create hook\n");
+    // Only the activated boot environment may still be promoted with libze_promote
+    if ((ret = promote_pending_clear_others(lzeh, options->be_name)) != LIBZE_ERROR_SUCCESS) {
         goto err;
     }
 
-err:
-    if (!is_root) {
-        ret = (ret == LIBZE_ERROR_SUCCESS) ? temp_unmount_be(lzeh, tmp_dirname, be_zh) : ret;
+    /* Plugin - Post Activate */
+    if ((lzeh->lz_funcs != NULL) &&
+        (lzeh->lz_funcs->plugin_post_activate(lzeh, options->be_name) != 0)) {
+        goto err;
     }
 
+err:
+    zfs_close(be_zh);
+    if (be_bpool_zh != NULL) {
+        zfs_close(be_bpool_zh);
+    }
     return ret;
 }
 
 /**
- * @brief Create boot environment
- * @param lzeh Initialized libze handle
- * @param options Options for boot environment
- * @return non @p LIBZE_ERROR_SUCCESS on failure
+ * @brief Promote a single boot environment
+ * @param[in] lzeh Initialized lzeh libze handle
+ * @param[in] be_name Name of boot environment
+ * @return @p LIBZE_ERROR_SUCCESS on success
+ */
+static libze_error
+promote_by_name(libze_handle *lzeh, char const be_name[static 1]) {
+    libze_error ret = LIBZE_ERROR_SUCCESS;
+    zfs_handle_t *be_zh = NULL, *be_bpool_zh = NULL;
+
+    if (open_boot_environment(lzeh, be_name, &be_zh, NULL, &be_bpool_zh, NULL) !=
+        LIBZE_ERROR_SUCCESS) {
+        return libze_error_prepend(lzeh, lzeh->libze_error,
+                                   "Failed to open boot environment (%s) for promotion!\n",
+                                   be_name);
+    }
+
+    ret = promote_boot_environment(lzeh, be_zh, be_bpool_zh);
+
+    zfs_close(be_zh);
+    if (be_bpool_zh != NULL) {
+        zfs_close(be_bpool_zh);
+    }
+    return ret;
+}
+
+/**
+ * @brief Complete the promotion of boot environments activated with
+ *        @p libze_activate_options->deferred set.
+ * @param[in] lzeh Initialized lzeh libze handle
+ * @param[in] options If @p options->pending is set, promote all boot environments with a
+ *            pending promotion, otherwise promote @p options->be_name.
+ * @return @p LIBZE_ERROR_SUCCESS on success
+ */
+libze_error
+libze_promote(libze_handle *lzeh, libze_promote_options *options) {
+    libze_error ret = LIBZE_ERROR_SUCCESS;
+
+    if (!options->pending) {
+        return promote_by_name(lzeh, options->be_name);
+    }
+
+    nvlist_t *pending = NULL;
+    if ((pending = fnvlist_alloc()) == NULL) {
+        return libze_error_nomem(lzeh);
+    }
+
+    if ((ret = promote_pending_get(lzeh, pending)) != LIBZE_ERROR_SUCCESS) {
+        goto err;
+    }
+
+    for (nvpair_t *pair = nvlist_next_nvpair(pending, NULL); pair != NULL;
+         pair = nvlist_next_nvpair(pending, pair)) {
+        if ((ret = promote_by_name(lzeh, nvpair_name(pair))) != LIBZE_ERROR_SUCCESS) {
+            goto err;
+        }
+    }
+
+err:
+    fnvlist_free(pending);
+    return ret;
+}
+
+/**********************************************
+ ************** clone and create **************
+ **********************************************/
+
+typedef struct libze_clone_prop_cbdata {
+    libze_handle *lzeh;
+    zfs_handle_t *zhp;
+    nvlist_t *props;
+} libze_clone_prop_cbdata_t;
+
+/**
+ * @brief Callback to run on each property
+ * @param prop Current property
+ * @param[in,out] data Initialized @p libze_clone_prop_cbdata_t to save props into.
+ * @return @p ZPROP_CONT to continue iterating.
+ */
+static int
+clone_prop_cb(int prop, void *data) {
+    libze_clone_prop_cbdata_t *pcbd = data;
+
+    zprop_source_t src;
+    char propbuf[ZFS_MAXPROPLEN];
+    char statbuf[ZFS_MAXPROPLEN];
+    char const *prop_name;
+
+    // Skip if readonly or canmount
+    if (zfs_prop_readonly(prop)) {
+        return ZPROP_CONT;
+    }
+
+    prop_name = zfs_prop_to_name(prop);
+
+    // Always set canmount=noauto
+    if (prop == ZFS_PROP_CANMOUNT) {
+        fnvlist_add_string(pcbd->props, prop_name, "noauto");
+        return ZPROP_CONT;
+    }
+
+    if (zfs_prop_get(pcbd->zhp, prop, propbuf, ZFS_MAXPROPLEN, &src, statbuf, ZFS_MAXPROPLEN,
+                     B_FALSE) != 0) {
+        return ZPROP_CONT;
+    }
+
+    // Skip if not LOCAL and not RECEIVED
+    if ((src != ZPROP_SRC_LOCAL) && (src != ZPROP_SRC_RECEIVED)) {
+        return ZPROP_CONT;
+    }
+
+    if (nvlist_add_string(pcbd->props, prop_name, propbuf) != 0) {
+        return ZPROP_CONT;
+    }
+
+    return ZPROP_CONT;
+}
+
+/**
+ * @brief Callback run recursively on a dataset
+ * @param[in] zhdl Initialized @p zfs_handle_t representing current dataset
+ * @param data Initialized @p libze_clone_cbdata to save properties into.
+ * @return Non-zero on success.
+ */
+static int
+libze_clone_cb(zfs_handle_t *zhdl, void *data) {
+    libze_clone_cbdata *cbd = data;
+    int ret = LIBZE_ERROR_SUCCESS;
+    nvlist_t *props = NULL;
+
+    if (((props = fnvlist_alloc()) == NULL)) {
+        return libze_error_nomem(cbd->lzeh);
+    }
+
+    libze_clone_prop_cbdata_t cb_data = {.lzeh = cbd->lzeh, .props = props, .zhp = zhdl};
+
+    // Iterate over all props
+    if (zprop_iter(clone_prop_cb, &cb_data, B_FALSE, B_FALSE, ZFS_TYPE_FILESYSTEM) == ZPROP_INVAL) {
+        ret = libze_error_set(cbd->lzeh, LIBZE_ERROR_UNKNOWN,
+                              "Failed to iterate over properties for top level dataset.\n");
+        goto err;
+    }
+
+    fnvlist_add_nvlist(*cbd->outnvl, zfs_get_name(zhdl), props);
+
+    if (cbd->recursive) {
+        if (zfs_iter_filesystems(zhdl, libze_clone_cb, cbd) != 0) {
+            ret = libze_error_set(cbd->lzeh, LIBZE_ERROR_UNKNOWN,
+                                  "Failed to iterate over child datasets.\n");
+            goto err;
+        }
+    }
+
+    return ret;
+err:
+    fnvlist_free(props);
+    return ret;
+}
+
+/**
+ * @brief Create a recursive clone from a snapshot given the dataset and snapshot separately.
+ *        The snapshot suffix should be the same for all nested datasets.
+ * @param lzeh Initialized libze handle
+ * @param source_root Top level dataset for clone.
+ * @param source_snap_suffix Snapshot name.
+ * @param be Name for new boot environment
+ * @param recursive Do recursive clone
+ * @return @p LIBZE_ERROR_SUCCESS on success,
+ *         @p LIBZE_ERROR_ZFS_OPEN, @p LIBZE_ERROR_UNKNOWN,
+ *         or @p LIBZE_ERROR_MAXPATHLEN on failure.
+ *
+ * @pre lzeh != NULL
+ * @pre source_root != NULL
+ * @pre source_snap_suffix != NULL
+ * @pre be != NULL
+ */
+libze_error
+libze_clone(libze_handle *lzeh, char source_root[static 1], char source_snap_suffix[static 1],
+            char be[static 1], boolean_t recursive) {
+    libze_error ret = LIBZE_ERROR_SUCCESS;
+
+    nvlist_t *cdata = NULL;
+    if ((cdata = fnvlist_alloc()) == NULL) {
+        return libze_error_nomem(lzeh);
+    }
+
+    // Get be root handle
+    zfs_handle_t *zroot_hdl = NULL;
+    if ((zroot_hdl = zfs_open(lzeh->lzh, source_root, ZFS_TYPE_FILESYSTEM)) == NULL) {
+        ret = libze_error_set(lzeh, LIBZE_ERROR_ZFS_OPEN, "Error opening %s", source_root);
+        goto err;
+    }
+
+    libze_clone_cbdata cbd = {.outnvl = &cdata, .lzeh = lzeh, .recursive = recursive};
+
+    // Get properties for bootfs and under bootfs
+    if (libze_clone_cb(zroot_hdl, &cbd) != 0) {
+        // libze_clone_cb sets error message.
+        ret = LIBZE_ERROR_UNKNOWN;
+        goto err;
+    }
+
+    nvpair_t *pair = NULL;
+    for (pair = nvlist_next_nvpair(cdata, NULL); pair != NULL;
+         pair = nvlist_next_nvpair(cdata, pair)) {
+        nvlist_t *ds_props = NULL;
+        nvpair_value_nvlist(pair, &ds_props);
+
+        // Recursive clone
+        const char *ds_name = nvpair_name(pair);
+        char ds_snap_buf[ZFS_MAX_DATASET_NAME_LEN] = "";
+        char be_child_buf[ZFS_MAX_DATASET_NAME_LEN] = "";
+        char ds_child_buf[ZFS_MAX_DATASET_NAME_LEN] = "";
+        if (libze_util_suffix_after_string(source_root, ds_name, ZFS_MAX_DATASET_NAME_LEN,
+                                           be_child_buf) == 0) {
+            if (strlen(be_child_buf) > 0) {
+                if (libze_util_concat(be, be_child_buf, "/", ZFS_MAX_DATASET_NAME_LEN,
+                                      ds_child_buf) != LIBZE_ERROR_SUCCESS) {
+                    ret = libze_error_set(lzeh, LIBZE_ERROR_MAXPATHLEN,
+                                          "Requested child clone exceeds max length %d\n",
+                                          ZFS_MAX_DATASET_NAME_LEN);
+                    goto err;
+                }
+            } else {
+                // Child empty
+                if (strlcpy(ds_child_buf, be, ZFS_MAX_DATASET_NAME_LEN) >=
+                    ZFS_MAX_DATASET_NAME_LEN) {
+                    ret = libze_error_set(lzeh, LIBZE_ERROR_MAXPATHLEN, "No child clone found\n");
+                    goto err;
+                }
+            }
+        }
+
+        if (libze_util_concat(ds_name, "@", source_snap_suffix, ZFS_MAX_DATASET_NAME_LEN,
+                              ds_snap_buf) != LIBZE_ERROR_SUCCESS) {
+            ret = libze_error_set(lzeh, LIBZE_ERROR_MAXPATHLEN,
+                                  "Requested snapshot exceeds max length %d\n",
+                                  ZFS_MAX_DATASET_NAME_LEN);
+            goto err;
+        }
+
+        zfs_handle_t *snap_handle = NULL;
+        if ((snap_handle = zfs_open(lzeh->lzh, ds_snap_buf, ZFS_TYPE_SNAPSHOT)) == NULL) {
+            ret = libze_error_set(lzeh, LIBZE_ERROR_ZFS_OPEN, "Error opening %s", ds_snap_buf);
+            goto err;
+        }
+        if (zfs_clone(snap_handle, ds_child_buf, ds_props) != 0) {
+            zfs_close(snap_handle);
+            ret = libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN, "Clone error %s", ds_child_buf);
+            goto err;
+        }
+
+        zfs_close(snap_handle);
+    }
+
+err:
+    libze_list_free(cdata);
+    zfs_close(zroot_hdl);
+    return ret;
+}
+
+/**
+ * @brief Create a snapshot name from the format in 'org.zectl:snapformat', or
+ *        @p ZE_SNAPSHOT_FORMAT_DEFAULT if unset, see @p libze_util_snap_format_expand. The
+ *        sequence in %Q increases with every name generated by the process, and %Q is appended to
+ *        formats without it, so names are unique without checking existing snapshots.
+ * @param[in] lzeh Initialized libze handle
+ * @param[in] buflen Length of buffer @p buf
+ * @param[out] buf Buffer for snapshot name
+ * @return @p LIBZE_ERROR_SUCCESS on success,
+ *         @p LIBZE_ERROR_MAXPATHLEN if buffer length exceeded,
+ *         @p LIBZE_ERROR_UNKNOWN if the name isn't a valid snapshot name
+ */
+static libze_error
+gen_snap_suffix(libze_handle *lzeh, size_t buflen, char buf[buflen]) {
+    static unsigned long sequence = 0;
+    libze_error ret = LIBZE_ERROR_SUCCESS;
+    struct timespec now = {0};
+
+    char const *format = libze_prop_value(lzeh, LIBZE_PROP_SNAPFORMAT);
+    if (format == NULL) {
+        return lzeh->libze_error;
+    }
+    if ((strlen(format) == 0) || (strcmp(format, "-") == 0)) {
+        format = ZE_SNAPSHOT_FORMAT_DEFAULT;
+    }
+
+    (void) clock_gettime(CLOCK_REALTIME, &now);
+
+    if (libze_util_snap_format_expand(format, &now, sequence++, buflen, buf) !=
+        LIBZE_ERROR_SUCCESS) {
+        return libze_error_set(lzeh, LIBZE_ERROR_MAXPATHLEN,
+                               "Snapshot name from format (%s) exceeds max length (%zu).\n",
+                               format, buflen);
+    }
+
+    // Locale dependent conversions may expand to characters not allowed in snapshot names
+    if (!libze_util_snap_suffix_valid(buf)) {
+        return libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN,
+                               "Snapshot name (%s) from format (%s) is invalid.\n", buf,
+                               format);
+    }
+
+    return ret;
+}
+
+/**
+ * @brief Take a snapshot implicitly required by another operation. The snapshot is tagged
+ *        with @p ZE_PROP_SNAPSHOT so that it can later be found by @p libze_gc.
+ * @param[in] lzeh Initialized libze handle
+ * @param[in] snapshot Full name of snapshot to create
+ * @param[in] recursive Create snapshot recursively
+ * @return non-zero on failure
+ */
+static int
+snapshot_tagged(libze_handle *lzeh, char const snapshot[static 1], boolean_t recursive) {
+    nvlist_t *props = NULL;
+    if ((props = fnvlist_alloc()) == NULL) {
+        return -1;
+    }
+    if (nvlist_add_string(props, ZE_PROP_SNAPSHOT, ZE_SNAPSHOT_CREATE) != 0) {
+        fnvlist_free(props);
+        return -1;
+    }
+
+    int ret = zfs_snapshot(lzeh->lzh, snapshot, recursive, props);
+    fnvlist_free(props);
+    return ret;
+}
+
+typedef struct create_data {
+    char snap_suffix[ZFS_MAX_DATASET_NAME_LEN];
+    char source_dataset[ZFS_MAX_DATASET_NAME_LEN];
+    boolean_t is_snap;
+    boolean_t recursive;
+} create_data;
+
+/**
+ * @brief Cut snapshot and dataset from full snapshot
+ * @param[in] source_snap Source full snapshot
+ * @param[out] dest_dataset Destination dataset
+ * @param[out] dest_snapshot Destination snapshot suffix
+ * @return @p LIBZE_ERROR_SUCCESS on success,
+ *         @p LIBZE_ERROR_MAXPATHLEN if ZFS_MAX_DATASET_NAME_LEN exceeded,
+ *         @p LIBZE_ERROR_UNKNOWN if no suffix found
+ */
+static libze_error
+get_snap_and_dataset(char const source_snap[ZFS_MAX_DATASET_NAME_LEN],
+                     char dest_dataset[ZFS_MAX_DATASET_NAME_LEN],
+                     char dest_snapshot[ZFS_MAX_DATASET_NAME_LEN]) {
+    // Get snapshot dataset
+    if (libze_util_cut(source_snap, ZFS_MAX_DATASET_NAME_LEN, dest_dataset, '@') != 0) {
+        return LIBZE_ERROR_MAXPATHLEN;
+    }
+    // Get snap suffix
+    if (libze_util_suffix_after_string(dest_dataset, source_snap, ZFS_MAX_DATASET_NAME_LEN,
+                                       dest_snapshot) != 0) {
+        return LIBZE_ERROR_UNKNOWN;
+    }
+
+    return LIBZE_ERROR_SUCCESS;
+}
+
+/**
+ * @brief Prepare boot pool data
+ * @param lzeh Initialized libze handle
+ * @param source_snap Source snapshot
+ * @param source_be_name Source boot environment name
+ * @param dest_dataset Destination full dataset
+ * @param dest_snapshot_suffix Destination snapshot suffix
+ * @return @p LIBZE_ERROR_SUCCESS on success
+ */
+static libze_error
+prepare_existing_boot_pool_data(libze_handle *lzeh,
+                                char const source_snap[ZFS_MAX_DATASET_NAME_LEN],
+                                char const source_be_name[ZFS_MAX_DATASET_NAME_LEN],
+                                char dest_dataset[ZFS_MAX_DATASET_NAME_LEN],
+                                char dest_snapshot_suffix[ZFS_MAX_DATASET_NAME_LEN]) {
+    char t_buff[ZFS_MAX_DATASET_NAME_LEN];
+    switch (get_snap_and_dataset(source_snap, t_buff, dest_snapshot_suffix)) {
+        case LIBZE_ERROR_MAXPATHLEN:
+            return libze_error_set(lzeh, LIBZE_ERROR_MAXPATHLEN,
+                                   "Source snapshot %s is too long.\n", source_snap);
+        case LIBZE_ERROR_UNKNOWN:
+            return libze_error_set(
+                lzeh, LIBZE_ERROR_UNKNOWN,
+                "Source snapshot %s doesn't contain snapshot suffix or is too long.\n",
+                source_snap);
+        default:
+            break;
+    }
+
+    /* Validate source boot environment */
+    char source_bpool_ds[ZFS_MAX_DATASET_NAME_LEN] = "";
+    if (validate_existing_be(lzeh, source_be_name, NULL, source_bpool_ds) != LIBZE_ERROR_SUCCESS) {
+        return libze_error_prepend(lzeh, lzeh->libze_error,
+                                   "Failed to validate existing boot environment (%s)!\n",
+                                   source_be_name);
+    }
+
+    char ds_snap_buf[ZFS_MAX_DATASET_NAME_LEN] = "";
+    if (libze_util_concat(source_bpool_ds, "@", source_snap, ZFS_MAX_DATASET_NAME_LEN,
+                          ds_snap_buf) != LIBZE_ERROR_SUCCESS) {
+        return libze_error_set(lzeh, LIBZE_ERROR_MAXPATHLEN,
+                               "Boot pool snapshot (%s@%s) is too long (%d).\n", source_bpool_ds,
+                               source_snap, ZFS_MAX_DATASET_NAME_LEN);
+    }
+
+    if (!zfs_dataset_exists(lzeh->lzh, ds_snap_buf, ZFS_TYPE_SNAPSHOT)) {
+        return libze_error_set(lzeh, LIBZE_ERROR_MAXPATHLEN,
+                               "Source boot pool snapshot (%s) doesn't exist.\n", ds_snap_buf);
+    }
+
+    return LIBZE_ERROR_SUCCESS;
+}
+
+/**
+ * @brief Populate @p cdata with what is necessary for create
+ * @param[in] lzeh Initialized libze handle
+ * @param[in] options Create options
+ * @param[out] cdata Data to populate
+ * @return @p LIBZE_ERROR_SUCCESS on success,
+ *         @p LIBZE_ERROR_EEXIST if source doesn't exist,
+ *         @p LIBZE_ERROR_MAXPATHLEN if source is too long,
+ *         @p LIBZE_ERROR_UNKNOWN if no snap suffix found
+ *
+ * @pre (options->existing == B_TRUE) && (strlen(cdata->source_dataset) > 0)
+ */
+static libze_error
+prepare_create_from_existing(libze_handle *lzeh, char const be_source[ZFS_MAX_DATASET_NAME_LEN],
+                             create_data *cdata) {
+    // Is a snapshot
+    if (strchr(be_source, '@') != NULL) {
+        cdata->is_snap = B_TRUE;
+        if (!zfs_dataset_exists(lzeh->lzh, be_source, ZFS_TYPE_SNAPSHOT)) {
+            return libze_error_set(lzeh, LIBZE_ERROR_EEXIST, "Source snapshot %s doesn't exist.\n",
+                                   be_source);
+        }
+
+        switch (get_snap_and_dataset(be_source, cdata->source_dataset, cdata->snap_suffix)) {
+            case LIBZE_ERROR_MAXPATHLEN:
+                return libze_error_set(lzeh, LIBZE_ERROR_MAXPATHLEN,
+                                       "Source snapshot %s is too long.\n", be_source);
+            case LIBZE_ERROR_UNKNOWN:
+                return libze_error_set(
+                    lzeh, LIBZE_ERROR_UNKNOWN,
+                    "Source snapshot %s doesn't contain snapshot suffix or is too long.\n",
+                    be_source);
+            default:
+                return LIBZE_ERROR_SUCCESS;
+        }
+    }
+
+    cdata->is_snap = B_FALSE;
+
+    char snap_buf[ZFS_MAX_DATASET_NAME_LEN];
+    libze_error ret = gen_snap_suffix(lzeh, ZFS_MAX_DATASET_NAME_LEN, cdata->snap_suffix);
+    if (ret != LIBZE_ERROR_SUCCESS) {
+        return ret;
+    }
+    int len =
+        libze_util_concat(be_source, "@", cdata->snap_suffix, ZFS_MAX_DATASET_NAME_LEN, snap_buf);
+    if (len != LIBZE_ERROR_SUCCESS) {
+        return libze_error_set(lzeh, LIBZE_ERROR_MAXPATHLEN,
+                               "Source dataset snapshot will exceed max dataset length.\n");
+    }
+
+    if (snapshot_tagged(lzeh, snap_buf, cdata->recursive) != 0) {
+        return libze_error_set(lzeh, LIBZE_ERROR_MAXPATHLEN, "Failed to create snapshot %s.\n",
+                               snap_buf);
+    }
+    // Regular dataset
+    if (!zfs_dataset_exists(lzeh->lzh, be_source, ZFS_TYPE_FILESYSTEM)) {
+        return libze_error_set(lzeh, LIBZE_ERROR_EEXIST, "Source dataset %s doesn't exist.\n",
+                               be_source);
+    }
+    if (strlcpy(cdata->source_dataset, be_source, ZFS_MAX_DATASET_NAME_LEN) >=
+        ZFS_MAX_DATASET_NAME_LEN) {
+        return libze_error_set(lzeh, LIBZE_ERROR_MAXPATHLEN,
+                               "Source dataset %s exceeds max dataset length.\n", be_source);
+    }
+
+    return LIBZE_ERROR_SUCCESS;
+}
+
+/**
+ * @brief Function ran post-create, execute plugin if it exists.
+ * @param[in] lzeh Initialized @p libze_handle
+ * @param[in] options Options the boot environment was created with
+ * @param[in] is_snap Whether the boot environment was created from an existing snapshot
+ * @return @p LIBZE_ERROR_SUCCESS on success,
+ *         @p LIBZE_ERROR_UNKNOWN, or @p LIBZE_ERROR_PLUGIN on failure.
+ *
+ * @pre lzeh != NULL
+ * @pre options != NULL
+ * @post if the boot environment != root dataset and a plugin is loaded, it stays mounted in
+ *       the mount session of lzeh until libze_fini, libze_destroy or libze_rename releases it
+ */
+static libze_error
+post_create(libze_handle *lzeh, libze_create_options *options, boolean_t is_snap) {
+    libze_error ret = LIBZE_ERROR_SUCCESS;
+
+    if (lzeh->lz_funcs == NULL) {
+        return ret;
+    }
+
+    char tmp_dirname[LIBZE_MAX_PATH_LEN] = "/";
+
+    zfs_handle_t *be_zh = NULL, *be_bpool_zh = NULL;
+    char be_ds[ZFS_MAX_DATASET_NAME_LEN] = "";
+
+    if (open_boot_environment(lzeh, options->be_name, &be_zh, be_ds, &be_bpool_zh, NULL) !=
+        LIBZE_ERROR_SUCCESS) {
+        return libze_error_prepend(lzeh, lzeh->libze_error,
+                                   "Failed to open boot environment (%s) for post-create!\n",
+                                   options->be_name);
+    }
+
+    char const *ds_name = zfs_get_name(be_zh);
+    boolean_t is_root = libze_is_root_be(lzeh, ds_name);
+
+    if (!is_root) {
+        ret = mount_session_get(lzeh, options->be_name, be_zh, tmp_dirname);
+        if (ret != LIBZE_ERROR_SUCCESS) {
+            goto err;
+        }
+    }
+
+    libze_create_data create_data = {
+            .be_name = options->be_name,
+            .be_mountpoint = tmp_dirname,
+            .from_snapshot = is_snap
+    };
+
+    if (lzeh->lz_funcs->plugin_post_create(lzeh, &create_data) != 0) {
+        ret = libze_error_set(lzeh, LIBZE_ERROR_PLUGIN, "Failed to run post-create hook\n");
+        goto err;
+    }
+
+err:
+    zfs_close(be_zh);
+    if (be_bpool_zh != NULL) {
+        zfs_close(be_bpool_zh);
+    }
+
+    return ret;
+}
+
+/**
+ * @brief Create boot environment
+ * @param lzeh Initialized libze handle
+ * @param options Options for boot environment
+ * @return non @p LIBZE_ERROR_SUCCESS on failure
+ */
+libze_error
+libze_create(libze_handle *lzeh, libze_create_options *options) {
+    libze_error ret = LIBZE_ERROR_SUCCESS;
+    create_data cdata;
+    create_data boot_pool_cdata;
+
+    /* Validate new boot environment */
+    char new_ds_chk[ZFS_MAX_DATASET_NAME_LEN] = "";
+    char new_bpool_ds_chk[ZFS_MAX_DATASET_NAME_LEN] = "";
+    if (validate_new_be(lzeh, options->be_name, new_ds_chk, new_bpool_ds_chk) != LIBZE_ERROR_SUCCESS) {
+        return libze_error_prepend(lzeh, lzeh->libze_error,
+                                   "Failed to validate new boot environment (%s)!\n",
+                                   options->be_name);
+    }
+
+    /* Populate cdata from existing dataset or snap */
+    if (options->existing) {
+        ret = prepare_create_from_existing(lzeh, options->be_source, &cdata);
+        if (ret != LIBZE_ERROR_SUCCESS) {
+            return ret;
+        }
+
+        if (lzeh->bootpool.pool_zhdl != NULL) {
+            /* Setup source as (boot pool root)/env/(existing name)
+             * Since from existing, use snap suffix from existing */
+            char dest_ds_buf[ZFS_MAX_DATASET_NAME_LEN] = "";
+            char dest_snap_buf[ZFS_MAX_DATASET_NAME_LEN] = "";
+            ret = prepare_existing_boot_pool_data(lzeh, options->be_source, options->be_name,
+                                                  dest_ds_buf, dest_snap_buf);
+            if (ret != LIBZE_ERROR_SUCCESS) {
+                return ret;
+            }
+            ret = prepare_create_from_existing(lzeh, dest_ds_buf, &boot_pool_cdata);
+            if (ret != LIBZE_ERROR_SUCCESS) {
+                return ret;
+            }
+        }
+    } else { // Populate cdata from bootfs
+        cdata.is_snap = B_FALSE;
+        if (strlcpy(cdata.source_dataset, lzeh->env_activated_path, ZFS_MAX_DATASET_NAME_LEN) >=
+            ZFS_MAX_DATASET_NAME_LEN) {
+            return libze_error_set(lzeh, LIBZE_ERROR_MAXPATHLEN,
+                                   "Source dataset %s exceeds max dataset length.\n",
+                                   lzeh->env_activated_path);
+        }
+        char snap_buf[ZFS_MAX_DATASET_NAME_LEN];
+        if ((ret = gen_snap_suffix(lzeh, ZFS_MAX_DATASET_NAME_LEN, cdata.snap_suffix)) !=
+            LIBZE_ERROR_SUCCESS) {
+            return ret;
+        }
+        int len = libze_util_concat(cdata.source_dataset, "@", cdata.snap_suffix,
+                                    ZFS_MAX_DATASET_NAME_LEN, snap_buf);
+        if (len != LIBZE_ERROR_SUCCESS) {
+            return libze_error_set(lzeh, LIBZE_ERROR_MAXPATHLEN,
+                                   "Source dataset snapshot will exceed max dataset length.\n");
+        }
+
+        if (snapshot_tagged(lzeh, snap_buf, options->recursive) != 0) {
+            return libze_error_set(lzeh, LIBZE_ERROR_MAXPATHLEN, "Failed to create snapshot %s.\n",
+                                   snap_buf);
+        }
+
+        if (lzeh->bootpool.pool_zhdl != NULL) {
+            boot_pool_cdata.is_snap = B_FALSE;
+            (void) libze_util_concat(lzeh->bootpool.root_path_full, lzeh->env_running, "",
+                                     ZFS_MAX_DATASET_NAME_LEN, boot_pool_cdata.source_dataset);
+            (void) strlcpy(boot_pool_cdata.snap_suffix, cdata.snap_suffix,
+                           ZFS_MAX_DATASET_NAME_LEN);
+            if (libze_util_concat(boot_pool_cdata.source_dataset, "@", boot_pool_cdata.snap_suffix,
+                                  ZFS_MAX_DATASET_NAME_LEN, snap_buf) != LIBZE_ERROR_SUCCESS) {
+                return libze_error_set(
+                    lzeh, LIBZE_ERROR_MAXPATHLEN,
+                    "Source boot pool dataset snapshot (%s@%s) exceeds max dataset length (%d).\n",
+                    boot_pool_cdata.source_dataset, boot_pool_cdata.snap_suffix,
+                    ZFS_MAX_DATASET_NAME_LEN);
+            }
+            if (snapshot_tagged(lzeh, snap_buf, options->recursive) != 0) {
+                return libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN,
+                                       "Failed to create snapshot (%s).\n", snap_buf);
+            }
+        }
+    }
+
+    /* Validate new boot environment */
+    char new_ds[ZFS_MAX_DATASET_NAME_LEN] = "";
+    char new_bpool_ds[ZFS_MAX_DATASET_NAME_LEN] = "";
+    if (validate_new_be(lzeh, options->be_name, new_ds, new_bpool_ds) != LIBZE_ERROR_SUCCESS) {
+        return libze_error_prepend(lzeh, lzeh->libze_error,
+                                   "Failed to validate new boot environment (%s)!\n",
+                                   options->be_name);
+    }
+
+    if (libze_clone(lzeh, cdata.source_dataset, cdata.snap_suffix, new_ds, options->recursive) !=
+        LIBZE_ERROR_SUCCESS) {
+        return LIBZE_ERROR_UNKNOWN;
+    }
+
+    if (strlen(new_bpool_ds) > 0) {
+        if (libze_clone(lzeh, boot_pool_cdata.source_dataset, boot_pool_cdata.snap_suffix,
+                        new_bpool_ds, options->recursive) != LIBZE_ERROR_SUCCESS) {
+            return libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN,
+                                   "The dataset on the bootpool (%s) can't be cloned.\n",
+                                   new_bpool_ds);
+        }
+    }
+
+    ret = post_create(lzeh, options, cdata.is_snap);
+
+    return ret;
+}
+
+/*************************************
+ ************** destroy **************
+ *************************************/
+
+typedef struct libze_destroy_cbdata {
+    libze_handle *lzeh;
+    libze_destroy_options *options;
+} libze_destroy_cbdata;
+
+/**
+ * @brief Destroy callback called for each child recursively
+ * @param zh Handle of each dataset to dataset
+ * @param data @p libze_destroy_cbdata callback data
+ * @return non-zero if not successful
+ */
+static int
+libze_destroy_cb(zfs_handle_t *zh, void *data) {
+    int ret = 0;
+    libze_destroy_cbdata *cbd = data;
+
+    char const *ds = zfs_get_name(zh);
+    if (dataset_is_mounted(cbd->lzeh, zh)) {
+        if (cbd->options->force) {
+            zfs_unmount(zh, NULL, 0);
+            libze_mnttab_invalidate(cbd->lzeh);
+        } else {
+            return libze_error_set(cbd->lzeh, LIBZE_ERROR_UNKNOWN,
+                                   "Dataset %s is mounted, run with force or unmount dataset\n",
+                                   ds);
+        }
+    }
+
+    zfs_handle_t *origin_h = NULL;
+    // Dont run destroy_origin if snap callback
+    if ((strchr(zfs_get_name(zh), '@') == NULL) && cbd->options->destroy_origin) {
+        // Check if clone, origin snapshot saved to buffer
+        char buf[ZFS_MAX_DATASET_NAME_LEN];
+        if (zfs_prop_get(zh, ZFS_PROP_ORIGIN, buf, ZFS_MAX_DATASET_NAME_LEN, NULL, NULL, 0, 1) ==
+            0) {
+            // Destroy origin snapshot
+            origin_h = zfs_open(cbd->lzeh->lzh, buf, ZFS_TYPE_SNAPSHOT);
+            if (origin_h == NULL) {
+                return libze_error_set(cbd->lzeh, LIBZE_ERROR_UNKNOWN,
+                                       "Failed to open origin snapshot %s\n", buf);
+            }
+        }
+    }
+
+    // Destroy children recursively
+    if (zfs_iter_children(zh, libze_destroy_cb, cbd) != 0) {
+        return libze_error_set(cbd->lzeh, LIBZE_ERROR_UNKNOWN,
+                               "Failed to iterate over children of %s\n", ds);
+    }
+    // Destroy dataset, ignore error if inner snap recurse so destroy continues
+    if (zfs_destroy(zh, B_FALSE) != 0) {
+        return libze_error_set(cbd->lzeh, LIBZE_ERROR_UNKNOWN, "Failed to destroy dataset %s\n",
+                               ds);
+    }
+
+    if (cbd->options->destroy_origin && (origin_h != NULL)) {
+        if ((ret = libze_destroy_cb(origin_h, cbd)) != 0) {
+            libze_error_set(cbd->lzeh, LIBZE_ERROR_UNKNOWN,
+                            "Failed to destroy origin snapshot %s\n", zfs_get_name(origin_h));
+        }
+        zfs_close(origin_h);
+    }
+
+    return ret;
+}
+
+/**
+ * @brief Destroy a boot environment clone or dataset
+ * @param lzeh Initialized @p libze_handle
+ * @param options Destroy options
+ * @param filesystem Clone or boot environment full name
+ * @return @p LIBZE_ERROR_SUCCESS on success,
+ *         @p LIBZE_ERROR_ZFS_OPEN if @p filesystem can't be opened,
+ *         @p LIBZE_ERROR_EEXIST if @p filesystem doesn't exist,
+ */
+static libze_error
+destroy_filesystem(libze_handle *lzeh, libze_destroy_options *options,
+                   char const filesystem[ZFS_MAX_DATASET_NAME_LEN]) {
+    libze_error ret = LIBZE_ERROR_SUCCESS;
+
+    if (!zfs_dataset_exists(lzeh->lzh, filesystem, ZFS_TYPE_FILESYSTEM)) {
+        return libze_error_set(lzeh, LIBZE_ERROR_EEXIST, "Dataset %s does not exist\n", filesystem);
+    }
+    zfs_handle_t *be_zh = NULL;
+    be_zh = zfs_open(lzeh->lzh, filesystem, ZFS_TYPE_FILESYSTEM);
+    if (be_zh == NULL) {
+        return libze_error_set(lzeh, LIBZE_ERROR_ZFS_OPEN, "Failed opening dataset %s\n",
+                               filesystem);
+    }
+
+    libze_destroy_cbdata cbd = {.lzeh = lzeh, .options = options};
+
+    if (libze_destroy_cb(be_zh, &cbd) != 0) {
+        ret = LIBZE_ERROR_UNKNOWN;
+    }
+    zfs_close(be_zh);
+
+    return ret;
+}
+
+/**
+ * @brief Destroy a boot environment snapshot
+ * @param lzeh Initialized @p libze_handle
+ * @param options Destroy options
+ * @param snapshot Snapshot full name
+ * @param snapshot_bpool Snapshot full name on bootpool or NULL if not used
+ * @return @p LIBZE_ERROR_SUCCESS on success
+ */
+static libze_error
+destroy_snapshot(libze_handle *lzeh, libze_destroy_options *options,
+                 char const snapshot[ZFS_MAX_DATASET_NAME_LEN],
+                 char const snapshot_bpool[ZFS_MAX_DATASET_NAME_LEN]) {
+    if (!zfs_dataset_exists(lzeh->lzh, snapshot, ZFS_TYPE_SNAPSHOT)) {
+        return libze_error_set(lzeh, LIBZE_ERROR_EEXIST, "Snapshot %s does not exist\n", snapshot);
+    }
+    char be_snap_ds_buff[ZFS_MAX_DATASET_NAME_LEN] = "";
+    char be_full_ds[ZFS_MAX_DATASET_NAME_LEN] = "";
+
+    // Get boot environment name, we know ZFS_MAX_DATASET_NAME_LEN wont be exceeded
+    (void) libze_util_cut(options->be_name, ZFS_MAX_DATASET_NAME_LEN, be_snap_ds_buff, '@');
+
+    /* Validate that snapshot is from a boot environment */
+    if (validate_existing_be(lzeh, be_snap_ds_buff, NULL, NULL) != LIBZE_ERROR_SUCCESS) {
+        return libze_error_prepend(lzeh, lzeh->libze_error,
+                                   "Failed to validate corresponding boot environment (%s) to "
+                                   " snapshot!\n",
+                                   be_snap_ds_buff);
+    }
+
+    zfs_handle_t *be_zh = zfs_open(lzeh->lzh, snapshot, ZFS_TYPE_SNAPSHOT);
+    if (be_zh == NULL) {
+        return libze_error_set(lzeh, LIBZE_ERROR_ZFS_OPEN, "Failed opening snapshot (%s).\n",
+                               snapshot);
+    }
+    if (zfs_destroy(be_zh, B_FALSE) != 0) {
+        zfs_close(be_zh);
+        return libze_error_set(lzeh, LIBZE_ERROR_EEXIST, "Failed to destroy snapshot %s\n",
+                               snapshot);
+    }
+    zfs_close(be_zh);
+
+    if (snapshot_bpool != NULL) {
+        if (!zfs_dataset_exists(lzeh->lzh, snapshot_bpool, ZFS_TYPE_SNAPSHOT)) {
+            return libze_error_set(lzeh, LIBZE_ERROR_EEXIST,
+                                   "Snapshot on bootpool (%s) does not exist.\n", snapshot_bpool);
+        }
+        zfs_handle_t *be_bpool_zh = zfs_open(lzeh->lzh, snapshot_bpool, ZFS_TYPE_SNAPSHOT);
+        if (be_bpool_zh == NULL) {
+            return libze_error_set(lzeh, LIBZE_ERROR_ZFS_OPEN,
+                                   "Failed opening snapshot on bootpool (%s).\n", snapshot_bpool);
+        }
+        if (zfs_destroy(be_bpool_zh, B_FALSE) != 0) {
+            zfs_close(be_bpool_zh);
+            return libze_error_set(lzeh, LIBZE_ERROR_EEXIST,
+                                   "Failed to destroy snapshot on bootpool (%s).\n",
+                                   snapshot_bpool);
+        }
+        zfs_close(be_bpool_zh);
+    }
+
+    return LIBZE_ERROR_SUCCESS;
+}
+
+/**
+ * @brief Destroy a boot environment
+ * @param lzeh Initialized @p libze_handle
+ * @param options Destroy options
+ * @return @p LIBZE_ERROR_SUCCESS on success
  */
 libze_error
-libze_create(libze_handle *lzeh, libze_create_options *options) {
+libze_destroy(libze_handle *lzeh, libze_destroy_options *options) {
     libze_error ret = LIBZE_ERROR_SUCCESS;
-    create_data cdata;
-    create_data boot_pool_cdata;
+    zfs_handle_t *be_zh = NULL, *be_bpool_zh = NULL;
+    char be_ds[ZFS_MAX_DATASET_NAME_LEN] = "";
+    char be_bpool_ds[ZFS_MAX_DATASET_NAME_LEN] = "";
 
-    /* Validate new boot environment */
-    char new_ds_chk[ZFS_MAX_DATASET_NAME_LEN] = "";
-    char new_bpool_ds_chk[ZFS_MAX_DATASET_NAME_LEN] = "";
-    if (validate_new_be(lzeh, options->be_name, new_ds_chk, new_bpool_ds_chk) != LIBZE_ERROR_SUCCESS) {
-        return libze_error_prepend(lzeh, lzeh->libze_error,
-                                   "Failed to validate new boot environment (%s)!\n",
-                                   options->be_name);
+    if ((strchr(options->be_name, '@') == NULL)) {
+        if (open_boot_environment(lzeh, options->be_name, &be_zh, be_ds, &be_bpool_zh,
+                                  be_bpool_ds) != LIBZE_ERROR_SUCCESS) {
+            return libze_error_prepend(lzeh, lzeh->libze_error,
+                                       "Failed to open boot environment (%s) which should be "
+                                       "destroyed.\n",
+                                       options->be_name);
+        }
+
+        if (libze_is_active_be(lzeh, be_ds)) {
+            ret =
+                libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN,
+                                "Cannot destroy active boot environment (%s).\n", options->be_name);
+            goto err;
+        }
+        if (libze_is_root_be(lzeh, be_ds)) {
+            ret = libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN,
+                                  "Cannot destroy root boot environment (%s).\n", options->be_name);
+            goto err;
+        }
+
+        if ((ret = mount_session_drop(lzeh, options->be_name)) != LIBZE_ERROR_SUCCESS) {
+            goto err;
+        }
+
+        if ((ret = destroy_filesystem(lzeh, options, be_ds)) != LIBZE_ERROR_SUCCESS) {
+            ret = libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN,
+                                  "Failed to destroy the requested boot environment (%s).\n",
+                                  options->be_name);
+            goto err;
+        }
+
+        if (be_bpool_zh != NULL) {
+            libze_destroy_cbdata cbd = {.lzeh = lzeh, .options = options};
+            if (libze_destroy_cb(be_bpool_zh, &cbd) != 0) {
+                ret = libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN,
+                                      "Failed to destroy the requested boot environment on bootpool"
+                                      " (%s).\n",
+                                      options->be_name);
+            }
+        err:
+            zfs_close(be_zh);
+            if (be_bpool_zh != NULL) {
+                zfs_close(be_bpool_zh);
+            }
+            return ret;
+        }
+    } else {
+        if (libze_util_concat(lzeh->env_root, "/", options->be_name, ZFS_MAX_DATASET_NAME_LEN,
+                              be_ds) != LIBZE_ERROR_SUCCESS) {
+            return libze_error_set(lzeh, LIBZE_ERROR_MAXPATHLEN,
+                                   "The snapshot name (%s%s) exceeds max length (%d).\n",
+                                   lzeh->env_root, options->be_name, ZFS_MAX_DATASET_NAME_LEN);
+        }
+        if (lzeh->bootpool.pool_zhdl != NULL) {
+            if (libze_util_concat(lzeh->bootpool.root_path_full, "", options->be_name,
+                                  ZFS_MAX_DATASET_NAME_LEN, be_bpool_ds) != LIBZE_ERROR_SUCCESS) {
+                return libze_error_set(lzeh, LIBZE_ERROR_MAXPATHLEN,
+                                       "The snapshot name for the bootpool (%s%s) exceeds max "
+                                       "length (%d).\n",
+                                       lzeh->env_root, options->be_name, ZFS_MAX_DATASET_NAME_LEN);
+            }
+        }
+        if ((ret = destroy_snapshot(lzeh, options, be_ds, be_bpool_ds)) != LIBZE_ERROR_SUCCESS) {
+            return ret;
+        }
+    }
+
+    if ((lzeh->lz_funcs != NULL) &&
+        (lzeh->lz_funcs->plugin_post_destroy(lzeh, options->be_name) != 0)) {
+        return LIBZE_ERROR_PLUGIN;
+    }
+
+    return ret;
+}
+
+/**********************************
+ ************** diff **************
+ **********************************/
+
+// Longest line of output buffered per dataset before it is written out regardless
+#define DIFF_LINE_LEN 8192
+
+typedef struct diff_entry {
+    /**< Snapshot compared from */
+    char from[ZFS_MAX_DATASET_NAME_LEN];
+    /**< Snapshot or filesystem compared to */
+    char to[ZFS_MAX_DATASET_NAME_LEN];
+    /**< Process running the diff, -1 if not started */
+    pid_t pid;
+    /**< Read end of the pipe the differences are written to */
+    int out_fd;
+    /**< Read end of the pipe an error is reported through */
+    int err_fd;
+    /**< Output not yet written out, after the last complete line */
+    char line[DIFF_LINE_LEN];
+    size_t line_len;
+} diff_entry;
+
+typedef struct diff_collect_cbdata {
+    libze_handle *lzeh;
+    char const *from_ds;
+    char const *from_snap;
+    char const *to_ds;
+    /**< Empty if compared to the filesystems */
+    char const *to_snap;
+    diff_entry *entries;
+    size_t count;
+    size_t capacity;
+} diff_collect_cbdata;
+
+/**
+ * @brief Filesystem callback, pairs @p zh with the dataset at the same relative position in the
+ *        boot environment compared to, and recurses into its children. Datasets which only
+ *        exist on one side are skipped.
+ * @param zh Handle of filesystem in the boot environment compared from, closed on exit
+ * @param data @p diff_collect_cbdata callback data
+ * @return non-zero on failure
+ */
+static int
+diff_collect_cb(zfs_handle_t *zh, void *data) {
+    diff_collect_cbdata *cbd = data;
+    char const *dataset = zfs_get_name(zh);
+    char const *relative = dataset + strlen(cbd->from_ds);
+    boolean_t to_snapshot = (strlen(cbd->to_snap) > 0);
+    int ret = 0;
+
+    if (cbd->count == cbd->capacity) {
+        size_t capacity = (cbd->capacity == 0) ? 8 : cbd->capacity * 2;
+        diff_entry *entries = realloc(cbd->entries, capacity * sizeof(diff_entry));
+        if (entries == NULL) {
+            ret = libze_error_nomem(cbd->lzeh);
+            goto done;
+        }
+        cbd->entries = entries;
+        cbd->capacity = capacity;
+    }
+
+    diff_entry *entry = &cbd->entries[cbd->count];
+    *entry = (diff_entry){.pid = -1, .out_fd = -1, .err_fd = -1, .line_len = 0};
+
+    if ((snprintf(entry->from, ZFS_MAX_DATASET_NAME_LEN, "%s@%s", dataset, cbd->from_snap) >=
+         ZFS_MAX_DATASET_NAME_LEN) ||
+        (snprintf(entry->to, ZFS_MAX_DATASET_NAME_LEN, "%s%s%s%s", cbd->to_ds, relative,
+                  to_snapshot ? "@" : "", cbd->to_snap) >= ZFS_MAX_DATASET_NAME_LEN)) {
+        ret = libze_error_set(cbd->lzeh, LIBZE_ERROR_MAXPATHLEN,
+                              "Dataset to compare with (%s) exceeds max length (%d).\n", dataset,
+                              ZFS_MAX_DATASET_NAME_LEN);
+        goto done;
+    }
+
+    if (zfs_dataset_exists(cbd->lzeh->lzh, entry->from, ZFS_TYPE_SNAPSHOT) &&
+        zfs_dataset_exists(cbd->lzeh->lzh, entry->to,
+                           to_snapshot ? ZFS_TYPE_SNAPSHOT : ZFS_TYPE_FILESYSTEM)) {
+        cbd->count++;
+    }
+
+    ret = zfs_iter_filesystems(zh, diff_collect_cb, cbd);
+
+done:
+    zfs_close(zh);
+    return ret;
+}
+
+/**
+ * @brief Split <boot environment>[@<snapshot>] and validate the boot environment
+ * @param[in] lzeh Initialized lzeh libze handle
+ * @param[in] argument Boot environment, optionally with a snapshot
+ * @param[out] be_name Boot environment name
+ * @param[out] be_ds Boot environment dataset
+ * @param[out] snap_suffix Snapshot after the '@', empty if none
+ * @return @p LIBZE_ERROR_SUCCESS on success
+ */
+static libze_error
+diff_resolve(libze_handle *lzeh, char const argument[static 1],
+             char be_name[ZFS_MAX_DATASET_NAME_LEN], char be_ds[ZFS_MAX_DATASET_NAME_LEN],
+             char snap_suffix[ZFS_MAX_DATASET_NAME_LEN]) {
+    char be_bpool_ds[ZFS_MAX_DATASET_NAME_LEN] = "";
+    snap_suffix[0] = '\0';
+
+    if (strchr(argument, '@') != NULL) {
+        if (libze_util_split(argument, ZFS_MAX_DATASET_NAME_LEN, be_name, snap_suffix, '@') !=
+            LIBZE_ERROR_SUCCESS) {
+            return libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN, "Failed parsing snapshot (%s).\n",
+                                   argument);
+        }
+    } else if (strlcpy(be_name, argument, ZFS_MAX_DATASET_NAME_LEN) >= ZFS_MAX_DATASET_NAME_LEN) {
+        return libze_error_set(lzeh, LIBZE_ERROR_MAXPATHLEN,
+                               "Boot environment (%s) exceeds max length (%d).\n", argument,
+                               ZFS_MAX_DATASET_NAME_LEN);
+    }
+
+    libze_error ret = validate_existing_be(lzeh, be_name, be_ds, be_bpool_ds);
+    if (ret != LIBZE_ERROR_SUCCESS) {
+        return libze_error_prepend(lzeh, ret, "Failed validating boot environment (%s).\n",
+                                   be_name);
+    }
+
+    return LIBZE_ERROR_SUCCESS;
+}
+
+/**
+ * @brief Make sure a boot environment is mounted, ZFS can only report differences of mounted
+ *        filesystems. Unmounted boot environments are mounted for the rest of the mount session.
+ * @param[in] lzeh Initialized lzeh libze handle
+ * @param[in] be_name Boot environment name
+ * @param[in] be_ds Boot environment dataset
+ * @return @p LIBZE_ERROR_SUCCESS on success
+ */
+static libze_error
+diff_mount(libze_handle *lzeh, char const be_name[static 1], char const be_ds[static 1]) {
+    char mountpoint[LIBZE_MAX_PATH_LEN] = "";
+
+    zfs_handle_t *zh = zfs_open(lzeh->lzh, be_ds, ZFS_TYPE_FILESYSTEM);
+    if (zh == NULL) {
+        return libze_error_set(lzeh, LIBZE_ERROR_ZFS_OPEN, "Failed opening dataset (%s).\n",
+                               be_ds);
+    }
+    boolean_t mounted = dataset_is_mounted(lzeh, zh);
+    zfs_close(zh);
+
+    if (mounted) {
+        return LIBZE_ERROR_SUCCESS;
+    }
+    return libze_mount_session_get(lzeh, be_name, mountpoint);
+}
+
+/**
+ * @brief Write all of @p buf to @p fd
+ * @return non-zero on failure
+ */
+static int
+diff_write(int fd, char const *buf, size_t len) {
+    while (len > 0) {
+        ssize_t written = write(fd, buf, len);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += written;
+        len -= (size_t) written;
+    }
+    return 0;
+}
+
+/**
+ * @brief Write out the complete lines buffered for @p entry, or everything at the end of its
+ *        output, so that lines of concurrent diffs are never interleaved
+ */
+static int
+diff_flush(int outfd, diff_entry *entry, boolean_t end) {
+    size_t complete = entry->line_len;
+
+    if (!end && (entry->line_len < DIFF_LINE_LEN)) {
+        while ((complete > 0) && (entry->line[complete - 1] != '\n')) {
+            complete--;
+        }
+    }
+
+    if (diff_write(outfd, entry->line, complete) != 0) {
+        return -1;
+    }
+    (void) memmove(entry->line, entry->line + complete, entry->line_len - complete);
+    entry->line_len -= complete;
+    return 0;
+}
+
+/**
+ * @brief Start a process reporting the differences of @p entry. Every diff runs in its own
+ *        process with its own libzfs handle, a libzfs handle can't be shared between threads.
+ *        The output ends when the process exits, whether or not libzfs closes the descriptor.
+ * @param[in] flags @p diff_flags_t passed to @p zfs_show_diffs
+ * @return non-zero on failure
+ */
+static int
+diff_start(diff_entry *entry, int flags) {
+    int out_pipe[2] = {-1, -1};
+    int err_pipe[2] = {-1, -1};
+
+    if ((pipe(out_pipe) != 0) || (pipe(err_pipe) != 0)) {
+        goto err;
+    }
+
+    if ((entry->pid = fork()) == -1) {
+        goto err;
     }
 
-    /* Populate cdata from existing dataset or snap */
-    if (options->existing) {
-        ret = prepare_create_from_existing(lzeh, options->be_source, &cdata);
-        if (ret != LIBZE_ERROR_SUCCESS) {
-            return ret;
-        }
+    if (entry->pid == 0) {
+        char message[LIBZE_MAX_ERROR_LEN] = "";
+        char dataset[ZFS_MAX_DATASET_NAME_LEN] = "";
+        zfs_handle_t *zh = NULL;
+
+        (void) strlcpy(dataset, entry->from, ZFS_MAX_DATASET_NAME_LEN);
+        *strchr(dataset, '@') = '\0';
+
+        libzfs_handle_t *lzh = libzfs_init();
+        if (lzh == NULL) {
+            (void) strlcpy(message, "Failed to initialize libzfs", LIBZE_MAX_ERROR_LEN);
+        } else if (((zh = zfs_open(lzh, dataset, ZFS_TYPE_FILESYSTEM)) == NULL) ||
+                   (zfs_show_diffs(zh, out_pipe[1], entry->from, entry->to, flags) != 0)) {
+            (void) strlcpy(message, libzfs_error_description(lzh), LIBZE_MAX_ERROR_LEN);
+        }
+
+        if (strlen(message) > 0) {
+            (void) diff_write(err_pipe[1], message, strlen(message));
+            _exit(EXIT_FAILURE);
+        }
+        _exit(EXIT_SUCCESS);
+    }
+
+    (void) close(out_pipe[1]);
+    (void) close(err_pipe[1]);
+    entry->out_fd = out_pipe[0];
+    entry->err_fd = err_pipe[0];
+    return 0;
+
+err:
+    for (int i = 0; i < 2; i++) {
+        if (out_pipe[i] != -1) {
+            (void) close(out_pipe[i]);
+        }
+        if (err_pipe[i] != -1) {
+            (void) close(err_pipe[i]);
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Reap the process of @p entry once its output ended
+ * @param[in] lzeh Initialized lzeh libze handle
+ * @return @p LIBZE_ERROR_SUCCESS if the diff succeeded
+ */
+static libze_error
+diff_finish(libze_handle *lzeh, diff_entry *entry) {
+    char message[LIBZE_MAX_ERROR_LEN] = "";
+    int status = 0;
+
+    (void) close(entry->out_fd);
+    entry->out_fd = -1;
+
+    ssize_t len = read(entry->err_fd, message, LIBZE_MAX_ERROR_LEN - 1);
+    (void) close(entry->err_fd);
+    entry->err_fd = -1;
+
+    while ((waitpid(entry->pid, &status, 0) == -1) && (errno == EINTR)) {
+    }
+    entry->pid = -1;
+
+    if (WIFEXITED(status) && (WEXITSTATUS(status) == EXIT_SUCCESS)) {
+        return LIBZE_ERROR_SUCCESS;
+    }
+    if (len > 0) {
+        message[len] = '\0';
+    }
+    return libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN, "Failed to diff (%s) and (%s): %s\n",
+                           entry->from, entry->to, message);
+}
+
+/**
+ * @brief Run the diffs of all @p entries, at most @p nprocs at once, and merge their output into
+ *        @p outfd line by line as it arrives
+ * @return @p LIBZE_ERROR_SUCCESS if all diffs succeeded, otherwise the last failure is set
+ */
+static libze_error
+diff_run(libze_handle *lzeh, diff_entry *entries, size_t count, int flags, int outfd) {
+    libze_error ret = LIBZE_ERROR_SUCCESS;
+    size_t nprocs = (size_t) libze_taskq_nthreads((int) count);
+    size_t next = 0;
+    size_t running = 0;
+
+    struct pollfd *pfds = calloc(count, sizeof(struct pollfd));
+    if (pfds == NULL) {
+        return libze_error_nomem(lzeh);
+    }
+    for (size_t i = 0; i < count; i++) {
+        pfds[i] = (struct pollfd){.fd = -1, .events = POLLIN};
+    }
 
-        if (lzeh->bootpool.pool_zhdl != NULL) {
-            /* Setup source as (boot pool root)/env/(existing name)
-             * Since from existing, use snap suffix from existing */
-            char dest_ds_buf[ZFS_MAX_DATASET_NAME_LEN] = "";
-            char dest_snap_buf[ZFS_MAX_DATASET_NAME_LEN] = "";
-            ret = prepare_existing_boot_pool_data(lzeh, options->be_source, options->be_name,
-                                                  dest_ds_buf, dest_snap_buf);
-            if (ret != LIBZE_ERROR_SUCCESS) {
-                return ret;
-            }
-            ret = prepare_create_from_existing(lzeh, dest_ds_buf, &boot_pool_cdata);
-            if (ret != LIBZE_ERROR_SUCCESS) {
-                return ret;
+    while ((next < count) || (running > 0)) {
+        while ((next < count) && (running < nprocs)) {
+            if (diff_start(&entries[next], flags) != 0) {
+                ret = libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN, "Failed to start diff of (%s).\n",
+                                      entries[next].from);
+            } else {
+                pfds[next].fd = entries[next].out_fd;
+                running++;
             }
+            next++;
         }
-    } else { // Populate cdata from bootfs
-        cdata.is_snap = B_FALSE;
-        if (strlcpy(cdata.source_dataset, lzeh->env_activated_path, ZFS_MAX_DATASET_NAME_LEN) >=
-            ZFS_MAX_DATASET_NAME_LEN) {
-            return libze_error_set(lzeh, LIBZE_ERROR_MAXPATHLEN,
-                                   "Source dataset %s exceeds max dataset length.\n",
-                                   lzeh->env_activated_path);
-        }
-        char snap_buf[ZFS_MAX_DATASET_NAME_LEN];
-        (void) gen_snap_suffix(ZFS_MAX_DATASET_NAME_LEN, cdata.snap_suffix);
-        int len = libze_util_concat(cdata.source_dataset, "@", cdata.snap_suffix,
-                                    ZFS_MAX_DATASET_NAME_LEN, snap_buf);
-        if (len != LIBZE_ERROR_SUCCESS) {
-            return libze_error_set(lzeh, LIBZE_ERROR_MAXPATHLEN,
-                                   "Source dataset snapshot will exceed max dataset length.\n");
+
+        if (running == 0) {
+            continue;
         }
 
-        if (zfs_snapshot(lzeh->lzh, snap_buf, options->recursive, NULL) != 0) {
-            return libze_error_set(lzeh, LIBZE_ERROR_MAXPATHLEN, "Failed to create snapshot %s.\n",
-                                   snap_buf);
+        if (poll(pfds, count, -1) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // Stop reading, reap below
+            ret = libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN, "Failed to poll diffs: %s\n",
+                                  strerror(errno));
+            break;
         }
 
-        if (lzeh->bootpool.pool_zhdl != NULL) {
-            boot_pool_cdata.is_snap = B_FALSE;
-            (void) libze_util_concat(lzeh->bootpool.root_path_full, lzeh->env_running, "",
-                                     ZFS_MAX_DATASET_NAME_LEN, boot_pool_cdata.source_dataset);
-            (void) strlcpy(boot_pool_cdata.snap_suffix, cdata.snap_suffix,
-                           ZFS_MAX_DATASET_NAME_LEN);
-            if (libze_util_concat(boot_pool_cdata.source_dataset, "@", boot_pool_cdata.snap_suffix,
-                                  ZFS_MAX_DATASET_NAME_LEN, snap_buf) != LIBZE_ERROR_SUCCESS) {
-                return libze_error_set(
-                    lzeh, LIBZE_ERROR_MAXPATHLEN,
-                    "Source boot pool dataset snapshot (%s@%s) exceeds max dataset length (%d).\n",
-                    boot_pool_cdata.source_dataset, boot_pool_cdata.snap_suffix,
-                    ZFS_MAX_DATASET_NAME_LEN);
+        for (size_t i = 0; i < count; i++) {
+            if ((pfds[i].fd == -1) || (pfds[i].revents == 0)) {
+                continue;
             }
-            if (zfs_snapshot(lzeh->lzh, snap_buf, options->recursive, NULL) != 0) {
-                return libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN,
-                                       "Failed to create snapshot (%s).\n", snap_buf);
+            diff_entry *entry = &entries[i];
+            ssize_t len = read(entry->out_fd, entry->line + entry->line_len,
+                               DIFF_LINE_LEN - entry->line_len);
+            if ((len < 0) && (errno == EINTR)) {
+                continue;
+            }
+            if (len > 0) {
+                entry->line_len += (size_t) len;
+            }
+            (void) diff_flush(outfd, entry, len <= 0);
+            if (len <= 0) {
+                pfds[i].fd = -1;
+                running--;
+                libze_error finish_ret = diff_finish(lzeh, entry);
+                if (finish_ret != LIBZE_ERROR_SUCCESS) {
+                    ret = finish_ret;
+                }
             }
         }
     }
 
-    /* Validate new boot environment */
-    char new_ds[ZFS_MAX_DATASET_NAME_LEN] = "";
-    char new_bpool_ds[ZFS_MAX_DATASET_NAME_LEN] = "";
-    if (validate_new_be(lzeh, options->be_name, new_ds, new_bpool_ds) != LIBZE_ERROR_SUCCESS) {
-        return libze_error_prepend(lzeh, lzeh->libze_error,
-                                   "Failed to validate new boot environment (%s)!\n",
-                                   options->be_name);
+    for (size_t i = 0; i < count; i++) {
+        if (entries[i].pid != -1) {
+            (void) diff_finish(lzeh, &entries[i]);
+        }
     }
 
-    if (libze_clone(lzeh, cdata.source_dataset, cdata.snap_suffix, new_ds, options->recursive) !=
+    free(pfds);
+    return ret;
+}
+
+/**
+ * @brief Report the differences between two boot environments, or a boot environment and one of
+ *        its snapshots. Datasets of both boot environments are paired by their relative name,
+ *        and the differences of all pairs are computed concurrently.
+ * @param[in] lzeh Initialized lzeh libze handle
+ * @param[in] options Diff options
+ * @return @p LIBZE_ERROR_SUCCESS on success
+ */
+libze_error
+libze_diff(libze_handle *lzeh, libze_diff_options *options) {
+    libze_error ret = LIBZE_ERROR_SUCCESS;
+    char from_be[ZFS_MAX_DATASET_NAME_LEN] = "";
+    char from_ds[ZFS_MAX_DATASET_NAME_LEN] = "";
+    char from_snap[ZFS_MAX_DATASET_NAME_LEN] = "";
+    char to_be[ZFS_MAX_DATASET_NAME_LEN] = "";
+    char to_ds[ZFS_MAX_DATASET_NAME_LEN] = "";
+    char to_snap[ZFS_MAX_DATASET_NAME_LEN] = "";
+
+    if ((ret = diff_resolve(lzeh, options->from, from_be, from_ds, from_snap)) !=
         LIBZE_ERROR_SUCCESS) {
-        return LIBZE_ERROR_UNKNOWN;
+        return ret;
     }
 
-    if (strlen(new_bpool_ds) > 0) {
-        if (libze_clone(lzeh, boot_pool_cdata.source_dataset, boot_pool_cdata.snap_suffix,
-                        new_bpool_ds, options->recursive) != LIBZE_ERROR_SUCCESS) {
+    if (options->to == NULL) {
+        if (strlen(from_snap) == 0) {
             return libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN,
-                                   "The dataset on the bootpool (%s) can't be cloned.\n",
-                                   new_bpool_ds);
+                                   "A snapshot of (%s) is required to compare it to itself.\n",
+                                   from_be);
         }
+        (void) strlcpy(to_be, from_be, ZFS_MAX_DATASET_NAME_LEN);
+        (void) strlcpy(to_ds, from_ds, ZFS_MAX_DATASET_NAME_LEN);
+    } else if ((ret = diff_resolve(lzeh, options->to, to_be, to_ds, to_snap)) !=
+               LIBZE_ERROR_SUCCESS) {
+        return ret;
     }
 
-    ret = post_create(lzeh, options, cdata.is_snap);
+    // Without a snapshot, compare from the snapshot the other boot environment was cloned from
+    if (strlen(from_snap) == 0) {
+        char origin[ZFS_MAX_DATASET_NAME_LEN] = "";
+        size_t from_len = strlen(from_ds);
+
+        zfs_handle_t *zh = zfs_open(lzeh->lzh, to_ds, ZFS_TYPE_FILESYSTEM);
+        if (zh == NULL) {
+            return libze_error_set(lzeh, LIBZE_ERROR_ZFS_OPEN, "Failed opening dataset (%s).\n",
+                                   to_ds);
+        }
+        int err = zfs_prop_get(zh, ZFS_PROP_ORIGIN, origin, ZFS_MAX_DATASET_NAME_LEN, NULL, NULL,
+                               0, 1);
+        zfs_close(zh);
+
+        if ((err != 0) || (strncmp(origin, from_ds, from_len) != 0) ||
+            (origin[from_len] != '@')) {
+            return libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN,
+                                   "Boot environment (%s) wasn't created from (%s), "
+                                   "specify a snapshot to compare from.\n",
+                                   to_be, from_be);
+        }
+        (void) strlcpy(from_snap, origin + from_len + 1, ZFS_MAX_DATASET_NAME_LEN);
+    }
+
+    if (((ret = diff_mount(lzeh, from_be, from_ds)) != LIBZE_ERROR_SUCCESS) ||
+        ((strcmp(from_be, to_be) != 0) &&
+         ((ret = diff_mount(lzeh, to_be, to_ds)) != LIBZE_ERROR_SUCCESS))) {
+        return libze_error_prepend(lzeh, ret, "Failed to mount boot environments to diff.\n");
+    }
+
+    diff_collect_cbdata cbd = {.lzeh = lzeh,
+                               .from_ds = from_ds,
+                               .from_snap = from_snap,
+                               .to_ds = to_ds,
+                               .to_snap = to_snap,
+                               .entries = NULL,
+                               .count = 0,
+                               .capacity = 0};
+
+    zfs_handle_t *from_zh = zfs_open(lzeh->lzh, from_ds, ZFS_TYPE_FILESYSTEM);
+    if (from_zh == NULL) {
+        return libze_error_set(lzeh, LIBZE_ERROR_ZFS_OPEN, "Failed opening dataset (%s).\n",
+                               from_ds);
+    }
+    // Closes from_zh
+    if (diff_collect_cb(from_zh, &cbd) != 0) {
+        ret = lzeh->libze_error;
+        goto err;
+    }
+
+    if (cbd.count == 0) {
+        ret = libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN, "No datasets of (%s@%s) to compare.\n",
+                              from_be, from_snap);
+        goto err;
+    }
 
+    ret = diff_run(lzeh, cbd.entries, cbd.count, options->flags, options->outfd);
+
+err:
+    free(cbd.entries);
     return ret;
 }
 
-/*************************************
- ************** destroy **************
- *************************************/
+/********************************
+ ************** gc **************
+ ********************************/
 
-typedef struct libze_destroy_cbdata {
+typedef struct libze_gc_cbdata {
     libze_handle *lzeh;
-    libze_destroy_options *options;
-} libze_destroy_cbdata;
+    nvlist_t *snapshots;
+} libze_gc_cbdata;
 
 /**
- * @brief Destroy callback called for each child recursively
- * @param zh Handle of each dataset to dataset
- * @param data @p libze_destroy_cbdata callback data
+ * @brief Snapshot callback, add snapshot to @p cbd->snapshots if it was tagged by libze,
+ *        has no dependent clones and no user holds.
+ * @param zh Handle of snapshot
+ * @param data @p libze_gc_cbdata callback data
  * @return non-zero if not successful
  */
 static int
-libze_destroy_cb(zfs_handle_t *zh, void *data) {
+gc_snapshot_cb(zfs_handle_t *zh, void *data) {
     int ret = 0;
-    libze_destroy_cbdata *cbd = data;
-
+    libze_gc_cbdata *cbd = data;
     char const *ds = zfs_get_name(zh);
-    if (zfs_is_mounted(zh, NULL)) {
-        if (cbd->options->force) {
-            zfs_unmount(zh, NULL, 0);
-        } else {
-            return libze_error_set(cbd->lzeh, LIBZE_ERROR_UNKNOWN,
-                                   "Dataset %s is mounted, run with force or unmount dataset\n",
-                                   ds);
-        }
-    }
 
-    zfs_handle_t *origin_h = NULL;
-    // Dont run destroy_origin if snap callback
-    if ((strchr(zfs_get_name(zh), '@') == NULL) && cbd->options->destroy_origin) {
-        // Check if clone, origin snapshot saved to buffer
-        char buf[ZFS_MAX_DATASET_NAME_LEN];
-        if (zfs_prop_get(zh, ZFS_PROP_ORIGIN, buf, ZFS_MAX_DATASET_NAME_LEN, NULL, NULL, 0, 1) ==
-            0) {
-            // Destroy origin snapshot
-            origin_h = zfs_open(cbd->lzeh->lzh, buf, ZFS_TYPE_SNAPSHOT);
-            if (origin_h == NULL) {
-                return libze_error_set(cbd->lzeh, LIBZE_ERROR_UNKNOWN,
-                                       "Failed to open origin snapshot %s\n", buf);
-            }
-        }
+    // Only consider snapshots the tag was set on directly, not inherited from their dataset
+    if (!user_prop_is_local(zh, ZE_PROP_SNAPSHOT)) {
+        goto fin;
     }
 
-    // Destroy children recursively
-    if (zfs_iter_children(zh, libze_destroy_cb, cbd) != 0) {
-        return libze_error_set(cbd->lzeh, LIBZE_ERROR_UNKNOWN,
-                               "Failed to iterate over children of %s\n", ds);
-    }
-    // Destroy dataset, ignore error if inner snap recurse so destroy continues
-    if (zfs_destroy(zh, B_FALSE) != 0) {
-        return libze_error_set(cbd->lzeh, LIBZE_ERROR_UNKNOWN, "Failed to destroy dataset %s\n",
-                               ds);
+    if ((zfs_prop_get_int(zh, ZFS_PROP_NUMCLONES) != 0) ||
+        (zfs_prop_get_int(zh, ZFS_PROP_USERREFS) != 0)) {
+        goto fin;
     }
 
-    if (cbd->options->destroy_origin && (origin_h != NULL)) {
-        if ((ret = libze_destroy_cb(origin_h, cbd)) != 0) {
-            libze_error_set(cbd->lzeh, LIBZE_ERROR_UNKNOWN,
-                            "Failed to destroy origin snapshot %s\n", zfs_get_name(origin_h));
-        }
-        zfs_close(origin_h);
+    if (nvlist_add_boolean(cbd->snapshots, ds) != 0) {
+        ret = libze_error_nomem(cbd->lzeh);
     }
 
+fin:
+    zfs_close(zh);
     return ret;
 }
 
+static int
+gc_filesystem_cb(zfs_handle_t *zh, void *data);
+
 /**
- * @brief Destroy a boot environment clone or dataset
- * @param lzeh Initialized @p libze_handle
- * @param options Destroy options
- * @param filesystem Clone or boot environment full name
- * @return @p LIBZE_ERROR_SUCCESS on success,
- *         @p LIBZE_ERROR_ZFS_OPEN if @p filesystem can't be opened,
- *         @p LIBZE_ERROR_EEXIST if @p filesystem doesn't exist,
+ * @brief Collect orphaned snapshots of @p zh and all of its children
+ * @param zh Handle of filesystem
+ * @param data @p libze_gc_cbdata callback data
+ * @return non-zero if not successful
  */
-static libze_error
-destroy_filesystem(libze_handle *lzeh, libze_destroy_options *options,
-                   char const filesystem[ZFS_MAX_DATASET_NAME_LEN]) {
-    libze_error ret = LIBZE_ERROR_SUCCESS;
+static int
+gc_collect(zfs_handle_t *zh, void *data) {
+    libze_gc_cbdata *cbd = data;
 
-    if (!zfs_dataset_exists(lzeh->lzh, filesystem, ZFS_TYPE_FILESYSTEM)) {
-        return libze_error_set(lzeh, LIBZE_ERROR_EEXIST, "Dataset %s does not exist\n", filesystem);
+    if (zfs_iter_snapshots(zh, B_FALSE, gc_snapshot_cb, cbd, 0, 0) != 0) {
+        return libze_error_set(cbd->lzeh, LIBZE_ERROR_UNKNOWN,
+                               "Failed to iterate over snapshots of %s.\n", zfs_get_name(zh));
     }
-    zfs_handle_t *be_zh = NULL;
-    be_zh = zfs_open(lzeh->lzh, filesystem, ZFS_TYPE_FILESYSTEM);
-    if (be_zh == NULL) {
-        return libze_error_set(lzeh, LIBZE_ERROR_ZFS_OPEN, "Failed opening dataset %s\n",
-                               filesystem);
+    if (zfs_iter_filesystems(zh, gc_filesystem_cb, cbd) != 0) {
+        return libze_error_set(cbd->lzeh, LIBZE_ERROR_UNKNOWN,
+                               "Failed to iterate over children of %s.\n", zfs_get_name(zh));
     }
 
-    libze_destroy_cbdata cbd = {.lzeh = lzeh, .options = options};
-
-    if (libze_destroy_cb(be_zh, &cbd) != 0) {
-        ret = LIBZE_ERROR_UNKNOWN;
-    }
-    zfs_close(be_zh);
+    return 0;
+}
 
+/**
+ * @brief Filesystem callback for @p gc_collect
+ * @param zh Handle of filesystem, closed on exit
+ * @param data @p libze_gc_cbdata callback data
+ * @return non-zero if not successful
+ */
+static int
+gc_filesystem_cb(zfs_handle_t *zh, void *data) {
+    int ret = gc_collect(zh, data);
+    zfs_close(zh);
     return ret;
 }
 
 /**
- * @brief Destroy a boot environment snapshot
- * @param lzeh Initialized @p libze_handle
- * @param options Destroy options
- * @param snapshot Snapshot full name
- * @param snapshot_bpool Snapshot full name on bootpool or NULL if not used
- * @return @p LIBZE_ERROR_SUCCESS on success
+ * @brief Collect orphaned snapshots below the dataset @p root
+ * @param lzeh Initialized libze handle
+ * @param root Dataset to search below
+ * @param cbd Callback data to collect into
+ * @return @p LIBZE_ERROR_SUCCESS on success,
+ *         @p LIBZE_ERROR_ZFS_OPEN if @p root can't be opened,
+ *         @p LIBZE_ERROR_UNKNOWN on failure
  */
 static libze_error
-destroy_snapshot(libze_handle *lzeh, libze_destroy_options *options,
-                 char const snapshot[ZFS_MAX_DATASET_NAME_LEN],
-                 char const snapshot_bpool[ZFS_MAX_DATASET_NAME_LEN]) {
-    if (!zfs_dataset_exists(lzeh->lzh, snapshot, ZFS_TYPE_SNAPSHOT)) {
-        return libze_error_set(lzeh, LIBZE_ERROR_EEXIST, "Snapshot %s does not exist\n", snapshot);
-    }
-    char be_snap_ds_buff[ZFS_MAX_DATASET_NAME_LEN] = "";
-    char be_full_ds[ZFS_MAX_DATASET_NAME_LEN] = "";
-
-    // Get boot environment name, we know ZFS_MAX_DATASET_NAME_LEN wont be exceeded
-    (void) libze_util_cut(options->be_name, ZFS_MAX_DATASET_NAME_LEN, be_snap_ds_buff, '@');
-
-    /* Validate that snapshot is from a boot environment */
-    if (validate_existing_be(lzeh, be_snap_ds_buff, NULL, NULL) != LIBZE_ERROR_SUCCESS) {
-        return libze_error_prepend(lzeh, lzeh->libze_error,
-                                   "Failed to validate corresponding boot environment (%s) to "
-                                   " snapshot!\n",
-                                   be_snap_ds_buff);
-    }
-
-    zfs_handle_t *be_zh = zfs_open(lzeh->lzh, snapshot, ZFS_TYPE_SNAPSHOT);
-    if (be_zh == NULL) {
-        return libze_error_set(lzeh, LIBZE_ERROR_ZFS_OPEN, "Failed opening snapshot (%s).\n",
-                               snapshot);
-    }
-    if (zfs_destroy(be_zh, B_FALSE) != 0) {
-        zfs_close(be_zh);
-        return libze_error_set(lzeh, LIBZE_ERROR_EEXIST, "Failed to destroy snapshot %s\n",
-                               snapshot);
-    }
-    zfs_close(be_zh);
-
-    if (snapshot_bpool != NULL) {
-        if (!zfs_dataset_exists(lzeh->lzh, snapshot_bpool, ZFS_TYPE_SNAPSHOT)) {
-            return libze_error_set(lzeh, LIBZE_ERROR_EEXIST,
-                                   "Snapshot on bootpool (%s) does not exist.\n", snapshot_bpool);
-        }
-        zfs_handle_t *be_bpool_zh = zfs_open(lzeh->lzh, snapshot_bpool, ZFS_TYPE_SNAPSHOT);
-        if (be_bpool_zh == NULL) {
-            return libze_error_set(lzeh, LIBZE_ERROR_ZFS_OPEN,
-                                   "Failed opening snapshot on bootpool (%s).\n", snapshot_bpool);
-        }
-        if (zfs_destroy(be_bpool_zh, B_FALSE) != 0) {
-            zfs_close(be_bpool_zh);
-            return libze_error_set(lzeh, LIBZE_ERROR_EEXIST,
-                                   "Failed to destroy snapshot on bootpool (%s).\n",
-                                   snapshot_bpool);
-        }
-        zfs_close(be_bpool_zh);
+gc_collect_root(libze_handle *lzeh, char const root[static 1], libze_gc_cbdata *cbd) {
+    zfs_handle_t *zh = zfs_open(lzeh->lzh, root, ZFS_TYPE_FILESYSTEM);
+    if (zh == NULL) {
+        return libze_error_set(lzeh, LIBZE_ERROR_ZFS_OPEN, "Failed opening dataset (%s).\n",
+                               root);
     }
 
-    return LIBZE_ERROR_SUCCESS;
+    libze_error ret = (gc_collect(zh, cbd) != 0) ? lzeh->libze_error : LIBZE_ERROR_SUCCESS;
+    zfs_close(zh);
+    return ret;
 }
 
 /**
- * @brief Destroy a boot environment
- * @param lzeh Initialized @p libze_handle
- * @param options Destroy options
+ * @brief Destroy snapshots implicitly created by libze which no longer have any dependent
+ *        clones. Snapshots explicitly created with @p libze_snapshot are never removed.
+ *        All orphaned snapshots are destroyed in a single batch.
+ * @param[in] lzeh Initialized libze handle
+ * @param[in] options gc options, if @p options->noop is set nothing is destroyed
+ * @param[out] outnvl nvlist of orphaned snapshot names, should be freed by the caller
  * @return @p LIBZE_ERROR_SUCCESS on success
+ *
+ * @pre lzeh != NULL
+ * @pre options != NULL
  */
 libze_error
-libze_destroy(libze_handle *lzeh, libze_destroy_options *options) {
+libze_gc(libze_handle *lzeh, libze_gc_options *options, nvlist_t **outnvl) {
     libze_error ret = LIBZE_ERROR_SUCCESS;
-    zfs_handle_t *be_zh = NULL, *be_bpool_zh = NULL;
-    char be_ds[ZFS_MAX_DATASET_NAME_LEN] = "";
-    char be_bpool_ds[ZFS_MAX_DATASET_NAME_LEN] = "";
-
-    if ((strchr(options->be_name, '@') == NULL)) {
-        if (open_boot_environment(lzeh, options->be_name, &be_zh, be_ds, &be_bpool_zh,
-                                  be_bpool_ds) != LIBZE_ERROR_SUCCESS) {
-            return libze_error_prepend(lzeh, lzeh->libze_error,
-                                       "Failed to open boot environment (%s) which should be "
-                                       "destroyed.\n",
-                                       options->be_name);
-        }
+    libze_gc_cbdata cbd = {.lzeh = lzeh, .snapshots = NULL};
 
-        if (libze_is_active_be(lzeh, be_ds)) {
-            ret =
-                libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN,
-                                "Cannot destroy active boot environment (%s).\n", options->be_name);
-            goto err;
-        }
-        if (libze_is_root_be(lzeh, be_ds)) {
-            ret = libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN,
-                                  "Cannot destroy root boot environment (%s).\n", options->be_name);
-            goto err;
-        }
+    if ((cbd.snapshots = fnvlist_alloc()) == NULL) {
+        return libze_error_nomem(lzeh);
+    }
 
-        if ((ret = destroy_filesystem(lzeh, options, be_ds)) != LIBZE_ERROR_SUCCESS) {
-            ret = libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN,
-                                  "Failed to destroy the requested boot environment (%s).\n",
-                                  options->be_name);
-            goto err;
-        }
+    if ((ret = gc_collect_root(lzeh, lzeh->env_root, &cbd)) != LIBZE_ERROR_SUCCESS) {
+        goto err;
+    }
 
-        if (be_bpool_zh != NULL) {
-            libze_destroy_cbdata cbd = {.lzeh = lzeh, .options = options};
-            if (libze_destroy_cb(be_bpool_zh, &cbd) != 0) {
-                ret = libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN,
-                                      "Failed to destroy the requested boot environment on bootpool"
-                                      " (%s).\n",
-                                      options->be_name);
-            }
-        err:
-            zfs_close(be_zh);
-            if (be_bpool_zh != NULL) {
-                zfs_close(be_bpool_zh);
-            }
-            return ret;
-        }
-    } else {
-        if (libze_util_concat(lzeh->env_root, "/", options->be_name, ZFS_MAX_DATASET_NAME_LEN,
-                              be_ds) != LIBZE_ERROR_SUCCESS) {
-            return libze_error_set(lzeh, LIBZE_ERROR_MAXPATHLEN,
-                                   "The snapshot name (%s%s) exceeds max length (%d).\n",
-                                   lzeh->env_root, options->be_name, ZFS_MAX_DATASET_NAME_LEN);
-        }
-        if (lzeh->bootpool.pool_zhdl != NULL) {
-            if (libze_util_concat(lzeh->bootpool.root_path_full, "", options->be_name,
-                                  ZFS_MAX_DATASET_NAME_LEN, be_bpool_ds) != LIBZE_ERROR_SUCCESS) {
-                return libze_error_set(lzeh, LIBZE_ERROR_MAXPATHLEN,
-                                       "The snapshot name for the bootpool (%s%s) exceeds max "
-                                       "length (%d).\n",
-                                       lzeh->env_root, options->be_name, ZFS_MAX_DATASET_NAME_LEN);
-            }
-        }
-        if ((ret = destroy_snapshot(lzeh, options, be_ds, be_bpool_ds)) != LIBZE_ERROR_SUCCESS) {
-            return ret;
-        }
+    if ((lzeh->bootpool.pool_zhdl != NULL) &&
+        ((ret = gc_collect_root(lzeh, lzeh->bootpool.root_path, &cbd)) != LIBZE_ERROR_SUCCESS)) {
+        goto err;
     }
 
-    if ((lzeh->lz_funcs != NULL) &&
-        (lzeh->lz_funcs->plugin_post_destroy(lzeh, options->be_name) != 0)) {
-        return LIBZE_ERROR_PLUGIN;
+    if (!options->noop && !nvlist_empty(cbd.snapshots) &&
+        (zfs_destroy_snaps_nvl(lzeh->lzh, cbd.snapshots, B_FALSE) != 0)) {
+        ret = libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN,
+                              "Failed to destroy orphaned snapshots.\n");
+        goto err;
     }
 
+    *outnvl = cbd.snapshots;
+    return ret;
+err:
+    fnvlist_free(cbd.snapshots);
     return ret;
 }
 
@@ -2251,7 +4590,6 @@ libze_list_cb(zfs_handle_t *zhdl, void *data) {
     char prop_buffer[ZFS_MAXPROPLEN] = "";
     char dataset[ZFS_MAX_DATASET_NAME_LEN] = "";
     char be_name[ZFS_MAX_DATASET_NAME_LEN] = "";
-    char mountpoint[ZFS_MAX_DATASET_NAME_LEN] = "";
     nvlist_t *props = NULL;
 
     char const *handle_name = zfs_get_name(zhdl);
@@ -2277,24 +4615,14 @@ libze_list_cb(zfs_handle_t *zhdl, void *data) {
     }
     fnvlist_add_string(props, "name", be_name);
 
-    // Mountpoint
-    char mounted[ZFS_MAX_DATASET_NAME_LEN];
-    if (zfs_prop_get(zhdl, ZFS_PROP_MOUNTED, mounted, ZFS_MAX_DATASET_NAME_LEN, NULL, NULL, 0, 1) !=
-        0) {
-        ret = libze_error_set(cbd->lzeh, LIBZE_ERROR_UNKNOWN, "Failed get 'mounted' for %s.\n",
-                              handle_name);
+    // Mountpoint, from the mount table snapshot shared by all boot environments
+    char const *mountpoint = libze_mnttab_mountpoint(cbd->lzeh, dataset);
+    if ((mountpoint == NULL) && (cbd->lzeh->libze_error != LIBZE_ERROR_SUCCESS)) {
+        ret = cbd->lzeh->libze_error;
         goto err;
     }
 
-    int is_mounted = strcmp(mounted, "yes");
-    if (is_mounted == 0) {
-        if (zfs_prop_get(zhdl, ZFS_PROP_MOUNTPOINT, mountpoint, ZFS_MAX_DATASET_NAME_LEN, NULL,
-                         NULL, 0, 1) != 0) {
-            ret = libze_error_set(cbd->lzeh, LIBZE_ERROR_UNKNOWN,
-                                  "Failed get 'mountpoint' for %s.\n", handle_name);
-            goto err;
-        }
-    }
+    int is_mounted = (mountpoint != NULL) ? 0 : 1;
     fnvlist_add_string(props, "mountpoint", (is_mounted == 0) ? mountpoint : "-");
 
     // Creation
@@ -2367,11 +4695,6 @@ err:
  ************** Mount **************
  *********************************/
 
-typedef struct libze_mount_cb_data {
-    libze_handle *lzeh;
-    char const *mountpoint;
-} libze_mount_cb_data;
-
 /**
  * @brief Create a directory
  * @param path Path of directory to create if it doesn't exist
@@ -2387,64 +4710,460 @@ directory_create_if_nonexistent(char const path[static 1]) {
     return mkdir(path, 0700);
 }
 
+typedef struct mount_entry {
+    char dataset[ZFS_MAX_DATASET_NAME_LEN];
+    char mountpoint[LIBZE_MAX_PATH_LEN];
+    mount_tree *tree;
+} mount_entry;
+
+struct mount_tree {
+    mount_entry *entries;
+    size_t count;
+    size_t capacity;
+    libze_taskq *tq;
+    pthread_mutex_t lock;
+    /**< Index of the first entry which failed to mount, @p count if none failed */
+    size_t failed;
+    /**< Mount entries read-only */
+    boolean_t readonly;
+};
+
+/**
+ * @brief Add a dataset to be mounted to @p tree
+ * @return non-zero on failure
+ */
+static int
+mount_tree_add(mount_tree *tree, char const dataset[static 1], char const mountpoint[static 1]) {
+    if (tree->count == tree->capacity) {
+        size_t capacity = (tree->capacity == 0) ? 16 : tree->capacity * 2;
+        mount_entry *entries = realloc(tree->entries, capacity * sizeof(mount_entry));
+        if (entries == NULL) {
+            return -1;
+        }
+        tree->entries = entries;
+        tree->capacity = capacity;
+    }
+
+    mount_entry *entry = &tree->entries[tree->count++];
+    (void) strlcpy(entry->dataset, dataset, ZFS_MAX_DATASET_NAME_LEN);
+    (void) strlcpy(entry->mountpoint, mountpoint, LIBZE_MAX_PATH_LEN);
+    entry->tree = tree;
+    return 0;
+}
+
 /**
- * @brief Mount callback called for each child of boot environment
- * @param zh Handle to current dataset to mount
+ * @brief Collect callback called for each child of boot environment, adds every mountable
+ *        dataset to @p data->tree
+ * @param zh Handle to current dataset, closed on exit
  * @param data @p libze_mount_cb_data object
  * @return Non-zero on failure.
  */
 static int
-mount_callback(zfs_handle_t *zh, void *data) {
+mount_collect_cb(zfs_handle_t *zh, void *data) {
+    int ret = 0;
     libze_mount_cb_data *cbd = data;
     char const *dataset = zfs_get_name(zh);
     char prop_buf[ZFS_MAXPROPLEN];
+    char mountpoint_buf[LIBZE_MAX_PATH_LEN];
+    char snapshot_buf[ZFS_MAX_DATASET_NAME_LEN];
+
+    if (cbd->snapshot != NULL) {
+        if (libze_util_concat(dataset, "@", cbd->snapshot, ZFS_MAX_DATASET_NAME_LEN,
+                              snapshot_buf) != LIBZE_ERROR_SUCCESS) {
+            ret = libze_error_set(cbd->lzeh, LIBZE_ERROR_MAXPATHLEN,
+                                  "Exceeded max dataset name length for %s@%s.\n", dataset,
+                                  cbd->snapshot);
+            goto fin;
+        }
+        // Created after the snapshot was taken, nothing to mount
+        if (!zfs_dataset_exists(cbd->lzeh->lzh, snapshot_buf, ZFS_TYPE_SNAPSHOT)) {
+            goto fin;
+        }
+        dataset = snapshot_buf;
+    }
 
     // Get mountpoint
     if (zfs_prop_get(zh, ZFS_PROP_MOUNTPOINT, prop_buf, ZFS_MAXPROPLEN, NULL, NULL, 0, 1) != 0) {
-        (void) libze_error_set(cbd->lzeh, LIBZE_ERROR_UNKNOWN, "Failed to get mountpoint for %s\n.",
-                               dataset);
+        ret = libze_error_set(cbd->lzeh, LIBZE_ERROR_UNKNOWN, "Failed to get mountpoint for %s\n.",
+                              dataset);
+        goto fin;
+    }
+
+    // No mountpoint, just for heirarchy, or not ZFS managed so skip
+    if ((strcmp(prop_buf, "none") != 0) && (strcmp(prop_buf, "legacy") != 0)) {
+        if (libze_util_concat(cbd->mountpoint, "", prop_buf, LIBZE_MAX_PATH_LEN, mountpoint_buf) !=
+            LIBZE_ERROR_SUCCESS) {
+            ret = libze_error_set(cbd->lzeh, LIBZE_ERROR_MAXPATHLEN,
+                                  "Exceeded max path length for mount\n.");
+            goto fin;
+        }
+
+        if ((cbd->snapshot == NULL) && dataset_is_mounted(cbd->lzeh, zh)) {
+            ret = libze_error_set(cbd->lzeh, LIBZE_ERROR_ZFS_OPEN,
+                                  "Dataset %s is already mounted\n", dataset);
+            goto fin;
+        }
+
+        if (mount_tree_add(cbd->tree, dataset, mountpoint_buf) != 0) {
+            ret = libze_error_nomem(cbd->lzeh);
+            goto fin;
+        }
+    }
+
+    ret = zfs_iter_filesystems(zh, mount_collect_cb, cbd);
+
+fin:
+    zfs_close(zh);
+    return ret;
+}
+
+/**
+ * @brief Order mountpoints so that every mountpoint sorts directly before its descendants.
+ *        '/' sorts before any other character, so "/a/b" is placed between "/a" and "/a-b".
+ *        Datasets sharing a mountpoint are ordered by name.
+ */
+static int
+mount_entry_compare(void const *a, void const *b) {
+    char const *mp_a = ((mount_entry const *) a)->mountpoint;
+    char const *mp_b = ((mount_entry const *) b)->mountpoint;
+
+    while ((*mp_a != '\0') && (*mp_a == *mp_b)) {
+        mp_a++;
+        mp_b++;
+    }
+
+    if (*mp_a == *mp_b) {
+        return strcmp(((mount_entry const *) a)->dataset, ((mount_entry const *) b)->dataset);
+    }
+    if (*mp_a == '\0') {
+        return -1;
+    }
+    if (*mp_b == '\0') {
+        return 1;
+    }
+    if (*mp_a == '/') {
         return -1;
     }
+    if (*mp_b == '/') {
+        return 1;
+    }
+    return (*mp_a < *mp_b) ? -1 : 1;
+}
+
+/**
+ * @brief Get the index of the next entry after @p idx which isn't mounted on or below the
+ *        mountpoint of @p idx
+ */
+static size_t
+mount_tree_next_sibling(mount_tree *tree, size_t idx) {
+    char const *parent = tree->entries[idx].mountpoint;
+    size_t len = strlen(parent);
+    size_t next = idx + 1;
+
+    while ((next < tree->count) && (strncmp(tree->entries[next].mountpoint, parent, len) == 0) &&
+           ((tree->entries[next].mountpoint[len] == '/') ||
+            (tree->entries[next].mountpoint[len] == '\0'))) {
+        next++;
+    }
+    return next;
+}
+
+/**
+ * @brief Get the index of the next entry after @p idx with a different mountpoint
+ */
+static size_t
+mount_tree_group_end(mount_tree *tree, size_t idx) {
+    size_t next = idx + 1;
+
+    while ((next < tree->count) &&
+           (strcmp(tree->entries[next].mountpoint, tree->entries[idx].mountpoint) == 0)) {
+        next++;
+    }
+    return next;
+}
+
+static void
+mount_tree_failed(mount_tree *tree, size_t idx) {
+    (void) pthread_mutex_lock(&tree->lock);
+    if (idx < tree->failed) {
+        tree->failed = idx;
+    }
+    (void) pthread_mutex_unlock(&tree->lock);
+}
+
+/**
+ * @brief Mount an entry and every following entry sharing its mountpoint, serially in order,
+ *        then dispatch the subtrees below them. Run on a worker, so only system calls are made
+ *        here, libzfs and the libze handle are not thread safe.
+ * @param arg First @p mount_entry of its mountpoint to mount
+ */
+static void
+mount_task(void *arg) {
+    mount_entry *entry = arg;
+    mount_tree *tree = entry->tree;
+    size_t idx = entry - tree->entries;
+    size_t group_end = mount_tree_group_end(tree, idx);
+
+    if (directory_create_if_nonexistent(entry->mountpoint) != 0) {
+        mount_tree_failed(tree, idx);
+        return;
+    }
+
+    for (size_t i = idx; i < group_end; i++) {
+        mount_entry *e = &tree->entries[i];
+        libze_error mount_ret = tree->readonly
+                                    ? libze_util_readonly_mount(e->dataset, e->mountpoint)
+                                    : libze_util_temporary_mount(e->dataset, e->mountpoint);
+        if (mount_ret != LIBZE_ERROR_SUCCESS) {
+            mount_tree_failed(tree, i);
+            return;
+        }
+    }
+
+    size_t end = mount_tree_next_sibling(tree, idx);
+    for (size_t i = group_end; i < end; i = mount_tree_next_sibling(tree, i)) {
+        if (libze_taskq_dispatch(tree->tq, mount_task, &tree->entries[i]) != 0) {
+            mount_tree_failed(tree, i);
+        }
+    }
+}
+
+/**
+ * @brief Collect all mountable children of @p zh into @p tree, sorted so that every mountpoint
+ *        comes before those nested in it
+ * @param[in] lzeh Initialized lzeh libze handle
+ * @param[in] zh Top level dataset, not included in @p tree
+ * @param[in] mountpoint Mountpoint of @p zh, prefixed to every mountpoint in @p tree
+ * @param[in] snapshot If not @p NULL, collect this snapshot of each child to be mounted
+ *            read-only, children without the snapshot are skipped
+ * @param[out] tree Zero initialized @p mount_tree, entries should be freed by the caller
+ * @return @p LIBZE_ERROR_SUCCESS on success
+ */
+static libze_error
+mount_tree_collect(libze_handle *lzeh, zfs_handle_t *zh, char const mountpoint[static 1],
+                   char const *snapshot, mount_tree *tree) {
+    libze_mount_cb_data cbd = {
+        .lzeh = lzeh, .mountpoint = mountpoint, .tree = tree, .snapshot = snapshot};
+    tree->readonly = (snapshot != NULL);
+
+    if (zfs_iter_filesystems(zh, mount_collect_cb, &cbd) != 0) {
+        return lzeh->libze_error;
+    }
+
+    if (tree->count > 0) {
+        qsort(tree->entries, tree->count, sizeof(mount_entry), mount_entry_compare);
+    }
+    tree->failed = tree->count;
+
+    return LIBZE_ERROR_SUCCESS;
+}
+
+/**
+ * @brief Recursively mount all children of @p zh below @p mountpoint. Datasets are mounted in
+ *        parallel, a dataset is only mounted once the dataset its mountpoint is nested in has been.
+ *        Datasets sharing a mountpoint are mounted serially, ordered by name.
+ * @param[in] lzeh Initialized lzeh libze handle
+ * @param[in] zh Dataset which has already been mounted at @p mountpoint
+ * @param[in] mountpoint Mountpoint of @p zh
+ * @param[in] snapshot If not @p NULL, mount this snapshot of each child read-only instead
+ * @return @p LIBZE_ERROR_SUCCESS on success
+ */
+static libze_error
+mount_children(libze_handle *lzeh, zfs_handle_t *zh, char const mountpoint[static 1],
+               char const *snapshot) {
+    libze_error ret = LIBZE_ERROR_SUCCESS;
+    mount_tree tree = {0};
+
+    if ((ret = mount_tree_collect(lzeh, zh, mountpoint, snapshot, &tree)) != LIBZE_ERROR_SUCCESS) {
+        goto err;
+    }
+
+    if (tree.count == 0) {
+        goto err;
+    }
+
+    if ((tree.tq = libze_taskq_create(libze_taskq_nthreads((int) tree.count))) == NULL) {
+        ret = libze_error_nomem(lzeh);
+        goto err;
+    }
+    (void) pthread_mutex_init(&tree.lock, NULL);
+
+    for (size_t i = 0; i < tree.count; i = mount_tree_next_sibling(&tree, i)) {
+        if (libze_taskq_dispatch(tree.tq, mount_task, &tree.entries[i]) != 0) {
+            mount_tree_failed(&tree, i);
+            break;
+        }
+    }
+
+    libze_taskq_wait(tree.tq);
+    libze_taskq_destroy(tree.tq);
+    (void) pthread_mutex_destroy(&tree.lock);
+    libze_mnttab_invalidate(lzeh);
+
+    if (tree.failed != tree.count) {
+        ret = libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN, "Failed to mount %s to %s.\n",
+                              tree.entries[tree.failed].dataset,
+                              tree.entries[tree.failed].mountpoint);
+    }
+
+err:
+    free(tree.entries);
+    return ret;
+}
+
+/**
+ * @brief Recursively mount a snapshot of a boot environment read-only, without cloning it.
+ *        Children are mounted if they have a snapshot of the same name, as is the bootpool
+ *        dataset. No plugin hooks are run.
+ * @param[in] lzeh Initialized lzeh libze handle
+ * @param[in] be_snapshot Snapshot to mount, in the form <boot environment>@<snapshot>
+ * @param[in] mountpoint Mountpoint for snapshot.
+ *            If @p NULL a temporary mountpoint will be created
+ * @param[in] mountpoint_buffer Mountpoint snapshot was mounted to.
+ *            If @p mountpoint was @p NULL, the temporary mountpoint will be here.
+ * @return @p LIBZE_ERROR_SUCCESS on success
+ */
+static libze_error
+mount_snapshot(libze_handle *lzeh, char const be_snapshot[static 1], char const *mountpoint,
+               char mountpoint_buffer[LIBZE_MAX_PATH_LEN]) {
+    libze_error ret = LIBZE_ERROR_SUCCESS;
+    char be_name[ZFS_MAX_DATASET_NAME_LEN] = "";
+    char snap_name[ZFS_MAX_DATASET_NAME_LEN] = "";
+    char be_ds[ZFS_MAX_DATASET_NAME_LEN] = "";
+    char be_bpool_ds[ZFS_MAX_DATASET_NAME_LEN] = "";
+    char snap_ds[ZFS_MAX_DATASET_NAME_LEN] = "";
+    char tmpdir_template[LIBZE_MAX_PATH_LEN] = "";
+    char const *real_mountpoint = mountpoint;
+    boolean_t tmpdir_created = B_FALSE;
+    zfs_handle_t *be_zh = NULL, *be_bpool_zh = NULL;
+
+    if (libze_util_split(be_snapshot, ZFS_MAX_DATASET_NAME_LEN, be_name, snap_name, '@') != 0) {
+        return libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN, "Invalid snapshot name (%s).\n",
+                               be_snapshot);
+    }
+
+    if (open_boot_environment(lzeh, be_name, &be_zh, be_ds, &be_bpool_zh, be_bpool_ds) !=
+        LIBZE_ERROR_SUCCESS) {
+        return libze_error_prepend(lzeh, lzeh->libze_error,
+                                   "Failed to open boot environment (%s) for mount!\n", be_name);
+    }
+
+    /* ZFS handle is open, on failure goto err */
+
+    if (libze_util_concat(be_ds, "@", snap_name, ZFS_MAX_DATASET_NAME_LEN, snap_ds) !=
+        LIBZE_ERROR_SUCCESS) {
+        ret = libze_error_set(lzeh, LIBZE_ERROR_MAXPATHLEN,
+                              "Snapshot name (%s@%s) exceeds max length (%d).\n", be_ds,
+                              snap_name, ZFS_MAX_DATASET_NAME_LEN);
+        goto err;
+    }
+
+    if (!zfs_dataset_exists(lzeh->lzh, snap_ds, ZFS_TYPE_SNAPSHOT)) {
+        ret = libze_error_set(lzeh, LIBZE_ERROR_EEXIST, "Snapshot (%s) doesn't exist.\n",
+                              snap_ds);
+        goto err;
+    }
+
+    if (mountpoint == NULL) {
+        if (libze_util_concat("/tmp/ze.", be_snapshot, ".XXXXXX", LIBZE_MAX_PATH_LEN,
+                              tmpdir_template) != LIBZE_ERROR_SUCCESS) {
+            ret = libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN,
+                                  "Could not create directory template\n");
+            goto err;
+        }
+        if ((real_mountpoint = mkdtemp(tmpdir_template)) == NULL) {
+            ret = libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN, "Could not create tmp directory %s\n",
+                                  tmpdir_template);
+            goto err;
+        }
+        tmpdir_created = B_TRUE;
+    }
+
+    if (strlcpy(mountpoint_buffer, real_mountpoint, LIBZE_MAX_PATH_LEN) >= LIBZE_MAX_PATH_LEN) {
+        ret = libze_error_set(lzeh, LIBZE_ERROR_MAXPATHLEN, "Mountpoint exceeds max length\n");
+        goto err;
+    }
+
+    if (libze_util_readonly_mount(snap_ds, real_mountpoint) != LIBZE_ERROR_SUCCESS) {
+        ret = libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN, "Failed to mount %s to %s.\n",
+                              be_snapshot, real_mountpoint);
+        goto err;
+    }
+    libze_mnttab_invalidate(lzeh);
+    tmpdir_created = B_FALSE;
+
+    if ((ret = mount_children(lzeh, be_zh, real_mountpoint, snap_name)) != LIBZE_ERROR_SUCCESS) {
+        goto err;
+    }
 
-    // No mountpoint, just for heirarchy, or not ZFS managed so skip
-    if ((strcmp(prop_buf, "none") == 0) || (strcmp(prop_buf, "legacy") == 0)) {
-        return zfs_iter_filesystems(zh, mount_callback, cbd);
+    if (be_bpool_zh == NULL) {
+        goto err;
     }
 
-    char mountpoint_buf[LIBZE_MAX_PATH_LEN];
-    if (libze_util_concat(cbd->mountpoint, "", prop_buf, LIBZE_MAX_PATH_LEN, mountpoint_buf) !=
+    if (libze_util_concat(be_bpool_ds, "@", snap_name, ZFS_MAX_DATASET_NAME_LEN, snap_ds) !=
         LIBZE_ERROR_SUCCESS) {
-        (void) libze_error_set(cbd->lzeh, LIBZE_ERROR_MAXPATHLEN,
-                               "Exceeded max path length for mount\n.");
-        return -1;
+        ret = libze_error_set(lzeh, LIBZE_ERROR_MAXPATHLEN,
+                              "Snapshot name (%s@%s) exceeds max length (%d).\n", be_bpool_ds,
+                              snap_name, ZFS_MAX_DATASET_NAME_LEN);
+        goto err;
     }
 
-    if (zfs_is_mounted(zh, NULL)) {
-        (void) libze_error_set(cbd->lzeh, LIBZE_ERROR_ZFS_OPEN, "Dataset %s is already mounted\n",
-                               dataset);
-        return -1;
+    // Bootpool dataset wasn't snapshotted along with the boot environment
+    if (!zfs_dataset_exists(lzeh->lzh, snap_ds, ZFS_TYPE_SNAPSHOT)) {
+        goto err;
     }
 
-    if (directory_create_if_nonexistent(mountpoint_buf) != 0) {
-        (void) libze_error_set(cbd->lzeh, LIBZE_ERROR_MAXPATHLEN,
-                               "Failed to create mountpoint %s for %s, or a file existed there\n.",
-                               mountpoint_buf, dataset);
-        return -1;
+    /* Mount snapshot of separate bootpool dataset to .../boot */
+    char prop_buf[ZFS_MAXPROPLEN] = "";
+    if (zfs_prop_get(be_bpool_zh, ZFS_PROP_MOUNTPOINT, prop_buf, ZFS_MAXPROPLEN, NULL, NULL, 0,
+                     1) != 0) {
+        ret = libze_error_set(lzeh, LIBZE_ERROR_LIBZFS,
+                              "Failed to get the mountpoint for the boot dataset (%s).\n",
+                              be_bpool_ds);
+        goto err;
+    }
+    if (strcmp(prop_buf, "legacy") != 0) {
+        ret = libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN,
+                              "Mounting a boot dataset which is not set to 'legacy' is "
+                              "currently not supported.\n");
+        goto err;
     }
 
-    if (libze_util_temporary_mount(dataset, mountpoint_buf) != LIBZE_ERROR_SUCCESS) {
-        (void) libze_error_set(cbd->lzeh, LIBZE_ERROR_UNKNOWN, "Failed to mount %s to %s.\n",
-                               dataset, mountpoint_buf);
-        return -1;
+    char mount_directory_boot[LIBZE_MAX_PATH_LEN] = "";
+    if (libze_util_concat(real_mountpoint, "/", "boot", LIBZE_MAX_PATH_LEN,
+                          mount_directory_boot) != LIBZE_ERROR_SUCCESS) {
+        ret = libze_error_set(lzeh, LIBZE_ERROR_MAXPATHLEN,
+                              "Path to the boot directory (%s/boot) is too long (%d).\n",
+                              real_mountpoint, LIBZE_MAX_PATH_LEN);
+        goto err;
+    }
+
+    // The snapshot is read-only, the directory has to exist in it already
+    if (libze_util_readonly_mount(snap_ds, mount_directory_boot) != LIBZE_ERROR_SUCCESS) {
+        ret = libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN,
+                              "Failed to mount the boot directory (%s) for the requested "
+                              "snapshot (%s).\n",
+                              mount_directory_boot, snap_ds);
+        goto err;
     }
+    libze_mnttab_invalidate(lzeh);
 
-    return zfs_iter_filesystems(zh, mount_callback, cbd);
+err:
+    if (tmpdir_created) {
+        (void) rmdir(real_mountpoint);
+    }
+    zfs_close(be_zh);
+    if (be_bpool_zh != NULL) {
+        zfs_close(be_bpool_zh);
+    }
+    return ret;
 }
 
 /**
  * @brief Recursively mount boot environment
  * @param[in] lzeh Initialized lzeh libze handle
- * @param[in] boot_environment Boot environment to mount
+ * @param[in] boot_environment Boot environment to mount, or <boot environment>@<snapshot> to
+ *            mount a snapshot of it read-only with @p mount_snapshot
  * @param[in] mountpoint Mountpoint for boot environment.
  *            If @p NULL a temporary mountpoint will be created
  * @param[in] mountpoint_buffer Mountpoint boot environment was mounted to.
@@ -2460,6 +5179,10 @@ libze_mount(libze_handle *lzeh, char const boot_environment[static 1], char cons
     char const *real_mountpoint;
     zfs_handle_t *be_zh = NULL, *be_bpool_zh = NULL;
 
+    if (strchr(boot_environment, '@') != NULL) {
+        return mount_snapshot(lzeh, boot_environment, mountpoint, mountpoint_buffer);
+    }
+
     if (open_boot_environment(lzeh, boot_environment, &be_zh, be_ds, &be_bpool_zh, be_bpool_ds) !=
         LIBZE_ERROR_SUCCESS) {
         return libze_error_prepend(lzeh, lzeh->libze_error,
@@ -2476,7 +5199,7 @@ libze_mount(libze_handle *lzeh, char const boot_environment[static 1], char cons
         goto err;
     }
 
-    if (zfs_is_mounted(be_zh, NULL)) {
+    if (dataset_is_mounted(lzeh, be_zh)) {
         ret = libze_error_set(lzeh, LIBZE_ERROR_ZFS_OPEN,
                               "The dataset of the boot environment (%s) is already mounted.\n",
                               boot_environment);
@@ -2517,11 +5240,9 @@ libze_mount(libze_handle *lzeh, char const boot_environment[static 1], char cons
                               boot_environment, real_mountpoint);
         goto err;
     }
+    libze_mnttab_invalidate(lzeh);
 
-    libze_mount_cb_data cbd = {.lzeh = lzeh, .mountpoint = real_mountpoint};
-
-    if (zfs_iter_filesystems(be_zh, mount_callback, &cbd) != 0) {
-        ret = lzeh->libze_error;
+    if ((ret = mount_children(lzeh, be_zh, real_mountpoint, NULL)) != LIBZE_ERROR_SUCCESS) {
         goto err;
     }
 
@@ -2559,6 +5280,7 @@ libze_mount(libze_handle *lzeh, char const boot_environment[static 1], char cons
                                        "boot dataset (%s) in legacy mode.\n.",
                                        mount_directory_boot, boot_environment);
             }
+            libze_mnttab_invalidate(lzeh);
         } else {
             // TODO mount temporary if not legacy ...
             return libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN,
@@ -2575,6 +5297,479 @@ err:
     return ret;
 }
 
+/**
+ * @brief Assemble the mount tree of a boot environment detached from the filesystem hierarchy
+ * @param[in] tree Sorted children of the boot environment, mountpoints relative to its root
+ * @param[in] be_ds Boot environment dataset
+ * @param[in] be_bpool_ds Boot environment dataset on the bootpool mounted at /boot, or NULL
+ * @return Mount file descriptor of the detached tree, or -1 on failure
+ */
+static int
+mount_tree_detached(mount_tree *tree, char const be_ds[static 1], char const *be_bpool_ds) {
+    int root_fd = libze_fsmount_dataset(be_ds);
+    if (root_fd < 0) {
+        return -1;
+    }
+
+    for (size_t i = 0; i <= tree->count; i++) {
+        char const *dataset = NULL;
+        char const *path = NULL;
+        if (i < tree->count) {
+            dataset = tree->entries[i].dataset;
+            // Relative to root of boot environment
+            path = tree->entries[i].mountpoint + strspn(tree->entries[i].mountpoint, "/");
+        } else if (be_bpool_ds != NULL) {
+            dataset = be_bpool_ds;
+            path = "boot";
+        } else {
+            break;
+        }
+
+        if ((mkdirat(root_fd, path, 0700) != 0) && (errno != EEXIST)) {
+            goto err;
+        }
+
+        int child_fd = libze_fsmount_dataset(dataset);
+        if (child_fd < 0) {
+            goto err;
+        }
+        int move_ret = libze_move_mount(child_fd, root_fd, path);
+        (void) close(child_fd);
+        if (move_ret != 0) {
+            goto err;
+        }
+    }
+
+    return root_fd;
+err:
+    // Closing the last reference dissolves the detached tree
+    (void) close(root_fd);
+    return -1;
+}
+
+/**
+ * @brief Recursively mount boot environment, like @p libze_mount. The whole tree, including the
+ *        bootpool dataset, is first assembled detached and then attached at the mountpoint in a
+ *        single step, so it never appears partially mounted. If the kernel does not support the
+ *        new mount API, fall back to @p libze_mount.
+ * @param[in] lzeh Initialized lzeh libze handle
+ * @param[in] boot_environment Boot environment to mount
+ * @param[in] mountpoint Mountpoint for boot environment.
+ *            If @p NULL a temporary mountpoint will be created
+ * @param[in] mountpoint_buffer Mountpoint boot environment was mounted to.
+ *            If @p mountpoint was @p NULL, the temporary mountpoint will be here.
+ * @return @p LIBZE_ERROR_SUCCESS on success
+ */
+libze_error
+libze_mount_detached(libze_handle *lzeh, char const boot_environment[static 1],
+                     char const *mountpoint, char mountpoint_buffer[LIBZE_MAX_PATH_LEN]) {
+    libze_error ret = LIBZE_ERROR_SUCCESS;
+    char be_ds[ZFS_MAX_DATASET_NAME_LEN] = "";
+    char be_bpool_ds[ZFS_MAX_DATASET_NAME_LEN] = "";
+    zfs_handle_t *be_zh = NULL, *be_bpool_zh = NULL;
+    char tmpdir_template[LIBZE_MAX_PATH_LEN] = "";
+    mount_tree tree = {0};
+    int root_fd = -1;
+    boolean_t fallback = B_FALSE;
+
+    // Snapshots are mounted read-only in place
+    if (strchr(boot_environment, '@') != NULL) {
+        return libze_mount(lzeh, boot_environment, mountpoint, mountpoint_buffer);
+    }
+
+    if (open_boot_environment(lzeh, boot_environment, &be_zh, be_ds, &be_bpool_zh, be_bpool_ds) !=
+        LIBZE_ERROR_SUCCESS) {
+        return libze_error_prepend(lzeh, lzeh->libze_error,
+                                   "Failed to open boot environment (%s) for mount!\n",
+                                   boot_environment);
+    }
+
+    if (libze_is_root_be(lzeh, be_ds)) {
+        ret = libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN,
+                              "Can't mount the currently running boot environment (%s).\n",
+                              boot_environment);
+        goto err;
+    }
+
+    if (dataset_is_mounted(lzeh, be_zh)) {
+        ret = libze_error_set(lzeh, LIBZE_ERROR_ZFS_OPEN,
+                              "The dataset of the boot environment (%s) is already mounted.\n",
+                              boot_environment);
+        goto err;
+    }
+
+    if (be_bpool_zh != NULL) {
+        char prop_buf[ZFS_MAXPROPLEN] = "";
+        if ((zfs_prop_get(be_bpool_zh, ZFS_PROP_MOUNTPOINT, prop_buf, ZFS_MAXPROPLEN, NULL, NULL,
+                          0, 1) != 0) ||
+            (strcmp(prop_buf, "legacy") != 0)) {
+            // Let libze_mount report the unsupported configuration
+            fallback = B_TRUE;
+            goto err;
+        }
+    }
+
+    if ((ret = mount_tree_collect(lzeh, be_zh, "", NULL, &tree)) != LIBZE_ERROR_SUCCESS) {
+        goto err;
+    }
+
+    root_fd = mount_tree_detached(&tree, be_ds, (be_bpool_zh != NULL) ? be_bpool_ds : NULL);
+    if (root_fd < 0) {
+        DEBUG_PRINT("Detached mount of %s failed (%s), falling back", be_ds, strerror(errno));
+        fallback = B_TRUE;
+        goto err;
+    }
+
+    if (mountpoint == NULL) {
+        if ((libze_util_concat("/tmp/ze.", boot_environment, ".XXXXXX", LIBZE_MAX_PATH_LEN,
+                               tmpdir_template) != LIBZE_ERROR_SUCCESS) ||
+            (mkdtemp(tmpdir_template) == NULL)) {
+            ret = libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN,
+                                  "Could not create tmp directory for %s\n", boot_environment);
+            goto err;
+        }
+        mountpoint = tmpdir_template;
+    }
+
+    if (strlcpy(mountpoint_buffer, mountpoint, LIBZE_MAX_PATH_LEN) >= LIBZE_MAX_PATH_LEN) {
+        ret = libze_error_set(lzeh, LIBZE_ERROR_MAXPATHLEN, "Mountpoint exceeds max length\n");
+        goto err;
+    }
+
+    if (libze_move_mount(root_fd, AT_FDCWD, mountpoint) != 0) {
+        ret = libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN, "Failed to attach %s to %s: %s.\n",
+                              boot_environment, mountpoint, strerror(errno));
+        goto err;
+    }
+    libze_mnttab_invalidate(lzeh);
+
+err:
+    if ((ret != LIBZE_ERROR_SUCCESS) && (strlen(tmpdir_template) > 0)) {
+        (void) rmdir(tmpdir_template);
+    }
+    if (root_fd >= 0) {
+        (void) close(root_fd);
+    }
+    free(tree.entries);
+    zfs_close(be_zh);
+    if (be_bpool_zh != NULL) {
+        zfs_close(be_bpool_zh);
+    }
+
+    if (fallback) {
+        return libze_mount(lzeh, boot_environment, mountpoint, mountpoint_buffer);
+    }
+    return ret;
+}
+
+/**********************************
+ ************** Exec **************
+ **********************************/
+
+typedef enum exec_stage {
+    EXEC_STAGE_NAMESPACE = 0,
+    EXEC_STAGE_MOUNT,
+    EXEC_STAGE_BIND,
+    EXEC_STAGE_CHROOT,
+    EXEC_STAGE_EXEC
+} exec_stage;
+
+static char const *const exec_stage_descriptions[] = {
+    [EXEC_STAGE_NAMESPACE] = "create a private mount namespace",
+    [EXEC_STAGE_MOUNT] = "mount the boot environment",
+    [EXEC_STAGE_BIND] = "bind mount /proc, /sys and /dev",
+    [EXEC_STAGE_CHROOT] = "change root into the boot environment",
+    [EXEC_STAGE_EXEC] = "execute the command"};
+
+/**< Reported by the child to the parent if entering the boot environment fails */
+typedef struct exec_report {
+    exec_stage stage;
+    int error;
+} exec_report;
+
+/**
+ * @brief Mount the boot environment at @p root in a private mount namespace, chroot into it and
+ *        execute the command. Run in the forked child, so only system calls are made here.
+ * @param[in] root Empty directory to mount the boot environment on
+ * @param[in] be_ds Boot environment dataset, or NULL if it and its children are already mounted
+ *            at @p root
+ * @param[in] be_bpool_ds Boot environment dataset on the bootpool mounted at /boot, or NULL
+ * @param[in] tree Sorted children of the boot environment, mountpoints below @p root
+ * @param[in] options Exec options
+ * @return Only returns on failure, the stage which failed with @p errno set
+ */
+static exec_stage
+exec_enter(char const root[static 1], char const be_ds[static 1], char const *be_bpool_ds,
+           mount_tree *tree, libze_exec_options *options) {
+    char path_buf[LIBZE_MAX_PATH_LEN];
+
+    if (libze_mount_namespace_private() != 0) {
+        return EXEC_STAGE_NAMESPACE;
+    }
+
+    if ((be_ds != NULL) && (libze_util_temporary_mount(be_ds, root) != LIBZE_ERROR_SUCCESS)) {
+        return EXEC_STAGE_MOUNT;
+    }
+
+    // Parents are sorted before their children
+    for (size_t i = 0; i < tree->count; i++) {
+        if ((directory_create_if_nonexistent(tree->entries[i].mountpoint) != 0) ||
+            (libze_util_temporary_mount(tree->entries[i].dataset, tree->entries[i].mountpoint) !=
+             LIBZE_ERROR_SUCCESS)) {
+            return EXEC_STAGE_MOUNT;
+        }
+    }
+
+    if (be_bpool_ds != NULL) {
+        if ((libze_util_concat(root, "/", "boot", LIBZE_MAX_PATH_LEN, path_buf) != 0) ||
+            (directory_create_if_nonexistent(path_buf) != 0) ||
+            (libze_util_temporary_mount(be_bpool_ds, path_buf) != LIBZE_ERROR_SUCCESS)) {
+            return EXEC_STAGE_MOUNT;
+        }
+    }
+
+    if (options->bind_system) {
+        char const *const binds[] = {"/proc", "/sys", "/dev"};
+        for (size_t i = 0; i < (sizeof(binds) / sizeof(binds[0])); i++) {
+            if ((libze_util_concat(root, "", binds[i], LIBZE_MAX_PATH_LEN, path_buf) != 0) ||
+                (directory_create_if_nonexistent(path_buf) != 0) ||
+                (mount(binds[i], path_buf, NULL, MS_BIND | MS_REC, NULL) != 0)) {
+                return EXEC_STAGE_BIND;
+            }
+        }
+    }
+
+    if ((chroot(root) != 0) || (chdir("/") != 0)) {
+        return EXEC_STAGE_CHROOT;
+    }
+
+    (void) execvp(options->argv[0], options->argv);
+    return EXEC_STAGE_EXEC;
+}
+
+/**
+ * @brief Run a command chrooted into a boot environment. The boot environment, its children and
+ *        its bootpool dataset are mounted in a private mount namespace of the command, so the
+ *        mounts are never visible to other processes, and are released when the command exits
+ *        without an unmount. If the boot environment is part of the mount session of @p lzeh,
+ *        its existing mount is used instead.
+ * @param[in] lzeh Initialized lzeh libze handle
+ * @param[in] options Exec options
+ * @param[out] exit_status Exit status of the command, or 128 + signal number if it was killed
+ * @return @p LIBZE_ERROR_SUCCESS if the command was run, regardless of its exit status
+ *
+ * @pre options->argv != NULL && options->argv[0] != NULL
+ */
+libze_error
+libze_exec(libze_handle *lzeh, libze_exec_options *options, int *exit_status) {
+    libze_error ret = LIBZE_ERROR_SUCCESS;
+    char be_ds[ZFS_MAX_DATASET_NAME_LEN] = "";
+    char be_bpool_ds[ZFS_MAX_DATASET_NAME_LEN] = "";
+    char tmpdir_template[LIBZE_MAX_PATH_LEN] = "";
+    zfs_handle_t *be_zh = NULL, *be_bpool_zh = NULL;
+    mount_tree tree = {0};
+    int report_fds[2] = {-1, -1};
+    const char *session_mountpoint = NULL;
+
+    if (open_boot_environment(lzeh, options->be_name, &be_zh, be_ds, &be_bpool_zh,
+                              be_bpool_ds) != LIBZE_ERROR_SUCCESS) {
+        return libze_error_prepend(lzeh, lzeh->libze_error,
+                                   "Failed to open boot environment (%s) for exec!\n",
+                                   options->be_name);
+    }
+
+    if (libze_is_root_be(lzeh, be_ds)) {
+        ret = libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN,
+                              "Can't exec in the currently running boot environment (%s).\n",
+                              options->be_name);
+        goto err;
+    }
+
+    if ((lzeh->mount_sessions != NULL) &&
+        (nvlist_lookup_string(lzeh->mount_sessions, options->be_name, &session_mountpoint) !=
+         0)) {
+        session_mountpoint = NULL;
+    }
+
+    if ((session_mountpoint == NULL) && dataset_is_mounted(lzeh, be_zh)) {
+        ret = libze_error_set(lzeh, LIBZE_ERROR_ZFS_OPEN,
+                              "The dataset of the boot environment (%s) is already mounted.\n",
+                              options->be_name);
+        goto err;
+    }
+
+    if (be_bpool_zh != NULL) {
+        char prop_buf[ZFS_MAXPROPLEN] = "";
+        if (zfs_prop_get(be_bpool_zh, ZFS_PROP_MOUNTPOINT, prop_buf, ZFS_MAXPROPLEN, NULL, NULL, 0,
+                         1) != 0) {
+            ret = libze_error_set(lzeh, LIBZE_ERROR_LIBZFS,
+                                  "Failed to get the mountpoint for the boot dataset (%s).\n",
+                                  be_bpool_ds);
+            goto err;
+        }
+        if (strcmp(prop_buf, "legacy") != 0) {
+            ret = libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN,
+                                  "Mounting a boot dataset which is not set to 'legacy' is "
+                                  "currently not supported.\n");
+            goto err;
+        }
+    }
+
+    // Reuse the mount of the session, otherwise mount in the namespace of the child
+    char const *root = session_mountpoint;
+    if (root == NULL) {
+        if (libze_util_concat("/tmp/ze.", options->be_name, ".XXXXXX", LIBZE_MAX_PATH_LEN,
+                              tmpdir_template) != LIBZE_ERROR_SUCCESS) {
+            ret = libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN,
+                                  "Could not create directory template\n");
+            goto err;
+        }
+        if ((root = mkdtemp(tmpdir_template)) == NULL) {
+            ret = libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN,
+                                  "Could not create tmp directory %s\n", tmpdir_template);
+            (void) strlcpy(tmpdir_template, "", LIBZE_MAX_PATH_LEN);
+            goto err;
+        }
+
+        // libzfs can't be used in the child, collect everything to mount beforehand
+        if ((ret = mount_tree_collect(lzeh, be_zh, tmpdir_template, NULL, &tree)) !=
+            LIBZE_ERROR_SUCCESS) {
+            goto err;
+        }
+    }
+
+    // Closed on a successful exec, so the parent reads nothing
+    if ((pipe(report_fds) != 0) || (fcntl(report_fds[1], F_SETFD, FD_CLOEXEC) != 0)) {
+        ret = libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN, "Failed to create pipe: %s.\n",
+                              strerror(errno));
+        goto err;
+    }
+
+    (void) fflush(NULL);
+    pid_t pid = fork();
+    if (pid < 0) {
+        ret = libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN, "Failed to fork: %s.\n",
+                              strerror(errno));
+        goto err;
+    }
+
+    if (pid == 0) {
+        (void) close(report_fds[0]);
+        exec_stage stage = exec_enter(root, (session_mountpoint == NULL) ? be_ds : NULL,
+                                      (be_bpool_zh != NULL) ? be_bpool_ds : NULL, &tree, options);
+        exec_report report = {.stage = stage, .error = errno};
+        (void) write(report_fds[1], &report, sizeof(report));
+        _exit(127);
+    }
+
+    (void) close(report_fds[1]);
+    report_fds[1] = -1;
+
+    exec_report report;
+    ssize_t report_len;
+    do {
+        report_len = read(report_fds[0], &report, sizeof(report));
+    } while ((report_len < 0) && (errno == EINTR));
+
+    int status = 0;
+    while ((waitpid(pid, &status, 0) < 0) && (errno == EINTR)) {
+    }
+
+    if (report_len == sizeof(report)) {
+        ret = libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN, "Failed to %s for %s: %s.\n",
+                              exec_stage_descriptions[report.stage], options->be_name,
+                              strerror(report.error));
+        goto err;
+    }
+
+    *exit_status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+
+err:
+    for (size_t i = 0; i < 2; i++) {
+        if (report_fds[i] >= 0) {
+            (void) close(report_fds[i]);
+        }
+    }
+    // Mounts lived in the namespace of the child, only the empty directory is left
+    if (strlen(tmpdir_template) > 0) {
+        (void) rmdir(tmpdir_template);
+    }
+    free(tree.entries);
+    zfs_close(be_zh);
+    if (be_bpool_zh != NULL) {
+        zfs_close(be_bpool_zh);
+    }
+    return ret;
+}
+
+/*************************************
+ ************** Upgrade **************
+ *************************************/
+
+/**
+ * @brief Create a boot environment, run a command in it, and activate it if the command
+ *        succeeded, all with a single handle. The plugin hooks and the command share one mount
+ *        of the new boot environment through the mount session of @p lzeh. If the command
+ *        fails, the new boot environment is destroyed again, along with its origin snapshot
+ *        unless the origin is an existing snapshot the boot environment was created from.
+ * @param[in] lzeh Initialized lzeh libze handle
+ * @param[in] options Upgrade options
+ * @param[out] exit_status Exit status of the command, as with @p libze_exec
+ * @return @p LIBZE_ERROR_SUCCESS if the command succeeded and the boot environment was activated
+ */
+libze_error
+libze_upgrade(libze_handle *lzeh, libze_upgrade_options *options, int *exit_status) {
+    libze_error ret = LIBZE_ERROR_SUCCESS;
+    char mountpoint[LIBZE_MAX_PATH_LEN] = "";
+    char *be_name = options->create.be_name;
+    libze_exec_options exec_options = {.bind_system = options->bind_system,
+                                       .argv = options->argv};
+    libze_activate_options activate_options = {
+        .be_name = be_name, .noconfirm = B_TRUE, .deferred = options->deferred};
+    // Only the snapshot libze_create took itself is destroyed with the boot environment
+    boolean_t from_snapshot =
+        options->create.existing && (strchr(options->create.be_source, '@') != NULL);
+    libze_destroy_options destroy_options = {.be_name = be_name,
+                                             .noconfirm = B_TRUE,
+                                             .destroy_origin = !from_snapshot,
+                                             .force = B_TRUE};
+
+    (void) strlcpy(exec_options.be_name, be_name, ZFS_MAX_DATASET_NAME_LEN);
+
+    if ((ret = libze_create(lzeh, &options->create)) != LIBZE_ERROR_SUCCESS) {
+        return ret;
+    }
+
+    // Mounted by post_create if a plugin is loaded, otherwise mount for the command here
+    if ((ret = libze_mount_session_get(lzeh, be_name, mountpoint)) != LIBZE_ERROR_SUCCESS) {
+        goto rollback;
+    }
+
+    if ((ret = libze_exec(lzeh, &exec_options, exit_status)) != LIBZE_ERROR_SUCCESS) {
+        goto rollback;
+    }
+
+    if (*exit_status != 0) {
+        ret = libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN, "Command '%s' exited with status %d.\n",
+                              options->argv[0], *exit_status);
+        goto rollback;
+    }
+
+    return libze_activate(lzeh, &activate_options);
+
+rollback:
+    // Retain existing error, unless the rollback fails as well
+    if (libze_destroy(lzeh, &destroy_options) != LIBZE_ERROR_SUCCESS) {
+        return libze_error_prepend(lzeh, ret,
+                                   "Failed to destroy boot environment (%s) after failed "
+                                   "upgrade.\n",
+                                   be_name);
+    }
+    return libze_error_prepend(lzeh, ret,
+                               "Upgrade of boot environment (%s) failed, it was destroyed.\n",
+                               be_name);
+}
+
 /************************************
  ************** Rename **************
  ************************************/
@@ -2621,13 +5816,16 @@ libze_rename(libze_handle *lzeh, char const boot_environment[static 1],
                               "Can't rename active boot environment (%s).\n", boot_environment);
         goto err;
     }
-    if (zfs_is_mounted(be_zh, NULL)) {
+    if ((ret = mount_session_drop(lzeh, boot_environment)) != LIBZE_ERROR_SUCCESS) {
+        goto err;
+    }
+    if (dataset_is_mounted(lzeh, be_zh)) {
         ret = libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN,
                               "Dataset (%s) is mounted, cannot rename.\n", boot_environment);
         goto err;
     }
     if (be_bpool_zh != NULL) {
-        if (zfs_is_mounted(be_bpool_zh, NULL)) {
+        if (dataset_is_mounted(lzeh, be_bpool_zh)) {
             ret = libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN,
                                   "Dataset on bootpool (%s) is mounted, cannot rename.\n",
                                   new_be_bpool_ds);
@@ -2675,15 +5873,194 @@ err:
  ************** Snapshot **************
  *************************************/
 
+typedef struct snapshot_latest_cbdata {
+    uint64_t createtxg;
+    /**< Name of the latest snapshot after the '@' */
+    char suffix[ZFS_MAX_DATASET_NAME_LEN];
+} snapshot_latest_cbdata;
+
 /**
- * @brief Take a snapshot of a boot environment
+ * @brief Snapshot callback, remembers the snapshot created last
+ * @param zh Handle of snapshot, closed on exit
+ * @param data @p snapshot_latest_cbdata callback data
+ * @return non-zero on failure
+ */
+static int
+snapshot_latest_cb(zfs_handle_t *zh, void *data) {
+    snapshot_latest_cbdata *cbd = data;
+    uint64_t createtxg = zfs_prop_get_int(zh, ZFS_PROP_CREATETXG);
+    char const *at = strchr(zfs_get_name(zh), '@');
+
+    if ((at != NULL) && (createtxg > cbd->createtxg)) {
+        cbd->createtxg = createtxg;
+        (void) strlcpy(cbd->suffix, at + 1, ZFS_MAX_DATASET_NAME_LEN);
+    }
+
+    zfs_close(zh);
+    return 0;
+}
+
+/**
+ * @brief Filesystem callback, checks that nothing was written to a dataset since the snapshot
+ *        @p data, stops iterating as soon as something was
+ * @param zh Handle of filesystem, closed on exit
+ * @param data Name of the property 'written@<snapshot>'
+ * @return non-zero if the dataset changed, or doesn't have the snapshot
+ */
+static int
+snapshot_written_cb(zfs_handle_t *zh, void *data) {
+    char const *written_prop = data;
+    uint64_t written = 0;
+
+    int ret = (zfs_prop_get_written_int(zh, written_prop, &written) != 0) || (written != 0);
+    if (ret == 0) {
+        ret = zfs_iter_filesystems(zh, snapshot_written_cb, data);
+    }
+
+    zfs_close(zh);
+    return ret;
+}
+
+/**
+ * @brief Check if a boot environment is unchanged since its latest snapshot. It is unchanged if
+ *        nothing was written to it, its children and its bootpool dataset since the snapshot,
+ *        and the snapshot was taken with the same plugin fingerprint.
  * @param[in] lzeh Initialized lzeh libze handle
- * @param[in] boot_environment Boot environment name to snapshot
- * @return @p LIBZE_ERROR_SUCCESS on success
+ * @param[in] be_ds Boot environment dataset
+ * @param[in] be_bpool_ds Boot environment dataset on the bootpool, empty if none
+ * @param[in] fingerprint Current plugin fingerprint, empty if none
+ * @param[out] snap_suffix Latest snapshot after the '@', if unchanged
+ * @return @p B_TRUE if unchanged
  */
-libze_error
-libze_snapshot(libze_handle *lzeh, char const boot_environment[static 1]) {
+static boolean_t
+snapshot_unchanged(libze_handle *lzeh, char const be_ds[static 1], char const be_bpool_ds[static 1],
+                   char const fingerprint[static 1], char snap_suffix[ZFS_MAX_DATASET_NAME_LEN]) {
+    boolean_t unchanged = B_FALSE;
+    snapshot_latest_cbdata cbd = {.createtxg = 0, .suffix = ""};
+    char written_prop[ZFS_MAX_DATASET_NAME_LEN] = "";
+    char snap_buf[ZFS_MAX_DATASET_NAME_LEN] = "";
+    zfs_handle_t *zh = NULL;
+
+    // written only accounts for synced data
+    nvlist_t *sync_args = fnvlist_alloc();
+    fnvlist_add_boolean_value(sync_args, "force", B_FALSE);
+    int sync_ret = lzc_sync(lzeh->env_pool, sync_args, NULL);
+    if ((sync_ret == 0) && (strlen(be_bpool_ds) > 0)) {
+        sync_ret = lzc_sync(lzeh->bootpool.zpool_name, sync_args, NULL);
+    }
+    fnvlist_free(sync_args);
+    if (sync_ret != 0) {
+        return B_FALSE;
+    }
+
+    if ((zh = zfs_open(lzeh->lzh, be_ds, ZFS_TYPE_FILESYSTEM)) == NULL) {
+        return B_FALSE;
+    }
+    (void) zfs_iter_snapshots(zh, B_FALSE, snapshot_latest_cb, &cbd, 0, 0);
+    zfs_close(zh);
+
+    if ((cbd.createtxg == 0) ||
+        (libze_util_concat("written", "@", cbd.suffix, ZFS_MAX_DATASET_NAME_LEN, written_prop) !=
+         LIBZE_ERROR_SUCCESS) ||
+        (libze_util_concat(be_ds, "@", cbd.suffix, ZFS_MAX_DATASET_NAME_LEN, snap_buf) !=
+         LIBZE_ERROR_SUCCESS)) {
+        return B_FALSE;
+    }
+
+    // A different fingerprint, or none at all, means the bootloader state changed
+    if (strlen(fingerprint) > 0) {
+        nvlist_t *prop = NULL;
+        const char *value = NULL;
+        if ((zh = zfs_open(lzeh->lzh, snap_buf, ZFS_TYPE_SNAPSHOT)) == NULL) {
+            return B_FALSE;
+        }
+        boolean_t same = (nvlist_lookup_nvlist(zfs_get_user_props(zh), ZE_PROP_FINGERPRINT,
+                                               &prop) == 0) &&
+                         (nvlist_lookup_string(prop, "value", &value) == 0) &&
+                         (strcmp(value, fingerprint) == 0);
+        zfs_close(zh);
+        if (!same) {
+            return B_FALSE;
+        }
+    }
+
+    if ((zh = zfs_open(lzeh->lzh, be_ds, ZFS_TYPE_FILESYSTEM)) == NULL) {
+        return B_FALSE;
+    }
+    // Closes zh
+    unchanged = (snapshot_written_cb(zh, written_prop) == 0);
+
+    if (unchanged && (strlen(be_bpool_ds) > 0)) {
+        if ((zh = zfs_open(lzeh->lzh, be_bpool_ds, ZFS_TYPE_FILESYSTEM)) == NULL) {
+            return B_FALSE;
+        }
+        unchanged = (snapshot_written_cb(zh, written_prop) == 0);
+    }
+
+    if (unchanged) {
+        (void) strlcpy(snap_suffix, cbd.suffix, ZFS_MAX_DATASET_NAME_LEN);
+    }
+    return unchanged;
+}
+
+/**
+ * @brief Take an exclusive lock on ZE_RUN_DIR/<lock_name>.lock. The lock is released when
+ *        @p lock_fd is closed, or with the process.
+ * @param[in] lzeh Initialized lzeh libze handle
+ * @param[in] lock_name Name of the lock file without extension
+ * @param[in] wait Wait for the lock if it is held, instead of returning without it
+ * @param[out] lock_fd Descriptor holding the lock, -1 if @p wait isn't set and the lock is held
+ * @return @p LIBZE_ERROR_SUCCESS on success, whether or not the lock was taken
+ */
+static libze_error
+run_lock_take(libze_handle *lzeh, char const lock_name[static 1], boolean_t wait, int *lock_fd) {
+    char lock_path[LIBZE_MAX_PATH_LEN] = "";
+    *lock_fd = -1;
+
+    if (snprintf(lock_path, LIBZE_MAX_PATH_LEN, "%s/%s.lock", ZE_RUN_DIR, lock_name) >=
+        LIBZE_MAX_PATH_LEN) {
+        return libze_error_set(lzeh, LIBZE_ERROR_MAXPATHLEN,
+                               "Lock path for (%s) exceeds max length (%d).\n", lock_name,
+                               LIBZE_MAX_PATH_LEN);
+    }
+
+    int err = libze_util_mkdir(ZE_RUN_DIR, 0755);
+    if (err != 0) {
+        return libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN, "Failed to create directory (%s): %s\n",
+                               ZE_RUN_DIR, strerror(err));
+    }
+
+    int fd = open(lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        return libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN, "Failed to open lock (%s): %s\n",
+                               lock_path, strerror(errno));
+    }
+
+    int locked;
+    while (((locked = flock(fd, LOCK_EX | (wait ? 0 : LOCK_NB))) != 0) && (errno == EINTR)) {
+    }
+    if (locked != 0) {
+        err = errno;
+        (void) close(fd);
+        if (!wait && (err == EWOULDBLOCK)) {
+            return LIBZE_ERROR_SUCCESS;
+        }
+        return libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN, "Failed to lock (%s): %s\n", lock_path,
+                               strerror(err));
+    }
+
+    *lock_fd = fd;
+    return LIBZE_ERROR_SUCCESS;
+}
+
+/**
+ * @brief Take a snapshot of a boot environment, see @p libze_snapshot
+ */
+static libze_error
+snapshot_take(libze_handle *lzeh, libze_snapshot_options *options,
+              char snapshot[ZFS_MAX_DATASET_NAME_LEN]) {
     libze_error ret = LIBZE_ERROR_SUCCESS;
+    char const *boot_environment = options->be_name;
 
     char be_ds[ZFS_MAX_DATASET_NAME_LEN] = "";
     char be_bpool_ds[ZFS_MAX_DATASET_NAME_LEN] = "";
@@ -2705,7 +6082,10 @@ libze_snapshot(libze_handle *lzeh, char const boot_environment[static 1]) {
             return libze_error_prepend(lzeh, ret, "Failed parsing dataset (%s).\n",
                                        boot_environment);
         }
-        (void) gen_snap_suffix(ZFS_MAX_DATASET_NAME_LEN, snap_suffix);
+        if ((ret = gen_snap_suffix(lzeh, ZFS_MAX_DATASET_NAME_LEN, snap_suffix)) !=
+            LIBZE_ERROR_SUCCESS) {
+            return ret;
+        }
     }
 
     if ((ret = validate_existing_be(lzeh, boot_environment_buf, be_ds, be_bpool_ds)) !=
@@ -2733,124 +6113,428 @@ libze_snapshot(libze_handle *lzeh, char const boot_environment[static 1]) {
 
     libze_snap_data sd = {
         .be_name = boot_environment_buf,
-        .is_root = B_FALSE
+        .is_root = libze_is_root_be(lzeh, be_ds),
+        .fingerprint = NULL
     };
 
+    char fingerprint[ZFS_MAXPROPLEN] = "";
+    if ((lzeh->lz_funcs != NULL) && (lzeh->lz_funcs->plugin_snapshot_fingerprint != NULL) &&
+        ((ret = lzeh->lz_funcs->plugin_snapshot_fingerprint(lzeh, &sd, fingerprint)) !=
+         LIBZE_ERROR_SUCCESS)) {
+        return ret;
+    }
+    // Passed to pre_snapshot, so the plugin doesn't fingerprint the bootloader state again
+    if ((lzeh->lz_funcs != NULL) && (lzeh->lz_funcs->plugin_snapshot_fingerprint != NULL)) {
+        sd.fingerprint = fingerprint;
+    }
+
+    if (options->if_changed &&
+        snapshot_unchanged(lzeh, be_ds, be_bpool_ds, fingerprint, snap_suffix)) {
+        (void) libze_util_concat(boot_environment_buf, "@", snap_suffix, ZFS_MAX_DATASET_NAME_LEN,
+                                 snapshot);
+        return ret;
+    }
+
+    nvlist_t *props = NULL;
+    int lock_fd = -1;
+
     /* Plugin - Pre snapshot */
     if (lzeh->lz_funcs != NULL) {
-        if (libze_is_root_be(lzeh, be_ds)) {
-            sd.is_root = B_TRUE;
+        /* Hooks of concurrent snapshots of the boot environment would write the same files and
+         * properties, hold the lock until the snapshot covers what the hook wrote */
+        char lock_name[LIBZE_MAX_PATH_LEN] = "";
+        (void) snprintf(lock_name, LIBZE_MAX_PATH_LEN, "snapshot-hook.%s", boot_environment_buf);
+        if ((ret = run_lock_take(lzeh, lock_name, B_TRUE, &lock_fd)) != LIBZE_ERROR_SUCCESS) {
+            return ret;
         }
         if ((ret = lzeh->lz_funcs->plugin_pre_snapshot(lzeh, &sd)) != LIBZE_ERROR_SUCCESS) {
-            return ret;
+            goto err;
         }
     }
 
-    if (zfs_snapshot(lzeh->lzh, snap_buf, B_TRUE, NULL) != 0) {
-        return libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN, "Failed to take snapshot (%s).\n",
-                               snap_buf);
+    if ((props = fnvlist_alloc()) == NULL) {
+        ret = libze_error_nomem(lzeh);
+        goto err;
+    }
+    if ((strlen(fingerprint) > 0) &&
+        (nvlist_add_string(props, ZE_PROP_FINGERPRINT, fingerprint) != 0)) {
+        ret = libze_error_nomem(lzeh);
+        goto err;
+    }
+
+    if (zfs_snapshot(lzeh->lzh, snap_buf, B_TRUE, props) != 0) {
+        ret = libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN, "Failed to take snapshot (%s).\n",
+                              snap_buf);
+        goto err;
     }
     if (strlen(be_bpool_ds) > 0) {
         if (zfs_snapshot(lzeh->lzh, snap_bpool_buf, B_TRUE, NULL) != 0) {
-            return libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN, "Failed to take snapshot (%s).\n",
-                                   snap_bpool_buf);
+            ret = libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN, "Failed to take snapshot (%s).\n",
+                                  snap_bpool_buf);
+            goto err;
         }
     }
 
+    (void) libze_util_concat(boot_environment_buf, "@", snap_suffix, ZFS_MAX_DATASET_NAME_LEN,
+                             snapshot);
+err:
+    if (props != NULL) {
+        fnvlist_free(props);
+    }
+    if (lock_fd != -1) {
+        (void) close(lock_fd);
+    }
     return ret;
 }
 
+/**
+ * @brief Become the leader of a coalescing window for snapshots of @p boot_environment.
+ *        The leader holds an exclusive lock on ZE_RUN_DIR/snapshot.<boot environment>.lock for
+ *        the duration of the window, requests arriving meanwhile fail to take it and fold into the
+ *        snapshot the leader takes afterwards. The lock is released with the process, so a leader
+ *        which dies doesn't swallow later requests.
+ * @param[in] lzeh Initialized lzeh libze handle
+ * @param[in] boot_environment Boot environment name
+ * @param[out] lock_fd Descriptor holding the lock if leader, otherwise -1
+ * @return @p LIBZE_ERROR_SUCCESS on success, whether or not leader
+ */
+static libze_error
+snapshot_coalesce_lock(libze_handle *lzeh, char const boot_environment[static 1], int *lock_fd) {
+    char lock_name[LIBZE_MAX_PATH_LEN] = "";
+
+    if (snprintf(lock_name, LIBZE_MAX_PATH_LEN, "snapshot.%s", boot_environment) >=
+        LIBZE_MAX_PATH_LEN) {
+        *lock_fd = -1;
+        return libze_error_set(lzeh, LIBZE_ERROR_MAXPATHLEN,
+                               "Snapshot lock path for (%s) exceeds max length (%d).\n",
+                               boot_environment, LIBZE_MAX_PATH_LEN);
+    }
+
+    return run_lock_take(lzeh, lock_name, B_FALSE, lock_fd);
+}
+
+/**
+ * @brief Take a snapshot of a boot environment
+ * @param[in] lzeh Initialized lzeh libze handle
+ * @param[in] options Snapshot options. If @p options->if_changed is set, and the boot
+ *            environment is unchanged since its latest snapshot, no snapshot is taken.
+ *            If @p options->coalesce is set, the snapshot is taken once the window ends, unless
+ *            another process already waits to take one, which the request is folded into.
+ * @param[out] snapshot Name of the snapshot taken, or of the latest snapshot if it was unchanged,
+ *             in the form <boot environment>@<snapshot>. Empty if folded into another request.
+ * @return @p LIBZE_ERROR_SUCCESS on success
+ */
+libze_error
+libze_snapshot(libze_handle *lzeh, libze_snapshot_options *options,
+               char snapshot[ZFS_MAX_DATASET_NAME_LEN]) {
+    libze_error ret = LIBZE_ERROR_SUCCESS;
+    int lock_fd = -1;
+
+    snapshot[0] = '\0';
+
+    if (options->coalesce == 0) {
+        return snapshot_take(lzeh, options, snapshot);
+    }
+
+    // Only the leader's snapshot is taken, names of folded requests would be lost
+    if (strchr(options->be_name, '@') != NULL) {
+        return libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN,
+                               "Coalesced snapshot of (%s) can't be named.\n", options->be_name);
+    }
+
+    // Fail before waiting, the name is also used for the lock path
+    char be_ds[ZFS_MAX_DATASET_NAME_LEN] = "";
+    char be_bpool_ds[ZFS_MAX_DATASET_NAME_LEN] = "";
+    if ((ret = validate_existing_be(lzeh, options->be_name, be_ds, be_bpool_ds)) !=
+        LIBZE_ERROR_SUCCESS) {
+        return libze_error_prepend(lzeh, ret,
+                                   "Failed validating boot environment (%s) for snapshot.\n",
+                                   options->be_name);
+    }
+
+    if ((ret = snapshot_coalesce_lock(lzeh, options->be_name, &lock_fd)) !=
+        LIBZE_ERROR_SUCCESS) {
+        return ret;
+    }
+    if (lock_fd == -1) {
+        return LIBZE_ERROR_SUCCESS;
+    }
+
+    for (unsigned int left = options->coalesce; left > 0;) {
+        left = sleep(left);
+    }
+
+    // Requests arriving from here on may postdate the snapshot, let them start a new window
+    (void) close(lock_fd);
+
+    return snapshot_take(lzeh, options, snapshot);
+}
+
 /*************************************
  ************** Unmount **************
  *************************************/
 
-typedef struct libze_umount_cb_data {
-    libze_handle *lzeh;
-} libze_umount_cb_data;
+typedef struct unmount_entry {
+    char const *mountpoint;
+    /**< Number of path components in @p mountpoint */
+    size_t depth;
+    /**< errno of umount2, set by the worker which owns the entry */
+    int error;
+} unmount_entry;
 
 /**
- * @brief Mount callback called for each child of boot environment
- * @param zh Handle to current dataset to mount
- * @param data @p libze_mount_cb_data object
- * @return Non-zero on failure.
+ * @brief Add the mounts of @p dataset and all of its children in @p all_mounts to @p mounts
+ * @param[in] all_mounts mountpoint -> dataset pairs of all mounted ZFS datasets
+ * @param[in] dataset Top level dataset
+ * @param[in] snapshot If not @p NULL, match the mounts of this snapshot of @p dataset and its
+ *            children instead of the datasets themselves
+ * @param[out] mounts nvlist to add matching mountpoint -> dataset pairs to
+ * @return @p B_TRUE if @p dataset, or its snapshot, is mounted
  */
+static boolean_t
+mounts_filter(nvlist_t *all_mounts, char const dataset[static 1], char const *snapshot,
+              nvlist_t *mounts) {
+    boolean_t found = B_FALSE;
+    size_t len = strlen(dataset);
+
+    for (nvpair_t *pair = nvlist_next_nvpair(all_mounts, NULL); pair != NULL;
+         pair = nvlist_next_nvpair(all_mounts, pair)) {
+        const char *ds = NULL;
+        if (nvpair_value_string(pair, &ds) != 0) {
+            continue;
+        }
+        char const *at = strchr(ds, '@');
+        if ((snapshot == NULL) ? (at != NULL) : ((at == NULL) || (strcmp(at + 1, snapshot) != 0))) {
+            continue;
+        }
+        size_t ds_len = (at == NULL) ? strlen(ds) : (size_t) (at - ds);
+        if ((ds_len == len) && (strncmp(ds, dataset, len) == 0)) {
+            found = B_TRUE;
+        } else if ((ds_len <= len) || (strncmp(ds, dataset, len) != 0) || (ds[len] != '/')) {
+            continue;
+        }
+        fnvlist_add_nvpair(mounts, pair);
+    }
+
+    return found;
+}
+
+static size_t
+path_depth(char const path[static 1]) {
+    size_t depth = 0;
+    for (; *path != '\0'; path++) {
+        if ((*path == '/') && (path[1] != '/') && (path[1] != '\0')) {
+            depth++;
+        }
+    }
+    return depth;
+}
+
 static int
-unmount_callback(zfs_handle_t *zh, void *data) {
-    libze_mount_cb_data *cbd = data;
-    char const *dataset = zfs_get_name(zh);
+unmount_entry_compare(void const *a, void const *b) {
+    size_t depth_a = ((unmount_entry const *) a)->depth;
+    size_t depth_b = ((unmount_entry const *) b)->depth;
+    // Deepest first
+    return (depth_a < depth_b) - (depth_a > depth_b);
+}
 
-    if (zfs_iter_filesystems(zh, unmount_callback, cbd) != 0) {
-        (void) libze_error_set(cbd->lzeh, LIBZE_ERROR_UNKNOWN, "Failed to iterate over %s\n.",
-                               dataset);
-        return -1;
+/**
+ * @brief Unmount a single entry, run on a worker
+ * @param arg @p unmount_entry to unmount
+ */
+static void
+unmount_task(void *arg) {
+    unmount_entry *entry = arg;
+    entry->error = (umount2(entry->mountpoint, 0) != 0) ? errno : 0;
+}
+
+/**
+ * @brief Unmount all mountpoints in @p mounts. Mountpoints are unmounted deepest first, all
+ *        mountpoints of the same depth are unmounted concurrently.
+ * @param[in] lzeh Initialized lzeh libze handle
+ * @param[in] mounts mountpoint -> dataset pairs to unmount
+ * @param[in] lazy Instead detach the top most mounts with @p MNT_DETACH, which lazily
+ *            unmounts everything below them even if busy.
+ * @return @p LIBZE_ERROR_SUCCESS on success
+ */
+static libze_error
+unmount_mounts(libze_handle *lzeh, nvlist_t *mounts, boolean_t lazy) {
+    libze_error ret = LIBZE_ERROR_SUCCESS;
+    size_t count = 0;
+    nvpair_t *pair = NULL;
+
+    for (pair = nvlist_next_nvpair(mounts, NULL); pair != NULL;
+         pair = nvlist_next_nvpair(mounts, pair)) {
+        count++;
+    }
+    if (count == 0) {
+        return ret;
     }
 
-    if (!zfs_is_mounted(zh, NULL)) {
-        return 0;
+    unmount_entry *entries = calloc(count, sizeof(unmount_entry));
+    if (entries == NULL) {
+        return libze_error_nomem(lzeh);
     }
 
-    if (zfs_unmount(zh, NULL, 0) != 0) {
-        (void) libze_error_set(cbd->lzeh, LIBZE_ERROR_UNKNOWN, "Failed to unmount %s\n.", dataset);
-        return -1;
+    size_t i = 0;
+    for (pair = nvlist_next_nvpair(mounts, NULL); pair != NULL;
+         pair = nvlist_next_nvpair(mounts, pair), i++) {
+        entries[i].mountpoint = nvpair_name(pair);
+        entries[i].depth = path_depth(entries[i].mountpoint);
     }
-    return 0;
+
+    if (lazy) {
+        for (i = 0; i < count; i++) {
+            char const *mountpoint = entries[i].mountpoint;
+            boolean_t nested = B_FALSE;
+            for (size_t j = 0; (j < count) && !nested; j++) {
+                size_t len = strlen(entries[j].mountpoint);
+                nested = (j != i) && (strncmp(mountpoint, entries[j].mountpoint, len) == 0) &&
+                         ((mountpoint[len] == '/') || (entries[j].mountpoint[len - 1] == '/'));
+            }
+            if (!nested && (umount2(mountpoint, MNT_DETACH) != 0)) {
+                ret = libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN, "Failed to detach %s: %s.\n",
+                                      mountpoint, strerror(errno));
+                goto err;
+            }
+        }
+        goto err;
+    }
+
+    qsort(entries, count, sizeof(unmount_entry), unmount_entry_compare);
+
+    libze_taskq *tq = libze_taskq_create(libze_taskq_nthreads((int) count));
+    if (tq == NULL) {
+        ret = libze_error_nomem(lzeh);
+        goto err;
+    }
+
+    for (i = 0; (i < count) && (ret == LIBZE_ERROR_SUCCESS);) {
+        size_t level_end = i;
+        for (; (level_end < count) && (entries[level_end].depth == entries[i].depth);
+             level_end++) {
+            if (libze_taskq_dispatch(tq, unmount_task, &entries[level_end]) != 0) {
+                unmount_task(&entries[level_end]);
+            }
+        }
+        libze_taskq_wait(tq);
+
+        for (; i < level_end; i++) {
+            if ((entries[i].error != 0) && (ret == LIBZE_ERROR_SUCCESS)) {
+                ret = libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN, "Failed to unmount %s: %s.\n",
+                                      entries[i].mountpoint, strerror(entries[i].error));
+            }
+        }
+    }
+
+    libze_taskq_destroy(tq);
+
+err:
+    free(entries);
+    libze_mnttab_invalidate(lzeh);
+    return ret;
+}
+
+/**
+ * @brief Unmount all mounts of @p dataset and its children, those not mounted are skipped
+ * @param[in] lzeh Initialized lzeh libze handle
+ * @param[in] dataset Top level dataset
+ * @param[in] lazy Lazily detach mounts
+ * @return @p LIBZE_ERROR_SUCCESS on success
+ */
+static libze_error
+unmount_dataset(libze_handle *lzeh, char const dataset[static 1], boolean_t lazy) {
+    libze_error ret = LIBZE_ERROR_SUCCESS;
+    nvlist_t *mounts = NULL;
+
+    if ((mounts = fnvlist_alloc()) == NULL) {
+        return libze_error_nomem(lzeh);
+    }
+
+    if ((ret = mnttab_load(lzeh)) != LIBZE_ERROR_SUCCESS) {
+        goto err;
+    }
+
+    (void) mounts_filter(lzeh->mnttab, dataset, NULL, mounts);
+    ret = unmount_mounts(lzeh, mounts, lazy);
+
+err:
+    nvlist_free(mounts);
+    return ret;
 }
 
 /**
- * @brief Recursively unmount boot environment
+ * @brief Recursively unmount boot environment, and its dataset on the bootpool.
+ *        The set of mounts is read from a single snapshot of the mount table.
  * @param[in] lzeh Initialized lzeh libze handle
- * @param[in] boot_environment Boot environment to unmount
+ * @param[in] boot_environment Boot environment to unmount, or <boot environment>@<snapshot>
+ *            to unmount a snapshot mounted with @p libze_mount
+ * @param[in] lazy Detach the mounts immediately with @p MNT_DETACH, even if they are busy
  * @return @p LIBZE_ERROR_SUCCESS on success
  */
 libze_error
-libze_unmount(libze_handle *lzeh, char const boot_environment[static 1]) {
+libze_unmount(libze_handle *lzeh, char const boot_environment[static 1], boolean_t lazy) {
     libze_error ret = LIBZE_ERROR_SUCCESS;
-    zfs_handle_t *be_zh = NULL, *be_bpool_zh = NULL;
+    nvlist_t *mounts = NULL;
     char be_ds[ZFS_MAX_DATASET_NAME_LEN] = "";
     char be_bpool_ds[ZFS_MAX_DATASET_NAME_LEN] = "";
+    char be_name[ZFS_MAX_DATASET_NAME_LEN] = "";
+    char snap_name[ZFS_MAX_DATASET_NAME_LEN] = "";
+    char const *snapshot = NULL;
 
-    if (libze_is_root_be(lzeh, boot_environment)) {
+    if (strchr(boot_environment, '@') != NULL) {
+        if (libze_util_split(boot_environment, ZFS_MAX_DATASET_NAME_LEN, be_name, snap_name,
+                             '@') != 0) {
+            return libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN, "Invalid snapshot name (%s).\n",
+                                   boot_environment);
+        }
+        snapshot = snap_name;
+    } else if (libze_is_root_be(lzeh, boot_environment)) {
         return libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN,
                                "Cannot umount root boot environment (%s).\n", boot_environment);
+    } else {
+        (void) strlcpy(be_name, boot_environment, ZFS_MAX_DATASET_NAME_LEN);
     }
-    if (open_boot_environment(lzeh, boot_environment, &be_zh, be_ds, &be_bpool_zh, NULL) !=
-        LIBZE_ERROR_SUCCESS) {
+
+    if (validate_existing_be(lzeh, be_name, be_ds, be_bpool_ds) != LIBZE_ERROR_SUCCESS) {
         return libze_error_prepend(lzeh, lzeh->libze_error,
                                    "Failed to open boot environment (%s) for unmount.\n",
-                                   boot_environment);
+                                   be_name);
     }
-    if (!zfs_is_mounted(be_zh, NULL)) {
-        ret = libze_error_set(lzeh, LIBZE_ERROR_MOUNTPOINT,
-                              "Boot environment dataset for %s is not mounted.\n", be_ds);
-        goto err;
+
+    if ((snapshot == NULL) && (lzeh->mount_sessions != NULL) &&
+        nvlist_exists(lzeh->mount_sessions, be_name)) {
+        return mount_session_drop(lzeh, be_name);
     }
 
-    libze_umount_cb_data cbd = {.lzeh = lzeh};
+    if ((mounts = fnvlist_alloc()) == NULL) {
+        return libze_error_nomem(lzeh);
+    }
 
-    if (be_bpool_zh != NULL) {
-        if (!zfs_is_mounted(be_bpool_zh, NULL)) {
-            ret = libze_error_set(lzeh, LIBZE_ERROR_MOUNTPOINT,
-                                  "Boot environment dataset on bootpool (%s) is not mounted.\n",
-                                  be_bpool_ds);
-            goto err;
-        }
-        if (unmount_callback(be_bpool_zh, &cbd) != 0) {
-            ret =
-                libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN,
-                                "Failed to unmount the mounted boot dataset (%s).\n", be_bpool_ds);
-            goto err;
-        }
+    if ((ret = mnttab_load(lzeh)) != LIBZE_ERROR_SUCCESS) {
+        goto err;
     }
 
-    if (unmount_callback(be_zh, &cbd) != 0) {
-        ret = lzeh->libze_error;
+    if (!mounts_filter(lzeh->mnttab, be_ds, snapshot, mounts)) {
+        ret = libze_error_set(lzeh, LIBZE_ERROR_MOUNTPOINT,
+                              "Boot environment dataset for %s is not mounted.\n",
+                              boot_environment);
         goto err;
     }
 
-err:
-    zfs_close(be_zh);
-    if (be_bpool_zh != NULL) {
-        zfs_close(be_bpool_zh);
+    // A snapshot may have been taken without the bootpool dataset
+    if ((strlen(be_bpool_ds) > 0) &&
+        !mounts_filter(lzeh->mnttab, be_bpool_ds, snapshot, mounts) &&
+        (snapshot == NULL)) {
+        ret = libze_error_set(lzeh, LIBZE_ERROR_MOUNTPOINT,
+                              "Boot environment dataset on bootpool (%s) is not mounted.\n",
+                              be_bpool_ds);
+        goto err;
     }
+
+    ret = unmount_mounts(lzeh, mounts, lazy);
+
+err:
+    nvlist_free(mounts);
     return ret;
 }
@@ -0,0 +1,190 @@
+/*
+ * Copyright (c) 2018, John Ramsden.
+ * https://github.com/johnramsden/zectl/blob/master/LICENSE.md
+ */
+
+/*
+ * Minimal fixed size worker pool. Tasks may dispatch further tasks,
+ * libze_taskq_wait returns once every dispatched task has completed.
+ */
+
+#include "libze_taskq.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+typedef struct libze_task {
+    libze_taskq_func func;
+    void *arg;
+    struct libze_task *next;
+} libze_task;
+
+struct libze_taskq {
+    pthread_mutex_t lock;
+    /**< Signalled when a task is queued or on shutdown */
+    pthread_cond_t work_cv;
+    /**< Signalled when the last outstanding task completes */
+    pthread_cond_t done_cv;
+    libze_task *head;
+    libze_task *tail;
+    /**< Tasks queued or running */
+    size_t outstanding;
+    int shutdown;
+    int nthreads;
+    pthread_t *threads;
+};
+
+static void *
+taskq_worker(void *data) {
+    libze_taskq *tq = data;
+
+    (void) pthread_mutex_lock(&tq->lock);
+    for (;;) {
+        while ((tq->head == NULL) && !tq->shutdown) {
+            (void) pthread_cond_wait(&tq->work_cv, &tq->lock);
+        }
+        if (tq->head == NULL) {
+            break;
+        }
+
+        libze_task *task = tq->head;
+        tq->head = task->next;
+        if (tq->head == NULL) {
+            tq->tail = NULL;
+        }
+        (void) pthread_mutex_unlock(&tq->lock);
+
+        task->func(task->arg);
+        free(task);
+
+        (void) pthread_mutex_lock(&tq->lock);
+        if (--tq->outstanding == 0) {
+            (void) pthread_cond_broadcast(&tq->done_cv);
+        }
+    }
+    (void) pthread_mutex_unlock(&tq->lock);
+
+    return NULL;
+}
+
+/**
+ * @brief Number of workers to use for at most @p max_tasks concurrent tasks
+ * @param max_tasks Upper bound of tasks which can run concurrently
+ * @return Number of online CPUs, bounded by @p max_tasks, at least 1
+ */
+int
+libze_taskq_nthreads(int max_tasks) {
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int nthreads = (ncpus > 0) ? (int) ncpus : 1;
+
+    if (nthreads > max_tasks) {
+        nthreads = max_tasks;
+    }
+    return (nthreads > 0) ? nthreads : 1;
+}
+
+/**
+ * @brief Create a task queue served by @p nthreads workers
+ * @param nthreads Number of worker threads
+ * @return Task queue, or NULL on failure
+ */
+libze_taskq *
+libze_taskq_create(int nthreads) {
+    libze_taskq *tq = calloc(1, sizeof(libze_taskq));
+    if (tq == NULL) {
+        return NULL;
+    }
+
+    if ((tq->threads = calloc(nthreads, sizeof(pthread_t))) == NULL) {
+        free(tq);
+        return NULL;
+    }
+
+    (void) pthread_mutex_init(&tq->lock, NULL);
+    (void) pthread_cond_init(&tq->work_cv, NULL);
+    (void) pthread_cond_init(&tq->done_cv, NULL);
+
+    for (; tq->nthreads < nthreads; tq->nthreads++) {
+        if (pthread_create(&tq->threads[tq->nthreads], NULL, taskq_worker, tq) != 0) {
+            break;
+        }
+    }
+
+    if (tq->nthreads == 0) {
+        libze_taskq_destroy(tq);
+        return NULL;
+    }
+
+    return tq;
+}
+
+/**
+ * @brief Queue @p func to be run with @p arg on a worker. Can be called from within a task.
+ * @param tq Task queue
+ * @param func Function to run
+ * @param arg Argument to @p func
+ * @return non-zero on failure
+ */
+int
+libze_taskq_dispatch(libze_taskq *tq, libze_taskq_func func, void *arg) {
+    libze_task *task = malloc(sizeof(libze_task));
+    if (task == NULL) {
+        return -1;
+    }
+    task->func = func;
+    task->arg = arg;
+    task->next = NULL;
+
+    (void) pthread_mutex_lock(&tq->lock);
+    if (tq->tail == NULL) {
+        tq->head = task;
+    } else {
+        tq->tail->next = task;
+    }
+    tq->tail = task;
+    tq->outstanding++;
+    (void) pthread_cond_signal(&tq->work_cv);
+    (void) pthread_mutex_unlock(&tq->lock);
+
+    return 0;
+}
+
+/**
+ * @brief Wait until all dispatched tasks, including those dispatched by tasks, have completed
+ * @param tq Task queue
+ */
+void
+libze_taskq_wait(libze_taskq *tq) {
+    (void) pthread_mutex_lock(&tq->lock);
+    while (tq->outstanding != 0) {
+        (void) pthread_cond_wait(&tq->done_cv, &tq->lock);
+    }
+    (void) pthread_mutex_unlock(&tq->lock);
+}
+
+/**
+ * @brief Finish all outstanding tasks, stop the workers and free @p tq
+ * @param tq Task queue
+ */
+void
+libze_taskq_destroy(libze_taskq *tq) {
+    if (tq == NULL) {
+        return;
+    }
+
+    (void) pthread_mutex_lock(&tq->lock);
+    tq->shutdown = 1;
+    (void) pthread_cond_broadcast(&tq->work_cv);
+    (void) pthread_mutex_unlock(&tq->lock);
+
+    for (int i = 0; i < tq->nthreads; i++) {
+        (void) pthread_join(tq->threads[i], NULL);
+    }
+
+    (void) pthread_mutex_destroy(&tq->lock);
+    (void) pthread_cond_destroy(&tq->work_cv);
+    (void) pthread_cond_destroy(&tq->done_cv);
+    free(tq->threads);
+    free(tq);
+}
@@ -0,0 +1,29 @@
+/*
+ * Copyright (c) 2018, John Ramsden.
+ * https://github.com/johnramsden/zectl/blob/master/LICENSE.md
+ */
+
+#ifndef ZE_LIBZE_TASKQ_H
+#define ZE_LIBZE_TASKQ_H
+
+/* Function run by a worker for each dispatched task */
+typedef void (*libze_taskq_func)(void *arg);
+
+typedef struct libze_taskq libze_taskq;
+
+libze_taskq *
+libze_taskq_create(int nthreads);
+
+int
+libze_taskq_dispatch(libze_taskq *tq, libze_taskq_func func, void *arg);
+
+void
+libze_taskq_wait(libze_taskq *tq);
+
+void
+libze_taskq_destroy(libze_taskq *tq);
+
+int
+libze_taskq_nthreads(int max_tasks);
+
+#endif // ZE_LIBZE_TASKQ_H
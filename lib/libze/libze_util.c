@@ -9,9 +9,14 @@
 #include "system_linux.h"
 
 #include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
 #include <string.h>
 #include <sys/mount.h>
 #include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
 #define ASCII_OFFSET 48
 
@@ -236,11 +241,8 @@ libze_get_root_dataset(libze_handle *lzeh) {
     zfs_handle_t *zh;
     int ret = 0;
 
-    char rootfs[ZFS_MAX_DATASET_NAME_LEN];
-
     // Make sure type is ZFS
-    if (libze_dataset_from_mountpoint("/", ZFS_MAX_DATASET_NAME_LEN, rootfs) !=
-        SYSTEM_ERR_SUCCESS) {
+    if (libze_mnttab_dataset(lzeh, "/") == NULL) {
         return -1;
     }
 
@@ -310,6 +312,28 @@ libze_util_temporary_mount(char const dataset[ZFS_MAX_DATASET_NAME_LEN],
     return LIBZE_ERROR_SUCCESS;
 }
 
+/**
+ * @brief Mount a dataset or snapshot read-only using zfsutil
+ *
+ * @param[in] dataset     Dataset or snapshot to mount
+ * @param[in] mountpoint  Mountpoint location
+ *
+ * @return @p LIBZE_ERROR_SUCCESS on success, @p LIBZE_ERROR_UNKNOWN on failure
+ */
+libze_error
+libze_util_readonly_mount(char const dataset[ZFS_MAX_DATASET_NAME_LEN],
+                          char const mountpoint[static 2]) {
+    char const *mount_settings = "zfsutil";
+    char const *mount_type = "zfs";
+    const unsigned long mount_flags = MS_RDONLY;
+
+    if (mount(dataset, mountpoint, mount_type, mount_flags, mount_settings) != 0) {
+        return LIBZE_ERROR_UNKNOWN;
+    }
+
+    return LIBZE_ERROR_SUCCESS;
+}
+
 /**
  * @brief Copy binary file into new binary file
  *
@@ -675,6 +699,164 @@ libze_util_copydir(char const directory_path[LIBZE_MAX_PATH_LEN],
                               &(struct copy_data){.dest = new_directory_path});
 }
 
+struct fingerprint_data {
+    /**< Length of the path of the directory being fingerprinted */
+    size_t root_len;
+    uint64_t fingerprint;
+};
+
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+/**
+ * @brief Add @p len bytes of @p data to the FNV-1a hash @p hash
+ */
+static uint64_t
+fnv1a(uint64_t hash, void const *data, size_t len) {
+    unsigned char const *bytes = data;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+/**
+ * @brief Add the contents of the file at @p path to the FNV-1a hash @p hash
+ * @return 0 on success else appropriate error as returned by errno
+ */
+static int
+fnv1a_file(uint64_t *hash, char const path[static 1]) {
+    char buf[64 * 1024];
+    ssize_t len;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return errno;
+    }
+
+    while ((len = read(fd, buf, sizeof(buf))) != 0) {
+        if (len < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            int err = errno;
+            (void) close(fd);
+            return err;
+        }
+        *hash = fnv1a(*hash, buf, (size_t) len);
+    }
+
+    (void) close(fd);
+    return 0;
+}
+
+/**
+ * @brief Fingerprint callback function for @p libze_util_fingerprint_dir
+ *
+ * @param[in] dirname          Name of parent of file or directory being fingerprinted
+ * @param[in] filename_suffix  Name of file or directory being fingerprinted prefixed with '/'
+ * @param[in] st               Stat buffer of dirname
+ * @param[in] data             Callback data of type 'struct fingerprint_data'
+ *
+ * @return 0 on success else appropriate error as returned by errno
+ */
+static int
+fingerprint_cb(char const dirname[LIBZE_MAX_PATH_LEN],
+               char const filename_suffix[LIBZE_MAX_PATH_LEN], struct stat *st, void *data) {
+    struct fingerprint_data *fd = data;
+
+    char path_to_item[LIBZE_MAX_PATH_LEN];
+
+    /* Copy current path into path_to_item */
+    if ((strlcpy(path_to_item, dirname, LIBZE_MAX_PATH_LEN) >= LIBZE_MAX_PATH_LEN) ||
+        (strlcat(path_to_item, filename_suffix, LIBZE_MAX_PATH_LEN) >= LIBZE_MAX_PATH_LEN)) {
+        return ENAMETOOLONG;
+    }
+
+    if (S_ISDIR(st->st_mode) &&
+        ((strcmp(filename_suffix, "/.") == 0) || (strcmp(filename_suffix, "/..") == 0))) {
+        /* Skip entering "." or ".." */
+        return 0;
+    }
+
+    /* Hash the path relative to the fingerprinted directory, so it can be moved */
+    char const *relative_path = path_to_item + fd->root_len;
+    uint64_t hash = fnv1a(FNV_OFFSET_BASIS, relative_path, strlen(relative_path));
+    hash = fnv1a(hash, &st->st_mode, sizeof(st->st_mode));
+
+    /* Contents rather than size and mtime, files replaced with 'cp -p' or 'rsync -a' keep both */
+    if (S_ISREG(st->st_mode)) {
+        int err = fnv1a_file(&hash, path_to_item);
+        if (err != 0) {
+            return err;
+        }
+    }
+
+    /* Entries are combined independent of the order readdir returns them in */
+    fd->fingerprint += hash;
+
+    if (S_ISDIR(st->st_mode)) {
+        /* path is directory, recurse */
+        return recursive_traverse(path_to_item, fingerprint_cb, data);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Fingerprint the contents of a directory recursively. The fingerprint changes if any
+ *        file is added, removed, renamed, or its contents or mode change.
+ *
+ * @param[in] directory_path  Directory to fingerprint
+ * @param[in] buflen          Length of buffer
+ * @param[out] buf            Buffer for the fingerprint as a hexadecimal string
+ *
+ * @return 0 on success else appropriate error as returned by errno
+ */
+int
+libze_util_fingerprint_dir(char const directory_path[LIBZE_MAX_PATH_LEN], size_t buflen,
+                           char buf[buflen]) {
+    struct fingerprint_data fd = {.root_len = strlen(directory_path), .fingerprint = 0};
+
+    int ret = recursive_traverse(directory_path, fingerprint_cb, &fd);
+    if (ret != 0) {
+        return ret;
+    }
+
+    if (snprintf(buf, buflen, "%016" PRIx64, fd.fingerprint) >= (int) buflen) {
+        return ENAMETOOLONG;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Fingerprint the contents of a file
+ *
+ * @param[in] file_path  File to fingerprint
+ * @param[in] buflen     Length of buffer
+ * @param[out] buf       Buffer for the fingerprint as a hexadecimal string
+ *
+ * @return 0 on success else appropriate error as returned by errno
+ */
+int
+libze_util_fingerprint_file(char const file_path[LIBZE_MAX_PATH_LEN], size_t buflen,
+                            char buf[buflen]) {
+    uint64_t hash = FNV_OFFSET_BASIS;
+
+    int ret = fnv1a_file(&hash, file_path);
+    if (ret != 0) {
+        return ret;
+    }
+
+    if (snprintf(buf, buflen, "%016" PRIx64, hash) >= (int) buflen) {
+        return ENAMETOOLONG;
+    }
+
+    return 0;
+}
+
 /**
  * @brief Global string search and replace
  * @param to_replace String to replace
@@ -833,4 +1015,84 @@ libze_util_regex_subexpr_replace(regex_t *re, size_t replace_buflen,
     }
 
     return LIBZE_ERROR_SUCCESS;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Expand a snapshot name format. The format is passed to strftime(3) after expanding the
+ *        conversions:
+ *          - %N: Microseconds of the current second
+ *          - %Q: <pid>.<sequence>
+ *        A format without %Q gets -%Q appended, so names generated in the same process or at
+ *        the same time never collide.
+ * @param[in] format Snapshot name format
+ * @param[in] now Time the snapshot name is generated for
+ * @param[in] sequence Sequence number substituted in %Q
+ * @param[in] buflen Length of buffer @p buf
+ * @param[out] buf Buffer for snapshot name
+ * @return @p LIBZE_ERROR_SUCCESS on success,
+ *         @p LIBZE_ERROR_MAXPATHLEN if buffer length exceeded or the name is empty
+ */
+libze_error
+libze_util_snap_format_expand(char const format[static 1], struct timespec const *now,
+                              unsigned long sequence, size_t buflen, char buf[buflen]) {
+    char expanded[ZFS_MAXPROPLEN] = "";
+    struct tm now_tm = {0};
+
+    (void) localtime_r(&now->tv_sec, &now_tm);
+
+    size_t len = 0;
+    boolean_t sequenced = B_FALSE;
+    for (char const *f = format; (*f != '\0') && (len < ZFS_MAXPROPLEN); f++) {
+        int written = 0;
+        if ((f[0] == '%') && (f[1] == 'N')) {
+            written = snprintf(expanded + len, ZFS_MAXPROPLEN - len, "%06ld",
+                               now->tv_nsec / 1000);
+            f++;
+        } else if ((f[0] == '%') && (f[1] == 'Q')) {
+            written = snprintf(expanded + len, ZFS_MAXPROPLEN - len, "%jd.%lu",
+                               (intmax_t) getpid(), sequence);
+            sequenced = B_TRUE;
+            f++;
+        } else if ((f[0] == '%') && (f[1] != '\0')) {
+            // Left for strftime, including "%%"
+            written = snprintf(expanded + len, ZFS_MAXPROPLEN - len, "%c%c", f[0], f[1]);
+            f++;
+        } else {
+            written = snprintf(expanded + len, ZFS_MAXPROPLEN - len, "%c", f[0]);
+        }
+        len += written;
+    }
+
+    if (!sequenced && (len < ZFS_MAXPROPLEN)) {
+        len += snprintf(expanded + len, ZFS_MAXPROPLEN - len, "-%jd.%lu", (intmax_t) getpid(),
+                        sequence);
+    }
+
+    if ((len >= ZFS_MAXPROPLEN) || (strftime(buf, buflen, expanded, &now_tm) == 0)) {
+        return LIBZE_ERROR_MAXPATHLEN;
+    }
+
+    return LIBZE_ERROR_SUCCESS;
+}
+
+/**
+ * @brief Check that a snapshot name, the part after the '@', is valid
+ * @param[in] snap_suffix Snapshot name
+ * @return @p B_TRUE if ZFS accepts @p snap_suffix as a snapshot name and it has no whitespace.
+ *         ZFS allows spaces, but zectl output and arguments are whitespace separated.
+ */
+boolean_t
+libze_util_snap_suffix_valid(char const snap_suffix[static 1]) {
+    char snapshot[ZFS_MAX_DATASET_NAME_LEN];
+
+    if (strpbrk(snap_suffix, " \t\n") != NULL) {
+        return B_FALSE;
+    }
+
+    // Any valid dataset name works, only the snapshot name is checked
+    if (libze_util_concat("pool", "@", snap_suffix, ZFS_MAX_DATASET_NAME_LEN, snapshot) != 0) {
+        return B_FALSE;
+    }
+
+    return zfs_name_valid(snapshot, ZFS_TYPE_SNAPSHOT) ? B_TRUE : B_FALSE;
+}
@@ -1,57 +1,185 @@
 // Make sure libspl mnttab.h isn't imported, creates getmnttent conflict
 #define _SYS_MNTTAB_H
+// unshare, getline
+#define _GNU_SOURCE
 
 #include "system_linux.h"
 
 #include "libze/libze_util.h"
 
-#include <mntent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mount.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/* Constants of the new mount API from linux/mount.h, which conflicts with sys/mount.h
+ * on some glibc versions */
+#define ZE_FSOPEN_CLOEXEC 0x00000001
+#define ZE_FSCONFIG_SET_FLAG 0
+#define ZE_FSCONFIG_SET_STRING 1
+#define ZE_FSCONFIG_CMD_CREATE 6
+#define ZE_FSMOUNT_CLOEXEC 0x00000001
+#define ZE_MOVE_MOUNT_F_EMPTY_PATH 0x00000004
+
+/**
+ * @brief Decode the octal escapes of space, tab, newline and backslash in a mountinfo field
+ * @param[in,out] field Field to decode in place
+ */
+static void
+mountinfo_unescape(char field[static 1]) {
+    char *out = field;
+
+    for (char const *in = field; *in != '\0'; out++) {
+        if ((in[0] == '\\') && (in[1] >= '0') && (in[1] <= '3') && (in[2] >= '0') &&
+            (in[2] <= '7') && (in[3] >= '0') && (in[3] <= '7')) {
+            *out = (char) (((in[1] - '0') << 6) | ((in[2] - '0') << 3) | (in[3] - '0'));
+            in += 4;
+        } else {
+            *out = *in++;
+        }
+    }
+    *out = '\0';
+}
 
 /**
- * @brief Given a mountpoint get the dataset mounted
- * @param[in] mountpoint Mountpoint to get dataset from
- * @param[in] buflen Length of buffer
- * @param[out] dataset_buf Buffer to place a dataset in
+ * @brief Index all mounted ZFS datasets of a mount table in mountinfo format
+ * @param[in] mnt_file Mount table, read up to its end
+ * @param[out] mountpoints Initialized nvlist with unique names, mountpoint -> dataset string
+ *             pairs are added. If a mountpoint is mounted over, the topmost dataset is kept.
+ * @param[out] datasets Initialized nvlist, or NULL. dataset -> mountpoint string pairs are
+ *             added, the first mount is kept for datasets mounted more than once.
  * @return @p SYSTEM_ERR_SUCCESS on success.
- *         @p SYSTEM_ERR_MNT_FILE if no mntfile exists.
- *         @p SYSTEM_ERR_NOT_FOUND if no dataset found.
- *         @p SYSTEM_ERR_WRONG_FSTYPE if non-zfs.
- *         @p SYSTEM_ERR_UNKNOWN if buflen exceeded.
+ *         @p SYSTEM_ERR_UNKNOWN if @p mountpoints or @p datasets couldn't be added to.
  */
 system_fs_error
-libze_dataset_from_mountpoint(char mountpoint[static 1], size_t buflen, char dataset_buf[buflen]) {
-
-    struct mntent *ent = NULL;
+libze_zfs_mounts_parse(FILE *mnt_file, nvlist_t *mountpoints, nvlist_t *datasets) {
     system_fs_error ret = SYSTEM_ERR_SUCCESS;
+    char *line = NULL;
+    size_t line_len = 0;
 
-    char const *mnt_location_file = "/proc/mounts";
-    FILE *mnt_file = setmntent(mnt_location_file, "r");
+    /* Lines in form:
+     * <id> <parent id> <major:minor> <root> <mountpoint> <options> [<optional>...] - <fstype>
+     * <source> <super options> */
+    while (getline(&line, &line_len, mnt_file) != -1) {
+        char *save = NULL;
+        char *field = strtok_r(line, " \n", &save);
+        char *mountpoint = NULL;
 
+        for (int i = 1; (field != NULL) && (i <= 4); i++) {
+            field = strtok_r(NULL, " \n", &save);
+            if (i == 4) {
+                mountpoint = field;
+            }
+        }
+        // Skip options and optional fields up to the separator
+        while ((field != NULL) && (strcmp(field, "-") != 0)) {
+            field = strtok_r(NULL, " \n", &save);
+        }
+
+        char *fstype = (field != NULL) ? strtok_r(NULL, " \n", &save) : NULL;
+        char *source = (fstype != NULL) ? strtok_r(NULL, " \n", &save) : NULL;
+        if ((mountpoint == NULL) || (source == NULL) || (strcmp(fstype, "zfs") != 0)) {
+            continue;
+        }
+
+        mountinfo_unescape(mountpoint);
+        mountinfo_unescape(source);
+
+        if ((nvlist_add_string(mountpoints, mountpoint, source) != 0) ||
+            ((datasets != NULL) && !nvlist_exists(datasets, source) &&
+             (nvlist_add_string(datasets, source, mountpoint) != 0))) {
+            ret = SYSTEM_ERR_UNKNOWN;
+            break;
+        }
+    }
+
+    free(line);
+    return ret;
+}
+
+/**
+ * @brief Read the mount table of the process once and index all mounted ZFS datasets, see
+ *        @p libze_zfs_mounts_parse
+ * @param[out] mountpoints Initialized nvlist with unique names
+ * @param[out] datasets Initialized nvlist, or NULL
+ * @return @p SYSTEM_ERR_SUCCESS on success.
+ *         @p SYSTEM_ERR_MNT_FILE if no mntfile exists.
+ *         @p SYSTEM_ERR_UNKNOWN if @p mountpoints or @p datasets couldn't be added to.
+ */
+system_fs_error
+libze_zfs_mounts_get(nvlist_t *mountpoints, nvlist_t *datasets) {
+    FILE *mnt_file = fopen("/proc/self/mountinfo", "re");
     if (mnt_file == NULL) {
         return SYSTEM_ERR_MNT_FILE;
     }
 
-    do { /* Loop until mountpoint found or EOF */
-        ent = getmntent(mnt_file);
-    } while (ent != NULL && (strcmp(ent->mnt_dir, mountpoint) != 0));
+    system_fs_error ret = libze_zfs_mounts_parse(mnt_file, mountpoints, datasets);
 
-    if (ent == NULL) {
-        ret = SYSTEM_ERR_NOT_FOUND;
-        goto fin;
-    }
+    (void) fclose(mnt_file);
+    return ret;
+}
 
-    /* Found root, checking if zfs */
-    if (strcmp(ent->mnt_type, "zfs") != 0) {
-        ret = SYSTEM_ERR_WRONG_FSTYPE;
-        goto fin;
+/**
+ * @brief Create a detached mount of a dataset with the new mount API, mounted with the
+ *        'zfsutil' option like @p libze_util_temporary_mount.
+ * @param[in] dataset Dataset to mount
+ * @return A file descriptor referring to the detached mount, or -1 with @p errno set.
+ *         @p errno is @p ENOSYS if the kernel doesn't support the new mount API.
+ */
+int
+libze_fsmount_dataset(char const dataset[static 1]) {
+#if defined(SYS_fsopen) && defined(SYS_fsconfig) && defined(SYS_fsmount)
+    int fs_fd = (int) syscall(SYS_fsopen, "zfs", ZE_FSOPEN_CLOEXEC);
+    if (fs_fd < 0) {
+        return -1;
     }
 
-    if (strlcpy(dataset_buf, ent->mnt_fsname, buflen) >= buflen) {
-        ret = SYSTEM_ERR_UNKNOWN;
-        goto fin;
+    int mnt_fd = -1;
+    if ((syscall(SYS_fsconfig, fs_fd, ZE_FSCONFIG_SET_STRING, "source", dataset, 0) == 0) &&
+        (syscall(SYS_fsconfig, fs_fd, ZE_FSCONFIG_SET_FLAG, "zfsutil", NULL, 0) == 0) &&
+        (syscall(SYS_fsconfig, fs_fd, ZE_FSCONFIG_CMD_CREATE, NULL, NULL, 0) == 0)) {
+        mnt_fd = (int) syscall(SYS_fsmount, fs_fd, ZE_FSMOUNT_CLOEXEC, 0);
     }
 
-fin:
-    endmntent(mnt_file);
-    return ret;
-}
\ No newline at end of file
+    int saved_errno = errno;
+    (void) close(fs_fd);
+    errno = saved_errno;
+    return mnt_fd;
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+/**
+ * @brief Attach the mount referred to by @p from_fd at @p to_path relative to @p to_dfd
+ * @param[in] from_fd Mount file descriptor, e.g. from @p libze_fsmount_dataset
+ * @param[in] to_dfd Directory file descriptor, or @p AT_FDCWD
+ * @param[in] to_path Path to attach to, relative to @p to_dfd
+ * @return 0 on success, or -1 with @p errno set
+ */
+int
+libze_move_mount(int from_fd, int to_dfd, char const to_path[static 1]) {
+#if defined(SYS_move_mount)
+    return (int) syscall(SYS_move_mount, from_fd, "", to_dfd, to_path, ZE_MOVE_MOUNT_F_EMPTY_PATH);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+/**
+ * @brief Move the calling process into a new mount namespace, which doesn't propagate mounts
+ *        to or from the parent namespace. Mounts made afterwards are only visible to the
+ *        process and its children, and are released once the last of them exits.
+ * @return 0 on success, or -1 with @p errno set
+ */
+int
+libze_mount_namespace_private(void) {
+    if (unshare(CLONE_NEWNS) != 0) {
+        return -1;
+    }
+    return mount(NULL, "/", NULL, MS_REC | MS_PRIVATE, NULL);
+}
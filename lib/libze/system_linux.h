@@ -22,6 +22,18 @@ typedef enum system_fs_error {
 } system_fs_error;
 
 system_fs_error
-libze_dataset_from_mountpoint(char mountpoint[static 1], size_t buflen, char dataset_buf[buflen]);
+libze_zfs_mounts_parse(FILE *mnt_file, nvlist_t *mountpoints, nvlist_t *datasets);
+
+system_fs_error
+libze_zfs_mounts_get(nvlist_t *mountpoints, nvlist_t *datasets);
+
+int
+libze_fsmount_dataset(char const dataset[static 1]);
+
+int
+libze_move_mount(int from_fd, int to_dfd, char const to_path[static 1]);
+
+int
+libze_mount_namespace_private(void);
 
 #endif // ZE_SYSTEM_LINUX_H
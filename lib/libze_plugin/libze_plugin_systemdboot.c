@@ -4,21 +4,39 @@
 #include "libze/libze_util.h"
 
 #include <regex.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 
 #define REGEX_BUFLEN 512
 #define SYSTEMDBOOT_ENTRY_PREFIX "org.zectl"
 
-#define NUM_SYSTEMDBOOT_PROPERTY_VALUES 2
-#define NUM_SYSTEMDBOOT_PROPERTIES 3
+// Namespace of systemdboot properties, as formed by libze_plugin_form_namespace
+#define SYSTEMDBOOT_NAMESPACE ZE_PROP_NAMESPACE ".systemdboot"
 
 /**
- * @brief list of systemdboot plugin properties
+ * @brief Schema of systemdboot plugin properties
  */
-char const *systemdboot_properties[NUM_SYSTEMDBOOT_PROPERTIES][NUM_SYSTEMDBOOT_PROPERTY_VALUES] = {
-    {"efi", "/efi"}, {"boot", "/boot"}, {"kernelsnapshotdirectory", "/zectl/systemdboot"}};
+libze_prop_schema const systemdboot_properties[SYSTEMDBOOT_PROP_NUM] = {
+    [SYSTEMDBOOT_PROP_EFI] = {"efi", LIBZE_PROP_TYPE_PATH, "/efi", NULL},
+    [SYSTEMDBOOT_PROP_BOOT] = {"boot", LIBZE_PROP_TYPE_PATH, "/boot", NULL},
+    [SYSTEMDBOOT_PROP_KERNEL_SNAPSHOT_DIRECTORY] = {"kernelsnapshotdirectory",
+                                                    LIBZE_PROP_TYPE_PATH, "/zectl/systemdboot",
+                                                    NULL}};
+
+/**
+ * @brief Get the value of a systemdboot property without copying it
+ * @param[in] lzeh Initialized lzeh libze handle
+ * @param[in] property Index of the property in @p systemdboot_properties
+ * @return The value, its default if unset, or @p NULL with the error set on failure
+ */
+static char const *
+prop_value(libze_handle *lzeh, systemdboot_prop property) {
+    return libze_be_prop_value(lzeh, systemdboot_properties[property].name,
+                               SYSTEMDBOOT_NAMESPACE);
+}
 
 /**
  * @struct replace_matched_data
@@ -150,101 +168,17 @@ err:
  ********************************************************************/
 
 /**
- * @brief Add the systemd-boot default properties to nvlist
- *
- * @param[in,out] lzeh             libze handle
- * @param[out] default_properties  Populated default properties, alllocated internally.
- *                                 NULL if allocation fails
- *
- * @return @p LIBZE_ERROR_SUCCESS on success,
- *         @p LIBZE_ERROR_MAXPATHLEN if plugin namespace buffer exceeded,
- *         @p LIBZE_ERROR_NOMEM if nvlist allocation fails
- */
-libze_error
-libze_plugin_systemdboot_defaults(libze_handle *lzeh, nvlist_t **default_properties) {
-    libze_error ret = LIBZE_ERROR_SUCCESS;
-    nvlist_t *properties = NULL;
-
-    properties = fnvlist_alloc();
-    if (properties == NULL) {
-        return libze_error_nomem(lzeh);
-    }
-    char namespace_buf[ZFS_MAXPROPLEN];
-    if (libze_plugin_form_namespace(PLUGIN_SYSTEMDBOOT, namespace_buf) != LIBZE_ERROR_SUCCESS) {
-        ret = libze_error_set(lzeh, LIBZE_ERROR_MAXPATHLEN, "Exceeded max property name length.\n");
-        goto err;
-    }
-
-    /* Add all default properties to nvlist */
-    for (int i = 0; i < NUM_SYSTEMDBOOT_PROPERTIES; i++) {
-        if (libze_default_prop_add(&properties, systemdboot_properties[i][0],
-                                   systemdboot_properties[i][1], namespace_buf) != 0) {
-            ret = libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN,
-                                  "Failed to add %s property to systemdboot nvlist.\n",
-                                  systemdboot_properties[i][0]);
-            goto err;
-        }
-    }
-
-    *default_properties = properties;
-    return ret;
-err:
-    (void) libze_list_free(properties);
-    return ret;
-}
-
-/**
- * @brief Add default properties to libze handle
+ * @brief Add default properties to libze handle, as a fallback for unset properties
  *
  * @param[in,out] lzeh  libze handle
  * @return @p LIBZE_ERROR_SUCCESS on success,
- *         @p LIBZE_ERROR_NOMEM if an nvlist couldn't be duplicated
- *         @p LIBZE_ERROR_UNKNOWN if an nvlist value couldn't be accessed,
- *         @p LIBZE_ERROR_UNKNOWN if an nvlist couldn't be added to @p lzeh->ze_props
+ *         @p LIBZE_ERROR_MAXPATHLEN if plugin namespace buffer exceeded,
+ *         @p LIBZE_ERROR_NOMEM if the defaults couldn't be allocated or merged
  */
 static libze_error
 add_default_properties(libze_handle *lzeh) {
-    libze_error ret = LIBZE_ERROR_SUCCESS;
-
-    nvlist_t *defaults_nvl = NULL;
-    if ((ret = libze_plugin_systemdboot_defaults(lzeh, &defaults_nvl)) != LIBZE_ERROR_SUCCESS) {
-        return ret;
-    }
-
-    /* Add defaults */
-    nvpair_t *default_pair = NULL;
-    for (default_pair = nvlist_next_nvpair(defaults_nvl, NULL); default_pair != NULL;
-         default_pair = nvlist_next_nvpair(defaults_nvl, default_pair)) {
-        char const *default_nvp_name = nvpair_name(default_pair);
-
-        /* If nvlist already in properties, don't add default */
-        if (nvlist_exists(lzeh->ze_props, default_nvp_name)) {
-            continue;
-        }
-
-        nvlist_t *nvl = NULL;
-        if (nvpair_value_nvlist(default_pair, &nvl) != 0) {
-            ret = libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN, "Failed to access nvlist %s.\n",
-                                  default_nvp_name);
-            goto err;
-        }
-        nvlist_t *nvl_copy = NULL;
-        if (nvlist_dup(nvl, &nvl_copy, 0) != 0) {
-            ret = libze_error_nomem(lzeh);
-            goto err;
-        }
-        if (nvlist_add_nvlist(lzeh->ze_props, default_nvp_name, nvl_copy) != 0) {
-            ret = libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN, "Failed adding default property %s.\n",
-                                  default_nvp_name);
-            goto err;
-        }
-    }
-
-err:
-    if (defaults_nvl != NULL) {
-        (void) libze_list_free(defaults_nvl);
-    }
-    return ret;
+    return libze_schema_defaults_set(lzeh, systemdboot_properties, SYSTEMDBOOT_PROP_NUM,
+                                     SYSTEMDBOOT_NAMESPACE);
 }
 
 /**
@@ -255,9 +189,8 @@ err:
  * @pre lzeh->ze_props is allocated
  *
  * @return @p LIBZE_ERROR_SUCCESS on success,
- *         @p LIBZE_ERROR_NOMEM if an nvlist couldn't be duplicated
- *         @p LIBZE_ERROR_UNKNOWN if an nvlist value couldn't be accessed,
- *         @p LIBZE_ERROR_UNKNOWN if an nvlist couldn't be added to @p lzeh->ze_props
+ *         @p LIBZE_ERROR_MAXPATHLEN if plugin namespace buffer exceeded,
+ *         @p LIBZE_ERROR_NOMEM if the defaults couldn't be allocated or merged
  */
 libze_error
 libze_plugin_systemdboot_init(libze_handle *lzeh) {
@@ -859,17 +792,9 @@ libze_plugin_systemdboot_post_activate(libze_handle *lzeh, char const be_name[LI
         return libze_error_set(lzeh, LIBZE_ERROR_MAXPATHLEN, "Bootfs exceeds max path length.\n");
     }
 
-    char efi_mountpoint[ZFS_MAXPROPLEN];
-
-    char namespace_buf[ZFS_MAXPROPLEN];
-    if (libze_plugin_form_namespace(PLUGIN_SYSTEMDBOOT, namespace_buf) !=
-        LIBZE_PLUGIN_MANAGER_ERROR_SUCCESS) {
-        return libze_error_set(lzeh, LIBZE_ERROR_MAXPATHLEN,
-                               "Exceeded max property name length.\n");
-    }
+    char const *efi_mountpoint = NULL;
 
-    ret = libze_be_prop_get(lzeh, efi_mountpoint, "efi", namespace_buf);
-    if (ret != LIBZE_ERROR_SUCCESS) {
+    if ((efi_mountpoint = prop_value(lzeh, SYSTEMDBOOT_PROP_EFI)) == NULL) {
         return libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN,
                                "Couldn't access systemdboot:efi property.\n");
     }
@@ -1126,35 +1051,26 @@ libze_plugin_systemdboot_post_create(libze_handle *lzeh, libze_create_data *crea
     libze_error ret = LIBZE_ERROR_SUCCESS;
     int iret = 0;
 
-    char boot_mountpoint[ZFS_MAXPROPLEN];
-    char efi_mountpoint[ZFS_MAXPROPLEN];
-    char kernel_snap_dir[LIBZE_MAX_PATH_LEN];
+    char const *boot_mountpoint = NULL;
+    char const *efi_mountpoint = NULL;
+    char const *kernel_snap_dir = NULL;
     char kernel_source_dir[LIBZE_MAX_PATH_LEN];
     char kernel_mounted_snap_dir[LIBZE_MAX_PATH_LEN];
     char loader_buf[LIBZE_MAX_PATH_LEN];
     char loader_replace[LIBZE_MAX_PATH_LEN];
     char new_loader_buf[LIBZE_MAX_PATH_LEN];
 
-    char namespace_buf[ZFS_MAXPROPLEN];
-    if (libze_plugin_form_namespace(PLUGIN_SYSTEMDBOOT, namespace_buf) !=
-        LIBZE_PLUGIN_MANAGER_ERROR_SUCCESS) {
-        return libze_error_set(lzeh, LIBZE_ERROR_MAXPATHLEN,
-                               "Exceeded max property name length.\n");
-    }
-
-    ret = libze_be_prop_get(lzeh, boot_mountpoint, "boot", namespace_buf);
-    if (ret != LIBZE_ERROR_SUCCESS) {
+    if ((boot_mountpoint = prop_value(lzeh, SYSTEMDBOOT_PROP_BOOT)) == NULL) {
         return libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN,
                                "Couldn't access systemdboot:boot property.\n");
     }
-    ret = libze_be_prop_get(lzeh, efi_mountpoint, "efi", namespace_buf);
-    if (ret != LIBZE_ERROR_SUCCESS) {
+    if ((efi_mountpoint = prop_value(lzeh, SYSTEMDBOOT_PROP_EFI)) == NULL) {
         return libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN,
                                "Couldn't access systemdboot:efi property.\n");
     }
 
-    ret = libze_be_prop_get(lzeh, kernel_snap_dir, "kernelsnapshotdirectory", namespace_buf);
-    if (ret != LIBZE_ERROR_SUCCESS) {
+    kernel_snap_dir = prop_value(lzeh, SYSTEMDBOOT_PROP_KERNEL_SNAPSHOT_DIRECTORY);
+    if (kernel_snap_dir == NULL) {
         return libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN,
                                "Couldn't access systemdboot:kernelsnapshotdirectory property.\n");
     }
@@ -1328,17 +1244,9 @@ libze_plugin_systemdboot_post_destroy(libze_handle *lzeh, char const be_name[LIB
         return libze_error_set(lzeh, LIBZE_ERROR_MAXPATHLEN, "Bootfs exceeds max path length.\n");
     }
 
-    char efi_mountpoint[ZFS_MAXPROPLEN];
-    char namespace_buf[ZFS_MAXPROPLEN];
-
-    libze_plugin_manager_error per = libze_plugin_form_namespace(PLUGIN_SYSTEMDBOOT, namespace_buf);
-    if (per != LIBZE_PLUGIN_MANAGER_ERROR_SUCCESS) {
-        return libze_error_set(lzeh, LIBZE_ERROR_MAXPATHLEN,
-                               "Exceeded max property name length.\n");
-    }
+    char const *efi_mountpoint = NULL;
 
-    ret = libze_be_prop_get(lzeh, efi_mountpoint, "efi", namespace_buf);
-    if (ret != LIBZE_ERROR_SUCCESS) {
+    if ((efi_mountpoint = prop_value(lzeh, SYSTEMDBOOT_PROP_EFI)) == NULL) {
         return libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN,
                                "Couldn't access systemdboot:efi property.\n");
     }
@@ -1371,19 +1279,11 @@ libze_plugin_systemdboot_post_rename(libze_handle *lzeh, char const be_name_old[
                                      char const be_name_new[LIBZE_MAX_PATH_LEN]) {
     libze_error ret = LIBZE_ERROR_SUCCESS;
 
-    char efi_mountpoint[ZFS_MAXPROPLEN];
-    char namespace_buf[ZFS_MAXPROPLEN];
+    char const *efi_mountpoint = NULL;
     char loader_buf_old[ZFS_MAXPROPLEN];
     char loader_buf_new[ZFS_MAXPROPLEN];
 
-    libze_plugin_manager_error per = libze_plugin_form_namespace(PLUGIN_SYSTEMDBOOT, namespace_buf);
-    if (per != LIBZE_PLUGIN_MANAGER_ERROR_SUCCESS) {
-        return libze_error_set(lzeh, LIBZE_ERROR_MAXPATHLEN,
-                               "Exceeded max property name length.\n");
-    }
-
-    ret = libze_be_prop_get(lzeh, efi_mountpoint, "efi", namespace_buf);
-    if (ret != LIBZE_ERROR_SUCCESS) {
+    if ((efi_mountpoint = prop_value(lzeh, SYSTEMDBOOT_PROP_EFI)) == NULL) {
         return libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN,
                                "Couldn't access systemdboot:efi property.\n");
     }
@@ -1428,13 +1328,65 @@ libze_plugin_systemdboot_post_rename(libze_handle *lzeh, char const be_name_old[
     return ret;
 }
 
+/**
+ * @brief Check if the kernels stashed in a boot environment match @p fingerprint
+ * @param[in] lzeh Initialized libze handle
+ * @param[in] be_ds Boot environment dataset
+ * @param[in] stash_prop Property the fingerprint of the stashed kernels is recorded in
+ * @param[in] fingerprint Fingerprint of the current kernels
+ * @return @p B_TRUE if the stash is up to date
+ */
+static boolean_t
+stash_current(libze_handle *lzeh, char const be_ds[static 1], char const stash_prop[static 1],
+              char const fingerprint[static 1]) {
+    nvlist_t *prop = NULL;
+    char const *value = NULL;
+
+    zfs_handle_t *zh = zfs_open(lzeh->lzh, be_ds, ZFS_TYPE_FILESYSTEM);
+    if (zh == NULL) {
+        return B_FALSE;
+    }
+    boolean_t current = (nvlist_lookup_nvlist(zfs_get_user_props(zh), stash_prop, &prop) == 0) &&
+                        (nvlist_lookup_string(prop, "value", &value) == 0) &&
+                        (strcmp(value, fingerprint) == 0);
+    zfs_close(zh);
+
+    return current;
+}
+
+/**
+ * @brief Record the fingerprint of the kernels stashed in a boot environment
+ * @param[in] lzeh Initialized libze handle
+ * @param[in] be_ds Boot environment dataset
+ * @param[in] stash_prop Property to record the fingerprint in
+ * @param[in] fingerprint Fingerprint of the stashed kernels
+ * @return @p LIBZE_ERROR_SUCCESS on success
+ */
+static libze_error
+stash_record(libze_handle *lzeh, char const be_ds[static 1], char const stash_prop[static 1],
+             char const fingerprint[static 1]) {
+    zfs_handle_t *zh = zfs_open(lzeh->lzh, be_ds, ZFS_TYPE_FILESYSTEM);
+    if (zh == NULL) {
+        return libze_error_set(lzeh, LIBZE_ERROR_ZFS_OPEN, "Failed opening dataset (%s).\n",
+                               be_ds);
+    }
+    int err = zfs_prop_set(zh, stash_prop, fingerprint);
+    zfs_close(zh);
+    if (err != 0) {
+        return libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN, "Failed to set %s on (%s).\n",
+                               stash_prop, be_ds);
+    }
+
+    return LIBZE_ERROR_SUCCESS;
+}
+
 /**
  * @brief Pre snapshot hook
- *        Mounts the dataset being snapshotted (if it is not the currently mounted dataset).
- *        Copies the following for that environment to $kernelsnapshotdirectory.
+ *        Copies the following for that environment to $kernelsnapshotdirectory, unless the
+ *        kernels stashed there already match the fingerprint of the snapshot.
  *           $esp/env/org.zectl-$be -> $kernelsnapshotdirectory/env/boot
  *           $esp/loader/entries/org.zectl-$be.conf ->
- * $kernelsnapshotdirectory/loader/entries/org.zectl-%ZECTLBE%.conf Unmounts the dataset
+ *               $kernelsnapshotdirectory/loader/entries/org.zectl-%ZECTLBE%.conf
  *
  * @param[in,out] lzeh   libze handle
  * @param[in] snap_data  Snapshot related data
@@ -1447,7 +1399,7 @@ libze_plugin_systemdboot_pre_snapshot(libze_handle *lzeh, libze_snap_data *snap_
     libze_error ret = LIBZE_ERROR_SUCCESS;
 
     char mountpoint_buf[LIBZE_MAX_PATH_LEN];
-    char kernel_snap_dir[LIBZE_MAX_PATH_LEN];
+    char const *kernel_snap_dir = NULL;
     char kernel_mounted_snap_dir[LIBZE_MAX_PATH_LEN];
     char kernel_boot_dir[LIBZE_MAX_PATH_LEN];
     char kernel_loader_dir[LIBZE_MAX_PATH_LEN];
@@ -1457,28 +1409,30 @@ libze_plugin_systemdboot_pre_snapshot(libze_handle *lzeh, libze_snap_data *snap_
     char fstab_buf[LIBZE_MAX_PATH_LEN];
     char fstab_buf_dest[LIBZE_MAX_PATH_LEN];
     char etc_buf_dir[LIBZE_MAX_PATH_LEN];
-    char efi_mountpoint[ZFS_MAXPROPLEN];
-    char boot_mountpoint[ZFS_MAXPROPLEN];
-    char namespace_buf[ZFS_MAXPROPLEN];
-
-    if (libze_plugin_form_namespace(PLUGIN_SYSTEMDBOOT, namespace_buf) !=
-        LIBZE_PLUGIN_MANAGER_ERROR_SUCCESS) {
+    char const *efi_mountpoint = NULL;
+    char const *boot_mountpoint = NULL;
+    char const *stash_prop = SYSTEMDBOOT_NAMESPACE ":stashfingerprint";
+    char const *fingerprint = snap_data->fingerprint;
+    char fingerprint_buf[ZFS_MAXPROPLEN] = "";
+    char be_ds[ZFS_MAX_DATASET_NAME_LEN];
+    struct stat st;
+
+    if (libze_util_concat(lzeh->env_root, "/", snap_data->be_name, ZFS_MAX_DATASET_NAME_LEN,
+                          be_ds) != 0) {
         return libze_error_set(lzeh, LIBZE_ERROR_MAXPATHLEN,
-                               "Exceeded max property name length.\n");
+                               "Boot environment dataset exceeds max length.\n");
     }
 
-    ret = libze_be_prop_get(lzeh, efi_mountpoint, "efi", namespace_buf);
-    if (ret != LIBZE_ERROR_SUCCESS) {
+    if ((efi_mountpoint = prop_value(lzeh, SYSTEMDBOOT_PROP_EFI)) == NULL) {
         return libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN,
                                "Couldn't access systemdboot:efi property.\n");
     }
-    ret = libze_be_prop_get(lzeh, boot_mountpoint, "boot", namespace_buf);
-    if (ret != LIBZE_ERROR_SUCCESS) {
+    if ((boot_mountpoint = prop_value(lzeh, SYSTEMDBOOT_PROP_BOOT)) == NULL) {
         return libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN,
                                "Couldn't access systemdboot:boot property.\n");
     }
-    ret = libze_be_prop_get(lzeh, kernel_snap_dir, "kernelsnapshotdirectory", namespace_buf);
-    if (ret != LIBZE_ERROR_SUCCESS) {
+    kernel_snap_dir = prop_value(lzeh, SYSTEMDBOOT_PROP_KERNEL_SNAPSHOT_DIRECTORY);
+    if (kernel_snap_dir == NULL) {
         return libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN,
                                "Couldn't access systemdboot:kernelsnapshotdirectory property.\n");
     }
@@ -1486,8 +1440,8 @@ libze_plugin_systemdboot_pre_snapshot(libze_handle *lzeh, libze_snap_data *snap_
     if (snap_data->is_root) {
         (void) strlcat(mountpoint_buf, "", LIBZE_MAX_PATH_LEN);
     } else {
-        /* Get temporary mountpoint and place in mountpoint_buf */
-        ret = libze_mount(lzeh, snap_data->be_name, NULL, mountpoint_buf);
+        /* Get mountpoint shared with other hooks and place in mountpoint_buf */
+        ret = libze_mount_session_get(lzeh, snap_data->be_name, mountpoint_buf);
         if (ret != LIBZE_ERROR_SUCCESS) {
             return ret;
         }
@@ -1569,24 +1523,44 @@ libze_plugin_systemdboot_pre_snapshot(libze_handle *lzeh, libze_snap_data *snap_
         goto err;
     }
 
+    /* Skip stashing if the kernels didn't change since they were last stashed in the boot
+     * environment. Without a fingerprint, always stash. */
+    if (fingerprint == NULL) {
+        if (libze_plugin_systemdboot_snapshot_fingerprint(lzeh, snap_data, fingerprint_buf) !=
+            LIBZE_ERROR_SUCCESS) {
+            (void) libze_error_clear(lzeh);
+            fingerprint_buf[0] = '\0';
+        }
+        fingerprint = fingerprint_buf;
+    }
+    boolean_t stashed = (strlen(fingerprint) > 0) && (stat(kernel_loader_conf_dest, &st) == 0) &&
+                        stash_current(lzeh, be_ds, stash_prop, fingerprint);
+
     /* Copy the following for that environment to $kernelsnapshotdirectory.
      *  $esp/env/org.zectl-$be -> $kernelsnapshotdirectory/env/boot
      *  $esp/loader/entries/org.zectl-$be.conf ->
      * $kernelsnapshotdirectory/loader/entries/org.zectl-%ZECTLBE%.conf
      */
 
-    if (libze_util_copydir(kernel_dir_buf, kernel_boot_dir) != 0) {
-        ret =
-            libze_error_set(lzeh, LIBZE_ERROR_MAXPATHLEN, "Failed to copy directory (%s -> %s).\n",
-                            kernel_loader_conf, kernel_loader_conf_dest);
-        goto err;
-    }
+    if (!stashed) {
+        if (libze_util_copydir(kernel_dir_buf, kernel_boot_dir) != 0) {
+            ret = libze_error_set(lzeh, LIBZE_ERROR_MAXPATHLEN,
+                                  "Failed to copy directory (%s -> %s).\n", kernel_loader_conf,
+                                  kernel_loader_conf_dest);
+            goto err;
+        }
 
-    /* Replace BE with %ZECTLBE% */
-    ret = replace_be_name(lzeh, "%ZECTLBE%", snap_data->be_name, kernel_loader_conf,
-                          kernel_loader_conf_dest);
-    if (ret != LIBZE_ERROR_SUCCESS) {
-        goto err;
+        /* Replace BE with %ZECTLBE% */
+        ret = replace_be_name(lzeh, "%ZECTLBE%", snap_data->be_name, kernel_loader_conf,
+                              kernel_loader_conf_dest);
+        if (ret != LIBZE_ERROR_SUCCESS) {
+            goto err;
+        }
+
+        if ((strlen(fingerprint) > 0) &&
+            ((ret = stash_record(lzeh, be_ds, stash_prop, fingerprint)) != LIBZE_ERROR_SUCCESS)) {
+            goto err;
+        }
     }
     struct replace_fstab_data data = {.active_be = snap_data->be_name,
                                       .be_name = "%ZECTLBE%",
@@ -1601,12 +1575,62 @@ libze_plugin_systemdboot_pre_snapshot(libze_handle *lzeh, libze_snap_data *snap_
     }
 
 err:
-    if (!snap_data->is_root) {
-        ret = libze_unmount(lzeh, snap_data->be_name);
-        if (ret != LIBZE_ERROR_SUCCESS) {
-            return ret;
-        }
+    // A non root boot environment stays mounted until libze_fini
+    return ret;
+}
+
+/**
+ * @brief Snapshot fingerprint hook
+ *        Fingerprints the contents of the files the pre snapshot hook copies into the snapshot
+ *        from the ESP, which are read once per snapshot,
+ *           $esp/env/org.zectl-$be
+ *           $esp/loader/entries/org.zectl-$be.conf
+ *
+ * @param[in,out] lzeh      libze handle
+ * @param[in] snap_data     Snapshot related data
+ * @param[out] fingerprint  Fingerprint of the kernels and loader entry
+ * @return @p LIBZE_ERROR_SUCCESS on success,
+ *         @p LIBZE_ERROR_MAXPATHLEN on path exceeded,
+ *         @p LIBZE_ERROR_UNKNOWN otherwise
+ */
+libze_error
+libze_plugin_systemdboot_snapshot_fingerprint(libze_handle *lzeh, libze_snap_data *snap_data,
+                                              char fingerprint[ZFS_MAXPROPLEN]) {
+    char const *efi_mountpoint = NULL;
+    char kernel_dir_buf[LIBZE_MAX_PATH_LEN];
+    char kernel_loader_conf[LIBZE_MAX_PATH_LEN];
+    char kernel_fingerprint[ZFS_MAXPROPLEN];
+    char loader_fingerprint[ZFS_MAXPROPLEN];
+
+    if ((efi_mountpoint = prop_value(lzeh, SYSTEMDBOOT_PROP_EFI)) == NULL) {
+        return libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN,
+                               "Couldn't access systemdboot:efi property.\n");
     }
 
-    return ret;
+    if ((form_loader_entry_path(efi_mountpoint, "env", snap_data->be_name, kernel_dir_buf) !=
+         LIBZE_ERROR_SUCCESS) ||
+        (form_loader_entry_config(efi_mountpoint, snap_data->be_name, kernel_loader_conf) !=
+         LIBZE_ERROR_SUCCESS)) {
+        return libze_error_set(lzeh, LIBZE_ERROR_MAXPATHLEN,
+                               "BE kernel directory path exceeds max path length.\n");
+    }
+
+    if (libze_util_fingerprint_dir(kernel_dir_buf, ZFS_MAXPROPLEN, kernel_fingerprint) != 0) {
+        return libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN,
+                               "Failed to fingerprint kernel directory (%s).\n", kernel_dir_buf);
+    }
+
+    if (libze_util_fingerprint_file(kernel_loader_conf, ZFS_MAXPROPLEN, loader_fingerprint) !=
+        0) {
+        return libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN,
+                               "Failed to fingerprint loader entry (%s).\n", kernel_loader_conf);
+    }
+
+    if (snprintf(fingerprint, ZFS_MAXPROPLEN, "%s-%s", kernel_fingerprint, loader_fingerprint) >=
+        ZFS_MAXPROPLEN) {
+        return libze_error_set(lzeh, LIBZE_ERROR_MAXPATHLEN,
+                               "Fingerprint exceeds max property length.\n");
+    }
+
+    return LIBZE_ERROR_SUCCESS;
 }
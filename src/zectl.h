@@ -4,15 +4,51 @@
 #include "libze/libze.h"
 #include "libze/libze_plugin_manager.h"
 
+#include <stdio.h>
+
 #define HEADER_SPACING 2
 
 extern char const *const ZECTL_VERSION;
 
 extern char const *const ZE_PROGRAM;
 
+/* How zectld runs a command */
+typedef enum ze_command_mode {
+    /* Runs concurrently, doesn't change the state zectld keeps in its handle */
+    ZE_COMMAND_SHARED = 0,
+    /* Runs alone, zectld re-initializes its handle afterwards */
+    ZE_COMMAND_EXCLUSIVE,
+    /* Always runs in the calling process, never forwarded to zectld */
+    ZE_COMMAND_LOCAL
+} ze_command_mode;
+
+/* Function pointer to command */
+typedef libze_error (*command_func)(libze_handle *lzeh, int argc, char **argv);
+
+/* Command name -> function map */
+typedef struct {
+    char *name;
+    command_func command;
+    /* libze_facet flags of the parts of the handle the command requires */
+    unsigned int facets;
+    ze_command_mode mode;
+} command_map_t;
+
 void
 ze_usage(void);
 
+command_map_t const *
+ze_command_get(char const input_name[static 1]);
+
+int
+ze_define_default_props(libze_handle *lzeh);
+
+libze_error
+ze_command_prepare(libze_handle *lzeh, command_map_t const *command, FILE *err);
+
+int
+ze_command_run(libze_handle *lzeh, command_map_t const *command, int argc, char **argv);
+
 libze_error
 ze_activate(libze_handle *lzeh, int argc, char **argv);
 
@@ -22,6 +58,15 @@ ze_create(libze_handle *lzeh, int argc, char **argv);
 libze_error
 ze_destroy(libze_handle *lzeh, int argc, char **argv);
 
+libze_error
+ze_diff(libze_handle *lzeh, int argc, char **argv);
+
+libze_error
+ze_exec(libze_handle *lzeh, int argc, char **argv);
+
+libze_error
+ze_gc(libze_handle *lzeh, int argc, char **argv);
+
 libze_error
 ze_get(libze_handle *lzeh, int argc, char **argv);
 
@@ -31,6 +76,9 @@ ze_list(libze_handle *lzeh, int argc, char **argv);
 libze_error
 ze_mount(libze_handle *lzeh, int argc, char **argv);
 
+libze_error
+ze_promote(libze_handle *lzeh, int argc, char **argv);
+
 libze_error
 ze_rename(libze_handle *lzeh, int argc, char **argv);
 
@@ -43,4 +91,7 @@ ze_snapshot(libze_handle *lzeh, int argc, char **argv);
 libze_error
 ze_unmount(libze_handle *lzeh, int argc, char **argv);
 
+libze_error
+ze_upgrade(libze_handle *lzeh, int argc, char **argv);
+
 #endif // ZECTL_ZECTL_H
@@ -8,12 +8,15 @@ libze_error
 ze_activate(libze_handle *lzeh, int argc, char **argv) {
     libze_error ret = LIBZE_ERROR_SUCCESS;
     int opt;
-    libze_activate_options options = {.be_name = NULL, .noconfirm = B_FALSE};
+    libze_activate_options options = {.be_name = NULL, .noconfirm = B_FALSE, .deferred = B_FALSE};
 
     opterr = 0;
 
-    while ((opt = getopt(argc, argv, "y")) != -1) {
+    while ((opt = getopt(argc, argv, "dy")) != -1) {
         switch (opt) {
+            case 'd':
+                options.deferred = B_TRUE;
+                break;
             case 'y':
                 options.noconfirm = B_TRUE;
                 break;
@@ -0,0 +1,151 @@
+/*
+ * Commands shared by 'zectl' and 'zectld'
+ */
+
+#include "zectl.h"
+
+#include "libze/libze.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+char const *const ZE_PROGRAM = "zectl";
+char const *const ZECTL_VERSION = "0.1.6";
+
+#define NUM_COMMANDS 15
+
+/* Set up all commands, read-only commands skip loading the plugin and the bootpool */
+static command_map_t const ze_command_map[NUM_COMMANDS] = {
+    /* If commands are added or removed, must modify 'NUM_COMMANDS' */
+    {"activate", ze_activate, LIBZE_FACET_ALL, ZE_COMMAND_EXCLUSIVE},
+    {"create", ze_create, LIBZE_FACET_ALL, ZE_COMMAND_EXCLUSIVE},
+    {"destroy", ze_destroy, LIBZE_FACET_ALL, ZE_COMMAND_EXCLUSIVE},
+    {"diff", ze_diff, LIBZE_FACET_NONE, ZE_COMMAND_SHARED},
+    // Runs a command from the environment and terminal of the caller
+    {"exec", ze_exec, LIBZE_FACET_ALL, ZE_COMMAND_LOCAL},
+    {"gc", ze_gc, LIBZE_FACET_ALL, ZE_COMMAND_EXCLUSIVE},
+    // Plugin provides the defaults and schema of its properties
+    {"get", ze_get, LIBZE_FACET_PLUGIN, ZE_COMMAND_SHARED},
+    {"list", ze_list, LIBZE_FACET_NONE, ZE_COMMAND_SHARED},
+    {"mount", ze_mount, LIBZE_FACET_ALL, ZE_COMMAND_EXCLUSIVE},
+    {"promote", ze_promote, LIBZE_FACET_ALL, ZE_COMMAND_EXCLUSIVE},
+    {"rename", ze_rename, LIBZE_FACET_ALL, ZE_COMMAND_EXCLUSIVE},
+    {"set", ze_set, LIBZE_FACET_PLUGIN, ZE_COMMAND_EXCLUSIVE},
+    // Snapshots leave the handle untouched, coalesced snapshots must run concurrently
+    {"snapshot", ze_snapshot, LIBZE_FACET_ALL, ZE_COMMAND_SHARED},
+    {"unmount", ze_unmount, LIBZE_FACET_ALL, ZE_COMMAND_EXCLUSIVE},
+    {"upgrade", ze_upgrade, LIBZE_FACET_ALL, ZE_COMMAND_LOCAL}};
+
+/* Print zectl command usage */
+void
+ze_usage(void) {
+    puts("\nUsage:");
+    printf("%s activate [ -d ] <boot environment>\n", ZE_PROGRAM);
+    printf("%s create [ -e <existing-dataset> | <existing-dataset@snapshot> ] [ -r ] "
+           "<boot-environment>\n",
+           ZE_PROGRAM);
+    printf("%s destroy [ -F ] <boot-environment>\n", ZE_PROGRAM);
+    printf("%s diff [ -F ] [ -H ] [ -t ] <boot-environment>[@<snapshot>] "
+           "[ <boot-environment>[@<snapshot>] ]\n",
+           ZE_PROGRAM);
+    printf("%s exec [ -b ] <boot-environment> [ -- ] <command> [ <argument>... ]\n", ZE_PROGRAM);
+    printf("%s gc [ -n ]\n", ZE_PROGRAM);
+    printf("%s get [ -H ] [ -a | -b <boot-environment> ] [ property ]\n", ZE_PROGRAM);
+    printf("%s list\n", ZE_PROGRAM);
+    printf("%s mount [ -a ] <boot environment>[@<snapshot>] [ <mountpoint> ]\n", ZE_PROGRAM);
+    printf("%s promote [ -p | <boot-environment> ]\n", ZE_PROGRAM);
+    printf("%s rename <boot-environment> <boot-environment-new>\n", ZE_PROGRAM);
+    printf("%s set [ -a | -b <pattern> ] [ -r ] <property>=<value>...\n", ZE_PROGRAM);
+    printf("%s snapshot [ -c ] [ -C <seconds> ] <boot-environment>[@<snapshot>]\n", ZE_PROGRAM);
+    printf("%s unmount [ -l ] <boot-environment>[@<snapshot>]\n", ZE_PROGRAM);
+    printf("%s upgrade [ -b ] [ -d ] [ -e <existing-dataset> | <existing-dataset@snapshot> ] "
+           "[ -r ] <boot-environment> [ -- ] <command> [ <argument>... ]\n",
+           ZE_PROGRAM);
+    printf("%s version\n", ZE_PROGRAM);
+}
+
+/*
+ * Check the command matches with one of the available options.
+ * Return the map entry of the requested command or NULL if no match
+ */
+command_map_t const *
+ze_command_get(char const input_name[static 1]) {
+    command_map_t const *command = NULL;
+
+    for (int i = 0; i < NUM_COMMANDS; i++) {
+        if (strcmp(input_name, ze_command_map[i].name) == 0) {
+            command = &ze_command_map[i];
+        }
+    }
+    return command;
+}
+
+/**
+ * @brief Helper function to set default properties
+ * @param[in] lzeh Initialized lzeh libze handle
+ * @return 0 on success, nonzero on failure
+ *
+ */
+int
+ze_define_default_props(libze_handle *lzeh) {
+    return (libze_schema_defaults_set(lzeh, libze_properties, LIBZE_PROP_NUM,
+                                      ZE_PROP_NAMESPACE) != LIBZE_ERROR_SUCCESS)
+               ? -1
+               : 0;
+}
+
+/**
+ * @brief Load the plugin, initialize a separate bootpool and validate the running and activated
+ *        boot environment, as far as @p command requires
+ * @param[in,out] lzeh Initialized lzeh libze handle with its default properties set
+ * @param[in] command Command about to be run
+ * @param[in] err Stream warnings and errors are output to
+ * @return @p LIBZE_ERROR_SUCCESS on success, the error has already been output on failure
+ */
+libze_error
+ze_command_prepare(libze_handle *lzeh, command_map_t const *command, FILE *err) {
+    libze_error ze_ret = libze_facets_require(lzeh, command->facets);
+
+    // Clear any error messages
+    if (ze_ret == LIBZE_ERROR_PLUGIN_EEXIST) {
+        char const *plugin = libze_prop_value(lzeh, LIBZE_PROP_BOOTLOADER);
+        if (plugin == NULL) {
+            fputs(lzeh->libze_error_message, err);
+            return ze_ret;
+        }
+        fprintf(err,
+                "WARNING: No bootloader plugin found under bootloader=%s.\n"
+                "Continuing with no bootloader plugin.\n",
+                plugin);
+        (void) libze_error_clear(lzeh);
+        // The missing plugin isn't retried
+        ze_ret = libze_facets_require(lzeh, command->facets);
+    }
+
+    if (ze_ret != LIBZE_ERROR_SUCCESS) {
+        fputs(lzeh->libze_error_message, err);
+        (void) libze_error_clear(lzeh);
+    }
+
+    return ze_ret;
+}
+
+/**
+ * @brief Run @p command, outputting its errors to @p stderr
+ * @param[in,out] lzeh Initialized lzeh libze handle, prepared for @p command
+ * @param[in] command Command to run
+ * @param[in] argc Number of arguments, including the command name
+ * @param[in] argv Arguments, starting with the command name
+ * @return Exit status of the command
+ */
+int
+ze_command_run(libze_handle *lzeh, command_map_t const *command, int argc, char **argv) {
+    if (command->command(lzeh, argc, argv) != LIBZE_ERROR_SUCCESS) {
+        fprintf(stderr, "%s: Failed to run '%s %s'.\n", ZE_PROGRAM, ZE_PROGRAM, argv[0]);
+        fputs(lzeh->libze_error_message, stderr);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,302 @@
+/*
+ * Protocol between 'zectl' and 'zectld'
+ *
+ * A request is the command line of zectl, sent along with the standard streams and the working
+ * directory of the client. zectld replies whether it accepted the request, and once the command
+ * finished, its exit status. The command writes to the streams of the client directly.
+ */
+
+// MSG_CMSG_CLOEXEC
+#define _GNU_SOURCE
+
+#include "zectl.h"
+#include "zectl_daemon.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static int
+send_all(int sock, void const *buffer, size_t length) {
+    char const *position = buffer;
+
+    while (length > 0) {
+        ssize_t sent = send(sock, position, length, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        position += sent;
+        length -= (size_t) sent;
+    }
+
+    return 0;
+}
+
+static int
+recv_all(int sock, void *buffer, size_t length) {
+    char *position = buffer;
+
+    while (length > 0) {
+        ssize_t received = recv(sock, position, length, 0);
+        if (received < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (received == 0) {
+            return -1;
+        }
+        position += received;
+        length -= (size_t) received;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Get the path of the socket of zectld
+ * @return @p ZECTLD_SOCKET_ENV if set, otherwise @p ZECTLD_SOCKET
+ */
+char const *
+zectld_socket_path(void) {
+    char const *path = getenv(ZECTLD_SOCKET_ENV);
+    return ((path != NULL) && (strlen(path) > 0)) ? path : ZECTLD_SOCKET;
+}
+
+/**
+ * @brief Send a request to run @p argv, along with the standard streams and working directory
+ * @param[in] sock Socket connected to zectld
+ * @param[in] argc Number of arguments
+ * @param[in] argv Arguments, starting with the command name
+ * @return 0 on success, -1 if nothing or only part of the request was sent
+ */
+static int
+request_send(int sock, int argc, char **argv) {
+    zectld_request_header_t header = {ZECTLD_PROTOCOL_VERSION, (uint32_t) argc, 0};
+    for (int i = 0; i < argc; i++) {
+        size_t length = strlen(argv[i]) + 1;
+        if (length > (ZECTLD_MAX_REQUEST_LEN - header.length)) {
+            return -1;
+        }
+        header.length += (uint32_t) length;
+    }
+
+    int fds[ZECTLD_NUM_FDS] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO, -1};
+    if ((fds[ZECTLD_FD_CWD] = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1) {
+        return -1;
+    }
+
+    union {
+        char buffer[CMSG_SPACE(sizeof(fds))];
+        struct cmsghdr align;
+    } control;
+    (void) memset(&control, 0, sizeof(control));
+
+    struct iovec iov = {.iov_base = &header, .iov_len = sizeof(header)};
+    struct msghdr message = {.msg_iov = &iov,
+                             .msg_iovlen = 1,
+                             .msg_control = control.buffer,
+                             .msg_controllen = sizeof(control.buffer)};
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    (void) memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    ssize_t sent;
+    while (((sent = sendmsg(sock, &message, MSG_NOSIGNAL)) < 0) && (errno == EINTR)) {
+    }
+    (void) close(fds[ZECTLD_FD_CWD]);
+
+    if (sent < 0) {
+        return -1;
+    }
+    // Descriptors went with the first byte, the rest of the header is sent plainly
+    if ((send_all(sock, (char *) &header + sent, sizeof(header) - (size_t) sent) != 0)) {
+        return -1;
+    }
+
+    for (int i = 0; i < argc; i++) {
+        if (send_all(sock, argv[i], strlen(argv[i]) + 1) != 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Receive a request from a client
+ * @param[in] sock Socket of the client
+ * @param[out] request Received request, free with @p zectld_request_free
+ * @return 0 on success, -1 on a malformed or incomplete request
+ *
+ * @post On failure, @p request has been free'd
+ */
+int
+zectld_request_recv(int sock, zectld_request_t *request) {
+    zectld_request_header_t header;
+
+    request->argc = 0;
+    request->argv = NULL;
+    request->buffer = NULL;
+    for (int i = 0; i < ZECTLD_NUM_FDS; i++) {
+        request->fds[i] = -1;
+    }
+
+    union {
+        char buffer[CMSG_SPACE(sizeof(request->fds))];
+        struct cmsghdr align;
+    } control;
+
+    struct iovec iov = {.iov_base = &header, .iov_len = sizeof(header)};
+    struct msghdr message = {.msg_iov = &iov,
+                             .msg_iovlen = 1,
+                             .msg_control = control.buffer,
+                             .msg_controllen = sizeof(control.buffer)};
+
+    ssize_t received;
+    while (((received = recvmsg(sock, &message, MSG_CMSG_CLOEXEC)) < 0) && (errno == EINTR)) {
+    }
+    if (received <= 0) {
+        return -1;
+    }
+
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message); cmsg != NULL;
+         cmsg = CMSG_NXTHDR(&message, cmsg)) {
+        if ((cmsg->cmsg_level != SOL_SOCKET) || (cmsg->cmsg_type != SCM_RIGHTS)) {
+            continue;
+        }
+        // Keep exactly the expected descriptors, close anything else passed
+        size_t num_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (size_t i = 0; i < num_fds; i++) {
+            int fd;
+            (void) memcpy(&fd, CMSG_DATA(cmsg) + (i * sizeof(int)), sizeof(int));
+            if ((num_fds == ZECTLD_NUM_FDS) && (request->fds[i] == -1)) {
+                request->fds[i] = fd;
+            } else {
+                (void) close(fd);
+            }
+        }
+    }
+
+    if ((message.msg_flags & MSG_CTRUNC) || (request->fds[ZECTLD_FD_CWD] == -1) ||
+        (recv_all(sock, (char *) &header + received, sizeof(header) - (size_t) received) != 0)) {
+        goto err;
+    }
+
+    if ((header.version != ZECTLD_PROTOCOL_VERSION) || (header.argc == 0) ||
+        (header.length > ZECTLD_MAX_REQUEST_LEN) || (header.argc > header.length)) {
+        goto err;
+    }
+
+    if (((request->buffer = malloc(header.length)) == NULL) ||
+        ((request->argv = calloc(header.argc + 1, sizeof(char *))) == NULL) ||
+        (recv_all(sock, request->buffer, header.length) != 0) ||
+        (request->buffer[header.length - 1] != '\0')) {
+        goto err;
+    }
+
+    // Split the arguments, exactly argc of them
+    for (char *argument = request->buffer; argument < (request->buffer + header.length);
+         argument += strlen(argument) + 1) {
+        if ((uint32_t) request->argc == header.argc) {
+            goto err;
+        }
+        request->argv[request->argc++] = argument;
+    }
+    if ((uint32_t) request->argc != header.argc) {
+        goto err;
+    }
+
+    return 0;
+
+err:
+    zectld_request_free(request);
+    return -1;
+}
+
+/**
+ * @brief Free a request received with @p zectld_request_recv and close its descriptors
+ * @param[in,out] request Request to free
+ */
+void
+zectld_request_free(zectld_request_t *request) {
+    for (int i = 0; i < ZECTLD_NUM_FDS; i++) {
+        if (request->fds[i] != -1) {
+            (void) close(request->fds[i]);
+            request->fds[i] = -1;
+        }
+    }
+    free(request->argv);
+    free(request->buffer);
+    request->argv = NULL;
+    request->buffer = NULL;
+    request->argc = 0;
+}
+
+/**
+ * @brief Send a reply to a client
+ * @param[in] sock Socket of the client
+ * @param[in] reply @p ZECTLD_ACCEPTED, @p ZECTLD_REFUSED or the exit status of the command
+ * @return 0 on success, -1 if the client is gone
+ */
+int
+zectld_reply_send(int sock, int32_t reply) {
+    return send_all(sock, &reply, sizeof(reply));
+}
+
+/**
+ * @brief Run a command through zectld
+ * @param[in] argc Number of arguments
+ * @param[in] argv Arguments, starting with the command name
+ * @param[out] status Exit status of the command
+ * @return 0 if zectld ran the command, -1 if zectld isn't running or refused the request and
+ *         the command should run in process
+ */
+int
+ze_daemon_run(int argc, char **argv, int *status) {
+    int ret = -1;
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+
+    if (strlcpy(address.sun_path, zectld_socket_path(), sizeof(address.sun_path)) >=
+        sizeof(address.sun_path)) {
+        return -1;
+    }
+
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock == -1) {
+        return -1;
+    }
+
+    int32_t reply;
+    if ((connect(sock, (struct sockaddr *) &address, sizeof(address)) != 0) ||
+        (request_send(sock, argc, argv) != 0) || (recv_all(sock, &reply, sizeof(reply)) != 0) ||
+        (reply != ZECTLD_ACCEPTED)) {
+        goto fin;
+    }
+
+    // The command is running, from now on it can't be retried in process
+    ret = 0;
+    if (recv_all(sock, &reply, sizeof(reply)) != 0) {
+        fprintf(stderr, "%s: Lost connection to zectld while running '%s %s'.\n", ZE_PROGRAM,
+                ZE_PROGRAM, argv[0]);
+        *status = EXIT_FAILURE;
+        goto fin;
+    }
+    *status = reply;
+
+fin:
+    (void) close(sock);
+    return ret;
+}
@@ -0,0 +1,60 @@
+#ifndef ZECTL_ZECTL_DAEMON_H
+#define ZECTL_ZECTL_DAEMON_H
+
+#include <stdint.h>
+
+/* Socket zectld listens on, unless overridden with ZECTLD_SOCKET_ENV */
+#define ZECTLD_SOCKET "/run/zectld.sock"
+#define ZECTLD_SOCKET_ENV "ZECTLD_SOCKET"
+
+#define ZECTLD_PROTOCOL_VERSION 1
+/* Upper bound on the length of the arguments of a request */
+#define ZECTLD_MAX_REQUEST_LEN (64 * 1024)
+
+/* Descriptors of the client passed along with a request */
+enum {
+    ZECTLD_FD_STDIN = 0,
+    ZECTLD_FD_STDOUT,
+    ZECTLD_FD_STDERR,
+    ZECTLD_FD_CWD,
+    ZECTLD_NUM_FDS
+};
+
+/* First reply to a request, followed by the exit status of the command if accepted */
+enum {
+    ZECTLD_ACCEPTED = 0,
+    ZECTLD_REFUSED
+};
+
+/* Header of a request, followed by 'length' bytes of 'argc' NUL terminated arguments */
+typedef struct zectld_request_header {
+    uint32_t version;
+    uint32_t argc;
+    uint32_t length;
+} zectld_request_header_t;
+
+/* Request received by zectld */
+typedef struct zectld_request {
+    int argc;
+    /* NULL terminated, pointing into buffer */
+    char **argv;
+    char *buffer;
+    int fds[ZECTLD_NUM_FDS];
+} zectld_request_t;
+
+char const *
+zectld_socket_path(void);
+
+int
+zectld_request_recv(int sock, zectld_request_t *request);
+
+void
+zectld_request_free(zectld_request_t *request);
+
+int
+zectld_reply_send(int sock, int32_t reply);
+
+int
+ze_daemon_run(int argc, char **argv, int *status);
+
+#endif // ZECTL_ZECTL_DAEMON_H
@@ -0,0 +1,56 @@
+#include "zectl.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+/**
+ * diff command main function
+ * @param lzeh Initialized libze handle
+ * @param argc Argument count
+ * @param argv Argument vector
+ * @return @p LIBZE_ERROR_SUCCESS on success
+ */
+libze_error
+ze_diff(libze_handle *lzeh, int argc, char **argv) {
+    int opt;
+    libze_diff_options options = {.from = NULL, .to = NULL, .flags = 0, .outfd = STDOUT_FILENO};
+
+    opterr = 0;
+
+    while ((opt = getopt(argc, argv, "FHt")) != -1) {
+        switch (opt) {
+            case 'F':
+                options.flags |= ZFS_DIFF_CLASSIFY;
+                break;
+            case 'H':
+                options.flags |= ZFS_DIFF_PARSEABLE;
+                break;
+            case 't':
+                options.flags |= ZFS_DIFF_TIMESTAMP;
+                break;
+            default:
+                fprintf(stderr, "%s diff: unknown option '-%c'\n", ZE_PROGRAM, optopt);
+                ze_usage();
+                return LIBZE_ERROR_UNKNOWN;
+        }
+    }
+
+    argc -= optind;
+    argv += optind;
+
+    if ((argc < 1) || (argc > 2)) {
+        fprintf(stderr, "%s diff: wrong number of arguments\n", ZE_PROGRAM);
+        ze_usage();
+        return LIBZE_ERROR_UNKNOWN;
+    }
+
+    options.from = argv[0];
+    if (argc == 2) {
+        options.to = argv[1];
+    }
+
+    // Output of the library is written directly to the descriptor
+    (void) fflush(stdout);
+
+    return libze_diff(lzeh, &options);
+}
@@ -0,0 +1,68 @@
+#include "zectl.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * exec command main function
+ * @param lzeh Initialized libze handle
+ * @param argc Argument count
+ * @param argv Argument vector
+ * @return @p LIBZE_ERROR_SUCCESS if the command ran and exited successfully
+ */
+libze_error
+ze_exec(libze_handle *lzeh, int argc, char **argv) {
+    libze_error ret = LIBZE_ERROR_SUCCESS;
+    int opt;
+    libze_exec_options options = {.bind_system = B_FALSE, .argv = NULL};
+
+    opterr = 0;
+
+    // Stop at the first non-option, the rest belongs to the command
+    while ((opt = getopt(argc, argv, "+b")) != -1) {
+        switch (opt) {
+            case 'b':
+                options.bind_system = B_TRUE;
+                break;
+            default:
+                fprintf(stderr, "%s exec: unknown option '-%c'\n", ZE_PROGRAM, optopt);
+                ze_usage();
+                return LIBZE_ERROR_UNKNOWN;
+        }
+    }
+
+    argc -= optind;
+    argv += optind;
+
+    if ((argc > 1) && (strcmp(argv[1], "--") == 0)) {
+        argv[1] = argv[0];
+        argc--;
+        argv++;
+    }
+
+    if (argc < 2) {
+        fprintf(stderr, "%s exec: wrong number of arguments\n", ZE_PROGRAM);
+        ze_usage();
+        return LIBZE_ERROR_UNKNOWN;
+    }
+
+    if (strlcpy(options.be_name, argv[0], ZFS_MAX_DATASET_NAME_LEN) >= ZFS_MAX_DATASET_NAME_LEN) {
+        fprintf(stderr, "Boot environment name exceeds max dataset length.\n");
+        return LIBZE_ERROR_MAXPATHLEN;
+    }
+    options.argv = &argv[1];
+
+    int exit_status = 0;
+    if ((ret = libze_exec(lzeh, &options, &exit_status)) != LIBZE_ERROR_SUCCESS) {
+        return ret;
+    }
+
+    if (exit_status != 0) {
+        return libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN,
+                               "Command '%s' exited with status %d.\n", options.argv[0],
+                               exit_status);
+    }
+
+    return ret;
+}
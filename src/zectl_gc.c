@@ -0,0 +1,47 @@
+#include "zectl.h"
+
+#include <stdio.h>
+#include <sys/nvpair.h>
+#include <unistd.h>
+
+libze_error
+ze_gc(libze_handle *lzeh, int argc, char **argv) {
+    libze_error ret = LIBZE_ERROR_SUCCESS;
+    int opt;
+    libze_gc_options options = {.noop = B_FALSE};
+    nvlist_t *snapshots = NULL;
+
+    opterr = 0;
+
+    while ((opt = getopt(argc, argv, "n")) != -1) {
+        switch (opt) {
+            case 'n':
+                options.noop = B_TRUE;
+                break;
+            default:
+                fprintf(stderr, "%s gc: unknown option '-%c'\n", ZE_PROGRAM, optopt);
+                ze_usage();
+                return LIBZE_ERROR_UNKNOWN;
+        }
+    }
+
+    argc -= optind;
+
+    if (argc != 0) {
+        fprintf(stderr, "%s gc: wrong number of arguments\n", ZE_PROGRAM);
+        ze_usage();
+        return LIBZE_ERROR_UNKNOWN;
+    }
+
+    if ((ret = libze_gc(lzeh, &options, &snapshots)) != LIBZE_ERROR_SUCCESS) {
+        return ret;
+    }
+
+    for (nvpair_t *pair = nvlist_next_nvpair(snapshots, NULL); pair != NULL;
+         pair = nvlist_next_nvpair(snapshots, pair)) {
+        printf("%s %s\n", options.noop ? "would destroy" : "destroyed", nvpair_name(pair));
+    }
+
+    fnvlist_free(snapshots);
+    return ret;
+}
@@ -6,16 +6,26 @@
 #include <sys/nvpair.h>
 #include <unistd.h>
 
+#define HEADER_NAME "NAME"
 #define HEADER_PROPERTY "PROPERTY"
 #define HEADER_VALUE "VALUE"
+#define HEADER_SOURCE "SOURCE"
+
+#define SOURCE_INHERITED "inherited from "
 
 typedef struct get_value_widths {
+    size_t name;
     size_t property;
     size_t value;
+    size_t source;
 } get_value_widths;
 
 typedef struct get_options {
     boolean_t tab_delimited;
+    /**< Get the properties of all boot environments */
+    boolean_t all;
+    /**< Boot environment to get the properties of, or NULL */
+    char const *boot_environment;
 } get_options;
 
 static libze_error
@@ -60,6 +70,109 @@ print_properties(libze_handle *lzeh, nvlist_t *properties, get_options *options)
     return LIBZE_ERROR_SUCCESS;
 }
 
+/**
+ * @brief Format the source of a boot environment property
+ * @param lzeh Initialized handle to libze object
+ * @param be Boot environment the property belongs to
+ * @param prop Property, with a value and an optional source dataset
+ * @param buflen Length of buffer
+ * @param buf Buffer to place the source in, "local", "inherited from <dataset>" or "default"
+ * @return Non-zero if the length of the buffer is exceeded
+ */
+static int
+format_source(libze_handle *lzeh, char const *be, nvlist_t *prop, size_t buflen,
+              char buf[buflen]) {
+    const char *source = NULL;
+
+    if (nvlist_lookup_string(prop, "source", &source) != 0) {
+        return (strlcpy(buf, "default", buflen) >= buflen) ? -1 : 0;
+    }
+
+    size_t root_len = strlen(lzeh->env_root);
+    if ((strncmp(source, lzeh->env_root, root_len) == 0) && (source[root_len] == '/') &&
+        (strcmp(source + root_len + 1, be) == 0)) {
+        return (strlcpy(buf, "local", buflen) >= buflen) ? -1 : 0;
+    }
+
+    if (strcmp(source, "-") == 0) {
+        return (strlcpy(buf, "-", buflen) >= buflen) ? -1 : 0;
+    }
+
+    return (snprintf(buf, buflen, "%s%s", SOURCE_INHERITED, source) >= (int) buflen) ? -1 : 0;
+}
+
+/**
+ * @brief Print the properties of boot environments, with the source they are resolved from
+ * @param lzeh Initialized handle to libze object
+ * @param be_properties Properties keyed by boot environment name
+ * @param options Output options
+ * @return LIBZE_ERROR_SUCCESS upon success
+ */
+static libze_error
+print_be_properties(libze_handle *lzeh, nvlist_t *be_properties, get_options *options) {
+    nvpair_t *be_pair = NULL;
+    nvpair_t *pair = NULL;
+    nvlist_t *props = NULL;
+    nvlist_t *prop = NULL;
+    char *tab_suffix = "\t";
+    char source[ZFS_MAXPROPLEN + sizeof(SOURCE_INHERITED)] = "";
+    get_value_widths widths = {0};
+
+    if (!options->tab_delimited) {
+        widths.name = strlen(HEADER_NAME);
+        widths.property = strlen(HEADER_PROPERTY);
+        widths.value = strlen(HEADER_VALUE);
+        widths.source = strlen(HEADER_SOURCE);
+        for (be_pair = nvlist_next_nvpair(be_properties, NULL); be_pair != NULL;
+             be_pair = nvlist_next_nvpair(be_properties, be_pair)) {
+            nvpair_value_nvlist(be_pair, &props);
+            (void) set_column_width(&widths.name, nvpair_name(be_pair));
+            for (pair = nvlist_next_nvpair(props, NULL); pair != NULL;
+                 pair = nvlist_next_nvpair(props, pair)) {
+                nvpair_value_nvlist(pair, &prop);
+                if ((set_column_width_lookup(prop, &widths.value, "value") != 0) ||
+                    (format_source(lzeh, nvpair_name(be_pair), prop, sizeof(source), source) !=
+                     0) ||
+                    (set_column_width(&widths.source, source) != 0) ||
+                    (set_column_width(&widths.property, nvpair_name(pair)) != 0)) {
+                    return libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN,
+                                           "Failed getting property widths");
+                }
+            }
+        }
+
+        tab_suffix = "";
+        widths.name += HEADER_SPACING;
+        widths.property += HEADER_SPACING;
+        widths.value += HEADER_SPACING;
+        printf("%-*s", (int) widths.name, HEADER_NAME);
+        printf("%-*s", (int) widths.property, HEADER_PROPERTY);
+        printf("%-*s", (int) widths.value, HEADER_VALUE);
+        printf("%s", HEADER_SOURCE);
+        fputs("\n", stdout);
+    }
+
+    for (be_pair = nvlist_next_nvpair(be_properties, NULL); be_pair != NULL;
+         be_pair = nvlist_next_nvpair(be_properties, be_pair)) {
+        nvpair_value_nvlist(be_pair, &props);
+        for (pair = nvlist_next_nvpair(props, NULL); pair != NULL;
+             pair = nvlist_next_nvpair(props, pair)) {
+            nvpair_value_nvlist(pair, &prop);
+            const char *string_prop = "";
+            (void) nvlist_lookup_string(prop, "value", &string_prop);
+            if (format_source(lzeh, nvpair_name(be_pair), prop, sizeof(source), source) != 0) {
+                return libze_error_set(lzeh, LIBZE_ERROR_UNKNOWN, "Property source too long");
+            }
+            printf("%-*s%s", (int) widths.name, nvpair_name(be_pair), tab_suffix);
+            printf("%-*s%s", (int) widths.property, nvpair_name(pair), tab_suffix);
+            printf("%-*s%s", (int) widths.value, string_prop, tab_suffix);
+            printf("%s\n", source);
+        }
+    }
+
+    return LIBZE_ERROR_SUCCESS;
+}
+
 /**
  * get command main function
  * @param lzeh Initialized handle to libze object
@@ -72,15 +185,21 @@ ze_get(libze_handle *lzeh, int argc, char **argv) {
 
     libze_error ret = LIBZE_ERROR_SUCCESS;
     nvlist_t *properties = NULL;
-    get_options options = {.tab_delimited = B_FALSE};
+    get_options options = {.tab_delimited = B_FALSE, .all = B_FALSE, .boot_environment = NULL};
 
     opterr = 0;
     int opt;
-    while ((opt = getopt(argc, argv, "H")) != -1) {
+    while ((opt = getopt(argc, argv, "Hab:")) != -1) {
         switch (opt) {
             case 'H':
                 options.tab_delimited = B_TRUE;
                 break;
+            case 'a':
+                options.all = B_TRUE;
+                break;
+            case 'b':
+                options.boot_environment = optarg;
+                break;
             default:
                 fprintf(stderr, "%s get: unknown option '-%c'\n", ZE_PROGRAM, optopt);
                 ze_usage();
@@ -96,26 +215,40 @@ ze_get(libze_handle *lzeh, int argc, char **argv) {
         return LIBZE_ERROR_UNKNOWN;
     }
 
+    if (options.all && (options.boot_environment != NULL)) {
+        fprintf(stderr, "%s get: -a and -b are mutually exclusive\n", ZE_PROGRAM);
+        ze_usage();
+        return LIBZE_ERROR_UNKNOWN;
+    }
+
     char *prop = argv[0];
 
-    boolean_t dealloc_properties = B_FALSE;
+    properties = fnvlist_alloc();
+    if (properties == NULL) {
+        return LIBZE_ERROR_NOMEM;
+    }
+
+    if (options.all || (options.boot_environment != NULL)) {
+        ret = libze_add_be_get_properties(
+            lzeh, &properties, options.boot_environment,
+            ((argc == 0) || (strcmp(prop, "all") == 0)) ? NULL : prop);
+        if (ret == LIBZE_ERROR_SUCCESS) {
+            ret = print_be_properties(lzeh, properties, &options);
+        }
+        goto err;
+    }
+
     if ((argc == 0) || (strcmp(prop, "all") == 0)) {
-        properties = lzeh->ze_props;
+        ret = libze_add_get_properties(lzeh, &properties);
     } else {
-        properties = fnvlist_alloc();
-        if (properties == NULL) {
-            return LIBZE_ERROR_NOMEM;
-        }
-        dealloc_properties = B_TRUE;
-        if ((ret = libze_add_get_property(lzeh, &properties, prop)) != LIBZE_ERROR_SUCCESS) {
-            goto err;
-        }
+        ret = libze_add_get_property(lzeh, &properties, prop);
+    }
+    if (ret != LIBZE_ERROR_SUCCESS) {
+        goto err;
     }
 
     ret = print_properties(lzeh, properties, &options);
 err:
-    if (dealloc_properties) {
-        fnvlist_free(properties);
-    }
+    fnvlist_free(properties);
     return ret;
 }
@@ -7,11 +7,15 @@ libze_error
 ze_mount(libze_handle *lzeh, int argc, char **argv) {
     libze_error ret = LIBZE_ERROR_SUCCESS;
     int opt;
+    boolean_t atomic = B_FALSE;
 
     opterr = 0;
 
-    while ((opt = getopt(argc, argv, "")) != -1) {
+    while ((opt = getopt(argc, argv, "a")) != -1) {
         switch (opt) {
+            case 'a':
+                atomic = B_TRUE;
+                break;
             default:
                 fprintf(stderr, "%s mount: unknown option '-%c'\n", ZE_PROGRAM, optopt);
                 ze_usage();
@@ -37,8 +41,13 @@ ze_mount(libze_handle *lzeh, int argc, char **argv) {
 
     char const *boot_environment = argv[0];
     char mountpoint_buffer[LIBZE_MAX_PATH_LEN];
-    if ((ret = libze_mount(lzeh, boot_environment, mountpoint, mountpoint_buffer)) ==
-        LIBZE_ERROR_SUCCESS) {
+    if (atomic) {
+        ret = libze_mount_detached(lzeh, boot_environment, mountpoint, mountpoint_buffer);
+    } else {
+        ret = libze_mount(lzeh, boot_environment, mountpoint, mountpoint_buffer);
+    }
+
+    if (ret == LIBZE_ERROR_SUCCESS) {
         puts(mountpoint_buffer);
     }
 
@@ -0,0 +1,39 @@
+#include "zectl.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+libze_error
+ze_promote(libze_handle *lzeh, int argc, char **argv) {
+    int opt;
+    libze_promote_options options = {.be_name = NULL, .pending = B_FALSE};
+
+    opterr = 0;
+
+    while ((opt = getopt(argc, argv, "p")) != -1) {
+        switch (opt) {
+            case 'p':
+                options.pending = B_TRUE;
+                break;
+            default:
+                fprintf(stderr, "%s promote: unknown option '-%c'\n", ZE_PROGRAM, optopt);
+                ze_usage();
+                return LIBZE_ERROR_UNKNOWN;
+        }
+    }
+
+    argc -= optind;
+    argv += optind;
+
+    if ((options.pending && (argc != 0)) || (!options.pending && (argc != 1))) {
+        fprintf(stderr, "%s promote: wrong number of arguments\n", ZE_PROGRAM);
+        ze_usage();
+        return LIBZE_ERROR_UNKNOWN;
+    }
+
+    if (!options.pending) {
+        options.be_name = argv[0];
+    }
+
+    return libze_promote(lzeh, &options);
+}
@@ -1,6 +1,7 @@
 #include "zectl.h"
 
 #include <stdio.h>
+#include <string.h>
 #include <sys/nvpair.h>
 #include <unistd.h>
 
@@ -17,14 +18,46 @@ ze_set(libze_handle *lzeh, int argc, char **argv) {
     libze_error ret = LIBZE_ERROR_SUCCESS;
     nvlist_t *properties = NULL;
 
-    if (argc == 0) {
-        fprintf(stderr, "No properties provided\n");
+    boolean_t all = B_FALSE;
+    libze_set_options options = {.pattern = NULL, .recursive = B_FALSE};
+
+    opterr = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "ab:r")) != -1) {
+        switch (opt) {
+            case 'a':
+                all = B_TRUE;
+                break;
+            case 'b':
+                options.pattern = optarg;
+                break;
+            case 'r':
+                options.recursive = B_TRUE;
+                break;
+            default:
+                fprintf(stderr, "%s set: unknown option '-%c'\n", ZE_PROGRAM, optopt);
+                ze_usage();
+                return LIBZE_ERROR_UNKNOWN;
+        }
+    }
+
+    argc -= optind;
+    argv += optind;
+
+    if (all && (options.pattern != NULL)) {
+        fprintf(stderr, "%s set: -a and -b are mutually exclusive\n", ZE_PROGRAM);
         ze_usage();
         return LIBZE_ERROR_UNKNOWN;
     }
 
-    if (argc > 1 && argv[1][0] == '-') {
-        fprintf(stderr, "%s set: unknown option '-%c'\n", ZE_PROGRAM, argv[1][1]);
+    if (options.recursive && !all && (options.pattern == NULL)) {
+        fprintf(stderr, "%s set: -r requires -a or -b\n", ZE_PROGRAM);
+        ze_usage();
+        return LIBZE_ERROR_UNKNOWN;
+    }
+
+    if (argc == 0) {
+        fprintf(stderr, "No properties provided\n");
         ze_usage();
         return LIBZE_ERROR_UNKNOWN;
     }
@@ -34,13 +67,21 @@ ze_set(libze_handle *lzeh, int argc, char **argv) {
         return LIBZE_ERROR_NOMEM;
     }
 
-    for (int i = 1; i < argc; i++) {
-        if ((ret = libze_add_set_property(properties, argv[i])) != LIBZE_ERROR_SUCCESS) {
+    for (int i = 0; i < argc; i++) {
+        if ((ret = libze_add_set_property(lzeh, properties, argv[i])) != LIBZE_ERROR_SUCCESS) {
             goto err;
         }
     }
 
-    ret = libze_set(lzeh, properties);
+    if ((options.pattern != NULL) && !options.recursive &&
+        (strpbrk(options.pattern, "*?[") == NULL)) {
+        // A plain boot environment name, reports a missing boot environment as such
+        ret = libze_be_set(lzeh, options.pattern, properties);
+    } else if (all || (options.pattern != NULL)) {
+        ret = libze_be_set_bulk(lzeh, &options, properties);
+    } else {
+        ret = libze_set(lzeh, properties);
+    }
 
 err:
     fnvlist_free(properties);
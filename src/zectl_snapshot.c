@@ -1,18 +1,37 @@
 #include "zectl.h"
 
+#include <errno.h>
+#include <limits.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 libze_error
 ze_snapshot(libze_handle *lzeh, int argc, char **argv) {
     libze_error ret = LIBZE_ERROR_SUCCESS;
     int opt;
+    libze_snapshot_options options = {.be_name = NULL, .if_changed = B_FALSE, .coalesce = 0};
+    char *end = NULL;
+    unsigned long window = 0;
 
     opterr = 0;
 
-    // Options may be added
-    while ((opt = getopt(argc, argv, "")) != -1) {
+    while ((opt = getopt(argc, argv, "cC:")) != -1) {
         switch (opt) {
+            case 'c':
+                options.if_changed = B_TRUE;
+                break;
+            case 'C':
+                errno = 0;
+                window = strtoul(optarg, &end, 10);
+                if ((errno != 0) || (end == optarg) || (*end != '\0') || (window > UINT_MAX)) {
+                    fprintf(stderr, "%s snapshot: invalid coalesce window '%s'\n", ZE_PROGRAM,
+                            optarg);
+                    return LIBZE_ERROR_UNKNOWN;
+                }
+                options.coalesce = window;
+                break;
             default:
                 fprintf(stderr, "%s snapshot: unknown option '-%c'\n", ZE_PROGRAM, optopt);
                 ze_usage();
@@ -29,5 +48,17 @@ ze_snapshot(libze_handle *lzeh, int argc, char **argv) {
         return LIBZE_ERROR_UNKNOWN;
     }
 
-    return libze_snapshot(lzeh, argv[0]);
-}
\ No newline at end of file
+    options.be_name = argv[0];
+
+    char snapshot[ZFS_MAX_DATASET_NAME_LEN] = "";
+    if ((ret = libze_snapshot(lzeh, &options, snapshot)) != LIBZE_ERROR_SUCCESS) {
+        return ret;
+    }
+
+    // The snapshot may be an existing one, or none if folded into another request, print which
+    if ((options.if_changed || (options.coalesce > 0)) && (strlen(snapshot) > 0)) {
+        puts(snapshot);
+    }
+
+    return ret;
+}
@@ -6,10 +6,14 @@
 libze_error
 ze_unmount(libze_handle *lzeh, int argc, char **argv) {
     int opt;
+    boolean_t lazy = B_FALSE;
     opterr = 0;
 
-    while ((opt = getopt(argc, argv, "")) != -1) {
+    while ((opt = getopt(argc, argv, "l")) != -1) {
         switch (opt) {
+            case 'l':
+                lazy = B_TRUE;
+                break;
             default:
                 fprintf(stderr, "%s unmount: unknown option '-%c'\n", ZE_PROGRAM, optopt);
                 ze_usage();
@@ -26,5 +30,5 @@ ze_unmount(libze_handle *lzeh, int argc, char **argv) {
         return LIBZE_ERROR_UNKNOWN;
     }
 
-    return libze_unmount(lzeh, argv[0]);
+    return libze_unmount(lzeh, argv[0], lazy);
 }
@@ -0,0 +1,80 @@
+#include "zectl.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * upgrade command main function
+ * @param lzeh Initialized libze handle
+ * @param argc Argument count
+ * @param argv Argument vector, contains the boot environment to create and the command to run
+ * @return @p LIBZE_ERROR_SUCCESS if the command succeeded and the boot environment was activated
+ */
+libze_error
+ze_upgrade(libze_handle *lzeh, int argc, char **argv) {
+    int opt;
+    char *be_existing = NULL;
+    libze_upgrade_options options = {.create = {.existing = B_FALSE, .recursive = B_FALSE},
+                                     .bind_system = B_FALSE,
+                                     .deferred = B_FALSE,
+                                     .argv = NULL};
+
+    opterr = 0;
+
+    // Stop at the first non-option, the rest belongs to the command
+    while ((opt = getopt(argc, argv, "+bde:r")) != -1) {
+        switch (opt) {
+            case 'b':
+                options.bind_system = B_TRUE;
+                break;
+            case 'd':
+                options.deferred = B_TRUE;
+                break;
+            case 'e':
+                be_existing = optarg;
+                options.create.existing = B_TRUE;
+                break;
+            case 'r':
+                options.create.recursive = B_TRUE;
+                break;
+            default:
+                fprintf(stderr, "%s upgrade: unknown option '-%c'\n", ZE_PROGRAM, optopt);
+                ze_usage();
+                return LIBZE_ERROR_UNKNOWN;
+        }
+    }
+
+    argc -= optind;
+    argv += optind;
+
+    if ((argc > 1) && (strcmp(argv[1], "--") == 0)) {
+        argv[1] = argv[0];
+        argc--;
+        argv++;
+    }
+
+    if (argc < 2) {
+        fprintf(stderr, "%s upgrade: wrong number of arguments\n", ZE_PROGRAM);
+        ze_usage();
+        return LIBZE_ERROR_UNKNOWN;
+    }
+
+    if (strlcpy(options.create.be_name, argv[0], ZFS_MAX_DATASET_NAME_LEN) >=
+        ZFS_MAX_DATASET_NAME_LEN) {
+        fprintf(stderr, "Boot environment name exceeds max dataset length.\n");
+        return LIBZE_ERROR_MAXPATHLEN;
+    }
+
+    if (options.create.existing &&
+        (strlcpy(options.create.be_source, be_existing, ZFS_MAX_DATASET_NAME_LEN) >=
+         ZFS_MAX_DATASET_NAME_LEN)) {
+        fprintf(stderr, "Existing boot environment source exceeds max dataset length.\n");
+        return LIBZE_ERROR_MAXPATHLEN;
+    }
+
+    options.argv = &argv[1];
+
+    int exit_status = 0;
+    return libze_upgrade(lzeh, &options, &exit_status);
+}
@@ -0,0 +1,531 @@
+/*
+ * Code for the daemon 'zectld'
+ *
+ * zectld keeps an initialized libze handle, with its plugin loaded and its bootpool opened once
+ * a command required them. Before every request the activated boot environment and properties are
+ * read again, as any command, 'zpool set bootfs' or 'zfs set' may have changed them, and the
+ * handle is initialized again if the plugin or bootpool changed. Every request runs in a child
+ * forked off that handle, with the standard streams and working directory of the client. Shared
+ * commands run concurrently. An exclusive command waits for the running shared commands, and
+ * further requests aren't accepted until it finished. The loop never blocks on a client: requests
+ * are received with a short timeout, and the output of preparing the handle is buffered and
+ * written by the child. A client hanging up interrupts the process group of its child.
+ */
+
+// accept4, struct ucred and POLLRDHUP
+#define _GNU_SOURCE
+
+#include "zectl.h"
+#include "zectl_daemon.h"
+
+#include "libze/libze.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define ZECTLD_PROGRAM "zectld"
+/* Requests running at once, further clients wait in the backlog of the socket */
+#define ZECTLD_MAX_RUNNING 64
+/* Time a client has to send its request, which it sends right after connecting */
+#define ZECTLD_REQUEST_TIMEOUT_MSEC 250
+
+/* Request running in a child */
+typedef struct zectld_running {
+    pid_t pid;
+    int sock;
+    boolean_t exclusive;
+    /* Set once the client hung up and the child was interrupted */
+    boolean_t cancelled;
+} zectld_running_t;
+
+/* Exclusive request waiting for the running requests to finish */
+typedef struct zectld_queued {
+    command_map_t const *command;
+    zectld_request_t request;
+    /* -1 if no request is waiting */
+    int sock;
+} zectld_queued_t;
+
+typedef struct zectld_state {
+    libze_handle *lzeh;
+    int listen_sock;
+    int signal_fd;
+    zectld_running_t running[ZECTLD_MAX_RUNNING];
+    size_t num_running;
+    boolean_t exclusive_running;
+    zectld_queued_t queued;
+    boolean_t stopping;
+    /* Set if stopping because the handle couldn't be initialized again */
+    boolean_t failed;
+} zectld_state_t;
+
+static void
+zectld_usage(void) {
+    printf("\nUsage:\n%s [ -s <socket> ]\n", ZECTLD_PROGRAM);
+}
+
+/**
+ * @brief Initialize a handle the way zectl does before running a command
+ * @return Initialized handle, or @p NULL on failure
+ */
+static libze_handle *
+handle_init(void) {
+    libze_handle *lzeh = libze_init();
+    if (lzeh == NULL) {
+        fprintf(stderr, "%s: System may not be configured correctly for boot environments\n",
+                ZECTLD_PROGRAM);
+        return NULL;
+    }
+
+    if (ze_define_default_props(lzeh) != 0) {
+        fprintf(stderr, "%s: Failed to set default properties\n", ZECTLD_PROGRAM);
+        libze_fini(lzeh);
+        return NULL;
+    }
+
+    // Every child reads the mount table itself
+    libze_mnttab_invalidate(lzeh);
+
+    return lzeh;
+}
+
+/**
+ * @brief Bring the handle up to date before running a request, initializing it again if the
+ *        plugin or bootpool it resolved changed, or it can't be refreshed
+ * @param[in,out] state State of zectld
+ * @return 0 on success, -1 if the handle can't be initialized again, zectld then stops once the
+ *         running requests finished
+ */
+static int
+handle_refresh(zectld_state_t *state) {
+    boolean_t facets_stale = B_FALSE;
+
+    if (state->lzeh != NULL) {
+        if (libze_refresh(state->lzeh, &facets_stale) != LIBZE_ERROR_SUCCESS) {
+            fputs(state->lzeh->libze_error_message, stderr);
+            facets_stale = B_TRUE;
+        }
+        (void) libze_error_clear(state->lzeh);
+        if (!facets_stale) {
+            return 0;
+        }
+    }
+
+    libze_fini(state->lzeh);
+    if ((state->lzeh = handle_init()) == NULL) {
+        fprintf(stderr, "%s: Failed to initialize again, stopping\n", ZECTLD_PROGRAM);
+        state->stopping = B_TRUE;
+        state->failed = B_TRUE;
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Check the client is root or runs as the same user as zectld
+ * @param[in] sock Socket of the client
+ * @return @p B_TRUE if the client may run commands
+ */
+static boolean_t
+client_permitted(int sock) {
+    struct ucred credentials;
+    socklen_t length = sizeof(credentials);
+
+    if (getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &credentials, &length) != 0) {
+        return B_FALSE;
+    }
+
+    return ((credentials.uid == 0) || (credentials.uid == geteuid())) ? B_TRUE : B_FALSE;
+}
+
+/**
+ * @brief Run a request in a forked child, exits with the status of the command
+ * @param[in,out] state State of zectld, its handle is used by the child
+ * @param[in] command Command requested
+ * @param[in,out] request Request of the client
+ * @param[in] sock Socket of the client
+ * @param[in] messages Output of preparing the handle for @p command, written to the client first
+ * @param[in] messages_len Length of @p messages
+ */
+static void
+child_run(zectld_state_t *state, command_map_t const *command, zectld_request_t *request,
+          int sock, char const *messages, size_t messages_len) {
+    // Interrupted as a group if the client hangs up
+    (void) setpgid(0, 0);
+
+    sigset_t signals;
+    (void) sigemptyset(&signals);
+    (void) sigprocmask(SIG_SETMASK, &signals, NULL);
+    (void) signal(SIGPIPE, SIG_DFL);
+    // Interrupted with SIGINT on hang up, even if zectld was started with it ignored
+    (void) signal(SIGINT, SIG_DFL);
+
+    (void) close(state->listen_sock);
+    (void) close(state->signal_fd);
+    (void) close(sock);
+    for (size_t i = 0; i < state->num_running; i++) {
+        (void) close(state->running[i].sock);
+    }
+
+    if ((dup2(request->fds[ZECTLD_FD_STDIN], STDIN_FILENO) == -1) ||
+        (dup2(request->fds[ZECTLD_FD_STDOUT], STDOUT_FILENO) == -1) ||
+        (dup2(request->fds[ZECTLD_FD_STDERR], STDERR_FILENO) == -1) ||
+        (fchdir(request->fds[ZECTLD_FD_CWD]) != 0)) {
+        _exit(EXIT_FAILURE);
+    }
+
+    if (messages_len > 0) {
+        (void) fwrite(messages, 1, messages_len, stderr);
+    }
+
+    // Commands parse their options from the start
+    optind = 1;
+
+    int status = ze_command_run(state->lzeh, command, request->argc, request->argv);
+
+    zectld_request_free(request);
+    libze_fini(state->lzeh);
+    exit(status);
+}
+
+/**
+ * @brief Start running a request in a child
+ * @param[in,out] state State of zectld
+ * @param[in] command Command requested
+ * @param[in,out] request Request of the client, free'd
+ * @param[in] sock Socket of the client, kept until the child finished or closed
+ */
+static void
+request_start(zectld_state_t *state, command_map_t const *command, zectld_request_t *request,
+              int sock) {
+    char *messages = NULL;
+    size_t messages_len = 0;
+    FILE *messages_file = NULL;
+
+    // Run by the client if the handle can't be brought up to date, or prepared for the command,
+    // which then outputs the errors itself
+    if ((handle_refresh(state) != 0) ||
+        ((messages_file = open_memstream(&messages, &messages_len)) == NULL)) {
+        (void) zectld_reply_send(sock, ZECTLD_REFUSED);
+        goto fin;
+    }
+
+    // Plugin, bootpool and validation are resolved once here, and kept for later requests.
+    // Warnings are written by the child, the client's stderr may block.
+    libze_error prepared = ze_command_prepare(state->lzeh, command, messages_file);
+    (void) fclose(messages_file);
+    libze_mnttab_invalidate(state->lzeh);
+    if (prepared != LIBZE_ERROR_SUCCESS) {
+        (void) zectld_reply_send(sock, ZECTLD_REFUSED);
+        goto fin;
+    }
+
+    (void) fflush(stdout);
+    (void) fflush(stderr);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        child_run(state, command, request, sock, messages, messages_len);
+    }
+    if (pid == -1) {
+        fprintf(stderr, "%s: Failed to fork for '%s %s': %s\n", ZECTLD_PROGRAM, ZE_PROGRAM,
+                request->argv[0], strerror(errno));
+        (void) zectld_reply_send(sock, ZECTLD_REFUSED);
+        goto fin;
+    }
+    // Set by both, whichever runs first
+    (void) setpgid(pid, pid);
+
+    boolean_t exclusive = (command->mode == ZE_COMMAND_EXCLUSIVE) ? B_TRUE : B_FALSE;
+    state->running[state->num_running++] = (zectld_running_t){pid, sock, exclusive, B_FALSE};
+    state->exclusive_running = state->exclusive_running || exclusive;
+    sock = -1;
+
+    // A client already gone is noticed as a hang up
+    (void) zectld_reply_send(state->running[state->num_running - 1].sock, ZECTLD_ACCEPTED);
+
+fin:
+    free(messages);
+    zectld_request_free(request);
+    if (sock != -1) {
+        (void) close(sock);
+    }
+}
+
+/**
+ * @brief Accept a client, and start running its request, or queue it if it is exclusive and
+ *        other requests are still running
+ * @param[in,out] state State of zectld
+ */
+static void
+request_accept(zectld_state_t *state) {
+    zectld_request_t request;
+
+    int sock = accept4(state->listen_sock, NULL, NULL, SOCK_CLOEXEC);
+    if (sock == -1) {
+        return;
+    }
+
+    struct timeval timeout = {.tv_usec = ZECTLD_REQUEST_TIMEOUT_MSEC * 1000};
+    (void) setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    (void) setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    if (zectld_request_recv(sock, &request) != 0) {
+        (void) close(sock);
+        return;
+    }
+
+    // Refused requests, and requests for commands that only run in process, are run by the client
+    command_map_t const *command = ze_command_get(request.argv[0]);
+    if (!client_permitted(sock) || (command == NULL) || (command->mode == ZE_COMMAND_LOCAL)) {
+        (void) zectld_reply_send(sock, ZECTLD_REFUSED);
+        zectld_request_free(&request);
+        (void) close(sock);
+        return;
+    }
+
+    // The client waits for the first reply until the request starts
+    if ((command->mode == ZE_COMMAND_EXCLUSIVE) && (state->num_running > 0)) {
+        state->queued = (zectld_queued_t){command, request, sock};
+        return;
+    }
+
+    request_start(state, command, &request, sock);
+}
+
+/**
+ * @brief Start the queued request once no other requests are running, or hand it back to its
+ *        client when stopping
+ * @param[in,out] state State of zectld
+ */
+static void
+queued_start(zectld_state_t *state) {
+    zectld_queued_t queued = state->queued;
+
+    if ((queued.sock == -1) || (!state->stopping && (state->num_running > 0))) {
+        return;
+    }
+    state->queued.sock = -1;
+
+    if (state->stopping) {
+        (void) zectld_reply_send(queued.sock, ZECTLD_REFUSED);
+        zectld_request_free(&queued.request);
+        (void) close(queued.sock);
+        return;
+    }
+
+    request_start(state, queued.command, &queued.request, queued.sock);
+}
+
+/**
+ * @brief Drop the queued request of a client which hung up, and interrupt the children of running
+ *        requests whose client hung up, as interrupting zectl would have in process
+ * @param[in,out] state State of zectld
+ * @param[in] fds Polled sockets, of the queued request followed by those of the running requests
+ */
+static void
+hangups_handle(zectld_state_t *state, struct pollfd const *fds) {
+    short const hangup = POLLRDHUP | POLLHUP | POLLERR;
+
+    if ((state->queued.sock != -1) && (fds[0].revents & hangup)) {
+        zectld_request_free(&state->queued.request);
+        (void) close(state->queued.sock);
+        state->queued.sock = -1;
+    }
+
+    for (size_t i = 0; i < state->num_running; i++) {
+        zectld_running_t *running = &state->running[i];
+        if (!running->cancelled && (fds[i + 1].revents & hangup)) {
+            (void) kill(-running->pid, SIGINT);
+            running->cancelled = B_TRUE;
+        }
+    }
+}
+
+/**
+ * @brief Reap finished children and reply their exit status
+ * @param[in,out] state State of zectld
+ */
+static void
+children_reap(zectld_state_t *state) {
+    pid_t pid;
+    int wstatus;
+
+    while ((pid = waitpid(-1, &wstatus, WNOHANG)) > 0) {
+        for (size_t i = 0; i < state->num_running; i++) {
+            zectld_running_t *running = &state->running[i];
+            if (running->pid != pid) {
+                continue;
+            }
+
+            int32_t status = WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : EXIT_FAILURE;
+            (void) zectld_reply_send(running->sock, status);
+            (void) close(running->sock);
+
+            if (running->exclusive) {
+                state->exclusive_running = B_FALSE;
+            }
+            *running = state->running[--state->num_running];
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Create the socket of zectld, unless another zectld is listening on it already
+ * @param[in] path Path of the socket
+ * @return Listening socket, or -1 on failure
+ */
+static int
+listen_socket_create(char const path[static 1]) {
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+
+    if (strlcpy(address.sun_path, path, sizeof(address.sun_path)) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "%s: Socket path %s is too long\n", ZECTLD_PROGRAM, path);
+        return -1;
+    }
+
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock == -1) {
+        fprintf(stderr, "%s: Failed to create socket: %s\n", ZECTLD_PROGRAM, strerror(errno));
+        return -1;
+    }
+
+    if (connect(sock, (struct sockaddr *) &address, sizeof(address)) == 0) {
+        fprintf(stderr, "%s: Already running on %s\n", ZECTLD_PROGRAM, path);
+        goto err;
+    }
+    // Stale socket of a previous zectld
+    (void) unlink(path);
+
+    // Only accessible to the user running zectld
+    mode_t mask = umask(0077);
+    int bound = bind(sock, (struct sockaddr *) &address, sizeof(address));
+    (void) umask(mask);
+
+    if ((bound != 0) || (listen(sock, SOMAXCONN) != 0)) {
+        fprintf(stderr, "%s: Failed to listen on %s: %s\n", ZECTLD_PROGRAM, path,
+                strerror(errno));
+        goto err;
+    }
+
+    return sock;
+
+err:
+    (void) close(sock);
+    return -1;
+}
+
+int
+main(int argc, char *argv[]) {
+    int ret = EXIT_FAILURE;
+    char const *path = zectld_socket_path();
+    zectld_state_t state = {.listen_sock = -1, .signal_fd = -1, .queued = {.sock = -1}};
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:")) != -1) {
+        switch (opt) {
+            case 's':
+                path = optarg;
+                break;
+            default:
+                zectld_usage();
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc) {
+        zectld_usage();
+        return EXIT_FAILURE;
+    }
+
+    // Children report back over the socket of their client, which may be gone
+    (void) signal(SIGPIPE, SIG_IGN);
+
+    sigset_t signals;
+    (void) sigemptyset(&signals);
+    (void) sigaddset(&signals, SIGCHLD);
+    (void) sigaddset(&signals, SIGINT);
+    (void) sigaddset(&signals, SIGTERM);
+    if ((sigprocmask(SIG_BLOCK, &signals, NULL) != 0) ||
+        ((state.signal_fd = signalfd(-1, &signals, SFD_CLOEXEC)) == -1)) {
+        fprintf(stderr, "%s: Failed to set up signals: %s\n", ZECTLD_PROGRAM, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    if ((state.lzeh = handle_init()) == NULL) {
+        goto fin;
+    }
+
+    if ((state.listen_sock = listen_socket_create(path)) == -1) {
+        goto fin;
+    }
+
+    while (!state.stopping || (state.num_running > 0)) {
+        // No further requests while an exclusive command runs or waits, or when stopping
+        boolean_t accepting = !state.stopping && !state.exclusive_running &&
+                              (state.queued.sock == -1) && (state.num_running < ZECTLD_MAX_RUNNING);
+        // Clients only send their request, anything after is a hang up. Negative descriptors
+        // are skipped, so the running request i stays at i + 3.
+        struct pollfd fds[3 + ZECTLD_MAX_RUNNING] = {
+            {.fd = state.signal_fd, .events = POLLIN},
+            {.fd = state.listen_sock, .events = accepting ? POLLIN : 0},
+            {.fd = state.queued.sock, .events = POLLRDHUP}};
+        nfds_t nfds = 3;
+        for (size_t i = 0; i < state.num_running; i++, nfds++) {
+            fds[nfds].fd = state.running[i].cancelled ? -1 : state.running[i].sock;
+            fds[nfds].events = POLLRDHUP;
+        }
+
+        if (poll(fds, nfds, -1) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "%s: Failed to wait for requests: %s\n", ZECTLD_PROGRAM,
+                    strerror(errno));
+            state.failed = B_TRUE;
+            break;
+        }
+
+        hangups_handle(&state, &fds[2]);
+
+        if (fds[0].revents & POLLIN) {
+            struct signalfd_siginfo info;
+            if ((read(state.signal_fd, &info, sizeof(info)) == sizeof(info)) &&
+                (info.ssi_signo != SIGCHLD)) {
+                state.stopping = B_TRUE;
+            }
+            children_reap(&state);
+            queued_start(&state);
+        }
+
+        if (accepting && (fds[1].revents & POLLIN)) {
+            request_accept(&state);
+        }
+    }
+
+    // A request still waiting is run by its client
+    state.stopping = B_TRUE;
+    queued_start(&state);
+
+    ret = state.failed ? EXIT_FAILURE : EXIT_SUCCESS;
+    (void) unlink(path);
+
+fin:
+    if (state.listen_sock != -1) {
+        (void) close(state.listen_sock);
+    }
+    (void) close(state.signal_fd);
+    libze_fini(state.lzeh);
+    return ret;
+}
@@ -5,9 +5,19 @@
 #include "zectl_tests.h"
 
 #include "libze/libze.h"
+#include "libze/libze_util.h"
+#include "system_linux.h"
 
 #include <check.h>
+#include <fcntl.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/nvpair.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
 START_TEST(test_libze_init) {
     libze_handle *lzeh = NULL;
@@ -17,11 +27,202 @@ START_TEST(test_libze_init) {
 }
 END_TEST
 
+/* Escaped spaces, a mountpoint mounted over and a dataset mounted twice */
+static char const *const test_mountinfo =
+    "22 1 0:21 / /proc rw,nosuid shared:5 - proc proc rw\n"
+    "30 1 0:25 / / rw,relatime shared:1 - zfs zroot/ROOT/default rw,xattr\n"
+    "40 30 0:30 / /mnt/with\\040space rw master:2 - zfs zroot/ROOT/be\\040one rw\n"
+    "41 30 0:31 / /mnt/over rw - zfs zroot/ROOT/under rw\n"
+    "42 41 0:32 / /mnt/over rw - zfs zroot/ROOT/top rw\n"
+    "43 30 0:32 / /mnt/again rw - zfs zroot/ROOT/top rw\n";
+
+START_TEST(test_libze_zfs_mounts_parse) {
+    nvlist_t *mountpoints = fnvlist_alloc();
+    nvlist_t *datasets = fnvlist_alloc();
+    char const *value = NULL;
+
+    FILE *mnt_file = fmemopen((void *) test_mountinfo, strlen(test_mountinfo), "r");
+    ck_assert_ptr_nonnull(mnt_file);
+    ck_assert_int_eq(libze_zfs_mounts_parse(mnt_file, mountpoints, datasets), SYSTEM_ERR_SUCCESS);
+    fclose(mnt_file);
+
+    // Only ZFS mounts are indexed
+    ck_assert(!nvlist_exists(mountpoints, "/proc"));
+    ck_assert_int_eq(nvlist_lookup_string(mountpoints, "/", &value), 0);
+    ck_assert_str_eq(value, "zroot/ROOT/default");
+
+    ck_assert_int_eq(nvlist_lookup_string(mountpoints, "/mnt/with space", &value), 0);
+    ck_assert_str_eq(value, "zroot/ROOT/be one");
+    ck_assert_int_eq(nvlist_lookup_string(datasets, "zroot/ROOT/be one", &value), 0);
+    ck_assert_str_eq(value, "/mnt/with space");
+
+    // The topmost mount of a mountpoint, and the first mount of a dataset
+    ck_assert_int_eq(nvlist_lookup_string(mountpoints, "/mnt/over", &value), 0);
+    ck_assert_str_eq(value, "zroot/ROOT/top");
+    ck_assert_int_eq(nvlist_lookup_string(datasets, "zroot/ROOT/top", &value), 0);
+    ck_assert_str_eq(value, "/mnt/over");
+    ck_assert_int_eq(nvlist_lookup_string(mountpoints, "/mnt/again", &value), 0);
+    ck_assert_str_eq(value, "zroot/ROOT/top");
+
+    fnvlist_free(mountpoints);
+    fnvlist_free(datasets);
+}
+END_TEST
+
+START_TEST(test_libze_util_snap_format_expand) {
+    struct timespec now = {.tv_sec = 0, .tv_nsec = 123456789};
+    char snap_suffix[ZFS_MAX_DATASET_NAME_LEN];
+    char expected[ZFS_MAX_DATASET_NAME_LEN];
+
+    setenv("TZ", "UTC", 1);
+    tzset();
+
+    ck_assert_int_eq(libze_util_snap_format_expand(ZE_SNAPSHOT_FORMAT_DEFAULT, &now, 7,
+                                                   ZFS_MAX_DATASET_NAME_LEN, snap_suffix),
+                     LIBZE_ERROR_SUCCESS);
+    snprintf(expected, ZFS_MAX_DATASET_NAME_LEN, "1970-01-01-00:00:00.123456-%jd.7",
+             (intmax_t) getpid());
+    ck_assert_str_eq(snap_suffix, expected);
+
+    // "%%N" is a literal "%N", and "%%Q" doesn't count as "%Q", which is appended if missing
+    ck_assert_int_eq(libze_util_snap_format_expand("%%N-%%Q-%Y", &now, 3,
+                                                   ZFS_MAX_DATASET_NAME_LEN, snap_suffix),
+                     LIBZE_ERROR_SUCCESS);
+    snprintf(expected, ZFS_MAX_DATASET_NAME_LEN, "%%N-%%Q-1970-%jd.3", (intmax_t) getpid());
+    ck_assert_str_eq(snap_suffix, expected);
+
+    // Too long for the buffer
+    ck_assert_int_eq(libze_util_snap_format_expand("%F", &now, 0, 4, snap_suffix),
+                     LIBZE_ERROR_MAXPATHLEN);
+}
+END_TEST
+
+START_TEST(test_validate_snapformat) {
+    libze_prop_validate_fn validate = libze_properties[LIBZE_PROP_SNAPFORMAT].validate;
+
+    ck_assert(validate(ZE_SNAPSHOT_FORMAT_DEFAULT));
+    ck_assert(validate("%Y%m%d-%H%M%S"));
+    // Empty and "-" restore the default
+    ck_assert(validate(""));
+    ck_assert(validate("-"));
+
+    ck_assert(!validate("a/b"));
+    ck_assert(!validate("a@b"));
+    ck_assert(!validate("a#b"));
+    // Conversions expanding to '/' or spaces
+    ck_assert(!validate("%D"));
+    ck_assert(!validate("%c"));
+}
+END_TEST
+
+static void
+test_prop_add(nvlist_t *props, char const *name, char const *value, char const *source) {
+    nvlist_t *prop = fnvlist_alloc();
+    fnvlist_add_string(prop, "value", value);
+    if (source != NULL) {
+        fnvlist_add_string(prop, "source", source);
+    }
+    fnvlist_add_nvlist(props, name, prop);
+    fnvlist_free(prop);
+}
+
+START_TEST(test_libze_prop_index) {
+    // Only the properties are used, no pools are opened
+    libze_handle *lzeh = calloc(1, sizeof(libze_handle));
+    ck_assert_ptr_nonnull(lzeh);
+
+    lzeh->ze_props = fnvlist_alloc();
+    test_prop_add(lzeh->ze_props, "org.zectl:snapformat", "%F", "zroot/ROOT");
+    test_prop_add(lzeh->ze_props, "org.zectl.systemdboot:efi", "/boot/efi", "zroot/ROOT");
+
+    ck_assert_int_eq(libze_schema_defaults_set(lzeh, libze_properties, LIBZE_PROP_NUM,
+                                               ZE_PROP_NAMESPACE),
+                     LIBZE_ERROR_SUCCESS);
+
+    // A set value shadows its default
+    ck_assert_str_eq(libze_prop_value(lzeh, LIBZE_PROP_SNAPFORMAT), "%F");
+    ck_assert_str_eq(libze_be_prop_source(lzeh, "snapformat", ZE_PROP_NAMESPACE), "zroot/ROOT");
+
+    // Unset properties fall back to their default, which has no source
+    ck_assert_str_eq(libze_prop_value(lzeh, LIBZE_PROP_BOOTLOADER), "");
+    ck_assert_str_eq(libze_be_prop_source(lzeh, "bootloader", ZE_PROP_NAMESPACE), "");
+
+    // Namespaces don't match a prefix of each other
+    ck_assert_str_eq(libze_be_prop_value(lzeh, "efi", ZE_PROP_NAMESPACE), "");
+    ck_assert_str_eq(libze_be_prop_value(lzeh, "efi", "org.zectl.systemdboot"), "/boot/efi");
+    ck_assert_str_eq(libze_be_prop_value(lzeh, "unknown", ZE_PROP_NAMESPACE), "");
+
+    // A later layer of defaults still doesn't shadow set values, defaults of other
+    // namespaces are dropped
+    nvlist_t *defaults = fnvlist_alloc();
+    test_prop_add(defaults, "org.zectl.systemdboot:efi", "/efi", NULL);
+    test_prop_add(defaults, "org.zectl.systemdboot:esp", "/efi", NULL);
+    test_prop_add(defaults, "org.zectl:snapformat", "%s", NULL);
+    ck_assert_int_eq(libze_default_props_set(lzeh, defaults, "org.zectl.systemdboot"),
+                     LIBZE_ERROR_SUCCESS);
+
+    ck_assert_str_eq(libze_be_prop_value(lzeh, "efi", "org.zectl.systemdboot"), "/boot/efi");
+    ck_assert_str_eq(libze_be_prop_value(lzeh, "esp", "org.zectl.systemdboot"), "/efi");
+    ck_assert_str_eq(libze_be_prop_source(lzeh, "esp", "org.zectl.systemdboot"), "");
+    ck_assert_str_eq(libze_prop_value(lzeh, LIBZE_PROP_SNAPFORMAT), "%F");
+    ck_assert_str_eq(libze_prop_value(lzeh, LIBZE_PROP_BOOTPOOLROOT), "");
+
+    libze_fini(lzeh);
+}
+END_TEST
+
+static void
+test_file_write(char const *path, char const *contents) {
+    FILE *file = fopen(path, "w");
+    ck_assert_ptr_nonnull(file);
+    fputs(contents, file);
+    fclose(file);
+}
+
+START_TEST(test_libze_util_fingerprint_dir) {
+    char directory[] = "/tmp/zectl_tests.XXXXXX";
+    char path[LIBZE_MAX_PATH_LEN];
+    char before[ZFS_MAXPROPLEN];
+    char after[ZFS_MAXPROPLEN];
+    struct stat st;
+
+    ck_assert_ptr_nonnull(mkdtemp(directory));
+    snprintf(path, LIBZE_MAX_PATH_LEN, "%s/vmlinuz", directory);
+
+    test_file_write(path, "kernel-1");
+    ck_assert_int_eq(stat(path, &st), 0);
+    ck_assert_int_eq(libze_util_fingerprint_dir(directory, ZFS_MAXPROPLEN, before), 0);
+
+    // Replaced with the same size and mtime, as 'cp -p' would
+    test_file_write(path, "kernel-2");
+    struct timespec times[2] = {st.st_atim, st.st_mtim};
+    ck_assert_int_eq(utimensat(AT_FDCWD, path, times, 0), 0);
+    ck_assert_int_eq(libze_util_fingerprint_dir(directory, ZFS_MAXPROPLEN, after), 0);
+    ck_assert_str_ne(before, after);
+
+    // Same contents again
+    test_file_write(path, "kernel-1");
+    ck_assert_int_eq(libze_util_fingerprint_dir(directory, ZFS_MAXPROPLEN, after), 0);
+    ck_assert_str_eq(before, after);
+
+    ck_assert_int_eq(libze_util_fingerprint_file(path, ZFS_MAXPROPLEN, after), 0);
+    ck_assert_int_ne(libze_util_fingerprint_file(directory, ZFS_MAXPROPLEN, after), 0);
+
+    unlink(path);
+    rmdir(directory);
+}
+END_TEST
+
 Suite *
 zectl_suite(void) {
     Suite *suite = suite_create("zectl");
     TCase *tcase = tcase_create("case");
     tcase_add_test(tcase, test_libze_init);
+    tcase_add_test(tcase, test_libze_zfs_mounts_parse);
+    tcase_add_test(tcase, test_libze_util_snap_format_expand);
+    tcase_add_test(tcase, test_validate_snapformat);
+    tcase_add_test(tcase, test_libze_prop_index);
+    tcase_add_test(tcase, test_libze_util_fingerprint_dir);
     suite_add_tcase(suite, tcase);
     return suite;
 }